@@ -25,6 +25,7 @@
 #include <math.h>
 #include "esp_system.h"
 #include "fd_forward.h"
+#include "image_pyramid.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 
@@ -32,6 +33,17 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 
+/*
+ * First resize of a pyramid from the original image. Beyond 2x, bilinear samples too few source pixels and aliases,
+ * the area average uses all of them.
+ */
+static void pyramid_resize(uint8_t *dst_image, uint8_t *src_image, int dst_w, int dst_h, int dst_c, int src_w, int src_h)
+{
+    if ((2 * dst_w <= src_w) && (2 * dst_h <= src_h) && (0 == image_resize_area(dst_image, src_image, dst_w, dst_h, dst_c, src_w, src_h)))
+        return;
+    image_resize_linear(dst_image, src_image, dst_w, dst_h, dst_c, src_w, src_h);
+}
+
 box_array_t *pnet_forward(dl_matrix3du_t *image, fptp_t min_face, fptp_t pyramid, net_config_t *config)
 { /*{{{*/
     mtmn_net_t *out;
@@ -51,7 +63,7 @@ box_array_t *pnet_forward(dl_matrix3du_t *image, fptp_t min_face, fptp_t pyramid
         if (DL_IMAGE_MIN(width, height) <= config->w)
             break;
 
-        image_resize_linear(in->item, image->item, width, height, in->c, image->w, image->h);
+        pyramid_resize(in->item, image->item, width, height, in->c, image->w, image->h);
 
         in->h = height;
         in->w = width;
@@ -159,7 +171,7 @@ box_array_t *pnet_forward2(dl_matrix3du_t *image, fptp_t min_face, fptp_t pyrami
         if (DL_IMAGE_MIN(width, height) <= config->w)
             break;
 
-        image_resize_linear(in->item, image->item, width, height, in->c, image->w, image->h);
+        pyramid_resize(in->item, image->item, width, height, in->c, image->w, image->h);
 
         in->h = height;
         in->w = width;
@@ -255,119 +267,26 @@ box_array_t *pnet_forward_fast(dl_matrix3du_t *image, fptp_t min_face, int pyram
 { /*{{{*/
     mtmn_net_t *out;
     fptp_t origin_scale = 1.0f * config->w / min_face;
-    fptp_t pyramid = 0.707106781; // sqrt(0.5)
     image_list_t *sorted_list = (image_list_t *)dl_lib_calloc(pyramid_times, sizeof(image_list_t), 0);
     image_list_t **origin_head = (image_list_t **)dl_lib_calloc(pyramid_times, sizeof(image_list_t *), 0);
     image_list_t all_box_list = {NULL};
     box_array_t *pnet_box_list = NULL;
     box_t *pnet_box = NULL;
 
-    int resized_w = round(image->w * origin_scale);
-    int resized_h = round(image->h * origin_scale);
-    fptp_t resized_scale = origin_scale;
-    dl_matrix3du_t *resized_image = dl_matrix3du_alloc(1, resized_w, resized_h, image->c);
-
-    for (size_t i = 0; i < (pyramid_times + 1) / 2; i++)
+    // all the levels at once, the frame is read once
+    image_pyramid_t pyramid_levels;
+    if (image_pyramid_init(&pyramid_levels, image->w, image->h, image->c, origin_scale, pyramid_times, config->w))
     {
-        if (DL_IMAGE_MIN(resized_w, resized_h) < config->w)
-        {
-            break;
-        }
-
-        if (0 == i)
-            image_resize_linear(resized_image->item,
-                                image->item,
-                                resized_w,
-                                resized_h,
-                                resized_image->c,
-                                image->w,
-                                image->h);
-        else
-            image_zoom_in_twice(resized_image->item,
-                                resized_w,
-                                resized_h,
-                                resized_image->c,
-                                resized_image->item,
-                                resized_image->w,
-                                resized_image->c);
-
-        resized_image->w = resized_w;
-        resized_image->h = resized_h;
-        resized_image->stride = resized_image->w * resized_image->c;
-
-#if CONFIG_MTMN_LITE_FLOAT
-        out = pnet_lite_f(resized_image);
-#endif
-
-#if CONFIG_MTMN_LITE_QUANT
-        out = pnet_lite_q(resized_image, DL_XTENSA_IMPL);
-#endif
-
-#if CONFIG_MTMN_HEAVY_QUANT
-        out = pnet_heavy_q(resized_image, DL_XTENSA_IMPL);
-#endif
-
-        if (out)
-        {
-            origin_head[i] = image_get_valid_boxes(out->category->item,
-                                                   out->offset->item,
-                                                   NULL,
-                                                   out->category->w,
-                                                   out->category->h,
-                                                   1,
-                                                   &config->w,
-                                                   config->threshold.score,
-                                                   2,
-                                                   resized_scale,
-                                                   resized_scale,
-                                                   false);
-
-            if (origin_head[i])
-            {
-                image_sort_insert_by_score(&sorted_list[i], origin_head[i]);
-
-                image_nms_process(&sorted_list[i], 0.5, true);
-            }
-
-            dl_matrix3d_free(out->category);
-            dl_matrix3d_free(out->offset);
-            dl_matrix3d_free(out->landmark);
-            dl_lib_free(out);
-        }
-
-        resized_w /= 2;
-        resized_h /= 2;
-        resized_scale /= 2;
+        dl_lib_free(sorted_list);
+        dl_lib_free(origin_head);
+        return NULL;
     }
+    image_pyramid_build(&pyramid_levels, image);
 
-    resized_w = round(image->w * origin_scale * pyramid);
-    resized_h = round(image->h * origin_scale * pyramid);
-    resized_scale = origin_scale * pyramid;
-    for (int i = (pyramid_times + 1) / 2; i < pyramid_times; i++)
+    for (int i = 0; i < pyramid_levels.n_levels; i++)
     {
-        if (DL_IMAGE_MIN(resized_w, resized_h) < config->w)
-            break;
-
-        if ((pyramid_times + 1) / 2 == i)
-            image_resize_linear(resized_image->item,
-                                image->item,
-                                resized_w,
-                                resized_h,
-                                resized_image->c,
-                                image->w,
-                                image->h);
-        else
-            image_zoom_in_twice(resized_image->item,
-                                resized_w,
-                                resized_h,
-                                resized_image->c,
-                                resized_image->item,
-                                resized_image->w,
-                                resized_image->c);
-
-        resized_image->w = resized_w;
-        resized_image->h = resized_h;
-        resized_image->stride = resized_image->w * resized_image->c;
+        dl_matrix3du_t *resized_image = &pyramid_levels.level[i].image;
+        fptp_t resized_scale = pyramid_levels.level[i].scale;
 
 #if CONFIG_MTMN_LITE_FLOAT
         out = pnet_lite_f(resized_image);
@@ -408,12 +327,8 @@ box_array_t *pnet_forward_fast(dl_matrix3du_t *image, fptp_t min_face, int pyram
             dl_matrix3d_free(out->landmark);
             dl_lib_free(out);
         }
-
-        resized_w /= 2;
-        resized_h /= 2;
-        resized_scale /= 2;
     }
-    dl_matrix3du_free(resized_image);
+    image_pyramid_free(&pyramid_levels);
 
     for (int i = 0; i < pyramid_times; i++)
         image_sort_insert_by_score(&all_box_list, &sorted_list[i]);
@@ -461,7 +376,6 @@ box_array_t *rnet_forward(dl_matrix3du_t *image, box_array_t *net_boxes, net_con
     image_list_t valid_list = {NULL};
     image_list_t sorted_list = {NULL};
     dl_matrix3du_t *resized_image;
-    dl_matrix3du_t *sliced_image;
     image_box_t *valid_box = NULL;
     box_t *net_box = NULL;
     box_array_t *net_box_list = NULL;
@@ -479,11 +393,9 @@ box_array_t *rnet_forward(dl_matrix3du_t *image, box_array_t *net_boxes, net_con
         int y = round(net_boxes->box[i].box_p[1]);
         int w = round(net_boxes->box[i].box_p[2]) - x + 1;
         int h = round(net_boxes->box[i].box_p[3]) - y + 1;
-        sliced_image = dl_matrix3du_alloc(1, w, h, image->c);
-
-        dl_matrix3du_slice_copy(sliced_image, image, x, y, w, h);
+        dl_matrix3du_t sliced_image = image_view(image, x, y, w, h);
 
-        image_resize_linear(resized_image->item, sliced_image->item, config->w, config->h, image->c, w, h);
+        image_resize_linear_crop(resized_image, &sliced_image);
 
 #if CONFIG_MTMN_LITE_FLOAT
         mtmn_net_t *out = rnet_lite_f_with_score_verify(resized_image, config->threshold.score);
@@ -515,7 +427,6 @@ box_array_t *rnet_forward(dl_matrix3du_t *image, box_array_t *net_boxes, net_con
             dl_matrix3d_free(out->offset);
             dl_lib_free(out);
         }
-        dl_matrix3du_free(sliced_image);
 
         if (valid_count > config->threshold.candidate_number - 1)
             break;
@@ -563,7 +474,6 @@ box_array_t *onet_forward(dl_matrix3du_t *image, box_array_t *net_boxes, net_con
     image_list_t valid_list = {NULL};
     image_list_t sorted_list = {NULL};
     dl_matrix3du_t *resized_image;
-    dl_matrix3du_t *sliced_image;
     image_box_t *valid_box = NULL;
     box_t *net_box = NULL;
     fptp_t *net_score = NULL;
@@ -583,11 +493,9 @@ box_array_t *onet_forward(dl_matrix3du_t *image, box_array_t *net_boxes, net_con
         int y = round(net_boxes->box[i].box_p[1]);
         int w = round(net_boxes->box[i].box_p[2]) - x + 1;
         int h = round(net_boxes->box[i].box_p[3]) - y + 1;
-        sliced_image = dl_matrix3du_alloc(1, w, h, image->c);
-
-        dl_matrix3du_slice_copy(sliced_image, image, x, y, w, h);
+        dl_matrix3du_t sliced_image = image_view(image, x, y, w, h);
 
-        image_resize_linear(resized_image->item, sliced_image->item, config->w, config->h, image->c, w, h);
+        image_resize_linear_crop(resized_image, &sliced_image);
 
 #if CONFIG_MTMN_LITE_FLOAT
         mtmn_net_t *out = onet_lite_f_with_score_verify(resized_image, config->threshold.score);
@@ -622,7 +530,6 @@ box_array_t *onet_forward(dl_matrix3du_t *image, box_array_t *net_boxes, net_con
             dl_matrix3d_free(out->landmark);
             dl_lib_free(out);
         }
-        dl_matrix3du_free(sliced_image);
 
         if (valid_count > config->threshold.candidate_number - 1)
             break;
@@ -56,7 +56,7 @@ extern "C"
     {
         float min_face;                 /*!< The minimum size of a detectable face */
         float pyramid;                  /*!< The scale of the gradient scaling for the input images */
-        int pyramid_times;              /*!< The pyramid resizing times */
+        int pyramid_times;              /*!< The pyramid resizing times, at most IMAGE_PYRAMID_MAX_LEVELS when 'type'==FAST */
         threshold_config_t p_threshold; /*!< The thresholds for P-Net. For details, see the definition of threshold_config_t */
         threshold_config_t r_threshold; /*!< The thresholds for R-Net. For details, see the definition of threshold_config_t */
         threshold_config_t o_threshold; /*!< The thresholds for O-Net. For details, see the definition of threshold_config_t */
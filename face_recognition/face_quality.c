@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+#include "face_quality.h"
+
+static const char *TAG = "face_quality";
+
+static const char *reason_str[FACE_QUALITY_REASON_MAX] = {"ok", "pose", "small", "blur", "dark", "bright"};
+
+#define FACE_QUALITY_DARK_LEVEL 16
+#define FACE_QUALITY_BRIGHT_LEVEL 240
+
+face_quality_reason_t face_quality_pose(fptp_t *landmark,
+                                        face_quality_config_t *config,
+                                        face_quality_t *result)
+{
+    fptp_t le_x = landmark[LEFT_EYE_X];
+    fptp_t le_y = landmark[LEFT_EYE_Y];
+    fptp_t re_x = landmark[RIGHT_EYE_X];
+    fptp_t re_y = landmark[RIGHT_EYE_Y];
+    fptp_t no_x = landmark[NOSE_X];
+    fptp_t no_y = landmark[NOSE_Y];
+
+    fptp_t nl = (no_x - le_x) * (no_x - le_x) + (no_y - le_y) * (no_y - le_y);
+    fptp_t nr = (no_x - re_x) * (no_x - re_x) + (no_y - re_y) * (no_y - re_y);
+    fptp_t ex = re_x - le_x;
+    fptp_t ey = re_y - le_y;
+
+    result->ne_ratio = (nr > 0) ? (nl / nr) : 0;
+    result->roll = atan2f(ey, ex);
+    result->eye_dist = sqrtf(ex * ex + ey * ey);
+
+    // same criterion as align_face_rot
+    if (result->ne_ratio <= config->ne_ratio_min || result->ne_ratio >= config->ne_ratio_max)
+        return FACE_QUALITY_POSE;
+    if (fabsf(result->roll) > config->roll_max)
+        return FACE_QUALITY_POSE;
+    if (result->eye_dist < config->eye_dist_min)
+        return FACE_QUALITY_SMALL;
+
+    return FACE_QUALITY_OK;
+}
+
+face_quality_reason_t face_quality_image(dl_matrix3du_t *aligned_face,
+                                         face_quality_config_t *config,
+                                         face_quality_t *result)
+{
+    int w = aligned_face->w;
+    int h = aligned_face->h;
+    int c = aligned_face->c;
+    int stride = w * c;
+    int x_margin = w >> 3;
+    int y_margin = h >> 3;
+
+    uint32_t grad_sum = 0;
+    uint32_t luma_sum = 0;
+    uint32_t dark = 0;
+    uint32_t bright = 0;
+    uint32_t n = 0;
+
+    // luma is approximated by (r + 2g + b) / 4, gradient energy by the forward differences
+    for (int y = y_margin; y < h - y_margin - 1; y++)
+    {
+        uint8_t *row = aligned_face->item + y * stride;
+        for (int x = x_margin; x < w - x_margin - 1; x++)
+        {
+            uint8_t *p = row + x * c;
+            int luma, luma_r, luma_d;
+            if (3 == c)
+            {
+                luma = (p[0] + (p[1] << 1) + p[2]) >> 2;
+                luma_r = (p[3] + (p[4] << 1) + p[5]) >> 2;
+                luma_d = (p[stride] + (p[stride + 1] << 1) + p[stride + 2]) >> 2;
+            }
+            else
+            {
+                luma = p[0];
+                luma_r = p[c];
+                luma_d = p[stride];
+            }
+            int dx = luma_r - luma;
+            int dy = luma_d - luma;
+            grad_sum += dx * dx + dy * dy;
+            luma_sum += luma;
+            dark += (luma < FACE_QUALITY_DARK_LEVEL);
+            bright += (luma > FACE_QUALITY_BRIGHT_LEVEL);
+            n++;
+        }
+    }
+
+    if (0 == n)
+        return FACE_QUALITY_SMALL;
+
+    result->sharpness = grad_sum / n;
+    result->brightness = luma_sum / n;
+    result->dark_percent = dark * 100 / n;
+    result->bright_percent = bright * 100 / n;
+
+    if (result->brightness < config->brightness_min || result->dark_percent > config->clip_percent_max)
+        return FACE_QUALITY_DARK;
+    if (result->brightness > config->brightness_max || result->bright_percent > config->clip_percent_max)
+        return FACE_QUALITY_BRIGHT;
+    // exposure first, a dark face also has a weak gradient
+    if (result->sharpness < config->sharpness_min)
+        return FACE_QUALITY_BLUR;
+
+    return FACE_QUALITY_OK;
+}
+
+face_quality_reason_t face_quality_check(fptp_t *landmark,
+                                         dl_matrix3du_t *aligned_face,
+                                         face_quality_config_t *config,
+                                         face_quality_t *result,
+                                         face_quality_stats_t *stats)
+{
+    face_quality_config_t default_config;
+    if (NULL == config)
+    {
+        face_quality_config_init(&default_config);
+        config = &default_config;
+    }
+
+    memset(result, 0, sizeof(face_quality_t));
+    result->reason = face_quality_pose(landmark, config, result);
+    if ((FACE_QUALITY_OK == result->reason) && aligned_face)
+        result->reason = face_quality_image(aligned_face, config, result);
+
+    if (stats)
+    {
+        stats->checked++;
+        stats->rejected[result->reason]++;
+    }
+
+    ESP_LOGD(TAG, "%s: ne_ratio %f, roll %f, eye_dist %f, sharpness %u, brightness %u, dark %u%%, bright %u%%",
+             reason_str[result->reason], result->ne_ratio, result->roll, result->eye_dist,
+             result->sharpness, result->brightness, result->dark_percent, result->bright_percent);
+
+    return result->reason;
+}
+
+void face_quality_stats_reset(face_quality_stats_t *stats)
+{
+    memset(stats, 0, sizeof(face_quality_stats_t));
+}
+
+void face_quality_stats_print(face_quality_stats_t *stats)
+{
+    ESP_LOGI(TAG, "checked: %u", stats->checked);
+    for (int i = 0; i < FACE_QUALITY_REASON_MAX; i++)
+    {
+        ESP_LOGI(TAG, "%-6s : %u", reason_str[i], stats->rejected[i]);
+    }
+}
+
+int8_t recognize_face_with_quality(face_id_list *l,
+                                   dl_matrix3du_t *aligned_face,
+                                   face_quality_t *quality)
+{
+    if (FACE_QUALITY_OK != quality->reason)
+        return FACE_QUALITY_SKIPPED;
+
+    return recognize_face(l, aligned_face);
+}
+
+int8_t enroll_face_with_quality(face_id_list *l,
+                                dl_matrix3du_t *aligned_face,
+                                face_quality_t *quality)
+{
+    if (FACE_QUALITY_OK != quality->reason)
+        return FACE_QUALITY_SKIPPED;
+
+    return enroll_face(l, aligned_face);
+}
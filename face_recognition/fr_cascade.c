@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "fr_cascade.h"
+
+static const char *TAG = "fr_cascade";
+
+int8_t fr_cascade_init(fr_cascade_t *c,
+                       uint8_t size,
+                       uint8_t confirm_times,
+                       fr_model_t fast_model,
+                       fr_model_t precise_model,
+                       dl_conv_mode mode)
+{
+    memset(c, 0, sizeof(fr_cascade_t));
+    if ((NULL == fr_model_get(fast_model)) || (NULL == fr_model_get(precise_model)))
+    {
+        ESP_LOGE(TAG, "Model is not linked");
+        return ESP_FAIL;
+    }
+
+    face_id_init_with_model(&c->fast, size, confirm_times, fast_model, mode);
+    face_id_init_with_model(&c->precise, size, confirm_times, precise_model, mode);
+    c->band_low = FR_CASCADE_BAND_LOW;
+    c->band_high = FR_CASCADE_BAND_HIGH;
+    c->threshold = FACE_REC_THRESHOLD;
+    return ESP_OK;
+}
+
+void fr_cascade_deinit(fr_cascade_t *c)
+{
+    while (c->fast.count)
+        delete_face(&c->fast);
+    while (c->precise.count)
+        delete_face(&c->precise);
+    dl_lib_free(c->fast.id_list);
+    dl_lib_free(c->precise.id_list);
+    c->fast.id_list = NULL;
+    c->precise.id_list = NULL;
+}
+
+int8_t fr_cascade_recognize(fr_cascade_t *c, dl_matrix3du_t *aligned_face)
+{
+    fptp_t similarity = -1;
+    int8_t matched_id = -1;
+
+    c->stats.recognized++;
+
+    dl_matrix3d_t *face_id = get_face_id_with_model(aligned_face, c->fast.model, c->fast.mode);
+    if (NULL == face_id)
+        return -1;
+    matched_id = match_face_id(&c->fast, face_id, &similarity);
+    dl_matrix3d_free(face_id);
+
+    if (similarity >= c->band_high)
+    {
+        ESP_LOGI(TAG, "Fast similarity: %.6f, id: %d", similarity, matched_id);
+        return matched_id;
+    }
+    if (similarity < c->band_low)
+    {
+        ESP_LOGI(TAG, "Fast similarity: %.6f, id: -1", similarity);
+        return -1;
+    }
+
+    // uncertain, ask the precise model
+    c->stats.escalated++;
+    face_id = get_face_id_with_model(aligned_face, c->precise.model, c->precise.mode);
+    if (NULL == face_id)
+        return -1;
+    matched_id = match_face_id(&c->precise, face_id, &similarity);
+    dl_matrix3d_free(face_id);
+
+    if (similarity < c->threshold)
+        matched_id = -1;
+
+    ESP_LOGI(TAG, "Precise similarity: %.6f, id: %d", similarity, matched_id);
+    return matched_id;
+}
+
+int8_t fr_cascade_enroll(fr_cascade_t *c, dl_matrix3du_t *aligned_face)
+{
+    // both lists advance in lockstep, so an index names the same person in either gallery
+    int8_t left_fast = enroll_face(&c->fast, aligned_face);
+    if (left_fast < 0)
+        return left_fast;
+
+    int8_t left_precise = enroll_face(&c->precise, aligned_face);
+    if (left_precise < 0)
+        return left_precise;
+
+    assert(left_fast == left_precise);
+    return left_precise;
+}
+
+uint8_t fr_cascade_delete(fr_cascade_t *c)
+{
+    delete_face(&c->fast);
+    return delete_face(&c->precise);
+}
+
+void fr_cascade_stats_print(fr_cascade_t *c)
+{
+    uint32_t recognized = c->stats.recognized;
+    uint32_t escalated = c->stats.escalated;
+    ESP_LOGI(TAG, "Precise model needed %u / %u (%.1f%%)",
+             escalated, recognized, recognized ? (100.0f * escalated / recognized) : 0.0f);
+}
@@ -2,26 +2,50 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <assert.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "fr_flash.h"
-#include "freertos/FreeRTOS.h"
-#include "esp_partition.h"
 
 static const char *TAG = "fr_flash";
+static fr_partition_t *fr_flash_partition = NULL;
+static int fr_flash_partition_owned = 0;
+
+fr_partition_t *fr_flash_get_partition(void)
+{
+    if (NULL == fr_flash_partition)
+    {
+        fr_flash_partition = fr_partition_open_flash();
+        fr_flash_partition_owned = (NULL != fr_flash_partition);
+    }
+    return fr_flash_partition;
+}
+
+void fr_flash_set_partition(fr_partition_t *p)
+{
+    // only the partition opened here is closed here
+    if (fr_flash_partition_owned && (fr_flash_partition != p))
+        fr_partition_close(fr_flash_partition);
+    fr_flash_partition = p;
+    fr_flash_partition_owned = 0;
+}
+
 int8_t enroll_face_id_to_flash(face_id_list *l,
               dl_matrix3du_t *aligned_face)
 {
     int8_t left_sample = enroll_face(l, aligned_face);
     if (left_sample == 0)
     {
-        const esp_partition_t *pt = esp_partition_find_first(FR_FLASH_TYPE, FR_FLASH_SUBTYPE, FR_FLASH_PARTITION_NAME);
+        fr_partition_t *pt = fr_flash_get_partition();
         if (pt == NULL){
             ESP_LOGE(TAG, "Not found");
             return -2;
         }
 
+        // every id keeps a FACE_ID_SIZE slot, so the layout does not depend on the model
         const int block_len = FACE_ID_SIZE * sizeof(float);
         const int block_num = (4096 + block_len - 1) / block_len;
+        const int id_len = l->id_size * sizeof(float);
         float *backup_buf = (float *)dl_lib_calloc(1, block_len, 0);
         int flash_info_flag = FR_FLASH_INFO_FLAG;
         uint8_t enroll_id_idx = l->tail == 0 ? (l->size - 1) : (l->tail - 1) % l->size;
@@ -29,29 +53,29 @@ int8_t enroll_face_id_to_flash(face_id_list *l,
         if(enroll_id_idx % block_num == 0)
         {
             // save the other block TODO: if block != 2
-            esp_partition_read(pt, 4096 + (enroll_id_idx + 1) * block_len, backup_buf, block_len);
+            fr_partition_read(pt, 4096 + (enroll_id_idx + 1) * block_len, backup_buf, block_len);
 
-            esp_partition_erase_range(pt, 4096 + enroll_id_idx * block_len, 4096);
+            fr_partition_erase(pt, 4096 + enroll_id_idx * block_len, 4096);
 
-            esp_partition_write(pt, 4096 + enroll_id_idx * block_len, l->id_list[enroll_id_idx]->item, block_len);
-            esp_partition_write(pt, 4096 + (enroll_id_idx + 1) * block_len, backup_buf, block_len); 
+            fr_partition_write(pt, 4096 + enroll_id_idx * block_len, l->id_list[enroll_id_idx]->item, id_len);
+            fr_partition_write(pt, 4096 + (enroll_id_idx + 1) * block_len, backup_buf, block_len); 
         }
         else
         {
             // save the other block TODO: if block != 2
-            esp_partition_read(pt, 4096 + (enroll_id_idx - 1) * block_len, backup_buf, block_len);
+            fr_partition_read(pt, 4096 + (enroll_id_idx - 1) * block_len, backup_buf, block_len);
 
-            esp_partition_erase_range(pt, 4096 + (enroll_id_idx - 1) * block_len, 4096);
+            fr_partition_erase(pt, 4096 + (enroll_id_idx - 1) * block_len, 4096);
 
-            esp_partition_write(pt, 4096 + (enroll_id_idx - 1) * block_len, backup_buf, block_len);
-            esp_partition_write(pt, 4096 + enroll_id_idx * block_len, l->id_list[enroll_id_idx]->item, block_len); 
+            fr_partition_write(pt, 4096 + (enroll_id_idx - 1) * block_len, backup_buf, block_len);
+            fr_partition_write(pt, 4096 + enroll_id_idx * block_len, l->id_list[enroll_id_idx]->item, id_len); 
         }
 
         dl_lib_free(backup_buf);
 
-        esp_partition_erase_range(pt, 0, 4096);
-        esp_partition_write(pt, 0, &flash_info_flag, sizeof(int));
-        esp_partition_write(pt, sizeof(int), l, sizeof(face_id_list));
+        fr_partition_erase(pt, 0, 4096);
+        fr_partition_write(pt, 0, &flash_info_flag, sizeof(int));
+        fr_partition_write(pt, sizeof(int), l, sizeof(face_id_list));
 
         return 0;
     }
@@ -61,7 +85,7 @@ int8_t enroll_face_id_to_flash(face_id_list *l,
 
 int8_t read_face_id_from_flash(face_id_list *l)
 {
-    const esp_partition_t *pt = esp_partition_find_first(FR_FLASH_TYPE, FR_FLASH_SUBTYPE, FR_FLASH_PARTITION_NAME);
+    fr_partition_t *pt = fr_flash_get_partition();
     if (pt == NULL){
         ESP_LOGE(TAG, "Not found");
         return -1;
@@ -69,32 +93,44 @@ int8_t read_face_id_from_flash(face_id_list *l)
 
     int flash_info_flag = 0;
 
-    esp_partition_read(pt, 0, &flash_info_flag, sizeof(int));
+    fr_partition_read(pt, 0, &flash_info_flag, sizeof(int));
     if(flash_info_flag != FR_FLASH_INFO_FLAG)
     {
         ESP_LOGE(TAG, "No ID Infomation");
         return -2;
     }
 
-    uint8_t size = l->size;
-    uint8_t confirm_times = l->confirm_times;
-    dl_matrix3d_t **id_list = l->id_list;
-
-    esp_partition_read(pt, sizeof(int), l, sizeof(face_id_list));
+    // the header is a raw copy of the list, only the ring indexes are taken from it
+    face_id_list stored;
+    fr_partition_read(pt, sizeof(int), &stored, sizeof(face_id_list));
     const int block_len = FACE_ID_SIZE * sizeof(float);
 
-    assert(l->size == size);
-    assert(l->confirm_times == confirm_times);
+    // headers written before the model was stored leave it erased, their ids come from the default model
+    if (0xFFFF == stored.id_size)
+    {
+        stored.model = FR_MODEL_DEFAULT;
+        stored.id_size = FACE_ID_SIZE;
+    }
+    if ((stored.model != l->model) || (stored.id_size != l->id_size))
+    {
+        ESP_LOGE(TAG, "Stored ids are from model %d with %d values, the list is for model %d with %d",
+                 stored.model, stored.id_size, l->model, l->id_size);
+        return -3;
+    }
+
+    assert(stored.size == l->size);
+    assert(stored.confirm_times == l->confirm_times);
 
+    l->head = stored.head;
+    l->tail = stored.tail;
+    l->count = stored.count;
     for(int i = 0; i < l->count; i++)
     {
-        uint8_t head = (l->head + i) % size;
-        id_list[head] = dl_matrix3d_alloc(1, 1, 1, FACE_ID_SIZE);
-        esp_partition_read(pt, 4096 + head * block_len, id_list[head]->item, block_len);
+        uint8_t head = (l->head + i) % l->size;
+        l->id_list[head] = dl_matrix3d_alloc(1, 1, 1, l->id_size);
+        fr_partition_read(pt, 4096 + head * block_len, l->id_list[head]->item, l->id_size * sizeof(float));
     }
 
-    l->id_list = id_list;
-
     return l->count;
 }
 
@@ -102,25 +138,25 @@ int8_t delete_face_id_in_flash(face_id_list *l)
 {
     delete_face(l);
 
-    const esp_partition_t *pt = esp_partition_find_first(FR_FLASH_TYPE, FR_FLASH_SUBTYPE, FR_FLASH_PARTITION_NAME);
+    fr_partition_t *pt = fr_flash_get_partition();
     if (pt == NULL){
         ESP_LOGE(TAG, "Not found");
         return -1;
     }
 
     int flash_info_flag = 0;
-    esp_partition_read(pt, 0, &flash_info_flag, sizeof(int));
+    fr_partition_read(pt, 0, &flash_info_flag, sizeof(int));
     if((flash_info_flag != FR_FLASH_INFO_FLAG))
     {
         ESP_LOGE(TAG, "No ID Infomation");
         return -2;
     }
 
-    esp_partition_erase_range(pt, 0, 4096);
+    fr_partition_erase(pt, 0, 4096);
     if (l->count)
     {
-        esp_partition_write(pt, 0, &flash_info_flag, sizeof(int));
-        esp_partition_write(pt, sizeof(int), l, sizeof(face_id_list));
+        fr_partition_write(pt, 0, &flash_info_flag, sizeof(int));
+        fr_partition_write(pt, sizeof(int), l, sizeof(face_id_list));
     }
     return l->count;
 }
@@ -134,7 +170,7 @@ int8_t enroll_face_id_to_flash_with_name(face_id_name_list *l,
         return left_sample;
 
     // left_sample == 0
-    const esp_partition_t *pt = esp_partition_find_first(FR_FLASH_TYPE, FR_FLASH_SUBTYPE, FR_FLASH_PARTITION_NAME);
+    fr_partition_t *pt = fr_flash_get_partition();
     if (pt == NULL){
         ESP_LOGE(TAG, "Not found");
         return -2;
@@ -145,36 +181,37 @@ int8_t enroll_face_id_to_flash_with_name(face_id_name_list *l,
     // flash can only be erased divided by 4K
     const int block_len = FACE_ID_SIZE * sizeof(float);
     const int block_num = (4096 + block_len - 1) / block_len;
+    const int id_len = l->id_size * sizeof(float);
 
     if(enroll_id_idx % block_num == 0)
     {
         // save the other block TODO: if block != 2
-        esp_partition_erase_range(pt, 4096 + enroll_id_idx * block_len, 4096);
+        fr_partition_erase(pt, 4096 + enroll_id_idx * block_len, 4096);
 
-        esp_partition_write(pt, 4096 + enroll_id_idx * block_len, l->tail->id_vec->item, block_len);
+        fr_partition_write(pt, 4096 + enroll_id_idx * block_len, l->tail->id_vec->item, id_len);
     }
     else
     {
         // save the other block TODO: if block != 2
         float *backup_buf = (float *)dl_lib_calloc(1, block_len, 0);
-        esp_partition_read(pt, 4096 + (enroll_id_idx - 1) * block_len, backup_buf, block_len);
+        fr_partition_read(pt, 4096 + (enroll_id_idx - 1) * block_len, backup_buf, block_len);
 
-        esp_partition_erase_range(pt, 4096 + (enroll_id_idx - 1) * block_len, 4096);
+        fr_partition_erase(pt, 4096 + (enroll_id_idx - 1) * block_len, 4096);
 
-        esp_partition_write(pt, 4096 + (enroll_id_idx - 1) * block_len, backup_buf, block_len);
-        esp_partition_write(pt, 4096 + enroll_id_idx * block_len, l->tail->id_vec->item, block_len); 
+        fr_partition_write(pt, 4096 + (enroll_id_idx - 1) * block_len, backup_buf, block_len);
+        fr_partition_write(pt, 4096 + enroll_id_idx * block_len, l->tail->id_vec->item, id_len); 
         dl_lib_free(backup_buf);
     }
 
     const int name_len = ENROLL_NAME_LEN * sizeof(char);
     char *backup_name = (char *)dl_lib_calloc(l->count, name_len, 0);
-    esp_partition_read(pt, sizeof(int) + sizeof(uint8_t), backup_name, name_len * (l->count - 1));
+    fr_partition_read(pt, sizeof(int) + sizeof(uint8_t), backup_name, name_len * (l->count - 1));
     memcpy(backup_name + (l->count - 1) * name_len, l->tail->id_name, name_len);
-    esp_partition_erase_range(pt, 0, 4096);
+    fr_partition_erase(pt, 0, 4096);
     int flash_info_flag = FR_FLASH_INFO_FLAG;
-    esp_partition_write(pt, 0, &flash_info_flag, sizeof(int));
-    esp_partition_write(pt, sizeof(int), &l->count, sizeof(uint8_t));
-    esp_partition_write(pt, sizeof(int) + sizeof(uint8_t), backup_name, name_len * l->count);
+    fr_partition_write(pt, 0, &flash_info_flag, sizeof(int));
+    fr_partition_write(pt, sizeof(int), &l->count, sizeof(uint8_t));
+    fr_partition_write(pt, sizeof(int) + sizeof(uint8_t), backup_name, name_len * l->count);
     dl_lib_free(backup_name);
 
     return 0;
@@ -182,7 +219,7 @@ int8_t enroll_face_id_to_flash_with_name(face_id_name_list *l,
 
 int8_t read_face_id_from_flash_with_name(face_id_name_list *l)
 {
-    const esp_partition_t *pt = esp_partition_find_first(FR_FLASH_TYPE, FR_FLASH_SUBTYPE, FR_FLASH_PARTITION_NAME);
+    fr_partition_t *pt = fr_flash_get_partition();
     if (pt == NULL){
         ESP_LOGE(TAG, "Not found");
         return -1;
@@ -191,7 +228,7 @@ int8_t read_face_id_from_flash_with_name(face_id_name_list *l)
     int flash_info_flag = 0;
     int offset = 0;
 
-    esp_partition_read(pt, offset, &flash_info_flag, sizeof(int));
+    fr_partition_read(pt, offset, &flash_info_flag, sizeof(int));
     offset += sizeof(int);
     if(flash_info_flag != FR_FLASH_INFO_FLAG)
     {
@@ -202,12 +239,12 @@ int8_t read_face_id_from_flash_with_name(face_id_name_list *l)
     // name and list have been initialized, need to copy them to prevent overwriting after read from flash
     uint8_t count = 0;
 
-    esp_partition_read(pt, offset, &count, sizeof(uint8_t));
+    fr_partition_read(pt, offset, &count, sizeof(uint8_t));
     offset += sizeof(uint8_t);
     const int name_len = count * ENROLL_NAME_LEN;
     char *name = (char *)dl_lib_calloc(name_len, sizeof(char), 0);
 
-    esp_partition_read(pt, offset, name, name_len);
+    fr_partition_read(pt, offset, name, name_len);
     offset += name_len;
 
     const int block_len = FACE_ID_SIZE * sizeof(float);
@@ -216,8 +253,8 @@ int8_t read_face_id_from_flash_with_name(face_id_name_list *l)
         face_id_node *new_node = (face_id_node *)dl_lib_calloc(1, sizeof(face_id_node), 0);
         new_node->next = NULL;
         memcpy(new_node->id_name, name + i * ENROLL_NAME_LEN * sizeof(char), ENROLL_NAME_LEN * sizeof(char));
-        new_node->id_vec = dl_matrix3d_alloc(1, 1, 1, FACE_ID_SIZE);
-        esp_partition_read(pt, 4096 + i * block_len, new_node->id_vec->item, block_len);
+        new_node->id_vec = dl_matrix3d_alloc(1, 1, 1, l->id_size);
+        fr_partition_read(pt, 4096 + i * block_len, new_node->id_vec->item, l->id_size * sizeof(float));
         if (NULL == l->head)
         {
             l->head = new_node;
@@ -239,27 +276,27 @@ int8_t read_face_id_from_flash_with_name(face_id_name_list *l)
 
 int8_t delete_face_id_in_flash_with_name(face_id_name_list *l, char *name)
 {
-    int8_t index = delete_face_with_name(l, name);
+    int index = delete_face_with_name(l, name);
     if (index < 0)
         return -3;
 
-    const esp_partition_t *pt = esp_partition_find_first(FR_FLASH_TYPE, FR_FLASH_SUBTYPE, FR_FLASH_PARTITION_NAME);
+    fr_partition_t *pt = fr_flash_get_partition();
     if (pt == NULL){
         ESP_LOGE(TAG, "Not found");
         return -1;
     }
 
     int flash_info_flag = 0;
-    esp_partition_read(pt, 0, &flash_info_flag, sizeof(int));
+    fr_partition_read(pt, 0, &flash_info_flag, sizeof(int));
     if((flash_info_flag != FR_FLASH_INFO_FLAG))
     {
         ESP_LOGE(TAG, "No ID Infomation");
         return -2;
     }
 
-    esp_partition_erase_range(pt, 0, 4096);
-    esp_partition_write(pt, 0, &flash_info_flag, sizeof(int));
-    esp_partition_write(pt, sizeof(int), &l->count, sizeof(uint8_t));
+    fr_partition_erase(pt, 0, 4096);
+    fr_partition_write(pt, 0, &flash_info_flag, sizeof(int));
+    fr_partition_write(pt, sizeof(int), &l->count, sizeof(uint8_t));
 
     // Last one don't need shift
     if (0 == l->count)
@@ -269,39 +306,40 @@ int8_t delete_face_id_in_flash_with_name(face_id_name_list *l, char *name)
     face_id_node *f = l->head;
     while (i < index)
     {
-        esp_partition_write(pt, sizeof(int) + sizeof(uint8_t) + i * ENROLL_NAME_LEN * sizeof(char), f->id_name, ENROLL_NAME_LEN * sizeof(char));
+        fr_partition_write(pt, sizeof(int) + sizeof(uint8_t) + i * ENROLL_NAME_LEN * sizeof(char), f->id_name, ENROLL_NAME_LEN * sizeof(char));
         f = f->next;
         i++;
     }
 
     const int block_len = FACE_ID_SIZE * sizeof(float);
     const int block_num = (4096 + block_len - 1) / block_len;
+    const int id_len = l->id_size * sizeof(float);
     while (i < l->count)
     {
         if (i % block_num == 0)
         {
-            esp_partition_erase_range(pt, 4096 + i * block_len, 4096);
+            fr_partition_erase(pt, 4096 + i * block_len, 4096);
 
-            esp_partition_write(pt, 4096 + i * block_len, f->id_vec->item, block_len);
-            esp_partition_write(pt, sizeof(int) + sizeof(uint8_t) + i * ENROLL_NAME_LEN * sizeof(char), f->id_name, ENROLL_NAME_LEN * sizeof(char));
+            fr_partition_write(pt, 4096 + i * block_len, f->id_vec->item, id_len);
+            fr_partition_write(pt, sizeof(int) + sizeof(uint8_t) + i * ENROLL_NAME_LEN * sizeof(char), f->id_name, ENROLL_NAME_LEN * sizeof(char));
 
             if (f == l->tail)
                 break;
             
             f = f->next;
-            esp_partition_write(pt, 4096 + (i + 1) * block_len, f->id_vec->item, block_len);
-            esp_partition_write(pt, sizeof(int) + sizeof(uint8_t) + (i + 1) * ENROLL_NAME_LEN * sizeof(char), f->id_name, ENROLL_NAME_LEN * sizeof(char));
+            fr_partition_write(pt, 4096 + (i + 1) * block_len, f->id_vec->item, id_len);
+            fr_partition_write(pt, sizeof(int) + sizeof(uint8_t) + (i + 1) * ENROLL_NAME_LEN * sizeof(char), f->id_name, ENROLL_NAME_LEN * sizeof(char));
             i += 2;
         }
         else
         {
             float *backup_buf = (float *)dl_lib_calloc(1, block_len, 0);
-            esp_partition_read(pt, 4096 + (i - 1) * block_len, backup_buf, block_len);
-            esp_partition_erase_range(pt, 4096 + (i - 1) * block_len, 4096);
+            fr_partition_read(pt, 4096 + (i - 1) * block_len, backup_buf, block_len);
+            fr_partition_erase(pt, 4096 + (i - 1) * block_len, 4096);
 
-            esp_partition_write(pt, 4096 + (i - 1) * block_len, backup_buf, block_len);
-            esp_partition_write(pt, 4096 + i * block_len, f->id_vec->item, block_len);
-            esp_partition_write(pt, sizeof(int) + sizeof(uint8_t) + i * ENROLL_NAME_LEN * sizeof(char), f->id_name, ENROLL_NAME_LEN * sizeof(char));
+            fr_partition_write(pt, 4096 + (i - 1) * block_len, backup_buf, block_len);
+            fr_partition_write(pt, 4096 + i * block_len, f->id_vec->item, id_len);
+            fr_partition_write(pt, sizeof(int) + sizeof(uint8_t) + i * ENROLL_NAME_LEN * sizeof(char), f->id_name, ENROLL_NAME_LEN * sizeof(char));
             i += 1;
             dl_lib_free(backup_buf);
         }
@@ -312,20 +350,70 @@ int8_t delete_face_id_in_flash_with_name(face_id_name_list *l, char *name)
 
 void delete_face_all_in_flash_with_name(face_id_name_list *l)
 {
-    const esp_partition_t *pt = esp_partition_find_first(FR_FLASH_TYPE, FR_FLASH_SUBTYPE, FR_FLASH_PARTITION_NAME);
+    fr_partition_t *pt = fr_flash_get_partition();
     if (pt == NULL){
         ESP_LOGE(TAG, "Not found");
         return;
     }
 
     int flash_info_flag = 0;
-    esp_partition_read(pt, 0, &flash_info_flag, sizeof(int));
+    fr_partition_read(pt, 0, &flash_info_flag, sizeof(int));
     if((flash_info_flag != FR_FLASH_INFO_FLAG))
     {
         ESP_LOGE(TAG, "No ID Infomation");
         return;
     }
-    esp_partition_erase_range(pt, 0, 4096 * (l->count + 1));
+    fr_partition_erase(pt, 0, 4096 * (l->count + 1));
 
     delete_face_all_with_name(l);
 }
+
+int fr_flash_benchmark(uint32_t cycles, uint8_t gallery_size)
+{
+    fr_partition_t *pt = fr_flash_get_partition();
+    if (pt == NULL)
+    {
+        ESP_LOGE(TAG, "Not found");
+        return ESP_FAIL;
+    }
+
+    face_id_name_list l;
+    face_id_name_init(&l, gallery_size, 1);
+    dl_matrix3d_t *id = dl_matrix3d_alloc(1, 1, 1, l.id_size);
+    char name[ENROLL_NAME_LEN];
+    int ret = ESP_OK;
+
+    fr_partition_erase(pt, 0, pt->sector_size);
+    fr_partition_stats_reset(pt);
+    srand(cycles);
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t c = 0; c < cycles; c++)
+    {
+        // keep the gallery full, the oldest id leaves for every new one
+        if (l.count == gallery_size)
+        {
+            memcpy(name, l.head->id_name, ENROLL_NAME_LEN);
+            delete_face_id_in_flash_with_name(&l, name);
+        }
+
+        for (int i = 0; i < l.id_size; i++)
+            id->item[i] = (fptp_t)rand() / RAND_MAX - 0.5f;
+        snprintf(name, ENROLL_NAME_LEN, "id%u", c);
+        if (0 != enroll_face_id_to_flash_with_name(&l, id, name))
+        {
+            ret = ESP_FAIL;
+            break;
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    if (cycles)
+        ESP_LOGI(TAG, "%u enroll/delete cycles on %d ids: %u us per cycle, flash busy %u us per cycle",
+                 cycles, gallery_size, (unsigned)(elapsed / cycles), (unsigned)(pt->stats.busy_us / cycles));
+    fr_partition_stats_print(pt);
+
+    delete_face_all_in_flash_with_name(&l);
+    dl_matrix3d_free(id);
+    return ret;
+}
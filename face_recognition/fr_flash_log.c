@@ -0,0 +1,1181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "fr_flash_log.h"
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#else
+#include <pthread.h>
+#endif
+
+static const char *TAG = "fr_flash_log";
+
+/*
+ * The partition is a ring of sectors. Each used sector starts with a header, the records follow as one byte stream
+ * which runs on into the next sector of the ring, so a record may span sectors. first_record tells where the first
+ * record starting in a sector is, the rest of a record that started in an erased sector is skipped with it.
+ */
+typedef struct
+{
+    uint32_t magic;        /*!< FR_LOG_SECTOR_MAGIC */
+    uint32_t seq;          /*!< +1 for each sector opened */
+    uint16_t first_record; /*!< offset in the sector of the first record starting here, FR_LOG_NO_RECORD if none */
+    uint16_t version;      /*!< FR_LOG_VERSION */
+    uint32_t crc;          /*!< crc of the fields above */
+} fr_log_sector_t;
+
+typedef struct
+{
+    uint16_t magic;    /*!< FR_LOG_RECORD_MAGIC */
+    uint8_t type;      /*!< fr_log_type_t */
+    uint8_t flags;     /*!< FR_LOG_FLAG_*, active low */
+    uint32_t seq;      /*!< +1 for each record written */
+    uint32_t id;       /*!< record id of the face, of the deleted face for a tombstone */
+    uint16_t len;      /*!< bytes of the payload */
+    uint16_t reserved; /*!< 0xFFFF */
+    uint32_t crc;      /*!< crc of the fields above and the payload */
+} fr_log_record_t;
+
+typedef enum
+{
+    FR_LOG_ENROLL = 1, /*!< payload: name[ENROLL_NAME_LEN], id vector */
+    FR_LOG_DELETE = 2, /*!< no payload */
+    FR_LOG_COMMIT = 3, /*!< no payload, id is the seq of the first record of the batch */
+} fr_log_type_t;
+
+static void *lock_create(void)
+{
+#ifdef ESP_PLATFORM
+    return xSemaphoreCreateMutex();
+#else
+    pthread_mutex_t *m = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
+    if (m)
+        pthread_mutex_init(m, NULL);
+    return m;
+#endif
+}
+
+static void lock_delete(void *lock)
+{
+#ifdef ESP_PLATFORM
+    vSemaphoreDelete((SemaphoreHandle_t)lock);
+#else
+    pthread_mutex_destroy((pthread_mutex_t *)lock);
+    free(lock);
+#endif
+}
+
+static void log_lock(fr_log_t *log)
+{
+#ifdef ESP_PLATFORM
+    xSemaphoreTake((SemaphoreHandle_t)log->lock, portMAX_DELAY);
+#else
+    pthread_mutex_lock((pthread_mutex_t *)log->lock);
+#endif
+}
+
+static void log_unlock(fr_log_t *log)
+{
+#ifdef ESP_PLATFORM
+    xSemaphoreGive((SemaphoreHandle_t)log->lock);
+#else
+    pthread_mutex_unlock((pthread_mutex_t *)log->lock);
+#endif
+}
+
+#define FR_LOG_FLAG_BATCH 0x01 /*!< cleared in the records of a batch, they only count once the commit record follows */
+
+#define FR_LOG_NO_RECORD 0xFFFF
+#define SECTOR_HDR ((uint32_t)sizeof(fr_log_sector_t))
+#define RECORD_HDR ((uint32_t)sizeof(fr_log_record_t))
+
+static inline uint32_t sector_size(fr_log_t *log)
+{
+    return log->part->sector_size;
+}
+
+static inline uint32_t sector_base(fr_log_t *log, uint16_t s)
+{
+    return s * sector_size(log);
+}
+
+static inline uint16_t sector_of(fr_log_t *log, uint32_t offset)
+{
+    return offset / sector_size(log);
+}
+
+static inline uint16_t sector_next(fr_log_t *log, uint16_t s)
+{
+    return (s + 1) % log->n_sectors;
+}
+
+static inline uint16_t sector_prev(fr_log_t *log, uint16_t s)
+{
+    return (s + log->n_sectors - 1) % log->n_sectors;
+}
+
+static inline uint16_t used_sectors(fr_log_t *log)
+{
+    return (log->head + log->n_sectors - log->tail) % log->n_sectors + 1;
+}
+
+static uint32_t raw_free_bytes(fr_log_t *log)
+{
+    uint32_t head_left = sector_base(log, log->head) + sector_size(log) - log->head_offset;
+    return head_left + (log->n_sectors - used_sectors(log)) * (sector_size(log) - SECTOR_HDR);
+}
+
+uint32_t fr_log_free_bytes(fr_log_t *log)
+{
+    uint32_t raw = raw_free_bytes(log);
+    uint32_t reserve = FR_LOG_RESERVE_SECTORS * (sector_size(log) - SECTOR_HDR);
+    return raw > reserve ? raw - reserve : 0;
+}
+
+uint32_t fr_log_garbage_bytes(fr_log_t *log)
+{
+    uint32_t garbage = 0;
+    for (int s = 0; s < log->n_sectors; s++)
+        garbage += log->used_bytes[s] - log->live_bytes[s];
+    return garbage;
+}
+
+/*
+ * Move a stream position forward by len bytes, skipping the sector headers.
+ */
+static uint32_t stream_advance(fr_log_t *log, uint32_t pos, uint32_t len)
+{
+    for (;;)
+    {
+        uint16_t s = sector_of(log, pos);
+        uint32_t left = sector_base(log, s) + sector_size(log) - pos;
+        if (len < left)
+            return pos + len;
+        len -= left;
+        pos = sector_base(log, sector_next(log, s)) + SECTOR_HDR;
+    }
+}
+
+static esp_err_t stream_read(fr_log_t *log, uint32_t pos, void *dst, uint32_t len)
+{
+    uint8_t *d = (uint8_t *)dst;
+    while (len)
+    {
+        uint16_t s = sector_of(log, pos);
+        uint32_t left = sector_base(log, s) + sector_size(log) - pos;
+        uint32_t n = len < left ? len : left;
+        esp_err_t ret = fr_partition_read(log->part, pos, d, n);
+        if (ESP_OK != ret)
+            return ret;
+        d += n;
+        len -= n;
+        pos = (n == left) ? sector_base(log, sector_next(log, s)) + SECTOR_HDR : pos + n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t sector_open(fr_log_t *log, uint16_t s, uint16_t first_record)
+{
+    fr_log_sector_t hdr;
+    hdr.magic = FR_LOG_SECTOR_MAGIC;
+    hdr.seq = log->sector_seq + 1;
+    hdr.first_record = first_record;
+    hdr.version = FR_LOG_VERSION;
+    hdr.crc = fr_crc32(0, &hdr, offsetof(fr_log_sector_t, crc));
+
+    // a gap in the sequence would cut the chain at the next open, so the number is only taken once written
+    esp_err_t ret = fr_partition_write(log->part, sector_base(log, s), &hdr, SECTOR_HDR);
+    if (ESP_OK != ret)
+    {
+        fr_partition_erase(log->part, sector_base(log, s), sector_size(log));
+        return ret;
+    }
+    log->sector_seq = hdr.seq;
+    log->head = s;
+    log->head_offset = sector_base(log, s) + SECTOR_HDR;
+    return ESP_OK;
+}
+
+static esp_err_t sector_erase(fr_log_t *log, uint16_t s)
+{
+    log->erase_count++;
+    log->used_bytes[s] = 0;
+    log->live_bytes[s] = 0;
+    return fr_partition_erase(log->part, sector_base(log, s), sector_size(log));
+}
+
+/*
+ * Write whole records at the head, opening the next sectors of the ring on the way. The caller makes sure they are free.
+ * rec holds the offsets of the n records in buf, their partition offsets are returned in pos.
+ * Each sector gets a single write, so a batch goes out as sequential sector sized writes.
+ */
+static esp_err_t stream_write(fr_log_t *log, const uint8_t *buf, uint32_t total, const uint32_t *rec, int n, uint32_t *pos, uint32_t *done)
+{
+    uint32_t ss = sector_size(log);
+    uint32_t written = 0;
+    int k = 0;
+    esp_err_t ret = ESP_OK;
+
+    while (written < total)
+    {
+        uint32_t end = sector_base(log, log->head) + ss;
+        if (log->head_offset == end)
+        {
+            uint16_t s = sector_next(log, log->head);
+            if (s == log->tail)
+                return ESP_ERR_NO_MEM;
+            // the first record starting here, or the next append if the buffer ends here
+            uint32_t next = (k < n) ? rec[k] : total;
+            uint16_t first = (SECTOR_HDR + next - written < ss) ? SECTOR_HDR + next - written : FR_LOG_NO_RECORD;
+            ret = sector_open(log, s, first);
+            if (ESP_OK != ret)
+                return ret;
+            end = sector_base(log, log->head) + ss;
+        }
+
+        uint32_t len = DL_IMAGE_MIN(total - written, end - log->head_offset);
+        for (; (k < n) && (rec[k] < written + len); k++)
+            pos[k] = log->head_offset + rec[k] - written;
+        ret = fr_partition_write(log->part, log->head_offset, buf + written, len);
+        if (ESP_OK != ret)
+            return ret;
+        written += len;
+        *done = written;
+        log->head_offset += len;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t stream_append(fr_log_t *log, const uint8_t *buf, uint32_t total, const uint32_t *rec, int n, uint32_t *pos)
+{
+    uint16_t first = log->head;
+    uint32_t done = 0;
+    esp_err_t ret = stream_write(log, buf, total, rec, n, pos, &done);
+    if (ESP_OK != ret)
+    {
+        // the torn records are garbage, and the rest of the head may hold a partial write, continue in a fresh sector
+        uint32_t end = sector_base(log, log->head) + sector_size(log);
+        log->used_bytes[first] += done;
+        log->used_bytes[log->head] += end - log->head_offset;
+        log->head_offset = end;
+    }
+    return ret;
+}
+
+/*
+ * Fill the header of a record whose payload is already in place, and seal it with the crc.
+ */
+static void record_seal(fr_log_t *log, uint8_t *rec, uint8_t type, uint8_t flags, uint32_t id, uint16_t len)
+{
+    fr_log_record_t *hdr = (fr_log_record_t *)rec;
+    hdr->magic = FR_LOG_RECORD_MAGIC;
+    hdr->type = type;
+    hdr->flags = flags;
+    hdr->seq = log->next_seq++;
+    hdr->id = id;
+    hdr->len = len;
+    hdr->reserved = 0xFFFF;
+    uint32_t crc = fr_crc32(0, rec, offsetof(fr_log_record_t, crc));
+    hdr->crc = fr_crc32(crc, rec + RECORD_HDR, len);
+}
+
+static uint8_t *record_build(fr_log_t *log, uint8_t type, uint32_t id, const void *payload, uint16_t len)
+{
+    uint8_t *rec = (uint8_t *)dl_lib_calloc(1, RECORD_HDR + len, 0);
+    if (NULL == rec)
+        return NULL;
+
+    if (len)
+        memcpy(rec + RECORD_HDR, payload, len);
+    record_seal(log, rec, type, 0xFF, id, len);
+    return rec;
+}
+
+static int entry_find_offset(fr_log_t *log, uint32_t offset)
+{
+    for (int i = 0; i < log->count; i++)
+    {
+        if (log->entry[i].offset == offset)
+            return i;
+    }
+    return -1;
+}
+
+static int entry_find_id(fr_log_t *log, uint32_t id)
+{
+    for (int i = 0; i < log->count; i++)
+    {
+        if (log->entry[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Room for n more entries, so the pushes that follow can not fail.
+ */
+static esp_err_t entry_reserve(fr_log_t *log, int n)
+{
+    if (log->count + n > log->capacity)
+    {
+        int capacity = log->capacity ? log->capacity : 16;
+        while (capacity < log->count + n)
+            capacity *= 2;
+        if (capacity > UINT16_MAX)
+            return ESP_ERR_NO_MEM;
+        fr_log_entry_t *entry = (fr_log_entry_t *)dl_lib_calloc(capacity, sizeof(fr_log_entry_t), 0);
+        if (NULL == entry)
+            return ESP_ERR_NO_MEM;
+        if (log->entry)
+        {
+            memcpy(entry, log->entry, log->count * sizeof(fr_log_entry_t));
+            dl_lib_free(log->entry);
+        }
+        log->entry = entry;
+        log->capacity = capacity;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t entry_push(fr_log_t *log, uint32_t id, uint32_t offset, uint16_t size)
+{
+    esp_err_t ret = entry_reserve(log, 1);
+    if (ESP_OK != ret)
+        return ret;
+    log->entry[log->count].id = id;
+    log->entry[log->count].offset = offset;
+    log->entry[log->count].size = size;
+    log->count++;
+    return ESP_OK;
+}
+
+static void entry_remove(fr_log_t *log, int i)
+{
+    memmove(log->entry + i, log->entry + i + 1, (log->count - i - 1) * sizeof(fr_log_entry_t));
+    log->count--;
+}
+
+/*
+ * Copy the live records starting in the tail sector to the head, then erase it.
+ */
+static esp_err_t compact_tail(fr_log_t *log)
+{
+    uint16_t s = log->tail;
+    if (s == log->head)
+        return ESP_ERR_NO_MEM;
+
+    fr_log_sector_t shdr;
+    esp_err_t ret = fr_partition_read(log->part, sector_base(log, s), &shdr, SECTOR_HDR);
+    if (ESP_OK != ret)
+        return ret;
+
+    if (FR_LOG_NO_RECORD != shdr.first_record)
+    {
+        uint32_t end = sector_base(log, s) + sector_size(log);
+        uint32_t pos = sector_base(log, s) + shdr.first_record;
+        while ((sector_of(log, pos) == s) && (pos < end) && log->live_bytes[s])
+        {
+            fr_log_record_t rhdr;
+            ret = stream_read(log, pos, &rhdr, RECORD_HDR);
+            if (ESP_OK != ret)
+                return ret;
+            if (FR_LOG_RECORD_MAGIC != rhdr.magic)
+                break;
+
+            uint32_t total = RECORD_HDR + rhdr.len;
+            int i = (FR_LOG_ENROLL == rhdr.type) ? entry_find_offset(log, pos) : -1;
+            if (i >= 0)
+            {
+                uint8_t *rec = (uint8_t *)dl_lib_calloc(1, total, 0);
+                if (NULL == rec)
+                    return ESP_ERR_NO_MEM;
+                ret = stream_read(log, pos, rec, total);
+                uint32_t start = 0;
+                if (ESP_OK == ret)
+                {
+                    // keep the record id, a new seq tells the copy is newer, a committed record needs no commit any more
+                    fr_log_record_t *hdr = (fr_log_record_t *)rec;
+                    hdr->seq = log->next_seq++;
+                    hdr->flags |= FR_LOG_FLAG_BATCH;
+                    uint32_t crc = fr_crc32(0, rec, offsetof(fr_log_record_t, crc));
+                    hdr->crc = fr_crc32(crc, rec + RECORD_HDR, hdr->len);
+                    uint32_t zero = 0;
+                    ret = stream_append(log, rec, total, &zero, 1, &start);
+                }
+                dl_lib_free(rec);
+                if (ESP_OK != ret)
+                    return ret;
+
+                log->entry[i].offset = start;
+                log->used_bytes[sector_of(log, start)] += total;
+                log->live_bytes[sector_of(log, start)] += total;
+                log->live_bytes[s] -= total;
+            }
+            pos = stream_advance(log, pos, total);
+        }
+    }
+
+    ret = sector_erase(log, s);
+    if (ESP_OK != ret)
+        return ret;
+    log->tail = sector_next(log, s);
+    ESP_LOGD(TAG, "Compacted sector %d", s);
+    return ESP_OK;
+}
+
+static esp_err_t make_room(fr_log_t *log, uint32_t total)
+{
+    for (int i = 0; i < 2 * log->n_sectors; i++)
+    {
+        if (fr_log_free_bytes(log) >= total)
+            return ESP_OK;
+        if (0 == fr_log_garbage_bytes(log))
+            break;
+        esp_err_t ret = compact_tail(log);
+        if (ESP_OK != ret)
+            return ret;
+    }
+    return fr_log_free_bytes(log) >= total ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t record_append(fr_log_t *log, uint8_t type, uint32_t id, const void *payload, uint16_t len, uint32_t *start)
+{
+    uint32_t total = RECORD_HDR + len;
+    esp_err_t ret = make_room(log, total);
+    if (ESP_OK != ret)
+        return ret;
+
+    uint8_t *rec = record_build(log, type, id, payload, len);
+    if (NULL == rec)
+        return ESP_ERR_NO_MEM;
+    uint32_t zero = 0;
+    ret = stream_append(log, rec, total, &zero, 1, start);
+    dl_lib_free(rec);
+    if (ESP_OK != ret)
+        return ret;
+
+    log->used_bytes[sector_of(log, *start)] += total;
+    return ESP_OK;
+}
+
+int fr_log_compact_step(fr_log_t *log)
+{
+    int ret = 0;
+    log_lock(log);
+    uint32_t tail_garbage = log->used_bytes[log->tail] - log->live_bytes[log->tail];
+    if ((log->tail != log->head) && (tail_garbage || (fr_log_garbage_bytes(log) >= sector_size(log) - SECTOR_HDR)))
+    {
+        // moving live data needs the reserve, which make_room keeps for this
+        ret = (ESP_OK == compact_tail(log)) ? 1 : -1;
+    }
+    log_unlock(log);
+    return ret;
+}
+
+static esp_err_t format(fr_log_t *log)
+{
+    esp_err_t ret = fr_partition_erase(log->part, 0, log->n_sectors * sector_size(log));
+    if (ESP_OK != ret)
+        return ret;
+
+    log->erase_count += log->n_sectors;
+    memset(log->used_bytes, 0, log->n_sectors * sizeof(uint32_t));
+    memset(log->live_bytes, 0, log->n_sectors * sizeof(uint32_t));
+    log->count = 0;
+    log->tail = 0;
+    log->sector_seq = 0;
+    log->next_seq = 1;
+    log->next_id = 1;
+    return sector_open(log, 0, SECTOR_HDR);
+}
+
+esp_err_t fr_log_format(fr_log_t *log)
+{
+    log_lock(log);
+    esp_err_t ret = format(log);
+    log_unlock(log);
+    return ret;
+}
+
+static int sector_header_valid(fr_log_sector_t *hdr)
+{
+    return (FR_LOG_SECTOR_MAGIC == hdr->magic) && (FR_LOG_VERSION == hdr->version) &&
+           (hdr->crc == fr_crc32(0, hdr, offsetof(fr_log_sector_t, crc)));
+}
+
+static int sector_blank(fr_log_t *log, uint32_t offset, uint32_t end)
+{
+    uint32_t buf[64];
+    while (offset < end)
+    {
+        uint32_t n = DL_IMAGE_MIN(end - offset, sizeof(buf));
+        if (ESP_OK != fr_partition_read(log->part, offset, buf, n))
+            return 0;
+        for (uint32_t i = 0; i < n / sizeof(uint32_t); i++)
+        {
+            if (0xFFFFFFFF != buf[i])
+                return 0;
+        }
+        offset += n;
+    }
+    return 1;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+    uint32_t ia = ((const fr_log_entry_t *)a)->id;
+    uint32_t ib = ((const fr_log_entry_t *)b)->id;
+    return (ia > ib) - (ia < ib);
+}
+
+/*
+ * Records of a batch seen by the recovery, waiting for the commit record.
+ */
+typedef struct
+{
+    fr_log_record_t *hdr; /*!< headers */
+    uint32_t *pos;        /*!< stream positions */
+    uint16_t count;       /*!< number of records */
+    uint16_t capacity;    /*!< allocated records */
+} fr_log_pending_t;
+
+static esp_err_t recover_apply(fr_log_t *log, fr_log_record_t *rhdr, uint32_t pos, uint16_t id_size)
+{
+    uint32_t total = RECORD_HDR + rhdr->len;
+    if (FR_LOG_ENROLL == rhdr->type)
+    {
+        // a later copy left by an interrupted compaction supersedes the earlier one
+        int i = entry_find_id(log, rhdr->id);
+        if (i >= 0)
+            log->entry[i].offset = pos;
+        else if (rhdr->len == ENROLL_NAME_LEN + id_size * sizeof(float))
+            return entry_push(log, rhdr->id, pos, total);
+        else
+            ESP_LOGW(TAG, "Record %u does not match id_size %d", rhdr->id, id_size);
+    }
+    else if (FR_LOG_DELETE == rhdr->type)
+    {
+        int i = entry_find_id(log, rhdr->id);
+        if (i >= 0)
+            entry_remove(log, i);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t recover_pending(fr_log_pending_t *pending, fr_log_record_t *rhdr, uint32_t pos)
+{
+    if (pending->count == pending->capacity)
+    {
+        uint16_t capacity = pending->capacity ? pending->capacity * 2 : 16;
+        fr_log_record_t *hdr = (fr_log_record_t *)dl_lib_calloc(capacity, sizeof(fr_log_record_t), 0);
+        uint32_t *p = (uint32_t *)dl_lib_calloc(capacity, sizeof(uint32_t), 0);
+        if ((NULL == hdr) || (NULL == p))
+        {
+            if (hdr)
+                dl_lib_free(hdr);
+            if (p)
+                dl_lib_free(p);
+            return ESP_ERR_NO_MEM;
+        }
+        if (pending->hdr)
+        {
+            memcpy(hdr, pending->hdr, pending->count * sizeof(fr_log_record_t));
+            memcpy(p, pending->pos, pending->count * sizeof(uint32_t));
+            dl_lib_free(pending->hdr);
+            dl_lib_free(pending->pos);
+        }
+        pending->hdr = hdr;
+        pending->pos = p;
+        pending->capacity = capacity;
+    }
+    pending->hdr[pending->count] = *rhdr;
+    pending->pos[pending->count] = pos;
+    pending->count++;
+    return ESP_OK;
+}
+
+/*
+ * Parse the records starting in sector s, returns the stream position after the last valid one.
+ * A record that can not be indexed sets err, the index would no longer match the log.
+ */
+static uint32_t recover_sector(fr_log_t *log, uint16_t s, fr_log_sector_t *shdr, uint16_t id_size, fr_log_pending_t *pending, esp_err_t *err)
+{
+    uint32_t end = sector_base(log, s) + sector_size(log);
+    if (FR_LOG_NO_RECORD == shdr->first_record)
+        return end;
+
+    uint32_t pos = sector_base(log, s) + shdr->first_record;
+    uint8_t *payload = (uint8_t *)dl_lib_calloc(1, ENROLL_NAME_LEN + id_size * sizeof(float), 0);
+    if (NULL == payload)
+    {
+        *err = ESP_ERR_NO_MEM;
+        return pos;
+    }
+    while ((pos < end) && (ESP_OK == *err))
+    {
+        fr_log_record_t rhdr;
+        if (ESP_OK != stream_read(log, pos, &rhdr, RECORD_HDR))
+            break;
+        if ((FR_LOG_RECORD_MAGIC != rhdr.magic) || (rhdr.len > ENROLL_NAME_LEN + id_size * sizeof(float)))
+            break;
+        if (ESP_OK != stream_read(log, stream_advance(log, pos, RECORD_HDR), payload, rhdr.len))
+            break;
+        uint32_t crc = fr_crc32(0, &rhdr, offsetof(fr_log_record_t, crc));
+        if (rhdr.crc != fr_crc32(crc, payload, rhdr.len))
+        {
+            ESP_LOGW(TAG, "Bad record at 0x%x", pos);
+            break;
+        }
+
+        uint32_t total = RECORD_HDR + rhdr.len;
+        log->next_seq = DL_IMAGE_MAX(log->next_seq, rhdr.seq + 1);
+        if (FR_LOG_ENROLL == rhdr.type)
+            log->next_id = DL_IMAGE_MAX(log->next_id, rhdr.id + 1);
+        log->used_bytes[s] += total;
+
+        if (FR_LOG_COMMIT == rhdr.type)
+        {
+            // records left by an older batch that never committed have a lower seq
+            for (int i = 0; (i < pending->count) && (ESP_OK == *err); i++)
+            {
+                if (pending->hdr[i].seq >= rhdr.id)
+                    *err = recover_apply(log, pending->hdr + i, pending->pos[i], id_size);
+            }
+            pending->count = 0;
+        }
+        else if (!(rhdr.flags & FR_LOG_FLAG_BATCH))
+            *err = recover_pending(pending, &rhdr, pos);
+        else
+            *err = recover_apply(log, &rhdr, pos, id_size);
+
+        pos = stream_advance(log, pos, total);
+        if (sector_of(log, pos) != s)
+            break;
+    }
+    dl_lib_free(payload);
+    return pos;
+}
+
+static esp_err_t list_append(face_id_name_list *l, const char *name, const fptp_t *vec)
+{
+    face_id_node *new_node = (face_id_node *)dl_lib_calloc(1, sizeof(face_id_node), 0);
+    if (NULL == new_node)
+        return ESP_ERR_NO_MEM;
+    new_node->next = NULL;
+    memcpy(new_node->id_name, name, ENROLL_NAME_LEN);
+    new_node->id_vec = dl_matrix3d_alloc(1, 1, 1, l->id_size);
+    if (NULL == new_node->id_vec)
+    {
+        dl_lib_free(new_node);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(new_node->id_vec->item, vec, l->id_size * sizeof(float));
+    if (NULL == l->head)
+        l->head = new_node;
+    else
+        l->tail->next = new_node;
+    l->tail = new_node;
+    l->count++;
+    return ESP_OK;
+}
+
+static esp_err_t recover(fr_log_t *log, face_id_name_list *l)
+{
+    uint16_t n = log->n_sectors;
+    fr_log_sector_t *shdr = (fr_log_sector_t *)dl_lib_calloc(n, sizeof(fr_log_sector_t), 0);
+    if (NULL == shdr)
+        return ESP_ERR_NO_MEM;
+
+    int head = -1;
+    for (uint16_t s = 0; s < n; s++)
+    {
+        fr_partition_read(log->part, sector_base(log, s), shdr + s, SECTOR_HDR);
+        if (sector_header_valid(shdr + s) && ((head < 0) || (shdr[s].seq > shdr[head].seq)))
+            head = s;
+    }
+
+    if (head < 0)
+    {
+        dl_lib_free(shdr);
+        ESP_LOGI(TAG, "No log found, format");
+        return format(log);
+    }
+
+    // walk back from the newest sector while the sequence numbers are contiguous
+    uint16_t tail = head;
+    for (int i = 1; i < n; i++)
+    {
+        uint16_t p = sector_prev(log, tail);
+        if ((p == head) || !sector_header_valid(shdr + p) || (shdr[p].seq + 1 != shdr[tail].seq))
+            break;
+        tail = p;
+    }
+    log->tail = tail;
+    log->head = head;
+    log->sector_seq = shdr[head].seq;
+    log->next_seq = 1;
+    log->next_id = 1;
+    log->count = 0;
+
+    uint32_t pos = 0;
+    esp_err_t ret = ESP_OK;
+    fr_log_pending_t pending = {0};
+    for (uint16_t s = tail;; s = sector_next(log, s))
+    {
+        pos = recover_sector(log, s, shdr + s, l->id_size, &pending, &ret);
+        if ((s == head) || (ESP_OK != ret))
+            break;
+    }
+    dl_lib_free(shdr);
+    if (pending.count && (ESP_OK == ret))
+        ESP_LOGW(TAG, "Dropped %d records of an uncommitted batch", pending.count);
+    if (pending.hdr)
+    {
+        dl_lib_free(pending.hdr);
+        dl_lib_free(pending.pos);
+    }
+    if (ESP_OK != ret)
+    {
+        // nothing is erased, the log is intact for a retry with more memory
+        ESP_LOGE(TAG, "Out of memory while indexing the log");
+        return ret;
+    }
+
+    // anything outside the chain is garbage, free sectors must be erased
+    for (uint16_t s = sector_next(log, head); s != tail; s = sector_next(log, s))
+    {
+        if (!sector_blank(log, sector_base(log, s), sector_base(log, s) + sector_size(log)))
+            sector_erase(log, s);
+    }
+
+    // bytes after the last valid record of the head may be torn, then continue in a fresh sector
+    uint32_t head_end = sector_base(log, head) + sector_size(log);
+    if ((sector_of(log, pos) != head) || !sector_blank(log, pos, head_end))
+        pos = head_end;
+    log->head_offset = pos;
+
+    if (log->count)
+        qsort(log->entry, log->count, sizeof(fr_log_entry_t), entry_cmp);
+
+    uint8_t *rec = (uint8_t *)dl_lib_calloc(1, RECORD_HDR + ENROLL_NAME_LEN + l->id_size * sizeof(float), 0);
+    if (NULL == rec)
+        return ESP_ERR_NO_MEM;
+    for (int i = 0; i < log->count; i++)
+    {
+        fr_log_entry_t *e = log->entry + i;
+        log->live_bytes[sector_of(log, e->offset)] += e->size;
+        stream_read(log, e->offset, rec, e->size);
+        if (ESP_OK != list_append(l, (const char *)rec + RECORD_HDR, (const fptp_t *)(rec + RECORD_HDR + ENROLL_NAME_LEN)))
+        {
+            dl_lib_free(rec);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    dl_lib_free(rec);
+
+    ESP_LOGI(TAG, "Recovered %d ids, sectors %d..%d, %u bytes free", log->count, log->tail, log->head, fr_log_free_bytes(log));
+    return ESP_OK;
+}
+
+esp_err_t fr_log_open(fr_log_t *log, fr_partition_t *part, face_id_name_list *l)
+{
+    memset(log, 0, sizeof(fr_log_t));
+    log->part = part;
+    log->n_sectors = part->size / part->sector_size;
+    if (log->n_sectors <= FR_LOG_RESERVE_SECTORS + 1)
+    {
+        ESP_LOGE(TAG, "Partition too small");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    log->used_bytes = (uint32_t *)dl_lib_calloc(log->n_sectors, sizeof(uint32_t), 0);
+    log->live_bytes = (uint32_t *)dl_lib_calloc(log->n_sectors, sizeof(uint32_t), 0);
+    log->lock = lock_create();
+    if ((NULL == log->used_bytes) || (NULL == log->live_bytes) || (NULL == log->lock))
+    {
+        fr_log_close(log);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = recover(log, l);
+    if (ESP_OK != ret)
+        fr_log_close(log);
+    return ret;
+}
+
+void fr_log_close(fr_log_t *log)
+{
+    if (log->used_bytes)
+        dl_lib_free(log->used_bytes);
+    if (log->live_bytes)
+        dl_lib_free(log->live_bytes);
+    if (log->entry)
+        dl_lib_free(log->entry);
+    if (log->lock)
+        lock_delete(log->lock);
+    log->lock = NULL;
+    log->used_bytes = NULL;
+    log->live_bytes = NULL;
+    log->entry = NULL;
+    log->count = 0;
+    log->capacity = 0;
+}
+
+static void list_remove_at(face_id_name_list *l, int index)
+{
+    face_id_node *p = NULL;
+    face_id_node *q = l->head;
+    for (int i = 0; i < index; i++)
+    {
+        p = q;
+        q = q->next;
+    }
+    if (p)
+        p->next = q->next;
+    else
+        l->head = q->next;
+    if (q == l->tail)
+        l->tail = p;
+    dl_matrix3d_free(q->id_vec);
+    dl_lib_free(q);
+    l->count--;
+}
+
+/*
+ * Keep the list in step with the entries when the record could not be written.
+ */
+static void list_drop_tail(face_id_name_list *l)
+{
+    face_id_node *tail = l->tail;
+    face_id_node *p = l->head;
+    if (p == tail)
+    {
+        l->head = NULL;
+        l->tail = NULL;
+    }
+    else
+    {
+        while (p->next != tail)
+            p = p->next;
+        p->next = NULL;
+        l->tail = p;
+    }
+    dl_matrix3d_free(tail->id_vec);
+    dl_lib_free(tail);
+    l->count--;
+}
+
+static int8_t log_enroll(fr_log_t *log, face_id_name_list *l, dl_matrix3d_t *new_id, char *name)
+{
+    int8_t left_sample = enroll_face_with_name(l, new_id, name);
+    if (left_sample)
+        return left_sample;
+
+    uint16_t len = ENROLL_NAME_LEN + l->id_size * sizeof(float);
+    uint8_t *payload = (uint8_t *)dl_lib_calloc(1, len, 0);
+    if (NULL == payload)
+    {
+        list_drop_tail(l);
+        return -2;
+    }
+    memcpy(payload, l->tail->id_name, ENROLL_NAME_LEN);
+    memcpy(payload + ENROLL_NAME_LEN, l->tail->id_vec->item, l->id_size * sizeof(float));
+
+    uint32_t start = 0;
+    uint32_t id = log->next_id;
+    esp_err_t ret = record_append(log, FR_LOG_ENROLL, id, payload, len, &start);
+    dl_lib_free(payload);
+    if ((ESP_OK != ret) || (ESP_OK != entry_push(log, id, start, RECORD_HDR + len)))
+    {
+        ESP_LOGE(TAG, "Log is full");
+        list_drop_tail(l);
+        return -2;
+    }
+    log->next_id++;
+    log->live_bytes[sector_of(log, start)] += RECORD_HDR + len;
+    return 0;
+}
+
+static int list_find_name(face_id_name_list *l, const char *name)
+{
+    face_id_node *p = l->head;
+    for (int i = 0; i < l->count; i++, p = p->next)
+    {
+        if (0 == strcmp(p->id_name, name))
+            return i;
+    }
+    return -1;
+}
+
+static int log_delete(fr_log_t *log, face_id_name_list *l, char *name)
+{
+    int index = list_find_name(l, name);
+    if (index < 0)
+        return -3;
+
+    // the tombstone goes first, the id stays in the list if it cannot be written
+    uint32_t start = 0;
+    if (ESP_OK != record_append(log, FR_LOG_DELETE, log->entry[index].id, NULL, 0, &start))
+    {
+        ESP_LOGE(TAG, "Log is full");
+        return -2;
+    }
+
+    // making room may have moved the record, so look at the entry only now
+    fr_log_entry_t e = log->entry[index];
+    list_remove_at(l, index);
+    entry_remove(log, index);
+    log->live_bytes[sector_of(log, e.offset)] -= e.size;
+    return l->count;
+}
+
+int8_t fr_log_enroll_with_name(fr_log_t *log, face_id_name_list *l, dl_matrix3d_t *new_id, char *name)
+{
+    log_lock(log);
+    int8_t ret = log_enroll(log, l, new_id, name);
+    log_unlock(log);
+    return ret;
+}
+
+int fr_log_delete_with_name(fr_log_t *log, face_id_name_list *l, char *name)
+{
+    log_lock(log);
+    int ret = log_delete(log, l, name);
+    log_unlock(log);
+    return ret;
+}
+
+void fr_log_delete_all_with_name(fr_log_t *log, face_id_name_list *l)
+{
+    log_lock(log);
+    delete_face_all_with_name(l);
+    format(log);
+    log_unlock(log);
+}
+
+static esp_err_t batch_grow(fr_log_batch_t *b)
+{
+    uint16_t capacity = b->capacity ? b->capacity * 2 : 16;
+    uint16_t n = b->n_existing + b->n_staged;
+    char *name = (char *)dl_lib_calloc(b->n_existing + capacity, ENROLL_NAME_LEN, 0);
+    uint8_t *alive = (uint8_t *)dl_lib_calloc(b->n_existing + capacity, 1, 0);
+    fptp_t *vec = (fptp_t *)dl_lib_calloc(capacity * b->l->id_size, sizeof(fptp_t), 0);
+    if ((NULL == name) || (NULL == alive) || (NULL == vec))
+    {
+        if (name)
+            dl_lib_free(name);
+        if (alive)
+            dl_lib_free(alive);
+        if (vec)
+            dl_lib_free(vec);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (b->name)
+    {
+        memcpy(name, b->name, n * ENROLL_NAME_LEN);
+        memcpy(alive, b->alive, n);
+        memcpy(vec, b->vec, b->n_staged * b->l->id_size * sizeof(fptp_t));
+        fr_log_batch_abort(b);
+    }
+    b->name = name;
+    b->alive = alive;
+    b->vec = vec;
+    b->capacity = capacity;
+    return ESP_OK;
+}
+
+esp_err_t fr_log_batch_begin(fr_log_batch_t *b, fr_log_t *log, face_id_name_list *l)
+{
+    memset(b, 0, sizeof(fr_log_batch_t));
+    b->log = log;
+    b->l = l;
+    b->n_existing = l->count;
+    b->n_alive = l->count;
+    esp_err_t ret = batch_grow(b);
+    if (ESP_OK != ret)
+        return ret;
+
+    face_id_node *p = l->head;
+    for (int i = 0; i < b->n_existing; i++, p = p->next)
+    {
+        memcpy(b->name + i * ENROLL_NAME_LEN, p->id_name, ENROLL_NAME_LEN);
+        b->alive[i] = 1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t fr_log_batch_enroll(fr_log_batch_t *b, dl_matrix3d_t *face_id, const char *name)
+{
+    if (b->n_alive >= UINT8_MAX)
+        return ESP_ERR_NO_MEM;
+    if ((b->n_staged == b->capacity) && (ESP_OK != batch_grow(b)))
+        return ESP_ERR_NO_MEM;
+
+    int i = b->n_existing + b->n_staged;
+    strncpy(b->name + i * ENROLL_NAME_LEN, name, ENROLL_NAME_LEN - 1);
+    b->alive[i] = 1;
+    memcpy(b->vec + b->n_staged * b->l->id_size, face_id->item, b->l->id_size * sizeof(fptp_t));
+    b->n_staged++;
+    b->n_alive++;
+    return ESP_OK;
+}
+
+int fr_log_batch_delete(fr_log_batch_t *b, const char *name)
+{
+    for (int i = 0; i < b->n_existing + b->n_staged; i++)
+    {
+        if (b->alive[i] && (0 == strcmp(b->name + i * ENROLL_NAME_LEN, name)))
+        {
+            b->alive[i] = 0;
+            b->n_alive--;
+            return b->n_alive;
+        }
+    }
+    return -3;
+}
+
+static esp_err_t batch_commit(fr_log_batch_t *b)
+{
+    fr_log_t *log = b->log;
+    face_id_name_list *l = b->l;
+    uint16_t len = ENROLL_NAME_LEN + l->id_size * sizeof(float);
+
+    // tombstones of the deleted ids, the staged ids still alive, and the commit record
+    int n = 1;
+    int n_new = 0;
+    uint32_t total = RECORD_HDR;
+    for (int i = 0; i < b->n_existing + b->n_staged; i++)
+    {
+        if ((i < b->n_existing) != (0 != b->alive[i]))
+        {
+            n++;
+            n_new += (i >= b->n_existing);
+            total += RECORD_HDR + (b->alive[i] ? len : 0);
+        }
+    }
+
+    // entries and nodes of the staged ids are allocated up front, once written the batch must not fail
+    face_id_name_list staged = *l;
+    staged.head = NULL;
+    staged.tail = NULL;
+    staged.count = 0;
+    esp_err_t ret = entry_reserve(log, n_new);
+    for (int j = 0; (j < b->n_staged) && (ESP_OK == ret); j++)
+    {
+        if (b->alive[b->n_existing + j])
+            ret = list_append(&staged, b->name + (b->n_existing + j) * ENROLL_NAME_LEN, b->vec + j * l->id_size);
+    }
+    if (ESP_OK == ret)
+        ret = make_room(log, total);
+    uint8_t *buf = (uint8_t *)dl_lib_calloc(1, total, 0);
+    uint32_t *rec = (uint32_t *)dl_lib_calloc(n, sizeof(uint32_t), 0);
+    uint32_t *pos = (uint32_t *)dl_lib_calloc(n, sizeof(uint32_t), 0);
+    if ((NULL == buf) || (NULL == rec) || (NULL == pos))
+        ret = ESP_ERR_NO_MEM;
+
+    if (ESP_OK == ret)
+    {
+        uint32_t first_seq = log->next_seq;
+        uint32_t off = 0;
+        int k = 0;
+        for (int i = 0; i < b->n_existing; i++)
+        {
+            if (b->alive[i])
+                continue;
+            rec[k++] = off;
+            record_seal(log, buf + off, FR_LOG_DELETE, 0xFF & ~FR_LOG_FLAG_BATCH, log->entry[i].id, 0);
+            off += RECORD_HDR;
+        }
+        uint32_t id = log->next_id;
+        for (int j = 0; j < b->n_staged; j++)
+        {
+            if (!b->alive[b->n_existing + j])
+                continue;
+            rec[k++] = off;
+            memcpy(buf + off + RECORD_HDR, b->name + (b->n_existing + j) * ENROLL_NAME_LEN, ENROLL_NAME_LEN);
+            memcpy(buf + off + RECORD_HDR + ENROLL_NAME_LEN, b->vec + j * l->id_size, l->id_size * sizeof(float));
+            record_seal(log, buf + off, FR_LOG_ENROLL, 0xFF & ~FR_LOG_FLAG_BATCH, id++, len);
+            off += RECORD_HDR + len;
+        }
+        rec[k] = off;
+        record_seal(log, buf + off, FR_LOG_COMMIT, 0xFF, first_seq, 0);
+
+        ret = stream_append(log, buf, total, rec, n, pos);
+    }
+
+    if (ESP_OK == ret)
+    {
+        for (int k = 0; k < n; k++)
+        {
+            uint32_t end = (k + 1 < n) ? rec[k + 1] : total;
+            log->used_bytes[sector_of(log, pos[k])] += end - rec[k];
+        }
+
+        int k = 0;
+        for (int i = b->n_existing - 1; i >= 0; i--)
+        {
+            if (b->alive[i])
+                continue;
+            k++;
+            list_remove_at(l, i);
+            log->live_bytes[sector_of(log, log->entry[i].offset)] -= log->entry[i].size;
+            entry_remove(log, i);
+        }
+        for (; k < n - 1; k++)
+        {
+            entry_push(log, log->next_id, pos[k], RECORD_HDR + len);
+            log->live_bytes[sector_of(log, pos[k])] += RECORD_HDR + len;
+            log->next_id++;
+        }
+        if (staged.count)
+        {
+            if (l->tail)
+                l->tail->next = staged.head;
+            else
+                l->head = staged.head;
+            l->tail = staged.tail;
+            l->count += staged.count;
+        }
+        ESP_LOGI(TAG, "Committed %d records, %u bytes", n, total);
+    }
+    else
+    {
+        while (staged.count)
+            list_drop_tail(&staged);
+        ESP_LOGE(TAG, "Batch not committed");
+    }
+
+    if (buf)
+        dl_lib_free(buf);
+    if (rec)
+        dl_lib_free(rec);
+    if (pos)
+        dl_lib_free(pos);
+    fr_log_batch_abort(b);
+    return ret;
+}
+
+esp_err_t fr_log_batch_commit(fr_log_batch_t *b)
+{
+    fr_log_t *log = b->log;
+    log_lock(log);
+    esp_err_t ret = batch_commit(b);
+    log_unlock(log);
+    return ret;
+}
+
+void fr_log_batch_abort(fr_log_batch_t *b)
+{
+    if (b->name)
+        dl_lib_free(b->name);
+    if (b->alive)
+        dl_lib_free(b->alive);
+    if (b->vec)
+        dl_lib_free(b->vec);
+    b->name = NULL;
+    b->alive = NULL;
+    b->vec = NULL;
+}
@@ -0,0 +1,610 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+#include "fr_flash_v2.h"
+
+static const char *TAG = "fr_flash_v2";
+
+#define ALIGN4(x) (((x) + 3) & ~3)
+
+/*
+ * Where the ids come from when saving, and where they go when loading, for both kinds of list.
+ * An id is reached through an opaque iterator, so a whole list is walked in one pass.
+ */
+typedef struct
+{
+    void *l;                           /*!< the list */
+    uint16_t count;                    /*!< ids to save */
+    uint16_t capacity;                 /*!< ids the list can take */
+    uint16_t id_size;                  /*!< length of a face id */
+    fr_model_t model;                  /*!< model of the list */
+    void *(*next)(void *l, void *it);  /*!< id after it, the first id for NULL */
+    char *(*name)(void *it);           /*!< name of an id, NULL for a list without names */
+    fptp_t *(*vec)(void *l, void *it); /*!< vector of an id */
+    void *(*add)(void *l);             /*!< append an id, NULL when out of memory */
+    void (*clear)(void *l);            /*!< drop the ids of the list */
+} fr_flash_v2_list_t;
+
+static uint16_t f32_to_f16(float f)
+{
+    union
+    {
+        float f;
+        uint32_t u;
+    } v = {f};
+    uint32_t sign = (v.u >> 16) & 0x8000;
+    int32_t exp = (int32_t)((v.u >> 23) & 0xFF) - 127 + 15;
+    uint32_t man = v.u & 0x7FFFFF;
+
+    if (0xFF == ((v.u >> 23) & 0xFF))
+        return sign | 0x7C00 | (man ? 0x200 : 0);
+    if (exp >= 31)
+        return sign | 0x7C00;
+    if (exp <= 0)
+    {
+        if (exp < -10)
+            return sign;
+        man |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint32_t half = man >> shift;
+        uint32_t rem = man & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if ((rem > mid) || ((rem == mid) && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    // round to nearest even, a carry moves into the exponent as it should
+    uint32_t half = ((uint32_t)exp << 10) | (man >> 13);
+    uint32_t rem = man & 0x1FFF;
+    if ((rem > 0x1000) || ((rem == 0x1000) && (half & 1)))
+        half++;
+    return sign | half;
+}
+
+static float f16_to_f32(uint16_t h)
+{
+    union
+    {
+        uint32_t u;
+        float f;
+    } v;
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t man = h & 0x3FF;
+
+    if (0 == exp)
+    {
+        float f = man * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+    if (31 == exp)
+        v.u = sign | 0x7F800000 | (man << 13);
+    else
+        v.u = sign | ((exp + 112) << 23) | (man << 13);
+    return v.f;
+}
+
+static uint16_t vector_stride(uint16_t dim, uint8_t dtype)
+{
+    switch (dtype)
+    {
+    case FR_FLASH_F16:
+        return ALIGN4(dim * sizeof(uint16_t));
+    case FR_FLASH_I8:
+        return sizeof(float) + ALIGN4(dim);
+    default:
+        return dim * sizeof(float);
+    }
+}
+
+static void vector_encode(uint8_t *dst, const fptp_t *vec, uint16_t dim, uint8_t dtype)
+{
+    memset(dst, 0, vector_stride(dim, dtype));
+    if (FR_FLASH_F16 == dtype)
+    {
+        uint16_t *d = (uint16_t *)dst;
+        for (int i = 0; i < dim; i++)
+            d[i] = f32_to_f16(vec[i]);
+    }
+    else if (FR_FLASH_I8 == dtype)
+    {
+        // symmetric, one scale per vector
+        float max = 0;
+        for (int i = 0; i < dim; i++)
+            max = DL_IMAGE_MAX(max, fabsf(vec[i]));
+        float scale = max / 127;
+        float inv = max > 0 ? 127 / max : 0;
+        int8_t *d = (int8_t *)(dst + sizeof(float));
+        memcpy(dst, &scale, sizeof(float));
+        for (int i = 0; i < dim; i++)
+            d[i] = (int8_t)lrintf(vec[i] * inv);
+    }
+    else
+        memcpy(dst, vec, dim * sizeof(float));
+}
+
+static void vector_decode(fptp_t *vec, const uint8_t *src, uint16_t dim, uint8_t dtype)
+{
+    if (FR_FLASH_F16 == dtype)
+    {
+        const uint16_t *s = (const uint16_t *)src;
+        for (int i = 0; i < dim; i++)
+            vec[i] = f16_to_f32(s[i]);
+    }
+    else if (FR_FLASH_I8 == dtype)
+    {
+        float scale;
+        const int8_t *s = (const int8_t *)(src + sizeof(float));
+        memcpy(&scale, src, sizeof(float));
+        for (int i = 0; i < dim; i++)
+            vec[i] = s[i] * scale;
+    }
+    else
+        memcpy(vec, src, dim * sizeof(float));
+}
+
+static uint32_t slot_size(fr_partition_t *p)
+{
+    return p->size / 2 / p->sector_size * p->sector_size;
+}
+
+static int header_valid(fr_partition_t *p, uint32_t base, fr_flash_v2_header_t *hdr)
+{
+    if (ESP_OK != fr_partition_read(p, base, hdr, sizeof(fr_flash_v2_header_t)))
+        return 0;
+    if ((FR_FLASH_V2_MAGIC != hdr->magic) || (FR_FLASH_V2_VERSION != hdr->version) ||
+        (sizeof(fr_flash_v2_header_t) != hdr->header_size) ||
+        (hdr->header_crc != fr_crc32(0, hdr, offsetof(fr_flash_v2_header_t, header_crc))))
+        return 0;
+    if ((hdr->stride != vector_stride(hdr->dim, hdr->dtype)) || (hdr->name_offset < hdr->header_size) ||
+        (hdr->vec_offset < hdr->name_offset) || (hdr->vec_offset + hdr->count * hdr->stride > slot_size(p)))
+        return 0;
+    return 1;
+}
+
+/*
+ * Valid headers of both slots, the newest first. Returns how many there are.
+ */
+static int slots_find(fr_partition_t *p, fr_flash_v2_header_t hdr[2], uint32_t base[2])
+{
+    fr_flash_v2_header_t h[2];
+    int valid[2];
+    for (int s = 0; s < 2; s++)
+        valid[s] = header_valid(p, s * slot_size(p), h + s);
+
+    int n = 0;
+    int first = (valid[0] && valid[1]) ? (h[1].generation > h[0].generation) : !valid[0];
+    for (int k = 0; k < 2; k++)
+    {
+        int s = k ? !first : first;
+        if (valid[s])
+        {
+            hdr[n] = h[s];
+            base[n] = s * slot_size(p);
+            n++;
+        }
+    }
+    return n;
+}
+
+static int legacy_present(fr_partition_t *p)
+{
+    int flash_info_flag = 0;
+    fr_partition_read(p, 0, &flash_info_flag, sizeof(int));
+    return FR_FLASH_INFO_FLAG == flash_info_flag;
+}
+
+/*
+ * Buffered sequential writer, keeps the crc of what went through it.
+ * With cmp set nothing is written, the data is compared with what the partition already holds.
+ */
+typedef struct
+{
+    fr_partition_t *p;
+    uint32_t offset;
+    uint8_t *buf;
+    uint32_t fill;
+    uint32_t crc;
+    esp_err_t ret;
+    uint8_t *cmp;
+    int same;
+} fr_flash_v2_writer_t;
+
+static void writer_flush(fr_flash_v2_writer_t *w)
+{
+    if (w->cmp)
+    {
+        if (w->fill && w->same)
+            w->same = (ESP_OK == fr_partition_read(w->p, w->offset, w->cmp, w->fill)) && !memcmp(w->cmp, w->buf, w->fill);
+    }
+    else if (w->fill && (ESP_OK == w->ret))
+        w->ret = fr_partition_write(w->p, w->offset, w->buf, w->fill);
+    w->crc = fr_crc32(w->crc, w->buf, w->fill);
+    w->offset += w->fill;
+    w->fill = 0;
+}
+
+static void writer_put(fr_flash_v2_writer_t *w, const void *data, uint32_t len)
+{
+    const uint8_t *d = (const uint8_t *)data;
+    while (len)
+    {
+        uint32_t n = DL_IMAGE_MIN(len, w->p->sector_size - w->fill);
+        memcpy(w->buf + w->fill, d, n);
+        w->fill += n;
+        d += n;
+        len -= n;
+        if (w->fill == w->p->sector_size)
+            writer_flush(w);
+    }
+}
+
+/*
+ * Put the name table and the vectors of an image through the writer.
+ */
+static void image_put(fr_flash_v2_writer_t *w, fr_flash_v2_list_t *src, const fr_flash_v2_header_t *hdr, uint8_t *vec)
+{
+    uint32_t name_len = 0;
+    void *it = NULL;
+    for (int i = 0; src->name && (i < src->count); i++)
+    {
+        it = src->next(src->l, it);
+        const char *name = src->name(it);
+        name_len += strlen(name) + 1;
+        writer_put(w, name, strlen(name) + 1);
+    }
+    uint32_t zero = 0;
+    writer_put(w, &zero, hdr->vec_offset - hdr->name_offset - name_len);
+    it = NULL;
+    for (int i = 0; (i < src->count) && (ESP_OK == w->ret) && ((NULL == w->cmp) || w->same); i++)
+    {
+        it = src->next(src->l, it);
+        vector_encode(vec, src->vec(src->l, it), hdr->dim, hdr->dtype);
+        writer_put(w, vec, hdr->stride);
+    }
+    writer_flush(w);
+}
+
+/*
+ * Whether the image at base holds what image_put would write, so a save can be skipped.
+ */
+static int image_same(fr_partition_t *p, uint32_t base, const fr_flash_v2_header_t *old, fr_flash_v2_list_t *src,
+                      const fr_flash_v2_header_t *hdr, uint8_t *vec, uint8_t *buf)
+{
+    if ((old->dim != hdr->dim) || (old->count != hdr->count) || (old->dtype != hdr->dtype) ||
+        (old->flags != hdr->flags) || (old->model != hdr->model) || (old->vec_offset != hdr->vec_offset))
+        return 0;
+
+    uint8_t *cmp = (uint8_t *)dl_lib_calloc(1, p->sector_size, 0);
+    if (NULL == cmp)
+        return 0;
+    fr_flash_v2_writer_t w = {p, base + hdr->name_offset, buf, 0, 0, ESP_OK, cmp, 1};
+    image_put(&w, src, hdr, vec);
+    dl_lib_free(cmp);
+    return w.same && (w.crc == old->data_crc);
+}
+
+static esp_err_t image_save(fr_flash_v2_list_t *src, fr_flash_dtype_t dtype)
+{
+    fr_partition_t *p = fr_flash_get_partition();
+    if (NULL == p)
+    {
+        ESP_LOGE(TAG, "Not found");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    fr_flash_v2_header_t hdr;
+    memset(&hdr, 0xFF, sizeof(hdr));
+    hdr.magic = FR_FLASH_V2_MAGIC;
+    hdr.version = FR_FLASH_V2_VERSION;
+    hdr.header_size = sizeof(fr_flash_v2_header_t);
+    hdr.dim = src->id_size;
+    hdr.count = src->count;
+    hdr.dtype = dtype;
+    hdr.stride = vector_stride(hdr.dim, dtype);
+    hdr.flags = src->name ? FR_FLASH_V2_NAMES : 0;
+    hdr.model = src->model;
+
+    uint32_t name_len = 0;
+    void *it = NULL;
+    for (int i = 0; src->name && (i < src->count); i++)
+    {
+        it = src->next(src->l, it);
+        name_len += strlen(src->name(it)) + 1;
+    }
+    hdr.name_offset = sizeof(fr_flash_v2_header_t);
+    hdr.vec_offset = ALIGN4(hdr.name_offset + name_len);
+    uint32_t total = hdr.vec_offset + hdr.count * hdr.stride;
+    if (total > slot_size(p))
+    {
+        ESP_LOGE(TAG, "%u bytes do not fit in a slot", total);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // write over the older image, or next to a partition of the old layout
+    fr_flash_v2_header_t found[2];
+    uint32_t found_base[2];
+    uint32_t base = 0;
+    int n_found = slots_find(p, found, found_base);
+    hdr.generation = 1;
+    if (n_found)
+    {
+        base = found_base[0] ? 0 : slot_size(p);
+        hdr.generation = found[0].generation + 1;
+    }
+    else if (legacy_present(p))
+    {
+        // the old layout keeps a slot per id, of a ring of capacity ids for a list without names
+        base = slot_size(p);
+        uint32_t legacy_end = 4096 + (src->name ? src->count : src->capacity) * FACE_ID_SIZE * sizeof(float);
+        if (legacy_end > base)
+        {
+            ESP_LOGE(TAG, "The old layout takes %u bytes, more than half of the partition", legacy_end);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    uint8_t *vec = (uint8_t *)dl_lib_calloc(1, hdr.stride, 0);
+    uint8_t *buf = (uint8_t *)dl_lib_calloc(1, p->sector_size, 0);
+    if ((NULL == vec) || (NULL == buf))
+    {
+        if (vec)
+            dl_lib_free(vec);
+        if (buf)
+            dl_lib_free(buf);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // saving what the newest image already holds would only wear the other slot
+    if (n_found && image_same(p, found_base[0], found, src, &hdr, vec, buf))
+    {
+        dl_lib_free(vec);
+        dl_lib_free(buf);
+        ESP_LOGI(TAG, "%d ids unchanged, generation %u kept", hdr.count, found[0].generation);
+        return ESP_OK;
+    }
+
+    fr_flash_v2_writer_t w = {p, base + hdr.name_offset, buf, 0, 0, ESP_OK, NULL, 0};
+    w.ret = fr_partition_erase(p, base, (total + p->sector_size - 1) / p->sector_size * p->sector_size);
+    image_put(&w, src, &hdr, vec);
+    dl_lib_free(vec);
+    dl_lib_free(buf);
+
+    // the header goes last, an image cut short is never valid
+    hdr.data_crc = w.crc;
+    hdr.header_crc = fr_crc32(0, &hdr, offsetof(fr_flash_v2_header_t, header_crc));
+    if (ESP_OK == w.ret)
+        w.ret = fr_partition_write(p, base, &hdr, sizeof(hdr));
+    if (ESP_OK != w.ret)
+        return w.ret;
+
+    ESP_LOGI(TAG, "Saved %d ids, %u bytes, generation %u", hdr.count, total, hdr.generation);
+    return ESP_OK;
+}
+
+static int image_load(fr_partition_t *p, uint32_t base, fr_flash_v2_header_t *hdr, fr_flash_v2_list_t *dst)
+{
+    if ((hdr->dim != dst->id_size) || (hdr->model != dst->model) || (hdr->count > dst->capacity) ||
+        (dst->name && !(hdr->flags & FR_FLASH_V2_NAMES)))
+    {
+        ESP_LOGE(TAG, "Image of %d ids of model %d, dim %d does not match the list", hdr->count, hdr->model, hdr->dim);
+        return -3;
+    }
+
+    uint32_t name_len = hdr->vec_offset - hdr->name_offset;
+    uint32_t chunk = DL_IMAGE_MAX(1, p->sector_size / hdr->stride) * hdr->stride;
+    char *name = (char *)dl_lib_calloc(1, name_len + 1, 0);
+    uint8_t *buf = (uint8_t *)dl_lib_calloc(1, chunk, 0);
+    if ((NULL == name) || (NULL == buf))
+    {
+        if (name)
+            dl_lib_free(name);
+        if (buf)
+            dl_lib_free(buf);
+        return -2;
+    }
+
+    esp_err_t ret = fr_partition_read(p, base + hdr->name_offset, name, name_len);
+    uint32_t crc = fr_crc32(0, name, name_len);
+
+    const char *n = name;
+    uint32_t offset = base + hdr->vec_offset;
+    for (int i = 0; (i < hdr->count) && (ESP_OK == ret); i++)
+    {
+        uint32_t in_chunk = i % (chunk / hdr->stride);
+        if (0 == in_chunk)
+        {
+            uint32_t len = DL_IMAGE_MIN(chunk, (hdr->count - i) * hdr->stride);
+            ret = fr_partition_read(p, offset, buf, len);
+            crc = fr_crc32(crc, buf, len);
+            offset += len;
+        }
+
+        const char *id_name = "";
+        if (hdr->flags & FR_FLASH_V2_NAMES)
+        {
+            size_t len = strnlen(n, name + name_len - n);
+            if ((len >= ENROLL_NAME_LEN) || (n + len >= name + name_len))
+            {
+                ret = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            id_name = n;
+            n += len + 1;
+        }
+        void *it = dst->add(dst->l);
+        if (NULL == it)
+        {
+            ret = ESP_ERR_NO_MEM;
+            break;
+        }
+        if (dst->name)
+            strncpy(dst->name(it), id_name, ENROLL_NAME_LEN - 1);
+        vector_decode(dst->vec(dst->l, it), buf + in_chunk * hdr->stride, hdr->dim, hdr->dtype);
+    }
+    dl_lib_free(name);
+    dl_lib_free(buf);
+
+    if ((ESP_OK != ret) || (crc != hdr->data_crc))
+    {
+        ESP_LOGE(TAG, "Image at 0x%x is corrupt", base);
+        dst->clear(dst->l);
+        return -2;
+    }
+    return hdr->count;
+}
+
+static int load(fr_flash_v2_list_t *dst, fr_flash_dtype_t dtype, int (*legacy)(void *l), esp_err_t (*save)(void *l, fr_flash_dtype_t dtype))
+{
+    fr_partition_t *p = fr_flash_get_partition();
+    if (NULL == p)
+    {
+        ESP_LOGE(TAG, "Not found");
+        return -1;
+    }
+
+    fr_flash_v2_header_t hdr[2];
+    uint32_t base[2];
+    int n = slots_find(p, hdr, base);
+    int ret = -2;
+    for (int s = 0; (s < n) && (-2 == ret); s++)
+        ret = image_load(p, base[s], hdr + s, dst);
+    if ((-2 != ret) || !legacy_present(p))
+        return ret;
+
+    ret = legacy(dst->l);
+    if (ret < 0)
+        return ret;
+    ESP_LOGI(TAG, "Migrating %d ids of the old layout", ret);
+    if (ESP_OK != save(dst->l, dtype))
+        ESP_LOGE(TAG, "Migration failed, the old layout is kept");
+    return ret;
+}
+
+static void *name_list_next(void *l, void *it)
+{
+    return it ? ((face_id_node *)it)->next : ((face_id_name_list *)l)->head;
+}
+
+static char *name_list_name(void *it)
+{
+    return ((face_id_node *)it)->id_name;
+}
+
+static fptp_t *name_list_vec(void *l, void *it)
+{
+    return ((face_id_node *)it)->id_vec->item;
+}
+
+static void *name_list_add(void *l)
+{
+    face_id_name_list *list = (face_id_name_list *)l;
+    face_id_node *new_node = (face_id_node *)dl_lib_calloc(1, sizeof(face_id_node), 0);
+    if (NULL == new_node)
+        return NULL;
+    new_node->id_vec = dl_matrix3d_alloc(1, 1, 1, list->id_size);
+    if (NULL == new_node->id_vec)
+    {
+        dl_lib_free(new_node);
+        return NULL;
+    }
+    if (NULL == list->head)
+        list->head = new_node;
+    else
+        list->tail->next = new_node;
+    list->tail = new_node;
+    list->count++;
+    return new_node;
+}
+
+static void name_list_clear(void *l)
+{
+    delete_face_all_with_name((face_id_name_list *)l);
+}
+
+/*
+ * An id of a face_id_list is its entry in id_list.
+ */
+static void *list_next(void *l, void *it)
+{
+    face_id_list *list = (face_id_list *)l;
+    if (NULL == it)
+        return list->id_list + list->head;
+    return list->id_list + ((dl_matrix3d_t **)it - list->id_list + 1) % list->size;
+}
+
+static fptp_t *list_vec(void *l, void *it)
+{
+    return (*(dl_matrix3d_t **)it)->item;
+}
+
+static void *list_add(void *l)
+{
+    face_id_list *list = (face_id_list *)l;
+    dl_matrix3d_t *id = dl_matrix3d_alloc(1, 1, 1, list->id_size);
+    if (NULL == id)
+        return NULL;
+    dl_matrix3d_t **it = list->id_list + list->tail;
+    *it = id;
+    list->tail = (list->tail + 1) % list->size;
+    list->count++;
+    return it;
+}
+
+static void list_clear(void *l)
+{
+    face_id_list *list = (face_id_list *)l;
+    while (list->count)
+        delete_face(list);
+    list->head = 0;
+    list->tail = 0;
+}
+
+static esp_err_t list_save(void *l, fr_flash_dtype_t dtype)
+{
+    return fr_flash_v2_save((face_id_list *)l, dtype);
+}
+
+static esp_err_t name_list_save(void *l, fr_flash_dtype_t dtype)
+{
+    return fr_flash_v2_save_with_name((face_id_name_list *)l, dtype);
+}
+
+static int list_legacy(void *l)
+{
+    return read_face_id_from_flash((face_id_list *)l);
+}
+
+static int name_list_legacy(void *l)
+{
+    return read_face_id_from_flash_with_name((face_id_name_list *)l);
+}
+
+esp_err_t fr_flash_v2_save(face_id_list *l, fr_flash_dtype_t dtype)
+{
+    fr_flash_v2_list_t src = {l, l->count, l->size, l->id_size, l->model, list_next, NULL, list_vec, list_add, list_clear};
+    return image_save(&src, dtype);
+}
+
+esp_err_t fr_flash_v2_save_with_name(face_id_name_list *l, fr_flash_dtype_t dtype)
+{
+    fr_flash_v2_list_t src = {l, l->count, UINT8_MAX, l->id_size, l->model, name_list_next, name_list_name, name_list_vec, name_list_add, name_list_clear};
+    return image_save(&src, dtype);
+}
+
+int fr_flash_v2_load(face_id_list *l, fr_flash_dtype_t dtype)
+{
+    fr_flash_v2_list_t dst = {l, 0, l->size, l->id_size, l->model, list_next, NULL, list_vec, list_add, list_clear};
+    list_clear(l);
+    return load(&dst, dtype, list_legacy, list_save);
+}
+
+int fr_flash_v2_load_with_name(face_id_name_list *l, fr_flash_dtype_t dtype)
+{
+    fr_flash_v2_list_t dst = {l, 0, UINT8_MAX, l->id_size, l->model, name_list_next, name_list_name, name_list_vec, name_list_add, name_list_clear};
+    name_list_clear(l);
+    return load(&dst, dtype, name_list_legacy, name_list_save);
+}
@@ -12,6 +12,32 @@ static const char *TAG = "face_recognition";
 static float dst_ldk_x[5] = {19.1473,36.7659,28.0126,20.77465,35.36495};
 static float dst_ldk_y[5] = {25.84815,25.7507,35.8683,46.18275,46.10205};
 
+// Every entry drags the weights of its model into the image, so only the configured ones are filled
+static const fr_model_info_t fr_model_registry[FR_MODEL_MAX] = {
+#if CONFIG_FRMN || CONFIG_FR_REGISTRY_FRMN
+    [FR_MODEL_FRMN] = {"FRMN", frmn_q, FACE_ID_SIZE},
+#endif
+#if CONFIG_MFN56_1X || CONFIG_FR_REGISTRY_MFN56_1X
+    [FR_MODEL_MFN56_1X] = {"MFN56_1X", mfn56_42m_q, FACE_ID_SIZE},
+#endif
+#if CONFIG_MFN56_2X || CONFIG_FR_REGISTRY_MFN56_2X
+    [FR_MODEL_MFN56_2X] = {"MFN56_2X", mfn56_72m_q, FACE_ID_SIZE},
+#endif
+#if CONFIG_MFN56_3X || CONFIG_FR_REGISTRY_MFN56_3X
+    [FR_MODEL_MFN56_3X] = {"MFN56_3X", mfn56_112m_q, FACE_ID_SIZE},
+#endif
+#if CONFIG_MFN56_4X || CONFIG_FR_REGISTRY_MFN56_4X
+    [FR_MODEL_MFN56_4X] = {"MFN56_4X", mfn56_156m_q, FACE_ID_SIZE},
+#endif
+};
+
+const fr_model_info_t *fr_model_get(fr_model_t model)
+{
+    if ((model >= FR_MODEL_MAX) || (NULL == fr_model_registry[model].forward))
+        return NULL;
+    return &fr_model_registry[model];
+}
+
 void face_id_init(face_id_list *l, uint8_t size, uint8_t confirm_times)
 {
     l->head = 0;
@@ -19,7 +45,27 @@ void face_id_init(face_id_list *l, uint8_t size, uint8_t confirm_times)
     l->count = 0;
     l->size = size;
     l->confirm_times = confirm_times;
+    l->confirm_count = 0;
     l->id_list = (dl_matrix3d_t **)dl_lib_calloc(size, sizeof(dl_matrix3d_t *), 0);
+    l->model = FR_MODEL_DEFAULT;
+    l->mode = FR_CONV_MODE_DEFAULT;
+    l->id_size = FACE_ID_SIZE;
+}
+
+int8_t face_id_init_with_model(face_id_list *l, uint8_t size, uint8_t confirm_times, fr_model_t model, dl_conv_mode mode)
+{
+    const fr_model_info_t *info = fr_model_get(model);
+    if (NULL == info)
+    {
+        ESP_LOGE(TAG, "Model %d is not linked", model);
+        return ESP_FAIL;
+    }
+
+    face_id_init(l, size, confirm_times);
+    l->model = model;
+    l->mode = mode;
+    l->id_size = info->id_size;
+    return ESP_OK;
 }
 
 void face_id_name_init(face_id_name_list *l, uint8_t size, uint8_t confirm_times)
@@ -28,6 +74,26 @@ void face_id_name_init(face_id_name_list *l, uint8_t size, uint8_t confirm_times
     l->tail = NULL;
     l->count = 0;
     l->confirm_times = confirm_times;
+    l->confirm_count = 0;
+    l->model = FR_MODEL_DEFAULT;
+    l->mode = FR_CONV_MODE_DEFAULT;
+    l->id_size = FACE_ID_SIZE;
+}
+
+int8_t face_id_name_init_with_model(face_id_name_list *l, uint8_t size, uint8_t confirm_times, fr_model_t model, dl_conv_mode mode)
+{
+    const fr_model_info_t *info = fr_model_get(model);
+    if (NULL == info)
+    {
+        ESP_LOGE(TAG, "Model %d is not linked", model);
+        return ESP_FAIL;
+    }
+
+    face_id_name_init(l, size, confirm_times);
+    l->model = model;
+    l->mode = mode;
+    l->id_size = info->id_size;
+    return ESP_OK;
 }
 
 void l2_norm(dl_matrix3d_t *feature)
@@ -201,41 +267,28 @@ int8_t align_face_sim(box_array_t *onet_boxes,
     return ESP_OK;
 }
 
-dl_matrix3d_t *get_face_id(dl_matrix3du_t *aligned_face)
+dl_matrix3d_t *get_face_id_with_model(dl_matrix3du_t *aligned_face, fr_model_t model, dl_conv_mode mode)
 {
-    dl_matrix3d_t *face_id = NULL;
+    const fr_model_info_t *info = fr_model_get(model);
+    if (NULL == info)
+    {
+        ESP_LOGE(TAG, "Model %d is not linked", model);
+        return NULL;
+    }
+
     dl_matrix3dq_t *mobileface_in = transform_frmn_input(aligned_face);
-#if CONFIG_XTENSA_IMPL
-    #if CONFIG_FRMN
-        dl_matrix3dq_t *face_id_q = frmn_q(mobileface_in, DL_XTENSA_IMPL);
-    #elif CONFIG_MFN56_1X
-        dl_matrix3dq_t *face_id_q = mfn56_42m_q(mobileface_in, DL_XTENSA_IMPL);
-    #elif CONFIG_MFN56_2X
-        dl_matrix3dq_t *face_id_q = mfn56_72m_q(mobileface_in, DL_XTENSA_IMPL);
-    #elif CONFIG_MFN56_3X
-        dl_matrix3dq_t *face_id_q = mfn56_112m_q(mobileface_in, DL_XTENSA_IMPL);
-    #elif CONFIG_MFN56_4X
-        dl_matrix3dq_t *face_id_q = mfn56_156m_q(mobileface_in, DL_XTENSA_IMPL);
-    #endif
-#else
-    #if CONFIG_FRMN
-        dl_matrix3dq_t *face_id_q = frmn_q(mobileface_in, DL_C_IMPL);
-    #elif CONFIG_MFN56_1X
-        dl_matrix3dq_t *face_id_q = mfn56_42m_q(mobileface_in, DL_C_IMPL);
-    #elif CONFIG_MFN56_2X
-        dl_matrix3dq_t *face_id_q = mfn56_72m_q(mobileface_in, DL_C_IMPL);
-    #elif CONFIG_MFN56_3X
-        dl_matrix3dq_t *face_id_q = mfn56_112m_q(mobileface_in, DL_C_IMPL);
-    #elif CONFIG_MFN56_4X
-        dl_matrix3dq_t *face_id_q = mfn56_156m_q(mobileface_in, DL_C_IMPL);
-    #endif
-#endif
-    face_id = dl_matrix3d_from_matrixq(face_id_q);
+    dl_matrix3dq_t *face_id_q = info->forward(mobileface_in, mode);
+    dl_matrix3d_t *face_id = dl_matrix3d_from_matrixq(face_id_q);
     l2_norm(face_id);
     dl_matrix3dq_free(face_id_q);
     return face_id;
 }
 
+dl_matrix3d_t *get_face_id(dl_matrix3du_t *aligned_face)
+{
+    return get_face_id_with_model(aligned_face, FR_MODEL_DEFAULT, FR_CONV_MODE_DEFAULT);
+}
+
 fptp_t cos_distance(dl_matrix3d_t *id_1,
                     dl_matrix3d_t *id_2)
 {
@@ -315,28 +368,42 @@ void devide_face_id(dl_matrix3d_t *id, uint8_t num)
     }
 }
 
-int8_t recognize_face(face_id_list *l,
-                      dl_matrix3du_t *algined_face)
+int8_t match_face_id(face_id_list *l,
+                     dl_matrix3d_t *face_id,
+                     fptp_t *max_similarity)
 {
     fptp_t similarity = 0;
-    fptp_t max_similarity = -1;
     int8_t matched_id = -1;
-    dl_matrix3d_t *face_id = NULL;
-
-    face_id = get_face_id(algined_face);
 
+    *max_similarity = -1;
     for (uint16_t i = 0; i < l->count; i++)
     {
         uint8_t head = (l->head + i) % l->size;
         similarity = cos_distance_unit_id(l->id_list[head], face_id);
 
-        if (similarity > max_similarity)
+        if (similarity > *max_similarity)
         {
-            max_similarity = similarity;
+            *max_similarity = similarity;
             matched_id = head;
         }
     }
 
+    return matched_id;
+}
+
+int8_t recognize_face(face_id_list *l,
+                      dl_matrix3du_t *algined_face)
+{
+    fptp_t max_similarity = -1;
+    int8_t matched_id = -1;
+    dl_matrix3d_t *face_id = NULL;
+
+    face_id = get_face_id_with_model(algined_face, l->model, l->mode);
+    if (NULL == face_id)
+        return -1;
+
+    matched_id = match_face_id(l, face_id, &max_similarity);
+
     if (max_similarity < FACE_REC_THRESHOLD)
     {
         matched_id = -1;
@@ -350,23 +417,23 @@ int8_t recognize_face(face_id_list *l,
 
 int8_t enroll_face(face_id_list *l, dl_matrix3du_t *aligned_face)
 {
-    static int8_t confirm_counter = 0;
-
     // add new_id to dest_id
-    dl_matrix3d_t *new_id = get_face_id(aligned_face);
+    dl_matrix3d_t *new_id = get_face_id_with_model(aligned_face, l->model, l->mode);
+    if (NULL == new_id)
+        return -1;
 
-    if ((l->count < l->size) && (confirm_counter == 0))
-        l->id_list[l->tail] = dl_matrix3d_alloc(1, 1, 1, FACE_ID_SIZE);
+    if ((l->count < l->size) && (l->confirm_count == 0))
+        l->id_list[l->tail] = dl_matrix3d_alloc(1, 1, 1, l->id_size);
 
     add_face_id(l->id_list[l->tail], new_id);
     dl_matrix3d_free(new_id);
 
-    confirm_counter++;
+    l->confirm_count++;
 
-    if (confirm_counter == l->confirm_times)
+    if (l->confirm_count == l->confirm_times)
     {
         devide_face_id(l->id_list[l->tail], l->confirm_times);
-        confirm_counter = 0;
+        l->confirm_count = 0;
 
         l->tail = (l->tail + 1) % l->size;
         l->count++;
@@ -380,7 +447,7 @@ int8_t enroll_face(face_id_list *l, dl_matrix3du_t *aligned_face)
         return 0;
     }
 
-    return l->confirm_times - confirm_counter;
+    return l->confirm_times - l->confirm_count;
 }
 
 uint8_t delete_face(face_id_list *l)
@@ -436,13 +503,11 @@ int8_t enroll_face_with_name(face_id_name_list *l,
                              dl_matrix3d_t *new_id,
                              char *name)
 {
-    static int8_t confirm_counter = 0;
-
-    if (confirm_counter == 0)
+    if (l->confirm_count == 0)
     {
         face_id_node *new_node = (face_id_node *)dl_lib_calloc(1, sizeof(face_id_node), 0);
         new_node->next = NULL;
-        new_node->id_vec = dl_matrix3d_alloc(1, 1, 1, FACE_ID_SIZE);
+        new_node->id_vec = dl_matrix3d_alloc(1, 1, 1, l->id_size);
         if (NULL == l->tail)
         {
             l->head = new_node;
@@ -455,14 +520,14 @@ int8_t enroll_face_with_name(face_id_name_list *l,
 
     add_face_id(new_tail->id_vec, new_id);
 
-    confirm_counter++;
+    l->confirm_count++;
 
-    if (confirm_counter == l->confirm_times)
+    if (l->confirm_count == l->confirm_times)
     {
         devide_face_id(new_tail->id_vec, l->confirm_times);
         memcpy(new_tail->id_name, name, strlen(name) + 1);
 
-        confirm_counter = 0;
+        l->confirm_count = 0;
 
         l->tail = new_tail;
         l->tail->next = NULL;
@@ -471,17 +536,17 @@ int8_t enroll_face_with_name(face_id_name_list *l,
         return 0;
     }
 
-    return l->confirm_times - confirm_counter;
+    return l->confirm_times - l->confirm_count;
 }
 
-int8_t delete_face_with_name(face_id_name_list *l, char *name)
+int delete_face_with_name(face_id_name_list *l, char *name)
 {
     if (l->count == 0)
         return -1;
 
     face_id_node *p = l->head;
     face_id_node *q = p;
-    for (int8_t i = 0; i < l->count; i++)
+    for (int i = 0; i < l->count; i++)
     {
         if (strcmp(q->id_name, name) == 0)
         {
@@ -517,7 +582,7 @@ void delete_face_all_with_name(face_id_name_list *l)
         return;
 
     face_id_node *p = l->head;
-    for (int8_t i = 0; i < l->count; i++)
+    for (int i = 0; i < l->count; i++)
     {
         dl_matrix3d_free(p->id_vec);
         l->head = p->next;
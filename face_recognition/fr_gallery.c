@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "fr_gallery.h"
+
+static const char *TAG = "fr_gallery";
+
+#define PAGE_OF(i) ((i) / FR_GALLERY_PAGE_IDS)
+#define SLOT_OF(i) ((i) % FR_GALLERY_PAGE_IDS)
+
+static fptp_t dot(const fptp_t *a, const fptp_t *b, int len)
+{
+    fptp_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < len; i++)
+        s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+esp_err_t fr_gallery_init(fr_gallery_t *g, uint32_t capacity, uint16_t id_size, uint8_t confirm_times, fr_gallery_policy_t policy)
+{
+    memset(g, 0, sizeof(fr_gallery_t));
+    g->capacity = capacity;
+    g->n_pages = (capacity + FR_GALLERY_PAGE_IDS - 1) / FR_GALLERY_PAGE_IDS;
+    g->id_size = id_size;
+    g->policy = policy;
+    g->next_id = 1;
+    g->confirm_times = confirm_times;
+    g->page = (fr_gallery_page_t **)dl_lib_calloc(g->n_pages, sizeof(fr_gallery_page_t *), 0);
+    g->pending = (fptp_t *)dl_lib_calloc(id_size, sizeof(fptp_t), 0);
+    if ((NULL == g->page) || (NULL == g->pending))
+    {
+        fr_gallery_free(g);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void fr_gallery_free(fr_gallery_t *g)
+{
+    for (uint32_t p = 0; g->page && (p < g->n_pages); p++)
+    {
+        if (g->page[p])
+            dl_lib_free(g->page[p]);
+    }
+    if (g->page)
+        dl_lib_free(g->page);
+    if (g->pending)
+        dl_lib_free(g->pending);
+    g->page = NULL;
+    g->pending = NULL;
+    g->count = 0;
+}
+
+static void slot_move(fr_gallery_t *g, uint32_t dst, uint32_t src)
+{
+    fr_gallery_page_t *d = g->page[PAGE_OF(dst)];
+    fr_gallery_page_t *s = g->page[PAGE_OF(src)];
+    uint32_t i = SLOT_OF(dst);
+    uint32_t j = SLOT_OF(src);
+
+    d->id[i] = s->id[j];
+    d->enrolled[i] = s->enrolled[j];
+    d->last_match[i] = s->last_match[j];
+    memcpy(d->name[i], s->name[j], ENROLL_NAME_LEN);
+    memcpy(d->vec + i * g->id_size, s->vec + j * g->id_size, g->id_size * sizeof(fptp_t));
+}
+
+static void slot_remove(fr_gallery_t *g, uint32_t i)
+{
+    uint32_t last = g->count - 1;
+    if (i != last)
+        slot_move(g, i, last);
+    g->count--;
+
+    // the last page became empty
+    if (0 == SLOT_OF(last))
+    {
+        dl_lib_free(g->page[PAGE_OF(last)]);
+        g->page[PAGE_OF(last)] = NULL;
+    }
+}
+
+static uint32_t slot_victim(fr_gallery_t *g)
+{
+    uint32_t victim = 0;
+    uint32_t oldest = UINT32_MAX;
+    for (uint32_t i = 0; i < g->count; i++)
+    {
+        fr_gallery_page_t *page = g->page[PAGE_OF(i)];
+        uint32_t t = (FR_GALLERY_FIFO == g->policy) ? page->enrolled[SLOT_OF(i)] : page->last_match[SLOT_OF(i)];
+        if (t < oldest)
+        {
+            oldest = t;
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+static int32_t slot_find_id(fr_gallery_t *g, uint32_t id)
+{
+    for (uint32_t i = 0; i < g->count; i++)
+    {
+        if (g->page[PAGE_OF(i)]->id[SLOT_OF(i)] == id)
+            return i;
+    }
+    return -1;
+}
+
+esp_err_t fr_gallery_add(fr_gallery_t *g, const fptp_t *vec, const char *name, uint32_t *id)
+{
+    if (g->count == g->capacity)
+    {
+        if ((FR_GALLERY_REJECT == g->policy) || (0 == g->capacity))
+        {
+            ESP_LOGW(TAG, "Gallery full");
+            return ESP_ERR_NO_MEM;
+        }
+        uint32_t victim = slot_victim(g);
+        ESP_LOGD(TAG, "Evict %s", g->page[PAGE_OF(victim)]->name[SLOT_OF(victim)]);
+        slot_remove(g, victim);
+    }
+
+    uint32_t i = g->count;
+    fr_gallery_page_t *page = g->page[PAGE_OF(i)];
+    if (NULL == page)
+    {
+        page = (fr_gallery_page_t *)dl_lib_calloc(1, sizeof(fr_gallery_page_t) + FR_GALLERY_PAGE_IDS * g->id_size * sizeof(fptp_t), 0);
+        if (NULL == page)
+            return ESP_ERR_NO_MEM;
+        page->vec = (fptp_t *)(page + 1);
+        g->page[PAGE_OF(i)] = page;
+    }
+
+    uint32_t k = SLOT_OF(i);
+    page->id[k] = g->next_id;
+    page->enrolled[k] = g->next_id;
+    page->last_match[k] = ++g->clock;
+    memset(page->name[k], 0, ENROLL_NAME_LEN);
+    strncpy(page->name[k], name, ENROLL_NAME_LEN - 1);
+    memcpy(page->vec + k * g->id_size, vec, g->id_size * sizeof(fptp_t));
+    g->count++;
+
+    if (id)
+        *id = g->next_id;
+    g->next_id++;
+    return ESP_OK;
+}
+
+int8_t fr_gallery_enroll(fr_gallery_t *g, dl_matrix3d_t *face_id, const char *name, uint32_t *id)
+{
+    for (int i = 0; i < g->id_size; i++)
+        g->pending[i] += face_id->item[i];
+    g->confirm_count++;
+    if (g->confirm_count < g->confirm_times)
+        return g->confirm_times - g->confirm_count;
+
+    for (int i = 0; i < g->id_size; i++)
+        g->pending[i] /= g->confirm_times;
+    esp_err_t ret = fr_gallery_add(g, g->pending, name, id);
+    memset(g->pending, 0, g->id_size * sizeof(fptp_t));
+    g->confirm_count = 0;
+    return (ESP_OK == ret) ? 0 : -2;
+}
+
+esp_err_t fr_gallery_delete(fr_gallery_t *g, uint32_t id)
+{
+    int32_t i = slot_find_id(g, id);
+    if (i < 0)
+        return ESP_ERR_NOT_FOUND;
+    slot_remove(g, i);
+    return ESP_OK;
+}
+
+esp_err_t fr_gallery_delete_name(fr_gallery_t *g, const char *name)
+{
+    for (uint32_t i = 0; i < g->count; i++)
+    {
+        if (0 == strcmp(g->page[PAGE_OF(i)]->name[SLOT_OF(i)], name))
+        {
+            slot_remove(g, i);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+const char *fr_gallery_recognize(fr_gallery_t *g, dl_matrix3d_t *face_id, fptp_t *max_similarity, uint32_t *id)
+{
+    fr_gallery_page_t *best_page = NULL;
+    uint32_t best_slot = 0;
+    *max_similarity = -1;
+
+    // one page after the other, each a contiguous run of vectors
+    for (uint32_t p = 0; p * FR_GALLERY_PAGE_IDS < g->count; p++)
+    {
+        fr_gallery_page_t *page = g->page[p];
+        uint32_t n = DL_IMAGE_MIN(FR_GALLERY_PAGE_IDS, g->count - p * FR_GALLERY_PAGE_IDS);
+        const fptp_t *vec = page->vec;
+        for (uint32_t k = 0; k < n; k++, vec += g->id_size)
+        {
+            fptp_t similarity = dot(vec, face_id->item, g->id_size);
+            if (similarity > *max_similarity)
+            {
+                *max_similarity = similarity;
+                best_page = page;
+                best_slot = k;
+            }
+        }
+    }
+
+    if ((NULL == best_page) || (*max_similarity < FACE_REC_THRESHOLD))
+        return NULL;
+
+    best_page->last_match[best_slot] = ++g->clock;
+    if (id)
+        *id = best_page->id[best_slot];
+    ESP_LOGI(TAG, "\nSimilarity: %.6f, name: %s", *max_similarity, best_page->name[best_slot]);
+    return best_page->name[best_slot];
+}
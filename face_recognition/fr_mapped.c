@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "fr_mapped.h"
+#include "fr_flash.h"
+
+static const char *TAG = "fr_mapped";
+
+#define DELETED(g, i) ((g)->deleted[(i) >> 3] & (1 << ((i)&7)))
+
+static fptp_t dot(const fptp_t *a, const fptp_t *b, int len)
+{
+    fptp_t dist = 0;
+    for (int i = 0; i < len; i++)
+        dist += a[i] * b[i];
+    return dist;
+}
+
+static void mapped_release(fr_mapped_gallery_t *g)
+{
+    if (g->vec)
+        fr_partition_munmap(g->part, g->map_handle);
+    if (g->name)
+        dl_lib_free(g->name);
+    if (g->deleted)
+        dl_lib_free(g->deleted);
+    g->vec = NULL;
+    g->map_handle = NULL;
+    g->name = NULL;
+    g->deleted = NULL;
+    g->n_mapped = 0;
+    g->n_deleted = 0;
+}
+
+static esp_err_t mapped_load(fr_mapped_gallery_t *g)
+{
+    int flash_info_flag = 0;
+    uint8_t count = 0;
+
+    esp_err_t ret = fr_partition_read(g->part, 0, &flash_info_flag, sizeof(int));
+    if (ESP_OK != ret)
+        return ret;
+    if (FR_MAPPED_COMPACTING_FLAG == flash_info_flag)
+    {
+        // the names no longer match the vectors
+        ESP_LOGE(TAG, "A compaction was cut short, the mapped ids are lost");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (flash_info_flag != FR_FLASH_INFO_FLAG)
+        return ESP_OK;
+    fr_partition_read(g->part, sizeof(int), &count, sizeof(uint8_t));
+    if (0 == count)
+        return ESP_OK;
+
+    g->name = (char *)dl_lib_calloc(count, ENROLL_NAME_LEN, 0);
+    g->deleted = (uint8_t *)dl_lib_calloc((count + 7) >> 3, 1, 0);
+    if ((NULL == g->name) || (NULL == g->deleted))
+        return ESP_ERR_NO_MEM;
+    fr_partition_read(g->part, FR_MAPPED_NAME_OFFSET, g->name, count * ENROLL_NAME_LEN);
+
+    const void *ptr = NULL;
+    ret = fr_partition_mmap(g->part, FR_MAPPED_VEC_OFFSET, count * FR_MAPPED_SLOT_SIZE, &ptr, &g->map_handle);
+    if (ESP_OK != ret)
+    {
+        ESP_LOGE(TAG, "Map failed");
+        return ret;
+    }
+    g->vec = (const fptp_t *)ptr;
+    g->n_mapped = count;
+    return ESP_OK;
+}
+
+esp_err_t fr_mapped_open(fr_mapped_gallery_t *g, fr_partition_t *part, uint8_t confirm_times)
+{
+    memset(g, 0, sizeof(fr_mapped_gallery_t));
+    g->part = part;
+    face_id_name_init(&g->delta, 0, confirm_times);
+
+    esp_err_t ret = mapped_load(g);
+    if (ESP_OK != ret)
+        mapped_release(g);
+    ESP_LOGI(TAG, "Mapped %d ids", g->n_mapped);
+    return ret;
+}
+
+void fr_mapped_close(fr_mapped_gallery_t *g)
+{
+    mapped_release(g);
+    delete_face_all_with_name(&g->delta);
+}
+
+uint16_t fr_mapped_count(fr_mapped_gallery_t *g)
+{
+    return g->n_mapped - g->n_deleted + g->delta.count;
+}
+
+const char *fr_mapped_recognize(fr_mapped_gallery_t *g, dl_matrix3d_t *face_id, fptp_t *max_similarity)
+{
+    int id_size = g->delta.id_size;
+    const char *matched = NULL;
+    fptp_t similarity = 0;
+
+    *max_similarity = -1;
+    for (int i = 0; i < g->n_mapped; i++)
+    {
+        if (DELETED(g, i))
+            continue;
+        similarity = dot(g->vec + i * FACE_ID_SIZE, face_id->item, id_size);
+        if (similarity > *max_similarity)
+        {
+            *max_similarity = similarity;
+            matched = g->name + i * ENROLL_NAME_LEN;
+        }
+    }
+
+    for (face_id_node *p = g->delta.head; p != NULL; p = p->next)
+    {
+        similarity = dot(p->id_vec->item, face_id->item, id_size);
+        if (similarity > *max_similarity)
+        {
+            *max_similarity = similarity;
+            matched = p->id_name;
+        }
+    }
+
+    if (*max_similarity < FACE_REC_THRESHOLD)
+        return NULL;
+
+    ESP_LOGI(TAG, "\nSimilarity: %.6f, name: %s", *max_similarity, matched);
+    return matched;
+}
+
+int8_t fr_mapped_enroll(fr_mapped_gallery_t *g, dl_matrix3d_t *new_id, char *name)
+{
+    return enroll_face_with_name(&g->delta, new_id, name);
+}
+
+int fr_mapped_delete(fr_mapped_gallery_t *g, char *name)
+{
+    for (int i = 0; i < g->n_mapped; i++)
+    {
+        if (!DELETED(g, i) && (0 == strcmp(g->name + i * ENROLL_NAME_LEN, name)))
+        {
+            g->deleted[i >> 3] |= 1 << (i & 7);
+            g->n_deleted++;
+            return fr_mapped_count(g);
+        }
+    }
+
+    if (delete_face_with_name(&g->delta, name) < 0)
+        return -3;
+    return fr_mapped_count(g);
+}
+
+/*
+ * Before the first write: unmap, as the cache may hold stale data of the sectors about to be rewritten,
+ * and mark a valid header as being compacted. Programming only clears bits, so no erase is needed.
+ */
+static esp_err_t compact_begin(fr_mapped_gallery_t *g)
+{
+    if (g->vec)
+        fr_partition_munmap(g->part, g->map_handle);
+    g->vec = NULL;
+    g->map_handle = NULL;
+
+    int flash_info_flag = 0;
+    esp_err_t ret = fr_partition_read(g->part, 0, &flash_info_flag, sizeof(int));
+    if ((ESP_OK != ret) || (FR_FLASH_INFO_FLAG != flash_info_flag))
+        return ret;
+    flash_info_flag = FR_MAPPED_COMPACTING_FLAG;
+    return fr_partition_write(g->part, 0, &flash_info_flag, sizeof(int));
+}
+
+esp_err_t fr_mapped_compact(fr_mapped_gallery_t *g)
+{
+    // nothing deleted or enrolled, the partition already holds the gallery
+    if ((0 == g->n_deleted) && (0 == g->delta.count))
+        return ESP_OK;
+
+    fr_partition_t *part = g->part;
+    uint16_t total = fr_mapped_count(g);
+    if ((total > UINT8_MAX) ||
+        (FR_MAPPED_NAME_OFFSET + total * ENROLL_NAME_LEN > FR_MAPPED_VEC_OFFSET) ||
+        (FR_MAPPED_VEC_OFFSET + total * FR_MAPPED_SLOT_SIZE > part->size))
+        return ESP_ERR_NO_MEM;
+
+    // new slot j is filled from old slot src[j] (src[j] >= j) or from the delta list (src[j] < 0)
+    int16_t *src = (int16_t *)dl_lib_calloc(total + 1, sizeof(int16_t), 0);
+    char *name = (char *)dl_lib_calloc(total + 1, ENROLL_NAME_LEN, 0);
+    uint8_t *buf = (uint8_t *)dl_lib_calloc(1, part->sector_size, 0);
+    if ((NULL == src) || (NULL == name) || (NULL == buf))
+    {
+        if (src)
+            dl_lib_free(src);
+        if (name)
+            dl_lib_free(name);
+        if (buf)
+            dl_lib_free(buf);
+        return ESP_ERR_NO_MEM;
+    }
+
+    int j = 0;
+    for (int i = 0; i < g->n_mapped; i++)
+    {
+        if (DELETED(g, i))
+            continue;
+        src[j] = i;
+        memcpy(name + j * ENROLL_NAME_LEN, g->name + i * ENROLL_NAME_LEN, ENROLL_NAME_LEN);
+        j++;
+    }
+    face_id_node *node = g->delta.head;
+    for (; j < total; j++, node = node->next)
+    {
+        src[j] = -1;
+        memcpy(name + j * ENROLL_NAME_LEN, node->id_name, ENROLL_NAME_LEN);
+    }
+
+    // slots move towards the start only, so a sector is always read before any of its data is overwritten
+    esp_err_t ret = ESP_OK;
+    int touched = 0;
+    const int slots = part->sector_size / FR_MAPPED_SLOT_SIZE;
+    node = g->delta.head;
+    for (int first = 0; (first < total) && (ESP_OK == ret); first += slots)
+    {
+        int changed = 0;
+        memset(buf, 0xFF, part->sector_size);
+        for (int k = 0; (k < slots) && (first + k < total); k++)
+        {
+            int s = src[first + k];
+            uint8_t *dst = buf + k * FR_MAPPED_SLOT_SIZE;
+            if (s < 0)
+            {
+                memcpy(dst, node->id_vec->item, g->delta.id_size * sizeof(float));
+                node = node->next;
+                changed = 1;
+            }
+            else
+            {
+                fr_partition_read(part, FR_MAPPED_VEC_OFFSET + s * FR_MAPPED_SLOT_SIZE, dst, FR_MAPPED_SLOT_SIZE);
+                changed |= (s != first + k);
+            }
+        }
+        if (!changed)
+            continue;
+
+        if (!touched)
+        {
+            ret = compact_begin(g);
+            touched = 1;
+            if (ESP_OK != ret)
+                break;
+        }
+        uint32_t offset = FR_MAPPED_VEC_OFFSET + first * FR_MAPPED_SLOT_SIZE;
+        ret = fr_partition_erase(part, offset, part->sector_size);
+        if (ESP_OK == ret)
+            ret = fr_partition_write(part, offset, buf, part->sector_size);
+    }
+
+    if (ESP_OK == ret)
+    {
+        // the flag goes last, a cut before it leaves an empty partition rather than a torn one
+        int flash_info_flag = FR_FLASH_INFO_FLAG;
+        uint8_t count = total;
+        if (!touched)
+            ret = compact_begin(g);
+        touched = 1;
+        if (ESP_OK == ret)
+            ret = fr_partition_erase(part, 0, part->sector_size);
+        if (ESP_OK == ret)
+            ret = fr_partition_write(part, sizeof(int), &count, sizeof(uint8_t));
+        if (ESP_OK == ret)
+            ret = fr_partition_write(part, FR_MAPPED_NAME_OFFSET, name, total * ENROLL_NAME_LEN);
+        if (ESP_OK == ret)
+            ret = fr_partition_write(part, 0, &flash_info_flag, sizeof(int));
+    }
+
+    dl_lib_free(src);
+    dl_lib_free(name);
+    dl_lib_free(buf);
+    if (ESP_OK != ret)
+    {
+        ESP_LOGE(TAG, "Compaction failed");
+        if (touched)
+        {
+            // the mapping is gone and the partition may be half rewritten, map whatever it holds now
+            mapped_release(g);
+            mapped_load(g);
+        }
+        return ret;
+    }
+
+    delete_face_all_with_name(&g->delta);
+    mapped_release(g);
+    ret = mapped_load(g);
+    ESP_LOGI(TAG, "Compacted, %d ids mapped", g->n_mapped);
+    return ret;
+}
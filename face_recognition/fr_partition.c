@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "fr_partition.h"
+#include "fr_flash.h"
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+#include "esp_timer.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char *TAG = "fr_partition";
+
+uint32_t fr_crc32(uint32_t crc, const void *data, size_t len)
+{
+    // nibble table, small enough to stay in flash cache
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    const uint8_t *p = (const uint8_t *)data;
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = (crc >> 4) ^ table[(crc ^ p[i]) & 0x0F];
+        crc = (crc >> 4) ^ table[(crc ^ (p[i] >> 4)) & 0x0F];
+    }
+    return ~crc;
+}
+
+#ifdef ESP_PLATFORM
+static esp_err_t flash_read(fr_partition_t *p, size_t offset, void *dst, size_t len)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = esp_partition_read((const esp_partition_t *)p->ctx, offset, dst, len);
+    p->stats.busy_us += esp_timer_get_time() - start;
+    return ret;
+}
+
+static esp_err_t flash_write(fr_partition_t *p, size_t offset, const void *src, size_t len)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = esp_partition_write((const esp_partition_t *)p->ctx, offset, src, len);
+    p->stats.busy_us += esp_timer_get_time() - start;
+    return ret;
+}
+
+static esp_err_t flash_erase(fr_partition_t *p, size_t offset, size_t len)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = esp_partition_erase_range((const esp_partition_t *)p->ctx, offset, len);
+    p->stats.busy_us += esp_timer_get_time() - start;
+    return ret;
+}
+
+static void flash_close(fr_partition_t *p)
+{
+}
+
+static esp_err_t flash_mmap(fr_partition_t *p, size_t offset, size_t len, const void **ptr, void **handle)
+{
+    spi_flash_mmap_handle_t h = 0;
+    esp_err_t ret = esp_partition_mmap((const esp_partition_t *)p->ctx, offset, len, SPI_FLASH_MMAP_DATA, ptr, &h);
+    *handle = (void *)(uintptr_t)h;
+    return ret;
+}
+
+static void flash_munmap(fr_partition_t *p, void *handle)
+{
+    spi_flash_munmap((spi_flash_mmap_handle_t)(uintptr_t)handle);
+}
+
+static const fr_partition_ops_t flash_ops = {flash_read, flash_write, flash_erase, flash_close, flash_mmap, flash_munmap};
+
+fr_partition_t *fr_partition_open_flash(void)
+{
+    const esp_partition_t *pt = esp_partition_find_first(FR_FLASH_TYPE, FR_FLASH_SUBTYPE, FR_FLASH_PARTITION_NAME);
+    if (pt == NULL)
+    {
+        ESP_LOGE(TAG, "Not found");
+        return NULL;
+    }
+
+    fr_partition_t *p = (fr_partition_t *)calloc(1, sizeof(fr_partition_t));
+    if (NULL == p)
+        return NULL;
+    p->ops = &flash_ops;
+    p->size = pt->size;
+    p->sector_size = FR_PARTITION_SECTOR_SIZE;
+    p->ctx = (void *)pt;
+    p->stats.sector_wear = (uint32_t *)calloc(p->size / p->sector_size, sizeof(uint32_t));
+    if (NULL == p->stats.sector_wear)
+    {
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+#else
+typedef struct
+{
+    int fd;
+    fr_partition_file_config_t config;
+} file_ctx_t;
+
+static esp_err_t file_read(fr_partition_t *p, size_t offset, void *dst, size_t len)
+{
+    file_ctx_t *ctx = (file_ctx_t *)p->ctx;
+    if (pread(ctx->fd, dst, len, offset) != (ssize_t)len)
+        return ESP_FAIL;
+    p->stats.busy_us += ((uint64_t)len * ctx->config.read_ns_per_byte + 500) / 1000;
+    return ESP_OK;
+}
+
+static esp_err_t file_write(fr_partition_t *p, size_t offset, const void *src, size_t len)
+{
+    file_ctx_t *ctx = (file_ctx_t *)p->ctx;
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *buf = (uint8_t *)malloc(len);
+    if (NULL == buf)
+        return ESP_ERR_NO_MEM;
+    if (pread(ctx->fd, buf, len, offset) != (ssize_t)len)
+    {
+        free(buf);
+        return ESP_FAIL;
+    }
+
+    // NOR flash can only clear bits, setting one needs an erase first
+    int violation = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        violation |= (buf[i] & s[i]) != s[i];
+        buf[i] &= s[i];
+    }
+    if (violation)
+    {
+        p->stats.violations++;
+        ESP_LOGW(TAG, "Write to 0x%x without erase", (unsigned)offset);
+        if (ctx->config.strict)
+        {
+            free(buf);
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    ssize_t n = pwrite(ctx->fd, buf, len, offset);
+    free(buf);
+    if (n != (ssize_t)len)
+        return ESP_FAIL;
+    p->stats.busy_us += (uint64_t)((offset + len + 255) / 256 - offset / 256) * ctx->config.program_us_per_page;
+    return ESP_OK;
+}
+
+/*
+ * Set a range of the file to 0xFF, like erased flash.
+ */
+static esp_err_t file_fill(int fd, size_t offset, size_t len)
+{
+    uint8_t buf[256];
+    memset(buf, 0xFF, sizeof(buf));
+    for (size_t i = 0; i < len; i += sizeof(buf))
+    {
+        size_t n = (len - i < sizeof(buf)) ? len - i : sizeof(buf);
+        if (pwrite(fd, buf, n, offset + i) != (ssize_t)n)
+            return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t file_erase(fr_partition_t *p, size_t offset, size_t len)
+{
+    file_ctx_t *ctx = (file_ctx_t *)p->ctx;
+    p->stats.busy_us += (uint64_t)(len / p->sector_size) * ctx->config.erase_us_per_sector;
+    return file_fill(ctx->fd, offset, len);
+}
+
+static void file_close(fr_partition_t *p)
+{
+    file_ctx_t *ctx = (file_ctx_t *)p->ctx;
+    close(ctx->fd);
+    free(ctx);
+}
+
+typedef struct
+{
+    void *base;
+    size_t len;
+} file_map_t;
+
+static esp_err_t file_mmap(fr_partition_t *p, size_t offset, size_t len, const void **ptr, void **handle)
+{
+    // a shared mapping of the file, later writes show through like the flash cache after an erase and write
+    file_ctx_t *ctx = (file_ctx_t *)p->ctx;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t skip = offset % page;
+    file_map_t *map = (file_map_t *)malloc(sizeof(file_map_t));
+    if (NULL == map)
+        return ESP_ERR_NO_MEM;
+    map->len = len + skip;
+    map->base = mmap(NULL, map->len, PROT_READ, MAP_SHARED, ctx->fd, offset - skip);
+    if (MAP_FAILED == map->base)
+    {
+        free(map);
+        return ESP_FAIL;
+    }
+    *ptr = (const uint8_t *)map->base + skip;
+    *handle = map;
+    return ESP_OK;
+}
+
+static void file_munmap(fr_partition_t *p, void *handle)
+{
+    file_map_t *map = (file_map_t *)handle;
+    munmap(map->base, map->len);
+    free(map);
+}
+
+static const fr_partition_ops_t file_ops = {file_read, file_write, file_erase, file_close, file_mmap, file_munmap};
+
+fr_partition_t *fr_partition_open_flash(void)
+{
+    ESP_LOGE(TAG, "Not found");
+    return NULL;
+}
+
+fr_partition_t *fr_partition_open_file(const char *path, size_t size, const fr_partition_file_config_t *config)
+{
+    fr_partition_file_config_t cfg;
+    if (config)
+        cfg = *config;
+    else
+        fr_partition_file_config_init(&cfg);
+    if (size % cfg.sector_size)
+        return NULL;
+
+    file_ctx_t *ctx = (file_ctx_t *)calloc(1, sizeof(file_ctx_t));
+    fr_partition_t *p = (fr_partition_t *)calloc(1, sizeof(fr_partition_t));
+    if ((NULL == ctx) || (NULL == p))
+    {
+        free(ctx);
+        free(p);
+        return NULL;
+    }
+
+    // a new file, or the part added to a short one, starts erased
+    ctx->config = cfg;
+    ctx->fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if ((ctx->fd < 0) || fstat(ctx->fd, &st) || ftruncate(ctx->fd, size) ||
+        (((size_t)st.st_size < size) && (ESP_OK != file_fill(ctx->fd, st.st_size, size - st.st_size))))
+    {
+        ESP_LOGE(TAG, "Can not open %s", path);
+        if (ctx->fd >= 0)
+            close(ctx->fd);
+        free(ctx);
+        free(p);
+        return NULL;
+    }
+
+    p->ops = &file_ops;
+    p->size = size;
+    p->sector_size = ctx->config.sector_size;
+    p->ctx = ctx;
+    p->stats.sector_wear = (uint32_t *)calloc(size / p->sector_size, sizeof(uint32_t));
+    if (NULL == p->stats.sector_wear)
+    {
+        file_close(p);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+#endif
+
+void fr_partition_stats_reset(fr_partition_t *p)
+{
+    uint32_t *wear = p->stats.sector_wear;
+    memset(wear, 0, p->size / p->sector_size * sizeof(uint32_t));
+    memset(&p->stats, 0, sizeof(fr_partition_stats_t));
+    p->stats.sector_wear = wear;
+}
+
+void fr_partition_stats_print(fr_partition_t *p)
+{
+    fr_partition_stats_t *s = &p->stats;
+    int n = p->size / p->sector_size;
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (s->sector_wear[i] < min)
+            min = s->sector_wear[i];
+        if (s->sector_wear[i] > max)
+            max = s->sector_wear[i];
+    }
+
+    ESP_LOGI(TAG, "reads %u (%u KB), writes %u (%u KB), erases %u, busy %u ms",
+             s->reads, (unsigned)(s->read_bytes >> 10), s->writes, (unsigned)(s->write_bytes >> 10),
+             s->erases, (unsigned)(s->busy_us / 1000));
+    ESP_LOGI(TAG, "wear per sector min %u, avg %.1f, max %u, violations %u",
+             min, (float)s->erases / n, max, s->violations);
+}
+
+void fr_partition_close(fr_partition_t *p)
+{
+    if (NULL == p)
+        return;
+    p->ops->close(p);
+    free(p->stats.sector_wear);
+    free(p);
+}
+
+esp_err_t fr_partition_import(fr_partition_t *p, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (NULL == f)
+    {
+        ESP_LOGE(TAG, "Can not open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint8_t *buf = (uint8_t *)malloc(p->sector_size);
+    if (NULL == buf)
+    {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // a short image leaves the rest of the partition erased
+    esp_err_t ret = ESP_OK;
+    for (size_t offset = 0; (offset < p->size) && (ESP_OK == ret); offset += p->sector_size)
+    {
+        size_t n = fread(buf, 1, p->sector_size, f);
+        memset(buf + n, 0xFF, p->sector_size - n);
+        ret = fr_partition_erase(p, offset, p->sector_size);
+        if (ESP_OK == ret)
+            ret = fr_partition_write(p, offset, buf, p->sector_size);
+    }
+    free(buf);
+    fclose(f);
+    return ret;
+}
+
+esp_err_t fr_partition_export(fr_partition_t *p, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (NULL == f)
+    {
+        ESP_LOGE(TAG, "Can not open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint8_t *buf = (uint8_t *)malloc(p->sector_size);
+    if (NULL == buf)
+    {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = ESP_OK;
+    for (size_t offset = 0; (offset < p->size) && (ESP_OK == ret); offset += p->sector_size)
+    {
+        ret = fr_partition_read(p, offset, buf, p->sector_size);
+        if ((ESP_OK == ret) && (fwrite(buf, 1, p->sector_size, f) != p->sector_size))
+            ret = ESP_FAIL;
+    }
+    free(buf);
+    if (fclose(f))
+        ret = ESP_FAIL;
+    return ret;
+}
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "fr_search.h"
+
+static const char *TAG = "fr_search";
+
+static void fr_search_tail_norm(const fptp_t *vec, uint16_t dim, uint16_t block, uint16_t n_blocks, fptp_t *tail_norm)
+{
+    // accumulate from the end so every tail is one running sum
+    fptp_t sum = 0;
+    for (int k = n_blocks - 1; k >= 0; k--)
+    {
+        int end = DL_IMAGE_MIN((k + 1) * block, dim);
+        for (int i = k * block; i < end; i++)
+            sum += vec[i] * vec[i];
+        tail_norm[k] = sqrtf(sum);
+    }
+}
+
+int8_t fr_search_index_init(fr_search_index_t *index, uint16_t dim, uint16_t block, uint32_t capacity)
+{
+    if (0 == block)
+        block = FR_SEARCH_BLOCK;
+
+    index->dim = dim;
+    index->block = block;
+    index->n_blocks = (dim + block - 1) / block;
+    index->count = 0;
+    index->capacity = capacity;
+    index->vec = (const fptp_t **)dl_lib_calloc(capacity, sizeof(fptp_t *), 0);
+    index->tail_norm = (fptp_t *)dl_lib_calloc(capacity * index->n_blocks, sizeof(fptp_t), 0);
+    if ((NULL == index->vec) || (NULL == index->tail_norm))
+    {
+        fr_search_index_free(index);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void fr_search_index_free(fr_search_index_t *index)
+{
+    if (index->vec)
+        dl_lib_free(index->vec);
+    if (index->tail_norm)
+        dl_lib_free(index->tail_norm);
+    index->vec = NULL;
+    index->tail_norm = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+int32_t fr_search_index_add(fr_search_index_t *index, const fptp_t *vec)
+{
+    if (index->count >= index->capacity)
+        return -1;
+
+    uint32_t n = index->count++;
+    index->vec[n] = vec;
+    fr_search_tail_norm(vec, index->dim, index->block, index->n_blocks, index->tail_norm + n * index->n_blocks);
+    return n;
+}
+
+void fr_search_index_sync(fr_search_index_t *index, face_id_list *l)
+{
+    assert(index->capacity >= l->size);
+    assert(index->dim == l->id_size);
+
+    index->count = 0;
+    for (int i = 0; i < l->count; i++)
+    {
+        uint8_t head = (l->head + i) % l->size;
+        fr_search_index_add(index, l->id_list[head]->item);
+    }
+}
+
+int32_t fr_search_best(fr_search_index_t *index,
+                       const fptp_t *query,
+                       fptp_t floor,
+                       fptp_t *max_similarity,
+                       fr_search_stats_t *stats)
+{
+    uint16_t dim = index->dim;
+    uint16_t block = index->block;
+    uint16_t n_blocks = index->n_blocks;
+    fptp_t q_tail[n_blocks];
+    fr_search_tail_norm(query, dim, block, n_blocks, q_tail);
+
+    fptp_t best = -1;
+    int32_t best_n = -1;
+    uint32_t pruned = 0;
+    uint64_t dims = 0;
+
+    for (uint32_t n = 0; n < index->count; n++)
+    {
+        const fptp_t *x = index->vec[n];
+        const fptp_t *x_tail = index->tail_norm + n * n_blocks;
+        fptp_t cutoff = DL_IMAGE_MAX(best, floor);
+        fptp_t dist = 0;
+        int k = 0;
+        int i = 0;
+
+        for (k = 0; k < n_blocks; k++)
+        {
+            if (k && (dist + q_tail[k] * x_tail[k] + FR_SEARCH_EPSILON < cutoff))
+                break;
+
+            // same order as cos_distance_unit_id, only paused between blocks
+            int end = DL_IMAGE_MIN(i + block, dim);
+            for (; i < end; i++)
+                dist += x[i] * query[i];
+        }
+        dims += i;
+
+        if (k < n_blocks)
+        {
+            pruned++;
+            continue;
+        }
+
+        if ((dist > best) && (dist >= floor))
+        {
+            best = dist;
+            best_n = n;
+        }
+    }
+
+    if (stats)
+    {
+        stats->candidates += index->count;
+        stats->pruned += pruned;
+        stats->dims += dims;
+    }
+
+    *max_similarity = best;
+    return best_n;
+}
+
+int8_t recognize_face_id_pruned(face_id_list *l,
+                                fr_search_index_t *index,
+                                dl_matrix3d_t *face_id,
+                                fptp_t *max_similarity)
+{
+    int32_t n = fr_search_best(index, face_id->item, FACE_REC_THRESHOLD, max_similarity, NULL);
+    if (n < 0)
+        return -1;
+    return (l->head + n) % l->size;
+}
+
+static void fr_search_random_unit(fptp_t *vec, uint16_t dim)
+{
+    fptp_t norm = 0;
+    for (int i = 0; i < dim; i++)
+    {
+        vec[i] = (fptp_t)rand() / RAND_MAX - 0.5f;
+        norm += vec[i] * vec[i];
+    }
+    norm = sqrtf(norm);
+    for (int i = 0; i < dim; i++)
+        vec[i] /= norm;
+}
+
+int8_t fr_search_benchmark(uint32_t n_ids, uint16_t dim, uint32_t n_queries, fptp_t noise)
+{
+    int8_t ret = ESP_OK;
+    fr_search_index_t index;
+    fr_search_stats_t stats = {0};
+    fptp_t *gallery = (fptp_t *)dl_lib_calloc(n_ids * dim, sizeof(fptp_t), 0);
+    fptp_t *query = (fptp_t *)dl_lib_calloc(dim, sizeof(fptp_t), 0);
+    fptp_t *perturb = (fptp_t *)dl_lib_calloc(dim, sizeof(fptp_t), 0);
+    if ((NULL == gallery) || (NULL == query) || (NULL == perturb) || (ESP_OK != fr_search_index_init(&index, dim, 0, n_ids)))
+    {
+        ESP_LOGE(TAG, "Out of memory for %u ids", n_ids);
+        if (gallery)
+            dl_lib_free(gallery);
+        if (query)
+            dl_lib_free(query);
+        if (perturb)
+            dl_lib_free(perturb);
+        return ESP_FAIL;
+    }
+
+    srand(n_ids);
+    for (uint32_t n = 0; n < n_ids; n++)
+    {
+        fr_search_random_unit(gallery + n * dim, dim);
+        fr_search_index_add(&index, gallery + n * dim);
+    }
+
+    int64_t exhaustive_us = 0;
+    int64_t pruned_us = 0;
+    for (uint32_t q = 0; q < n_queries; q++)
+    {
+        const fptp_t *target = gallery + (rand() % n_ids) * dim;
+        fr_search_random_unit(perturb, dim);
+        fptp_t norm = 0;
+        for (int i = 0; i < dim; i++)
+        {
+            query[i] = target[i] + noise * perturb[i];
+            norm += query[i] * query[i];
+        }
+        norm = sqrtf(norm);
+        for (int i = 0; i < dim; i++)
+            query[i] /= norm;
+
+        int64_t start = esp_timer_get_time();
+        fptp_t best = -1;
+        int32_t best_n = -1;
+        for (uint32_t n = 0; n < n_ids; n++)
+        {
+            const fptp_t *x = gallery + n * dim;
+            fptp_t dist = 0;
+            for (int i = 0; i < dim; i++)
+                dist += x[i] * query[i];
+            if (dist > best)
+            {
+                best = dist;
+                best_n = n;
+            }
+        }
+        exhaustive_us += esp_timer_get_time() - start;
+
+        start = esp_timer_get_time();
+        fptp_t pruned_best = -1;
+        int32_t pruned_n = fr_search_best(&index, query, -1, &pruned_best, &stats);
+        pruned_us += esp_timer_get_time() - start;
+
+        if ((pruned_n != best_n) || (memcmp(&pruned_best, &best, sizeof(fptp_t))))
+        {
+            ESP_LOGE(TAG, "Mismatch on query %u: %d %.9f vs %d %.9f", q, best_n, best, pruned_n, pruned_best);
+            ret = ESP_FAIL;
+        }
+    }
+
+    ESP_LOGI(TAG, "%u ids x %u dims, %u queries", n_ids, dim, n_queries);
+    ESP_LOGI(TAG, "exhaustive: %d us/query", (int)(exhaustive_us / DL_IMAGE_MAX(n_queries, 1)));
+    ESP_LOGI(TAG, "pruned    : %d us/query, %.1f%% candidates pruned, %.1f%% dims evaluated",
+             (int)(pruned_us / DL_IMAGE_MAX(n_queries, 1)),
+             stats.candidates ? 100.0f * stats.pruned / stats.candidates : 0.0f,
+             stats.candidates ? 100.0f * stats.dims / ((float)stats.candidates * dim) : 0.0f);
+
+    fr_search_index_free(&index);
+    dl_lib_free(gallery);
+    dl_lib_free(query);
+    dl_lib_free(perturb);
+    return ret;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "fr_forward.h"
+
+#define FACE_QUALITY_ROLL_MAX 0.6f      /*!< radian, align_face corrects smaller rolls */
+#define FACE_QUALITY_EYE_DIST_MIN 10.0f /*!< pixel, below this the aligned face is mostly upsampled */
+#define FACE_QUALITY_SHARPNESS_MIN 20   /*!< mean squared gradient of the aligned luma */
+#define FACE_QUALITY_BRIGHTNESS_MIN 40
+#define FACE_QUALITY_BRIGHTNESS_MAX 215
+#define FACE_QUALITY_CLIP_PERCENT_MAX 30 /*!< percentage of pixels allowed to be crushed or saturated */
+
+#define FACE_QUALITY_SKIPPED -3 /*!< returned by the gated paths when the face is not good enough */
+
+    typedef enum
+    {
+        FACE_QUALITY_OK = 0, /*!< Face is good for recognition */
+        FACE_QUALITY_POSE,   /*!< Face is not frontal */
+        FACE_QUALITY_SMALL,  /*!< Eye distance is too small */
+        FACE_QUALITY_BLUR,   /*!< Aligned face lacks detail */
+        FACE_QUALITY_DARK,   /*!< Aligned face is under exposed */
+        FACE_QUALITY_BRIGHT, /*!< Aligned face is over exposed */
+        FACE_QUALITY_REASON_MAX,
+    } face_quality_reason_t;
+
+    typedef struct
+    {
+        float ne_ratio_min;         /*!< min ratio of nose-to-left-eye and nose-to-right-eye distance */
+        float ne_ratio_max;         /*!< max ratio of nose-to-left-eye and nose-to-right-eye distance */
+        float roll_max;             /*!< max absolute roll of the eye line, in radian */
+        float eye_dist_min;         /*!< min eye distance in the source image */
+        uint32_t sharpness_min;     /*!< min mean squared gradient */
+        uint8_t brightness_min;     /*!< min mean luma */
+        uint8_t brightness_max;     /*!< max mean luma */
+        uint8_t clip_percent_max;   /*!< max percentage of pixels at either end of the histogram */
+    } face_quality_config_t;
+
+    typedef struct
+    {
+        face_quality_reason_t reason; /*!< the first failed check, FACE_QUALITY_OK if all passed */
+        float ne_ratio;               /*!< ratio of nose-to-left-eye and nose-to-right-eye distance */
+        float roll;                   /*!< roll of the eye line, in radian */
+        float eye_dist;               /*!< eye distance in the source image */
+        uint32_t sharpness;           /*!< mean squared gradient of the aligned luma */
+        uint8_t brightness;           /*!< mean luma of the aligned face */
+        uint8_t dark_percent;         /*!< percentage of crushed pixels */
+        uint8_t bright_percent;       /*!< percentage of saturated pixels */
+    } face_quality_t;
+
+    typedef struct
+    {
+        uint32_t checked;                           /*!< number of faces checked */
+        uint32_t rejected[FACE_QUALITY_REASON_MAX]; /*!< number of faces rejected for each reason, [FACE_QUALITY_OK] counts the passed ones */
+    } face_quality_stats_t;
+
+    /**
+     * @brief Fill the config with the default thresholds.
+     *
+     * @param config            Quality config
+     */
+    static inline void face_quality_config_init(face_quality_config_t *config)
+    {
+        config->ne_ratio_min = NOSE_EYE_RATIO_THRES_MIN;
+        config->ne_ratio_max = NOSE_EYE_RATIO_THRES_MAX;
+        config->roll_max = FACE_QUALITY_ROLL_MAX;
+        config->eye_dist_min = FACE_QUALITY_EYE_DIST_MIN;
+        config->sharpness_min = FACE_QUALITY_SHARPNESS_MIN;
+        config->brightness_min = FACE_QUALITY_BRIGHTNESS_MIN;
+        config->brightness_max = FACE_QUALITY_BRIGHTNESS_MAX;
+        config->clip_percent_max = FACE_QUALITY_CLIP_PERCENT_MAX;
+    }
+
+    /**
+     * @brief Score the pose from the five landmarks, no pixel is touched.
+     *
+     * @param landmark          landmark_p of one detected face
+     * @param config            Quality config
+     * @param result            ne_ratio, roll and eye_dist are filled
+     * @return face_quality_reason_t    FACE_QUALITY_OK, FACE_QUALITY_POSE or FACE_QUALITY_SMALL
+     */
+    face_quality_reason_t face_quality_pose(fptp_t *landmark,
+                                            face_quality_config_t *config,
+                                            face_quality_t *result);
+
+    /**
+     * @brief Score sharpness and exposure of an aligned face in a single pass.
+     *        The outer eighth of the crop is skipped, it may contain the zero border of the warp.
+     *
+     * @param aligned_face      Output of align_face, rgb888
+     * @param config            Quality config
+     * @param result            sharpness, brightness, dark_percent and bright_percent are filled
+     * @return face_quality_reason_t    FACE_QUALITY_OK, FACE_QUALITY_BLUR, FACE_QUALITY_DARK or FACE_QUALITY_BRIGHT
+     */
+    face_quality_reason_t face_quality_image(dl_matrix3du_t *aligned_face,
+                                             face_quality_config_t *config,
+                                             face_quality_t *result);
+
+    /**
+     * @brief Run the pose check and, if it passes and aligned_face is given, the image checks.
+     *
+     * @param landmark          landmark_p of one detected face
+     * @param aligned_face      Output of align_face, NULL to check the pose only
+     * @param config            Quality config, NULL for the defaults
+     * @param result            Quality result
+     * @param stats             Per-reason counters, can be NULL
+     * @return face_quality_reason_t    The first failed check, FACE_QUALITY_OK if all passed
+     */
+    face_quality_reason_t face_quality_check(fptp_t *landmark,
+                                             dl_matrix3du_t *aligned_face,
+                                             face_quality_config_t *config,
+                                             face_quality_t *result,
+                                             face_quality_stats_t *stats);
+
+    /**
+     * @brief Reset the per-reason counters.
+     *
+     * @param stats             Per-reason counters
+     */
+    void face_quality_stats_reset(face_quality_stats_t *stats);
+
+    /**
+     * @brief Print the per-reason counters.
+     *
+     * @param stats             Per-reason counters
+     */
+    void face_quality_stats_print(face_quality_stats_t *stats);
+
+    /**
+     * @brief Run recognize_face only if the face passed the quality check.
+     *
+     * @param l                     An ID list
+     * @param aligned_face          An aligned face
+     * @param quality               Result of face_quality_check
+     * @return FACE_QUALITY_SKIPPED Face skipped, get_face_id is not run
+     * @return others               Same as recognize_face
+     */
+    int8_t recognize_face_with_quality(face_id_list *l,
+                                       dl_matrix3du_t *aligned_face,
+                                       face_quality_t *quality);
+
+    /**
+     * @brief Run enroll_face only if the face passed the quality check.
+     *        A skipped face does not count as one of the confirm_times samples, the enrollment is deferred to the next good face.
+     *
+     * @param l                     Face id list
+     * @param aligned_face          An aligned face
+     * @param quality               Result of face_quality_check
+     * @return FACE_QUALITY_SKIPPED Face skipped, get_face_id is not run
+     * @return others               Same as enroll_face
+     */
+    int8_t enroll_face_with_quality(face_id_list *l,
+                                    dl_matrix3du_t *aligned_face,
+                                    face_quality_t *quality);
+
+#if __cplusplus
+}
+#endif
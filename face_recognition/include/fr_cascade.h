@@ -0,0 +1,92 @@
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "fr_forward.h"
+
+#define FR_CASCADE_BAND_LOW (FACE_REC_THRESHOLD - 0.1f)
+#define FR_CASCADE_BAND_HIGH (FACE_REC_THRESHOLD + 0.15f)
+
+    typedef struct
+    {
+        uint32_t recognized; /*!< number of recognize calls */
+        uint32_t escalated;  /*!< number of recognize calls that needed the precise model */
+    } fr_cascade_stats_t;
+
+    typedef struct
+    {
+        face_id_list fast;        /*!< gallery of the fast model */
+        face_id_list precise;     /*!< gallery of the precise model, same ids at the same index as fast */
+        fptp_t band_low;          /*!< fast similarity below this is a sure miss */
+        fptp_t band_high;         /*!< fast similarity at or above this is a sure hit */
+        fptp_t threshold;         /*!< precise similarity needed for a hit */
+        fr_cascade_stats_t stats; /*!< escalation counters */
+    } fr_cascade_t;
+
+    /**
+     * @brief Initialize the two galleries of a cascaded recognizer.
+     *
+     * @param c                    Cascaded recognizer
+     * @param size                 Size of each gallery
+     * @param confirm_times        Enroll times for one id
+     * @param fast_model           Model run on every face
+     * @param precise_model        Model run only when the fast similarity falls in [band_low, band_high)
+     * @param mode                 Conv implementation of both models
+     * @return ESP_OK              Success
+     * @return ESP_FAIL            One of the models is not linked
+     */
+    int8_t fr_cascade_init(fr_cascade_t *c,
+                           uint8_t size,
+                           uint8_t confirm_times,
+                           fr_model_t fast_model,
+                           fr_model_t precise_model,
+                           dl_conv_mode mode);
+
+    /**
+     * @brief Free the ids and the id lists of both galleries.
+     *
+     * @param c                    Cascaded recognizer
+     */
+    void fr_cascade_deinit(fr_cascade_t *c);
+
+    /**
+     * @brief Match the face with the fast model, and with the precise model only if the fast result is uncertain.
+     *
+     * @param c                    Cascaded recognizer
+     * @param aligned_face         An aligned face
+     * @return int8_t              Matched id, -1 if no match
+     */
+    int8_t fr_cascade_recognize(fr_cascade_t *c, dl_matrix3du_t *aligned_face);
+
+    /**
+     * @brief Enroll the face into both galleries.
+     *
+     * @param c                    Cascaded recognizer
+     * @param aligned_face         An aligned face
+     * @return -1                  Model failed
+     * @return 0                   Enrollment finish
+     * @return >=1                 The left piece of aligned faces should be input
+     */
+    int8_t fr_cascade_enroll(fr_cascade_t *c, dl_matrix3du_t *aligned_face);
+
+    /**
+     * @brief Delete the oldest id from both galleries.
+     *
+     * @param c                    Cascaded recognizer
+     * @return uint8_t             The number of IDs remaining
+     */
+    uint8_t fr_cascade_delete(fr_cascade_t *c);
+
+    /**
+     * @brief Print how often the precise model was needed.
+     *
+     * @param c                    Cascaded recognizer
+     */
+    void fr_cascade_stats_print(fr_cascade_t *c);
+
+#if __cplusplus
+}
+#endif
@@ -6,12 +6,28 @@ extern "C"
 #endif
 
 #include "fr_forward.h"
+#include "fr_partition.h"
 
 #define FR_FLASH_TYPE   32
 #define FR_FLASH_SUBTYPE   32
 #define FR_FLASH_PARTITION_NAME "fr"
 #define FR_FLASH_INFO_FLAG 12138
-        
+
+    /**
+     * @brief Partition used by the functions below, FR_FLASH_PARTITION_NAME opened on first use.
+     *
+     * @return fr_partition_t*      NULL if the partition is not found
+     */
+    fr_partition_t *fr_flash_get_partition(void);
+
+    /**
+     * @brief Redirect the functions below to another partition, e.g. fr_partition_open_file on the host.
+     *        A partition opened by fr_flash_get_partition is closed, p stays owned by the caller.
+     *
+     * @param p                     Partition, NULL to go back to FR_FLASH_PARTITION_NAME
+     */
+    void fr_flash_set_partition(fr_partition_t *p);
+
      /**
      * @brief Produce face id according to the input aligned face, and save it to dest_id and flash.
      * 
@@ -40,8 +56,11 @@ extern "C"
     /**
      * @brief Read the enrolled face IDs from the flash.
      * 
-     * @param l                     Face id list
-     * @return int8_t               The number of IDs remaining in flash
+     * @param l                     Face id list, initialized for the model that enrolled the IDs
+     * @return -1                   Flash partition not found
+     * @return -2                   No IDs in flash
+     * @return -3                   The IDs in flash are from another model or of another length, l is unchanged
+     * @return >=0                  The number of IDs remaining in flash
      */
     int8_t read_face_id_from_flash(face_id_list *l);
     
@@ -77,6 +96,17 @@ extern "C"
      */
     void delete_face_all_in_flash_with_name(face_id_name_list *l);
 
+    /**
+     * @brief Measure enrollment throughput and flash wear: enroll random ids with names, deleting the oldest
+     *        once the gallery is full. The ids in the partition are lost.
+     *
+     * @param cycles                Number of enrollments
+     * @param gallery_size          Number of ids kept in the partition
+     * @return ESP_OK               Success
+     * @return ESP_FAIL             Partition not found or enrollment failed
+     */
+    int fr_flash_benchmark(uint32_t cycles, uint8_t gallery_size);
+
 #if __cplusplus
 }
 #endif
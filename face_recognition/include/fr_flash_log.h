@@ -0,0 +1,199 @@
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "fr_forward.h"
+#include "fr_partition.h"
+
+#define FR_LOG_SECTOR_MAGIC 0x474C5246 /*!< "FRLG" */
+#define FR_LOG_RECORD_MAGIC 0xFA5E
+#define FR_LOG_VERSION 1
+#define FR_LOG_RESERVE_SECTORS 2 /*!< free sectors kept for compaction */
+
+    typedef struct
+    {
+        uint32_t id;     /*!< record id of the face, unique for the life of the log */
+        uint32_t offset; /*!< partition offset of the current copy of the record */
+        uint16_t size;   /*!< bytes of the record, header included */
+    } fr_log_entry_t;
+
+    typedef struct
+    {
+        fr_partition_t *part;   /*!< backing partition */
+        uint16_t n_sectors;     /*!< sectors of the partition */
+        uint16_t tail;          /*!< oldest sector of the log */
+        uint16_t head;          /*!< sector being written */
+        uint32_t head_offset;   /*!< partition offset of the next byte to write */
+        uint32_t sector_seq;    /*!< sequence number of the head sector */
+        uint32_t next_seq;      /*!< sequence number of the next record */
+        uint32_t next_id;       /*!< record id of the next enrolled face */
+        uint32_t *used_bytes;   /*!< per sector, bytes of the records starting in it */
+        uint32_t *live_bytes;   /*!< per sector, bytes of the live records starting in it */
+        fr_log_entry_t *entry;  /*!< live faces, same order as the nodes of the list */
+        uint16_t count;         /*!< number of live faces */
+        uint16_t capacity;      /*!< allocated entries */
+        uint32_t erase_count;   /*!< sectors erased since open */
+        void *lock;             /*!< mutex held by the calls that change the log */
+    } fr_log_t;
+
+    typedef struct
+    {
+        fr_log_t *log;          /*!< log the batch goes to */
+        face_id_name_list *l;   /*!< list kept in step with the log */
+        uint16_t n_existing;    /*!< ids of the list when the batch began */
+        uint16_t n_staged;      /*!< ids enrolled in the batch */
+        uint16_t capacity;      /*!< allocated staged ids */
+        uint16_t n_alive;       /*!< ids once the batch commits */
+        char *name;             /*!< names, the existing ids first, then the staged ones */
+        uint8_t *alive;         /*!< 0 once deleted in the batch */
+        fptp_t *vec;            /*!< vectors of the staged ids */
+    } fr_log_batch_t;
+
+    /**
+     * @brief Open the log on a partition and rebuild the gallery from it.
+     *        Sectors are chained by their sequence numbers, records are checked by CRC, torn or orphan data is skipped,
+     *        and live faces are appended to the list in enrollment order. A partition without a valid log is formatted.
+     *
+     * @param log               Log
+     * @param part              Partition, see fr_partition_open_flash and fr_partition_open_file
+     * @param l                 Empty face id list with name, initialized
+     * @return ESP_OK           Success
+     * @return others           Partition error or out of memory, the partition is left untouched and l may be partly filled
+     */
+    esp_err_t fr_log_open(fr_log_t *log, fr_partition_t *part, face_id_name_list *l);
+
+    /**
+     * @brief Free the log, the partition stays open.
+     *
+     * @param log               Log
+     */
+    void fr_log_close(fr_log_t *log);
+
+    /**
+     * @brief Erase the partition and start an empty log.
+     *
+     * @param log               Log
+     * @return ESP_OK           Success
+     */
+    esp_err_t fr_log_format(fr_log_t *log);
+
+    /**
+     * @brief Enroll like enroll_face_with_name, and append the finished id to the log.
+     *        No sector is erased unless the log has to compact to make room.
+     *
+     * @param log               Log
+     * @param l                 Face id list with name
+     * @param new_id            A face id that need to be enrolled
+     * @param name              name corresponding to the face id
+     * @return -2               Log is full, the id is dropped from the list as well
+     * @return 0                Enrollment finish
+     * @return >=1              The left piece of aligned faces should be input
+     */
+    int8_t fr_log_enroll_with_name(fr_log_t *log, face_id_name_list *l, dl_matrix3d_t *new_id, char *name);
+
+    /**
+     * @brief Delete like delete_face_with_name, and append a tombstone to the log.
+     *
+     * @param log               Log
+     * @param l                 Face id list with name
+     * @param name              The name that needs to be deleted
+     * @return -3               Name not found
+     * @return -2               Log is full, the id is kept in the list
+     * @return >=0              The number of IDs remaining
+     */
+    int fr_log_delete_with_name(fr_log_t *log, face_id_name_list *l, char *name);
+
+    /**
+     * @brief Delete all the ids of the list and format the log.
+     *
+     * @param log               Log
+     * @param l                 Face id list with name
+     */
+    void fr_log_delete_all_with_name(fr_log_t *log, face_id_name_list *l);
+
+    /**
+     * @brief Begin a batch of enrollments and deletions, staged in RAM until fr_log_batch_commit.
+     *        Nothing else may write to the log or change the list until the batch is committed or aborted.
+     *
+     * @param b                 Batch
+     * @param log               Log
+     * @param l                 Face id list with name
+     * @return ESP_OK           Success
+     * @return ESP_ERR_NO_MEM   Out of memory
+     */
+    esp_err_t fr_log_batch_begin(fr_log_batch_t *b, fr_log_t *log, face_id_name_list *l);
+
+    /**
+     * @brief Stage the enrollment of a finished face id.
+     *
+     * @param b                 Batch
+     * @param face_id           Face id, l->id_size long
+     * @param name              name corresponding to the face id
+     * @return ESP_OK           Success
+     * @return ESP_ERR_NO_MEM   Out of memory, or the list would go beyond 255 ids
+     */
+    esp_err_t fr_log_batch_enroll(fr_log_batch_t *b, dl_matrix3d_t *face_id, const char *name);
+
+    /**
+     * @brief Stage the deletion of the first id with the name, existing or staged.
+     *
+     * @param b                 Batch
+     * @param name              The name that needs to be deleted
+     * @return -3               Name not found
+     * @return >=0              The number of IDs remaining once the batch commits
+     */
+    int fr_log_batch_delete(fr_log_batch_t *b, const char *name);
+
+    /**
+     * @brief Write the batch and apply it to the list, then free it.
+     *        The records go out as sequential sector sized writes and are followed by a single commit record.
+     *        A batch cut short by a power loss is dropped as a whole by fr_log_open.
+     *
+     * @param b                 Batch
+     * @return ESP_OK           Success
+     * @return ESP_ERR_NO_MEM   Log is full, nothing is applied
+     * @return others           Partition error, nothing is applied
+     */
+    esp_err_t fr_log_batch_commit(fr_log_batch_t *b);
+
+    /**
+     * @brief Drop a batch, nothing is written.
+     *
+     * @param b                 Batch
+     */
+    void fr_log_batch_abort(fr_log_batch_t *b);
+
+    /**
+     * @brief Compact the oldest sector if it holds garbage, or if the log holds a sector worth of garbage.
+     *        Live records are copied to the head and the sector is erased. Call it from an idle task,
+     *        the log calls take a mutex. The list itself is not guarded, enroll, delete and recognize on one task.
+     *
+     * @param log               Log
+     * @return 1                One sector compacted
+     * @return 0                Nothing to do
+     * @return <0               Partition error
+     */
+    int fr_log_compact_step(fr_log_t *log);
+
+    /**
+     * @brief Bytes that can still be appended before compaction is needed.
+     *
+     * @param log               Log
+     * @return uint32_t         Free bytes, reserve excluded
+     */
+    uint32_t fr_log_free_bytes(fr_log_t *log);
+
+    /**
+     * @brief Bytes of deleted or superseded records.
+     *
+     * @param log               Log
+     * @return uint32_t         Garbage bytes
+     */
+    uint32_t fr_log_garbage_bytes(fr_log_t *log);
+
+#if __cplusplus
+}
+#endif
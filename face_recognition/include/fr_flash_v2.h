@@ -0,0 +1,101 @@
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "fr_flash.h"
+
+#define FR_FLASH_V2_MAGIC 0x32475246 /*!< "FRG2" */
+#define FR_FLASH_V2_VERSION 2
+#define FR_FLASH_V2_NAMES 0x01 /*!< the image has a name table */
+
+    typedef enum
+    {
+        FR_FLASH_F32 = 0, /*!< float, 4 bytes per element */
+        FR_FLASH_F16 = 1, /*!< IEEE half, 2 bytes per element */
+        FR_FLASH_I8 = 2,  /*!< int8 with one float scale per vector, 1 byte per element */
+    } fr_flash_dtype_t;
+
+    /*
+     * The partition holds two image slots, at 0 and at the middle. A save goes to the slot not holding the newest
+     * image and writes the header last, so the previous image stays valid until the new one is complete.
+     * An image is the header, the packed name table (count NUL terminated names) and the vectors, 4 byte aligned.
+     */
+    typedef struct
+    {
+        uint32_t magic;       /*!< FR_FLASH_V2_MAGIC */
+        uint16_t version;     /*!< FR_FLASH_V2_VERSION */
+        uint16_t header_size; /*!< sizeof(fr_flash_v2_header_t) */
+        uint32_t generation;  /*!< +1 for each save */
+        uint16_t dim;         /*!< elements of a face id */
+        uint16_t count;       /*!< number of face ids */
+        uint16_t stride;      /*!< bytes of a vector */
+        uint8_t dtype;        /*!< fr_flash_dtype_t */
+        uint8_t flags;        /*!< FR_FLASH_V2_NAMES */
+        uint8_t model;        /*!< fr_model_t that produced the face ids */
+        uint8_t reserved[3];  /*!< 0xFF */
+        uint32_t name_offset; /*!< start of the name table, from the start of the image */
+        uint32_t vec_offset;  /*!< start of the vectors, from the start of the image */
+        uint32_t data_crc;    /*!< crc from name_offset to the end of the vectors */
+        uint32_t header_crc;  /*!< crc of the fields above */
+    } fr_flash_v2_header_t;
+
+    /**
+     * @brief Save the face ids to the partition of fr_flash_get_partition, in the versioned format.
+     *        A save rewrites the whole image in the other slot, erasing every sector it spans. Nothing is written
+     *        if the newest image already holds the same ids in the same format.
+     *
+     * @param l                     Face id list
+     * @param dtype                 Element type of the stored vectors
+     * @return ESP_OK               Success
+     * @return ESP_ERR_NOT_FOUND    Partition not found
+     * @return ESP_ERR_NO_MEM       Image does not fit in a slot, or out of memory
+     * @return ESP_ERR_INVALID_SIZE The partition holds the old layout, which reaches into the second slot
+     */
+    esp_err_t fr_flash_v2_save(face_id_list *l, fr_flash_dtype_t dtype);
+
+    /**
+     * @brief Save the face ids and their names to the partition of fr_flash_get_partition, in the versioned format.
+     *        Costs the same as fr_flash_v2_save.
+     *
+     * @param l                     Face id list with name
+     * @param dtype                 Element type of the stored vectors
+     * @return ESP_OK               Success
+     * @return ESP_ERR_NOT_FOUND    Partition not found
+     * @return ESP_ERR_NO_MEM       Image does not fit in a slot, or out of memory
+     * @return ESP_ERR_INVALID_SIZE The partition holds the old layout, which reaches into the second slot
+     */
+    esp_err_t fr_flash_v2_save_with_name(face_id_name_list *l, fr_flash_dtype_t dtype);
+
+    /**
+     * @brief Load the newest valid image, the ids the list holds are freed first.
+     *        A partition written by enroll_face_id_to_flash is read and migrated to the versioned format.
+     *
+     * @param l                     Face id list, its model and id_size must match the image
+     * @param dtype                 Element type used when migrating
+     * @return >=0                  The number of IDs loaded
+     * @return -1                   Partition not found
+     * @return -2                   No face id in the partition
+     * @return -3                   The image does not match the list
+     */
+    int fr_flash_v2_load(face_id_list *l, fr_flash_dtype_t dtype);
+
+    /**
+     * @brief Load the newest valid image with names, the ids the list holds are freed first.
+     *        A partition written by enroll_face_id_to_flash_with_name is read and migrated to the versioned format.
+     *        The migration is refused, and the old layout kept, if it reaches into the second slot.
+     *
+     * @param l                     Face id list with name, its model and id_size must match the image
+     * @param dtype                 Element type used when migrating
+     * @return >=0                  The number of IDs loaded
+     * @return -1                   Partition not found
+     * @return -2                   No face id in the partition
+     * @return -3                   The image does not match the list
+     */
+    int fr_flash_v2_load_with_name(face_id_name_list *l, fr_flash_dtype_t dtype);
+
+#if __cplusplus
+}
+#endif
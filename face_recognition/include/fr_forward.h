@@ -29,6 +29,43 @@ extern "C"
 #define NOSE_EYE_RATIO_THRES_MIN 0.49f
 #define NOSE_EYE_RATIO_THRES_MAX 2.04f
 
+    typedef enum
+    {
+        FR_MODEL_FRMN = 0,  /*!< frmn_q */
+        FR_MODEL_MFN56_1X,  /*!< mfn56_42m_q */
+        FR_MODEL_MFN56_2X,  /*!< mfn56_72m_q */
+        FR_MODEL_MFN56_3X,  /*!< mfn56_112m_q */
+        FR_MODEL_MFN56_4X,  /*!< mfn56_156m_q */
+        FR_MODEL_MAX,
+    } fr_model_t;
+
+#if CONFIG_FRMN
+#define FR_MODEL_DEFAULT FR_MODEL_FRMN
+#elif CONFIG_MFN56_2X
+#define FR_MODEL_DEFAULT FR_MODEL_MFN56_2X
+#elif CONFIG_MFN56_3X
+#define FR_MODEL_DEFAULT FR_MODEL_MFN56_3X
+#elif CONFIG_MFN56_4X
+#define FR_MODEL_DEFAULT FR_MODEL_MFN56_4X
+#else
+#define FR_MODEL_DEFAULT FR_MODEL_MFN56_1X
+#endif
+
+#if CONFIG_XTENSA_IMPL
+#define FR_CONV_MODE_DEFAULT DL_XTENSA_IMPL
+#else
+#define FR_CONV_MODE_DEFAULT DL_C_IMPL
+#endif
+
+    typedef dl_matrix3dq_t *(*fr_model_forward_t)(dl_matrix3dq_t *in, dl_conv_mode mode);
+
+    typedef struct
+    {
+        const char *name;           /*!< name of the model */
+        fr_model_forward_t forward; /*!< forward function, NULL if the model is not linked */
+        uint16_t id_size;           /*!< length of the face id vector */
+    } fr_model_info_t;
+
 
 #define ENROLL_NAME_LEN 16
     typedef struct tag_face_id_node
@@ -44,6 +81,10 @@ extern "C"
         face_id_node *tail;    /*!< tail pointer of the id list */
         uint8_t count;         /*!< number of enrolled ids */
         uint8_t confirm_times; /*!< images needed for one enrolling */
+        uint8_t confirm_count; /*!< images collected for the id being enrolled */
+        fr_model_t model;      /*!< model producing the face ids */
+        dl_conv_mode mode;     /*!< conv implementation of the model */
+        uint16_t id_size;      /*!< length of the face id vector */
     } face_id_name_list;
 
     typedef struct
@@ -54,6 +95,10 @@ extern "C"
         uint8_t size;            /*!< max len of id list */
         uint8_t confirm_times;   /*!< images needed for one enrolling */
         dl_matrix3d_t **id_list; /*!< stores face id vectors */
+        uint8_t confirm_count;   /*!< images collected for the id being enrolled */
+        fr_model_t model;        /*!< model producing the face ids */
+        dl_conv_mode mode;       /*!< conv implementation of the model */
+        uint16_t id_size;        /*!< length of the face id vector */
     } face_id_list;
 
     /**
@@ -65,6 +110,19 @@ extern "C"
      */
     void face_id_init(face_id_list *l, uint8_t size, uint8_t confirm_times);
 
+    /**
+     * @brief Initialize face id list whose ids are produced by the given model.
+     * 
+     * @param l                    Face id list
+     * @param size                 Size of list, one list contains one vector
+     * @param confirm_times        Enroll times for one id
+     * @param model                Recognition model, must be linked
+     * @param mode                 Conv implementation of the model
+     * @return ESP_OK              Success
+     * @return ESP_FAIL            Model is not linked, the list is not initialized
+     */
+    int8_t face_id_init_with_model(face_id_list *l, uint8_t size, uint8_t confirm_times, fr_model_t model, dl_conv_mode mode);
+
     /**
      * @brief Initialize face id list with name.
      * 
@@ -74,6 +132,28 @@ extern "C"
      */
     void face_id_name_init(face_id_name_list *l, uint8_t size, uint8_t confirm_times);
 
+    /**
+     * @brief Initialize face id list with name whose ids are produced by the given model.
+     * 
+     * @param l                    Face id list
+     * @param size                 Size of list, one list contains one vector
+     * @param confirm_times        Enroll times for one id
+     * @param model                Recognition model, must be linked
+     * @param mode                 Conv implementation of the model
+     * @return ESP_OK              Success
+     * @return ESP_FAIL            Model is not linked, the list is not initialized
+     */
+    int8_t face_id_name_init_with_model(face_id_name_list *l, uint8_t size, uint8_t confirm_times, fr_model_t model, dl_conv_mode mode);
+
+    /**
+     * @brief Get the registry entry of a recognition model.
+     *        Only the model chosen in menuconfig and the ones enabled in "Recognition Model Registry" are linked.
+     * 
+     * @param model                Recognition model
+     * @return fr_model_info_t*    NULL if the model is not linked
+     */
+    const fr_model_info_t *fr_model_get(fr_model_t model);
+
     /**
      * @brief Alloc memory for aligned face.
      * 
@@ -108,13 +188,23 @@ extern "C"
     /**@}*/
 
     /**
-     * @brief Run the face recognition model to get the face feature
+     * @brief Run the face recognition model chosen in menuconfig to get the face feature
      * 
      * @param aligned_face      A 56x56x3 image, the variable need to do align_face first
      * @return face_id          A 512 vector, size (1, 1, 1, 512)
      */
     dl_matrix3d_t *get_face_id(dl_matrix3du_t *aligned_face);
 
+    /**
+     * @brief Run the given face recognition model to get the face feature
+     * 
+     * @param aligned_face      A 56x56x3 image, the variable need to do align_face first
+     * @param model             Recognition model
+     * @param mode              Conv implementation
+     * @return face_id          A vector of id_size of the model, size (1, 1, 1, id_size), NULL if the model is not linked
+     */
+    dl_matrix3d_t *get_face_id_with_model(dl_matrix3du_t *aligned_face, fr_model_t model, dl_conv_mode mode);
+
     /**
      * @brief Add src_id to dest_id
      * 
@@ -124,8 +214,19 @@ extern "C"
     void add_face_id(dl_matrix3d_t *dest_id,
                      dl_matrix3d_t *src_id);
 
+    /**
+     * @brief Find the most similar id in the id_list, no threshold is applied.
+     *
+     * @param l                     An ID list
+     * @param face_id               Face id produced by the model of the list
+     * @param max_similarity        Output, similarity of the returned id, -1 if the list is empty
+     * @return int8_t               Index of the most similar id, -1 if the list is empty
+     */
+    int8_t match_face_id(face_id_list *l, dl_matrix3d_t *face_id, fptp_t *max_similarity);
+
     /**
      * @brief Match face with the id_list, and return matched_id.
+     *        The face id is produced by the model of the list.
      *
      * @param l                     An ID list 
      * @param algined_face          An aligned face
@@ -179,9 +280,9 @@ extern "C"
      * 
      * @param l             Face id list
      * @param name          The name that needs to be deleted
-     * @return int8_t       The number of IDs remaining in face id list
+     * @return int          Position of the deleted id in the list, -1 if the name is not found
      */
-    int8_t delete_face_with_name(face_id_name_list *l, char *name);
+    int delete_face_with_name(face_id_name_list *l, char *name);
     
     /**
      * @brief               Delete all the enrolled face IDs and names paris
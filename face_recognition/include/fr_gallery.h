@@ -0,0 +1,128 @@
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "esp_err.h"
+#include "fr_forward.h"
+
+#ifndef FR_GALLERY_PAGE_IDS
+#define FR_GALLERY_PAGE_IDS 16 /*!< ids per page, a page of 512 element ids is 32KB of vectors */
+#endif
+
+    typedef enum
+    {
+        FR_GALLERY_REJECT = 0, /*!< a full gallery refuses new ids */
+        FR_GALLERY_FIFO = 1,   /*!< a full gallery evicts the oldest enrolled id */
+        FR_GALLERY_LRU = 2,    /*!< a full gallery evicts the id matched least recently */
+    } fr_gallery_policy_t;
+
+    typedef struct
+    {
+        uint32_t id[FR_GALLERY_PAGE_IDS];         /*!< handle of each id, stays the same while the id moves */
+        uint32_t enrolled[FR_GALLERY_PAGE_IDS];   /*!< enrollment order */
+        uint32_t last_match[FR_GALLERY_PAGE_IDS]; /*!< clock of the last match, or of the enrollment */
+        char name[FR_GALLERY_PAGE_IDS][ENROLL_NAME_LEN];
+        fptp_t *vec; /*!< FR_GALLERY_PAGE_IDS x id_size, contiguous, allocated with the page */
+    } fr_gallery_page_t;
+
+    /*
+     * Ids are kept dense: slot i lives in page i / FR_GALLERY_PAGE_IDS, a deleted id is replaced by the last one.
+     * Pages are allocated when the gallery grows into them and freed when it shrinks below them.
+     */
+    typedef struct
+    {
+        uint32_t capacity;          /*!< max number of ids */
+        uint32_t count;             /*!< number of ids */
+        uint32_t n_pages;           /*!< entries of the page table */
+        fr_gallery_page_t **page;   /*!< page table, NULL for pages not in use */
+        uint16_t id_size;           /*!< length of a face id */
+        fr_gallery_policy_t policy; /*!< what to do when full */
+        uint32_t next_id;           /*!< handle of the next id */
+        uint32_t clock;             /*!< +1 for each enrollment or match */
+        uint8_t confirm_times;      /*!< face ids averaged for one enrollment */
+        uint8_t confirm_count;      /*!< face ids collected for the id being enrolled */
+        fptp_t *pending;            /*!< sum of the face ids collected */
+    } fr_gallery_t;
+
+    /**
+     * @brief Initialize an empty gallery, no page is allocated yet.
+     *
+     * @param g                 Gallery
+     * @param capacity          Max number of ids
+     * @param id_size           Length of a face id, see fr_model_get
+     * @param confirm_times     Face ids averaged for one enrollment
+     * @param policy            What to do when full
+     * @return ESP_OK           Success
+     * @return ESP_ERR_NO_MEM   Out of memory
+     */
+    esp_err_t fr_gallery_init(fr_gallery_t *g, uint32_t capacity, uint16_t id_size, uint8_t confirm_times, fr_gallery_policy_t policy);
+
+    /**
+     * @brief Free the pages and the page table.
+     *
+     * @param g                 Gallery
+     */
+    void fr_gallery_free(fr_gallery_t *g);
+
+    /**
+     * @brief Add a finished face id.
+     *
+     * @param g                 Gallery
+     * @param vec               Face id, id_size long
+     * @param name              Name of the id
+     * @param id                Output, handle of the new id, can be NULL
+     * @return ESP_OK           Success
+     * @return ESP_ERR_NO_MEM   Gallery full with FR_GALLERY_REJECT, or out of memory
+     */
+    esp_err_t fr_gallery_add(fr_gallery_t *g, const fptp_t *vec, const char *name, uint32_t *id);
+
+    /**
+     * @brief Enroll like enroll_face_with_name, the id is added once confirm_times face ids are averaged.
+     *
+     * @param g                 Gallery
+     * @param face_id           Face id
+     * @param name              Name of the id
+     * @param id                Output, handle of the new id when the enrollment finishes, can be NULL
+     * @return -2               Gallery full with FR_GALLERY_REJECT, or out of memory
+     * @return 0                Enrollment finish
+     * @return >=1              The left piece of aligned faces should be input
+     */
+    int8_t fr_gallery_enroll(fr_gallery_t *g, dl_matrix3d_t *face_id, const char *name, uint32_t *id);
+
+    /**
+     * @brief Delete an id.
+     *
+     * @param g                 Gallery
+     * @param id                Handle of the id
+     * @return ESP_OK           Success
+     * @return ESP_ERR_NOT_FOUND No such id
+     */
+    esp_err_t fr_gallery_delete(fr_gallery_t *g, uint32_t id);
+
+    /**
+     * @brief Delete the first id with the name.
+     *
+     * @param g                 Gallery
+     * @param name              The name that needs to be deleted
+     * @return ESP_OK           Success
+     * @return ESP_ERR_NOT_FOUND No such name
+     */
+    esp_err_t fr_gallery_delete_name(fr_gallery_t *g, const char *name);
+
+    /**
+     * @brief Match a face id page by page. A match above FACE_REC_THRESHOLD refreshes the id for FR_GALLERY_LRU.
+     *
+     * @param g                 Gallery
+     * @param face_id           Face id
+     * @param max_similarity    Output, best similarity
+     * @param id                Output, handle of the best id, can be NULL
+     * @return const char*      Name of the matched id, NULL if below FACE_REC_THRESHOLD
+     */
+    const char *fr_gallery_recognize(fr_gallery_t *g, dl_matrix3d_t *face_id, fptp_t *max_similarity, uint32_t *id);
+
+#if __cplusplus
+}
+#endif
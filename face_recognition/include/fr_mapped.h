@@ -0,0 +1,111 @@
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "fr_forward.h"
+#include "fr_partition.h"
+
+/*
+ * Layout of enroll_face_id_to_flash_with_name, the vectors are already packed, one FACE_ID_SIZE slot per id.
+ */
+#define FR_MAPPED_NAME_OFFSET (sizeof(int) + sizeof(uint8_t))
+#define FR_MAPPED_VEC_OFFSET 4096
+#define FR_MAPPED_SLOT_SIZE (FACE_ID_SIZE * sizeof(float))
+
+/*
+ * The flag while fr_mapped_compact rewrites the vectors, FR_FLASH_INFO_FLAG with one bit cleared.
+ */
+#define FR_MAPPED_COMPACTING_FLAG (FR_FLASH_INFO_FLAG & ~0x100)
+
+    typedef struct
+    {
+        fr_partition_t *part;    /*!< backing partition */
+        const fptp_t *vec;       /*!< mapped vectors, id i at vec + i * FACE_ID_SIZE, NULL if nothing is mapped */
+        void *map_handle;        /*!< handle of the mapping */
+        uint8_t n_mapped;        /*!< ids in the mapped region */
+        uint8_t n_deleted;       /*!< mapped ids deleted since the last compaction */
+        char *name;              /*!< names of the mapped ids, n_mapped x ENROLL_NAME_LEN */
+        uint8_t *deleted;        /*!< bitmap of the deleted mapped ids */
+        face_id_name_list delta; /*!< ids enrolled since the last compaction, kept in RAM */
+    } fr_mapped_gallery_t;
+
+    /**
+     * @brief Map the ids stored by enroll_face_id_to_flash_with_name, no vector is copied to RAM.
+     *
+     * @param g                 Mapped gallery
+     * @param part              Partition, see fr_partition_open_flash and fr_partition_open_file
+     * @param confirm_times     Enroll times for one new id
+     * @return ESP_OK           Success, an empty partition gives an empty gallery
+     * @return ESP_ERR_INVALID_STATE A compaction was cut short, the gallery starts empty
+     * @return others           Partition error or out of memory
+     */
+    esp_err_t fr_mapped_open(fr_mapped_gallery_t *g, fr_partition_t *part, uint8_t confirm_times);
+
+    /**
+     * @brief Unmap the partition and free the ids in RAM. Call fr_mapped_compact first to keep them.
+     *
+     * @param g                 Mapped gallery
+     */
+    void fr_mapped_close(fr_mapped_gallery_t *g);
+
+    /**
+     * @brief Number of live ids, mapped and in RAM.
+     *
+     * @param g                 Mapped gallery
+     * @return uint16_t         Number of ids
+     */
+    uint16_t fr_mapped_count(fr_mapped_gallery_t *g);
+
+    /**
+     * @brief Match a face id against the mapped ids in place, then against the ids in RAM.
+     *
+     * @param g                 Mapped gallery
+     * @param face_id           Face id
+     * @param max_similarity    Output, best similarity
+     * @return const char*      Name of the matched id, NULL if below FACE_REC_THRESHOLD
+     */
+    const char *fr_mapped_recognize(fr_mapped_gallery_t *g, dl_matrix3d_t *face_id, fptp_t *max_similarity);
+
+    /**
+     * @brief Enroll like enroll_face_with_name, the id stays in RAM until fr_mapped_compact.
+     *
+     * @param g                 Mapped gallery
+     * @param new_id            A face id that need to be enrolled
+     * @param name              name corresponding to the face id
+     * @return 0                Enrollment finish
+     * @return >=1              The left piece of aligned faces should be input
+     */
+    int8_t fr_mapped_enroll(fr_mapped_gallery_t *g, dl_matrix3d_t *new_id, char *name);
+
+    /**
+     * @brief Delete the first id with the name. A mapped id is only marked until fr_mapped_compact.
+     *
+     * @param g                 Mapped gallery
+     * @param name              The name that needs to be deleted
+     * @return -3               Name not found
+     * @return >=0              The number of IDs remaining
+     */
+    int fr_mapped_delete(fr_mapped_gallery_t *g, char *name);
+
+    /**
+     * @brief Rewrite the partition with the live mapped ids followed by the ids in RAM, then map it again.
+     *        Only the sectors whose content changes are erased, and nothing is written if no id was deleted or enrolled
+     *        since the last compaction. The layout stays readable by read_face_id_from_flash_with_name.
+     *
+     * Not power safe: the vectors are moved in place before the names are rewritten. The header is marked first,
+     * so after a cut fr_mapped_open returns ESP_ERR_INVALID_STATE or an empty gallery, never names on the wrong vectors.
+     * If a write fails the gallery maps what the partition holds, the ids in RAM are kept.
+     *
+     * @param g                 Mapped gallery
+     * @return ESP_OK           Success
+     * @return ESP_ERR_NO_MEM   Partition or name table too small
+     * @return others           Partition error
+     */
+    esp_err_t fr_mapped_compact(fr_mapped_gallery_t *g);
+
+#if __cplusplus
+}
+#endif
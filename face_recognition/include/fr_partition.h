@@ -0,0 +1,195 @@
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define FR_PARTITION_SECTOR_SIZE 4096
+
+    typedef struct fr_partition_t fr_partition_t;
+
+    typedef struct
+    {
+        esp_err_t (*read)(fr_partition_t *p, size_t offset, void *dst, size_t len);        /*!< read bytes */
+        esp_err_t (*write)(fr_partition_t *p, size_t offset, const void *src, size_t len); /*!< program bytes, can only clear bits */
+        esp_err_t (*erase)(fr_partition_t *p, size_t offset, size_t len);                  /*!< set sector aligned range to 0xFF */
+        void (*close)(fr_partition_t *p);                                                  /*!< release the backend */
+        esp_err_t (*mmap)(fr_partition_t *p, size_t offset, size_t len, const void **ptr, void **handle); /*!< map a range read-only */
+        void (*munmap)(fr_partition_t *p, void *handle);                                   /*!< release a mapping */
+    } fr_partition_ops_t;
+
+    typedef struct
+    {
+        uint32_t reads;        /*!< read calls */
+        uint32_t writes;       /*!< write calls */
+        uint32_t erases;       /*!< sectors erased */
+        uint64_t read_bytes;   /*!< bytes read */
+        uint64_t write_bytes;  /*!< bytes programmed */
+        uint64_t busy_us;      /*!< time spent in the backend, measured on the chip, modelled by the file backend */
+        uint32_t violations;   /*!< writes that tried to set a programmed bit back to 1 without an erase, checked by the file backend */
+        uint32_t *sector_wear; /*!< erase count of each sector */
+    } fr_partition_stats_t;
+
+    struct fr_partition_t
+    {
+        const fr_partition_ops_t *ops; /*!< backend operations */
+        size_t size;                   /*!< size of the partition in bytes */
+        size_t sector_size;            /*!< erase granularity */
+        void *ctx;                     /*!< backend private data */
+        fr_partition_stats_t stats;    /*!< counters, see fr_partition_stats_reset */
+    };
+
+    typedef struct
+    {
+        size_t sector_size;           /*!< erase granularity, power of 2 */
+        uint32_t read_ns_per_byte;    /*!< modelled read time */
+        uint32_t program_us_per_page; /*!< modelled program time of a 256 byte page */
+        uint32_t erase_us_per_sector; /*!< modelled erase time of a sector */
+        uint8_t strict;               /*!< fail a write that needs an erase first, instead of ANDing it like NOR flash */
+    } fr_partition_file_config_t;
+
+    /**
+     * @brief Default file backend, with the typical timing of the SPI NOR flash of the ESP32 modules.
+     *
+     * @param config            Config to fill
+     */
+    static inline void fr_partition_file_config_init(fr_partition_file_config_t *config)
+    {
+        config->sector_size = FR_PARTITION_SECTOR_SIZE;
+        config->read_ns_per_byte = 25;
+        config->program_us_per_page = 700;
+        config->erase_us_per_sector = 45000;
+        config->strict = 0;
+    }
+
+    /**
+     * @brief Open the face id partition (FR_FLASH_PARTITION_NAME) of the flash.
+     *
+     * @return fr_partition_t*      NULL if the partition is not found
+     */
+    fr_partition_t *fr_partition_open_flash(void);
+
+#ifndef ESP_PLATFORM
+    /**
+     * @brief Open a file as a partition with NOR flash semantics, to run and benchmark the flash code on the host.
+     *        The file is a raw image of the partition, e.g. a dump from esptool.py read_flash, and fr_partition_mmap maps it shared.
+     *
+     * @param path                  Path of the image, a missing file or the part beyond a short one is created erased
+     * @param size                  Size of the partition, multiple of the sector size
+     * @param config                Erase granularity and timing model, NULL for fr_partition_file_config_init
+     * @return fr_partition_t*      NULL if the file can not be opened
+     */
+    fr_partition_t *fr_partition_open_file(const char *path, size_t size, const fr_partition_file_config_t *config);
+#endif
+
+    /**
+     * @brief Close a partition opened by fr_partition_open_*.
+     *
+     * @param p                     Partition
+     */
+    void fr_partition_close(fr_partition_t *p);
+
+    /**
+     * @brief Erase the partition and program a raw image, e.g. a dump read from the chip with esptool.py read_flash.
+     *        The image is the format of fr_partition_open_file, so this copies between a file and the flash or another file.
+     *
+     * @param p                     Partition
+     * @param path                  Raw image, a shorter image leaves the rest erased
+     * @return ESP_OK               Success
+     * @return others               File or partition error
+     */
+    esp_err_t fr_partition_import(fr_partition_t *p, const char *path);
+
+    /**
+     * @brief Save the partition as a raw image that can be written to the chip with esptool.py write_flash.
+     *
+     * @param p                     Partition
+     * @param path                  Raw image to write, p->size bytes
+     * @return ESP_OK               Success
+     * @return others               File or partition error
+     */
+    esp_err_t fr_partition_export(fr_partition_t *p, const char *path);
+
+    static inline esp_err_t fr_partition_read(fr_partition_t *p, size_t offset, void *dst, size_t len)
+    {
+        if (offset + len > p->size)
+            return ESP_ERR_INVALID_SIZE;
+        p->stats.reads++;
+        p->stats.read_bytes += len;
+        return p->ops->read(p, offset, dst, len);
+    }
+
+    static inline esp_err_t fr_partition_write(fr_partition_t *p, size_t offset, const void *src, size_t len)
+    {
+        if (offset + len > p->size)
+            return ESP_ERR_INVALID_SIZE;
+        p->stats.writes++;
+        p->stats.write_bytes += len;
+        return p->ops->write(p, offset, src, len);
+    }
+
+    static inline esp_err_t fr_partition_erase(fr_partition_t *p, size_t offset, size_t len)
+    {
+        if ((offset + len > p->size) || (offset % p->sector_size) || (len % p->sector_size))
+            return ESP_ERR_INVALID_SIZE;
+        for (size_t s = offset / p->sector_size; s < (offset + len) / p->sector_size; s++)
+            p->stats.sector_wear[s]++;
+        p->stats.erases += len / p->sector_size;
+        return p->ops->erase(p, offset, len);
+    }
+
+    /**
+     * @brief Map a range of the partition read-only into the address space.
+     *        Writes to the range are not guaranteed to be visible through an existing mapping, unmap before writing.
+     *
+     * @param p                     Partition
+     * @param offset                Start of the range, no alignment needed
+     * @param len                   Bytes of the range
+     * @param ptr                   Output, address of offset
+     * @param handle                Output, pass to fr_partition_munmap
+     * @return ESP_OK               Success
+     */
+    static inline esp_err_t fr_partition_mmap(fr_partition_t *p, size_t offset, size_t len, const void **ptr, void **handle)
+    {
+        if ((offset + len > p->size) || (0 == len))
+            return ESP_ERR_INVALID_SIZE;
+        return p->ops->mmap(p, offset, len, ptr, handle);
+    }
+
+    static inline void fr_partition_munmap(fr_partition_t *p, void *handle)
+    {
+        p->ops->munmap(p, handle);
+    }
+
+    /**
+     * @brief Clear the counters of a partition.
+     *
+     * @param p                     Partition
+     */
+    void fr_partition_stats_reset(fr_partition_t *p);
+
+    /**
+     * @brief Print the counters and the wear spread of a partition.
+     *
+     * @param p                     Partition
+     */
+    void fr_partition_stats_print(fr_partition_t *p);
+
+    /**
+     * @brief CRC-32 (IEEE 802.3), chainable by passing the previous result as crc, start with 0.
+     *
+     * @param crc                   Previous result
+     * @param data                  Bytes to add
+     * @param len                   Number of bytes
+     * @return uint32_t             CRC of all the bytes so far
+     */
+    uint32_t fr_crc32(uint32_t crc, const void *data, size_t len);
+
+#if __cplusplus
+}
+#endif
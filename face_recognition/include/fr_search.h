@@ -0,0 +1,118 @@
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "fr_forward.h"
+
+#define FR_SEARCH_BLOCK 64      /*!< dimensions evaluated between two bound checks */
+#define FR_SEARCH_EPSILON 1e-4f /*!< margin covering the rounding error of the bound */
+
+    typedef struct
+    {
+        uint16_t dim;       /*!< length of the vectors */
+        uint16_t block;     /*!< dimensions per block */
+        uint16_t n_blocks;  /*!< number of blocks */
+        uint32_t count;     /*!< number of vectors in the index */
+        uint32_t capacity;  /*!< max number of vectors */
+        const fptp_t **vec; /*!< vectors of the gallery, not owned by the index */
+        fptp_t *tail_norm;  /*!< tail_norm[i * n_blocks + k] is the l2 norm of vec[i][k * block ... dim) */
+    } fr_search_index_t;
+
+    typedef struct
+    {
+        uint32_t candidates; /*!< candidates visited */
+        uint32_t pruned;     /*!< candidates dropped before the last block */
+        uint64_t dims;       /*!< dimensions actually multiplied */
+    } fr_search_stats_t;
+
+    /**
+     * @brief Allocate an empty index.
+     *
+     * @param index             Search index
+     * @param dim               Length of the vectors
+     * @param block             Dimensions per block, 0 for FR_SEARCH_BLOCK
+     * @param capacity          Max number of vectors
+     * @return ESP_OK           Success
+     * @return ESP_FAIL         Out of memory
+     */
+    int8_t fr_search_index_init(fr_search_index_t *index, uint16_t dim, uint16_t block, uint32_t capacity);
+
+    /**
+     * @brief Free the index, the vectors are left alone.
+     *
+     * @param index             Search index
+     */
+    void fr_search_index_free(fr_search_index_t *index);
+
+    /**
+     * @brief Append a vector, the index keeps the pointer.
+     *
+     * @param index             Search index
+     * @param vec               Vector of index->dim
+     * @return int32_t          Position of the vector, -1 if the index is full
+     */
+    int32_t fr_search_index_add(fr_search_index_t *index, const fptp_t *vec);
+
+    /**
+     * @brief Rebuild the index from a face id list. Position i of the index is slot (l->head + i) % l->size of the list.
+     *        Call it after every enroll or delete.
+     *
+     * @param index             Search index, capacity >= l->size
+     * @param l                 Face id list
+     */
+    void fr_search_index_sync(fr_search_index_t *index, face_id_list *l);
+
+    /**
+     * @brief Find the most similar vector by inner product, with block-wise pruning.
+     *        After each block the remaining dot product is bounded by |q_tail| * |x_tail| (Cauchy-Schwarz).
+     *        A candidate is dropped once partial + bound + FR_SEARCH_EPSILON < max(best so far, floor).
+     *        The accumulation order is the one of cos_distance_unit_id, so a returned similarity is bit-identical
+     *        to the exhaustive one, and the returned position is identical whenever the best similarity >= floor.
+     *
+     * @param index             Search index
+     * @param query             Query vector of index->dim
+     * @param floor             Similarities below floor are of no interest, -1 to disable
+     * @param max_similarity    Output, similarity of the returned position, -1 if nothing reached floor
+     * @param stats             Search counters, can be NULL
+     * @return int32_t          Position of the most similar vector, -1 if nothing reached floor
+     */
+    int32_t fr_search_best(fr_search_index_t *index,
+                           const fptp_t *query,
+                           fptp_t floor,
+                           fptp_t *max_similarity,
+                           fr_search_stats_t *stats);
+
+    /**
+     * @brief Pruned replacement of match_face_id plus threshold, as used by recognize_face.
+     *
+     * @param l                 Face id list
+     * @param index             Index synced with l
+     * @param face_id           Face id produced by the model of the list
+     * @param max_similarity    Output, similarity of the returned id
+     * @return int8_t           Matched id, -1 if below FACE_REC_THRESHOLD
+     */
+    int8_t recognize_face_id_pruned(face_id_list *l,
+                                    fr_search_index_t *index,
+                                    dl_matrix3d_t *face_id,
+                                    fptp_t *max_similarity);
+
+    /**
+     * @brief Compare exhaustive and pruned search on a synthetic gallery of random unit vectors.
+     *        Each query is a perturbed copy of a random gallery vector. Results are checked for bit-identity and timing is logged.
+     *        The gallery takes n_ids * dim * 4 bytes, 50k ids of 512 only fit on a host build.
+     *
+     * @param n_ids             Gallery size
+     * @param dim               Length of the vectors
+     * @param n_queries         Number of queries
+     * @param noise             Perturbation of the queries, e.g. 0.5
+     * @return ESP_OK           All results identical
+     * @return ESP_FAIL         Mismatch or out of memory
+     */
+    int8_t fr_search_benchmark(uint32_t n_ids, uint16_t dim, uint32_t n_queries, fptp_t noise);
+
+#if __cplusplus
+}
+#endif
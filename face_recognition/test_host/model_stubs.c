@@ -0,0 +1,10 @@
+/*
+ * fr_forward.c links against the models of the prebuilt libraries, which the tests never run.
+ */
+void dl_matrix3d_from_matrixq(void) {}
+void dl_matrixq_from_matrix3d_qmf(void) {}
+void get_similarity_matrix(void) {}
+void image_cropper(void) {}
+void matrix_free(void) {}
+void mfn56_42m_q(void) {}
+void warp_affine(void) {}
@@ -0,0 +1,4 @@
+#pragma once
+
+#define CONFIG_MFN56_1X 1
+#define CONFIG_XTENSA_IMPL 1
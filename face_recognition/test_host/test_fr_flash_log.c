@@ -0,0 +1,363 @@
+/*
+ * Host tests of fr_flash_log.h on the file backend of fr_partition.h.
+ *
+ * - power cut: a scripted run of enrolls, deletes, batches and compactions is cut at every write and erase in turn,
+ *   half of the interrupted write lands. The reopened gallery must hold the ids from before or after the interrupted
+ *   call, and the log must take new enrollments.
+ * - compaction: a long enroll/delete churn on a small partition, checked against a reopen, with the wear of the sectors.
+ * - concurrency: fr_log_compact_step on a second thread while the main thread enrolls and deletes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "fr_flash_log.h"
+
+#define PART_FILE "test_fr_flash_log.bin"
+#define PART_SECTORS 12
+#define MAX_IDS 8
+
+#define CHECK(cond)                                                            \
+    do                                                                         \
+    {                                                                          \
+        if (!(cond))                                                           \
+        {                                                                      \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);             \
+            exit(1);                                                           \
+        }                                                                      \
+    } while (0)
+
+typedef struct
+{
+    int count;
+    char name[MAX_IDS + 4][ENROLL_NAME_LEN];
+    int value[MAX_IDS + 4];
+} gallery_t;
+
+typedef enum
+{
+    STEP_ENROLL,
+    STEP_DELETE,
+    STEP_BATCH,
+    STEP_COMPACT,
+} step_t;
+
+static const fr_partition_ops_t *file_ops;
+static fr_partition_ops_t cut_ops;
+static int events;  /*!< writes and erases so far */
+static int cut_at;  /*!< event losing the power, -1 for none */
+static int powered;
+
+static esp_err_t cut_read(fr_partition_t *p, size_t offset, void *dst, size_t len)
+{
+    return powered ? file_ops->read(p, offset, dst, len) : ESP_FAIL;
+}
+
+static esp_err_t cut_write(fr_partition_t *p, size_t offset, const void *src, size_t len)
+{
+    if (!powered)
+        return ESP_FAIL;
+    if (events++ == cut_at)
+    {
+        powered = 0;
+        if (len / 2)
+            file_ops->write(p, offset, src, len / 2);
+        return ESP_FAIL;
+    }
+    return file_ops->write(p, offset, src, len);
+}
+
+static esp_err_t cut_erase(fr_partition_t *p, size_t offset, size_t len)
+{
+    if (!powered)
+        return ESP_FAIL;
+    if (events++ == cut_at)
+    {
+        // every other cut lets the erase finish before the power goes
+        powered = 0;
+        if (cut_at & 1)
+            file_ops->erase(p, offset, len);
+        return ESP_FAIL;
+    }
+    return file_ops->erase(p, offset, len);
+}
+
+static fr_partition_t *part_open(void)
+{
+    fr_partition_file_config_t config;
+    fr_partition_file_config_init(&config);
+    config.strict = 1;
+    fr_partition_t *p = fr_partition_open_file(PART_FILE, PART_SECTORS * config.sector_size, &config);
+    CHECK(p);
+    file_ops = p->ops;
+    cut_ops = *p->ops;
+    cut_ops.read = cut_read;
+    cut_ops.write = cut_write;
+    cut_ops.erase = cut_erase;
+    p->ops = &cut_ops;
+    return p;
+}
+
+static void part_close(fr_partition_t *p)
+{
+    p->ops = file_ops;
+    fr_partition_close(p);
+}
+
+static dl_matrix3d_t *make_id(int value)
+{
+    dl_matrix3d_t *id = dl_matrix3d_alloc(1, 1, 1, FACE_ID_SIZE);
+    for (int i = 0; i < FACE_ID_SIZE; i++)
+        id->item[i] = value + i * 1e-3f;
+    return id;
+}
+
+static void gallery_add(gallery_t *g, int value)
+{
+    snprintf(g->name[g->count], ENROLL_NAME_LEN, "id%d", value);
+    g->value[g->count] = value;
+    g->count++;
+}
+
+static void gallery_remove(gallery_t *g, int i)
+{
+    memmove(g->name + i, g->name + i + 1, (g->count - i - 1) * ENROLL_NAME_LEN);
+    memmove(g->value + i, g->value + i + 1, (g->count - i - 1) * sizeof(int));
+    g->count--;
+}
+
+static int gallery_equal(const gallery_t *g, face_id_name_list *l)
+{
+    if (g->count != l->count)
+        return 0;
+    face_id_node *p = l->head;
+    for (int i = 0; i < g->count; i++, p = p->next)
+    {
+        if (strcmp(g->name[i], p->id_name) || ((float)g->value[i] != p->id_vec->item[0]))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Run one step of the script on the log and on the model, the model is only changed if the log call succeeds.
+ */
+static int step_run(fr_log_t *log, face_id_name_list *l, gallery_t *g, step_t step, int *next_value)
+{
+    if ((STEP_DELETE == step) && (0 == g->count))
+        step = STEP_ENROLL;
+    if ((STEP_ENROLL == step) && (MAX_IDS <= g->count))
+        step = STEP_DELETE;
+
+    gallery_t after = *g;
+    int ok = 0;
+    if (STEP_ENROLL == step)
+    {
+        dl_matrix3d_t *id = make_id(*next_value);
+        gallery_add(&after, *next_value);
+        ok = (0 == fr_log_enroll_with_name(log, l, id, after.name[after.count - 1]));
+        dl_matrix3d_free(id);
+    }
+    else if (STEP_DELETE == step)
+    {
+        int victim = *next_value % g->count;
+        gallery_remove(&after, victim);
+        ok = (0 <= fr_log_delete_with_name(log, l, (char *)g->name[victim]));
+    }
+    else if (STEP_BATCH == step)
+    {
+        fr_log_batch_t b;
+        ok = (ESP_OK == fr_log_batch_begin(&b, log, l));
+        if (ok && g->count)
+        {
+            fr_log_batch_delete(&b, g->name[0]);
+            gallery_remove(&after, 0);
+        }
+        for (int k = 0; ok && (k < 3) && (after.count < MAX_IDS); k++)
+        {
+            dl_matrix3d_t *id = make_id(*next_value + k);
+            gallery_add(&after, *next_value + k);
+            ok = (ESP_OK == fr_log_batch_enroll(&b, id, after.name[after.count - 1]));
+            dl_matrix3d_free(id);
+        }
+        ok = ok && (ESP_OK == fr_log_batch_commit(&b));
+    }
+    else
+        ok = (0 <= fr_log_compact_step(log));
+
+    *next_value += 3;
+    if (ok)
+        *g = after;
+    return ok;
+}
+
+static void reopen(fr_log_t *log, fr_partition_t *p, face_id_name_list *l)
+{
+    fr_log_close(log);
+    delete_face_all_with_name(l);
+    face_id_name_init(l, MAX_IDS + 4, 1);
+    CHECK(ESP_OK == fr_log_open(log, p, l));
+}
+
+/*
+ * Returns the writes and erases of the script, -1 if the power was cut.
+ */
+static int power_cut_run(int cut, int n_steps)
+{
+    remove(PART_FILE);
+    fr_partition_t *p = part_open();
+    face_id_name_list l;
+    face_id_name_init(&l, MAX_IDS + 4, 1);
+    fr_log_t log;
+    gallery_t g = {0};
+    gallery_t before = g;
+
+    events = 0;
+    cut_at = cut;
+    powered = 1;
+    int opened = (ESP_OK == fr_log_open(&log, p, &l));
+    CHECK(opened || !powered);
+
+    srand(1234);
+    int next_value = 1;
+    for (int i = 0; opened && (i < n_steps); i++)
+    {
+        step_t step = (step_t)(rand() % 4);
+        before = g;
+        if (!step_run(&log, &l, &g, step, &next_value))
+        {
+            CHECK(!powered);
+            break;
+        }
+    }
+    int script_events = powered ? events : -1;
+
+    // reboot, the ids of before or after the interrupted call must come back
+    powered = 1;
+    cut_at = -1;
+    if (opened)
+        reopen(&log, p, &l);
+    else
+        CHECK(ESP_OK == fr_log_open(&log, p, &l));
+    CHECK(gallery_equal(&before, &l) || gallery_equal(&g, &l));
+    if (gallery_equal(&before, &l))
+        g = before;
+
+    // the recovered log takes new ids, and keeps them over another reopen
+    int value = 1000;
+    CHECK(step_run(&log, &l, &g, STEP_ENROLL, &value));
+    reopen(&log, p, &l);
+    CHECK(gallery_equal(&g, &l));
+    CHECK(0 == p->stats.violations);
+
+    fr_log_close(&log);
+    delete_face_all_with_name(&l);
+    part_close(p);
+    return script_events;
+}
+
+static void test_power_cut(void)
+{
+    const int n_steps = 200;
+    int total = power_cut_run(-1, n_steps);
+    for (int cut = 0; cut < total; cut++)
+        CHECK(power_cut_run(cut, n_steps) < 0);
+    printf("power cut: %d cut points\n", total);
+}
+
+static void test_compaction(void)
+{
+    remove(PART_FILE);
+    fr_partition_t *p = part_open();
+    face_id_name_list l;
+    face_id_name_init(&l, MAX_IDS + 4, 1);
+    fr_log_t log;
+    gallery_t g = {0};
+    cut_at = -1;
+    powered = 1;
+    CHECK(ESP_OK == fr_log_open(&log, p, &l));
+
+    int next_value = 1;
+    int compacted = 0;
+    srand(99);
+    for (int i = 0; i < 3000; i++)
+    {
+        CHECK(step_run(&log, &l, &g, (step_t)(rand() % 2), &next_value));
+        if (0 == i % 4)
+            compacted += fr_log_compact_step(&log);
+        if (0 == i % 250)
+        {
+            reopen(&log, p, &l);
+            CHECK(gallery_equal(&g, &l));
+        }
+    }
+    reopen(&log, p, &l);
+    CHECK(gallery_equal(&g, &l));
+    CHECK(0 == p->stats.violations);
+
+    uint32_t min = UINT32_MAX, max = 0;
+    for (int s = 0; s < PART_SECTORS; s++)
+    {
+        min = DL_IMAGE_MIN(min, p->stats.sector_wear[s]);
+        max = DL_IMAGE_MAX(max, p->stats.sector_wear[s]);
+    }
+    CHECK(compacted > 0);
+    CHECK(max <= 2 * min + 2);
+    printf("compaction: %d steps, wear per sector %u..%u\n", compacted, min, max);
+
+    fr_log_close(&log);
+    delete_face_all_with_name(&l);
+    part_close(p);
+}
+
+static int compact_stop;
+
+static void *compact_task(void *arg)
+{
+    fr_log_t *log = (fr_log_t *)arg;
+    while (!__atomic_load_n(&compact_stop, __ATOMIC_RELAXED))
+        CHECK(0 <= fr_log_compact_step(log));
+    return NULL;
+}
+
+static void test_concurrent_compaction(void)
+{
+    remove(PART_FILE);
+    fr_partition_t *p = part_open();
+    face_id_name_list l;
+    face_id_name_init(&l, MAX_IDS + 4, 1);
+    fr_log_t log;
+    gallery_t g = {0};
+    cut_at = -1;
+    powered = 1;
+    CHECK(ESP_OK == fr_log_open(&log, p, &l));
+
+    pthread_t task;
+    __atomic_store_n(&compact_stop, 0, __ATOMIC_RELAXED);
+    CHECK(0 == pthread_create(&task, NULL, compact_task, &log));
+    int next_value = 1;
+    srand(7);
+    for (int i = 0; i < 1000; i++)
+        CHECK(step_run(&log, &l, &g, (step_t)(rand() % 3), &next_value));
+    __atomic_store_n(&compact_stop, 1, __ATOMIC_RELAXED);
+    pthread_join(task, NULL);
+
+    CHECK(gallery_equal(&g, &l));
+    reopen(&log, p, &l);
+    CHECK(gallery_equal(&g, &l));
+    printf("concurrent compaction: ok\n");
+
+    fr_log_close(&log);
+    delete_face_all_with_name(&l);
+    part_close(p);
+}
+
+int main(void)
+{
+    test_power_cut();
+    test_compaction();
+    test_concurrent_compaction();
+    remove(PART_FILE);
+    printf("OK\n");
+    return 0;
+}
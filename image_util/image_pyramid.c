@@ -0,0 +1,125 @@
+/*
+  * ESPRESSIF MIT License
+  *
+  * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+  *
+  * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+  * it is free of charge, to any person obtaining a copy of this software and associated
+  * documentation files (the "Software"), to deal in the Software without restriction, including
+  * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+  * to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all copies or
+  * substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+  *
+  */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "image_pyramid.h"
+
+#include "esp_log.h"
+
+static const char *TAG = "image_pyramid";
+
+static void image_pyramid_add(image_pyramid_t *p, int w, int h, int c, fptp_t scale, int parent)
+{
+    image_pyramid_level_t *l = &p->level[p->n_levels++];
+    l->image.w = w;
+    l->image.h = h;
+    l->image.c = c;
+    l->image.n = 1;
+    l->image.stride = w * c;
+    l->scale = scale;
+    l->offset = p->arena_size;
+    l->parent = parent;
+    p->arena_size += w * h * c;
+}
+
+int image_pyramid_init(image_pyramid_t *p, int src_w, int src_h, int c, fptp_t scale, int levels, int min_size)
+{
+    const fptp_t half_octave = 0.707106781; // sqrt(0.5)
+    memset(p, 0, sizeof(image_pyramid_t));
+    if (levels > IMAGE_PYRAMID_MAX_LEVELS)
+    {
+        ESP_LOGE(TAG, "%d levels asked, a pyramid keeps %d", levels, IMAGE_PYRAMID_MAX_LEVELS);
+        return -2;
+    }
+
+    // same sizes as pnet_forward_fast: round the first level of a chain, halve it down to min_size
+    for (int chain = 0; chain < 2; chain++)
+    {
+        int first = chain ? (levels + 1) / 2 : 0;
+        int last = chain ? levels : (levels + 1) / 2;
+        fptp_t s = chain ? scale * half_octave : scale;
+        int w = round(src_w * s);
+        int h = round(src_h * s);
+        int parent = chain ? 0 : -1;
+        for (int i = first; i < last; i++)
+        {
+            if (DL_IMAGE_MIN(w, h) < min_size)
+                break;
+            // the half-octave chain starts from the first level, not from the source
+            if (chain && (i == first) && (0 == p->n_levels))
+                break;
+            image_pyramid_add(p, w, h, c, s, parent);
+            parent = p->n_levels - 1;
+            w /= 2;
+            h /= 2;
+            s /= 2;
+        }
+    }
+
+    if (0 == p->n_levels)
+        return 0;
+    p->arena = (uint8_t *)dl_lib_calloc(p->arena_size, sizeof(uint8_t), 0);
+    if (NULL == p->arena)
+    {
+        p->n_levels = 0;
+        return -1;
+    }
+    for (int i = 0; i < p->n_levels; i++)
+        p->level[i].image.item = p->arena + p->level[i].offset;
+    return 0;
+}
+
+void image_pyramid_free(image_pyramid_t *p)
+{
+    dl_lib_free(p->arena);
+    p->arena = NULL;
+    p->n_levels = 0;
+}
+
+void image_pyramid_build(image_pyramid_t *p, const dl_matrix3du_t *src)
+{
+    for (int i = 0; i < p->n_levels; i++)
+    {
+        image_pyramid_level_t *l = &p->level[i];
+        dl_matrix3du_t *dst = &l->image;
+        if (l->parent < 0)
+        {
+            // beyond 2x the area average uses every source pixel, bilinear would alias
+            if ((2 * dst->w <= src->w) && (2 * dst->h <= src->h) && (src->stride == src->w * src->c) &&
+                (0 == image_resize_area(dst->item, src->item, dst->w, dst->h, dst->c, src->w, src->h)))
+                continue;
+            image_resize_linear_view(dst, src);
+            continue;
+        }
+
+        dl_matrix3du_t *parent = &p->level[l->parent].image;
+        if ((2 * dst->w <= parent->w) && (2 * dst->h <= parent->h))
+            image_zoom_in_twice(dst->item, dst->w, dst->h, dst->c, parent->item, parent->w, parent->c);
+        else
+            image_resize_linear_view(dst, parent);
+    }
+}
@@ -30,6 +30,11 @@
 #include <string.h>
 #include "image_util.h"
 #include "esp_timer.h"
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 void image_zoom_in_twice(uint8_t *dimage,
                          int dw,
@@ -74,13 +79,290 @@ void image_zoom_in_twice(uint8_t *dimage,
     return;
 }
 
-void image_resize_linear(uint8_t *dst_image, uint8_t *src_image, int dst_w, int dst_h, int dst_c, int src_w, int src_h)
+static void image_resize_linear_float(uint8_t *dst_image, int dst_stride, const uint8_t *src_image, int src_stride, int dst_w, int dst_h, int dst_c, int src_w, int src_h)
 { /*{{{*/
     float scale_x = (float)src_w / dst_w;
     float scale_y = (float)src_h / dst_h;
 
-    int dst_stride = dst_c * dst_w;
-    int src_stride = dst_c * src_w;
+    for (int y = 0; y < dst_h; y++)
+    {
+        float fy[2];
+        fy[0] = (float)((y + 0.5) * scale_y - 0.5); // y
+        int src_y = (int)fy[0];                     // y1
+        fy[0] -= src_y;                             // y - y1
+        fy[1] = 1 - fy[0];                          // y2 - y
+        src_y = DL_IMAGE_MAX(0, src_y);
+        src_y = DL_IMAGE_MIN(src_y, src_h - 2);
+
+        for (int x = 0; x < dst_w; x++)
+        {
+            float fx[2];
+            fx[0] = (float)((x + 0.5) * scale_x - 0.5); // x
+            int src_x = (int)fx[0];                     // x1
+            fx[0] -= src_x;                             // x - x1
+            if (src_x < 0)
+            {
+                fx[0] = 0;
+                src_x = 0;
+            }
+            if (src_x > src_w - 2)
+            {
+                fx[0] = 0;
+                src_x = src_w - 2;
+            }
+            fx[1] = 1 - fx[0]; // x2 - x
+
+            for (int c = 0; c < dst_c; c++)
+            {
+                dst_image[y * dst_stride + x * dst_c + c] = round(src_image[src_y * src_stride + src_x * dst_c + c] * fx[1] * fy[1] + src_image[src_y * src_stride + (src_x + 1) * dst_c + c] * fx[0] * fy[1] + src_image[(src_y + 1) * src_stride + src_x * dst_c + c] * fx[1] * fy[0] + src_image[(src_y + 1) * src_stride + (src_x + 1) * dst_c + c] * fx[0] * fy[0]);
+            }
+        }
+    }
+} /*}}}*/
+
+#define IMAGE_RESIZE_WEIGHT_SHIFT 10
+#define IMAGE_RESIZE_WEIGHT_ONE (1 << IMAGE_RESIZE_WEIGHT_SHIFT)
+
+image_resize_plan_t *image_resize_plan_create(int src_w, int src_h, int dst_w, int dst_h)
+{
+    // one block: the struct, then the int arrays, then the int16_t arrays
+    image_resize_plan_t *plan = (image_resize_plan_t *)dl_lib_calloc(1, sizeof(image_resize_plan_t) + (dst_w + dst_h) * 2 * (sizeof(int) + sizeof(int16_t)), 0);
+    if (NULL == plan)
+        return NULL;
+    plan->src_w = src_w;
+    plan->src_h = src_h;
+    plan->dst_w = dst_w;
+    plan->dst_h = dst_h;
+    plan->x_ofs = (int *)(plan + 1);
+    plan->y_ofs = plan->x_ofs + 2 * dst_w;
+    plan->x_w = (int16_t *)(plan->y_ofs + 2 * dst_h);
+    plan->y_w = plan->x_w + 2 * dst_w;
+
+    // same coordinates, clamping and rounding of the fraction as image_resize_linear_float
+    float scale_x = (float)src_w / dst_w;
+    float scale_y = (float)src_h / dst_h;
+    for (int x = 0; x < dst_w; x++)
+    {
+        float fx = (float)((x + 0.5) * scale_x - 0.5);
+        int src_x = (int)fx;
+        fx -= src_x;
+        if (src_x < 0)
+        {
+            fx = 0;
+            src_x = 0;
+        }
+        if (src_x > src_w - 2)
+        {
+            fx = 0;
+            src_x = DL_IMAGE_MAX(src_w - 2, 0);
+        }
+        int w = (int)lrintf(fx * IMAGE_RESIZE_WEIGHT_ONE);
+        plan->x_ofs[2 * x] = src_x;
+        plan->x_ofs[2 * x + 1] = DL_IMAGE_MIN(src_x + 1, src_w - 1);
+        plan->x_w[2 * x] = IMAGE_RESIZE_WEIGHT_ONE - w;
+        plan->x_w[2 * x + 1] = w;
+    }
+    for (int y = 0; y < dst_h; y++)
+    {
+        float fy = (float)((y + 0.5) * scale_y - 0.5);
+        int src_y = (int)fy;
+        fy -= src_y;
+        src_y = DL_IMAGE_MAX(0, src_y);
+        src_y = DL_IMAGE_MAX(DL_IMAGE_MIN(src_y, src_h - 2), 0);
+        int w = (int)lrintf(fy * IMAGE_RESIZE_WEIGHT_ONE);
+        plan->y_ofs[2 * y] = src_y;
+        plan->y_ofs[2 * y + 1] = DL_IMAGE_MIN(src_y + 1, src_h - 1);
+        plan->y_w[2 * y] = IMAGE_RESIZE_WEIGHT_ONE - w;
+        plan->y_w[2 * y + 1] = w;
+    }
+    return plan;
+}
+
+void image_resize_plan_free(image_resize_plan_t *plan)
+{
+    dl_lib_free(plan);
+}
+
+static image_resize_plan_t *image_resize_plan_cache[IMAGE_RESIZE_PLAN_CACHE];
+
+const image_resize_plan_t *image_resize_plan_get(int src_w, int src_h, int dst_w, int dst_h)
+{
+    for (int i = 0; i < IMAGE_RESIZE_PLAN_CACHE; i++)
+    {
+        image_resize_plan_t *plan = image_resize_plan_cache[i];
+        if (NULL == plan)
+            break;
+        if (plan->src_w == src_w && plan->src_h == src_h && plan->dst_w == dst_w && plan->dst_h == dst_h)
+            return plan;
+    }
+
+    image_resize_plan_t *plan = image_resize_plan_create(src_w, src_h, dst_w, dst_h);
+    if (NULL == plan)
+        return NULL;
+
+    // slots are only ever filled, so a plan seen by a lookup stays valid; two tasks can race for the same slot
+    for (int i = 0; i < IMAGE_RESIZE_PLAN_CACHE; i++)
+    {
+        if (__sync_bool_compare_and_swap(&image_resize_plan_cache[i], NULL, plan))
+            return plan;
+    }
+    image_resize_plan_free(plan);
+    return NULL;
+}
+
+/*
+ * Horizontal pass of one source row, result in Q10.
+ */
+static inline void image_resize_row_h(int32_t *dst, const uint8_t *src, const image_resize_plan_t *plan, int c)
+{
+    const int *ofs = plan->x_ofs;
+    const int16_t *w = plan->x_w;
+    for (int x = 0; x < plan->dst_w; x++)
+    {
+        const uint8_t *p0 = src + ofs[2 * x] * c;
+        const uint8_t *p1 = src + ofs[2 * x + 1] * c;
+        int w0 = w[2 * x];
+        int w1 = w[2 * x + 1];
+        for (int k = 0; k < c; k++)
+            dst[k] = p0[k] * w0 + p1[k] * w1;
+        dst += c;
+    }
+}
+
+/*
+ * Vertical pass, blends two rows of the horizontal pass and rounds back to 8 bits.
+ */
+static void image_resize_row_v(uint8_t *dst, const int32_t *row0, const int32_t *row1, int w0, int w1, int n)
+{
+    int i = 0;
+#if defined(__SSE4_1__)
+    const __m128i v_w0 = _mm_set1_epi32(w0);
+    const __m128i v_w1 = _mm_set1_epi32(w1);
+    const __m128i v_half = _mm_set1_epi32(1 << (2 * IMAGE_RESIZE_WEIGHT_SHIFT - 1));
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i a = _mm_add_epi32(_mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(row0 + i)), v_w0),
+                                  _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(row1 + i)), v_w1));
+        __m128i b = _mm_add_epi32(_mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(row0 + i + 4)), v_w0),
+                                  _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(row1 + i + 4)), v_w1));
+        a = _mm_srai_epi32(_mm_add_epi32(a, v_half), 2 * IMAGE_RESIZE_WEIGHT_SHIFT);
+        b = _mm_srai_epi32(_mm_add_epi32(b, v_half), 2 * IMAGE_RESIZE_WEIGHT_SHIFT);
+        // the saturating packs clamp to [0, 255]
+        __m128i v = _mm_packs_epi32(a, b);
+        _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(v, v));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= n; i += 8)
+    {
+        int32x4_t a = vmlaq_n_s32(vmulq_n_s32(vld1q_s32(row0 + i), w0), vld1q_s32(row1 + i), w1);
+        int32x4_t b = vmlaq_n_s32(vmulq_n_s32(vld1q_s32(row0 + i + 4), w0), vld1q_s32(row1 + i + 4), w1);
+        int16x8_t v = vcombine_s16(vqmovn_s32(vrshrq_n_s32(a, 2 * IMAGE_RESIZE_WEIGHT_SHIFT)),
+                                   vqmovn_s32(vrshrq_n_s32(b, 2 * IMAGE_RESIZE_WEIGHT_SHIFT)));
+        vst1_u8(dst + i, vqmovun_s16(v));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        int v = (row0[i] * w0 + row1[i] * w1 + (1 << (2 * IMAGE_RESIZE_WEIGHT_SHIFT - 1))) >> (2 * IMAGE_RESIZE_WEIGHT_SHIFT);
+        dst[i] = (uint8_t)DL_IMAGE_MIN(DL_IMAGE_MAX(v, 0), 255);
+    }
+}
+
+static int image_resize_linear_plan_stride(uint8_t *dst_image, int dst_stride, const uint8_t *src_image, int src_stride, int c, const image_resize_plan_t *plan)
+{ /*{{{*/
+    int n = plan->dst_w * c;
+    int32_t *rows = (int32_t *)dl_lib_calloc(2 * n, sizeof(int32_t), 0);
+    if (NULL == rows)
+        return -1;
+    int32_t *buf[2] = {rows, rows + n};
+
+    // source rows held by buf[0] and buf[1], consecutive output rows mostly share them
+    int held[2] = {-1, -1};
+    for (int y = 0; y < plan->dst_h; y++)
+    {
+        int y0 = plan->y_ofs[2 * y];
+        int y1 = plan->y_ofs[2 * y + 1];
+        if (held[0] != y0)
+        {
+            if (held[1] == y0)
+            {
+                int32_t *t = buf[0];
+                buf[0] = buf[1];
+                buf[1] = t;
+                held[1] = held[0];
+                held[0] = y0;
+            }
+            else
+            {
+                // constant channel numbers let the compiler unroll the taps
+                if (3 == c)
+                    image_resize_row_h(buf[0], src_image + y0 * src_stride, plan, 3);
+                else if (1 == c)
+                    image_resize_row_h(buf[0], src_image + y0 * src_stride, plan, 1);
+                else
+                    image_resize_row_h(buf[0], src_image + y0 * src_stride, plan, c);
+                held[0] = y0;
+            }
+        }
+        if (held[1] != y1)
+        {
+            if (3 == c)
+                image_resize_row_h(buf[1], src_image + y1 * src_stride, plan, 3);
+            else if (1 == c)
+                image_resize_row_h(buf[1], src_image + y1 * src_stride, plan, 1);
+            else
+                image_resize_row_h(buf[1], src_image + y1 * src_stride, plan, c);
+            held[1] = y1;
+        }
+        image_resize_row_v(dst_image + y * dst_stride, buf[0], buf[1], plan->y_w[2 * y], plan->y_w[2 * y + 1], n);
+    }
+
+    dl_lib_free(rows);
+    return 0;
+} /*}}}*/
+
+int image_resize_linear_plan(uint8_t *dst_image, const uint8_t *src_image, int c, const image_resize_plan_t *plan)
+{ /*{{{*/
+    return image_resize_linear_plan_stride(dst_image, plan->dst_w * c, src_image, plan->src_w * c, c, plan);
+} /*}}}*/
+
+static void image_resize_linear_run(uint8_t *dst_image, int dst_stride, const uint8_t *src_image, int src_stride, int dst_w, int dst_h, int dst_c, int src_w, int src_h, bool cached)
+{ /*{{{*/
+    // size pairs beyond the cache, or not worth a slot, get a plan of their own
+    image_resize_plan_t *owned = NULL;
+    const image_resize_plan_t *plan = cached ? image_resize_plan_get(src_w, src_h, dst_w, dst_h) : NULL;
+    if (NULL == plan)
+        plan = owned = image_resize_plan_create(src_w, src_h, dst_w, dst_h);
+
+    if ((NULL == plan) || (0 != image_resize_linear_plan_stride(dst_image, dst_stride, src_image, src_stride, dst_c, plan)))
+        image_resize_linear_float(dst_image, dst_stride, src_image, src_stride, dst_w, dst_h, dst_c, src_w, src_h);
+
+    if (owned)
+        image_resize_plan_free(owned);
+} /*}}}*/
+
+void image_resize_linear_stride(uint8_t *dst_image, int dst_stride, const uint8_t *src_image, int src_stride, int dst_w, int dst_h, int dst_c, int src_w, int src_h)
+{ /*{{{*/
+    image_resize_linear_run(dst_image, dst_stride, src_image, src_stride, dst_w, dst_h, dst_c, src_w, src_h, true);
+} /*}}}*/
+
+void image_resize_linear_view(dl_matrix3du_t *dst, const dl_matrix3du_t *src)
+{ /*{{{*/
+    assert(dst->c == src->c);
+    image_resize_linear_run(dst->item, dst->stride, src->item, src->stride, dst->w, dst->h, dst->c, src->w, src->h, true);
+} /*}}}*/
+
+void image_resize_linear_crop(dl_matrix3du_t *dst, const dl_matrix3du_t *src)
+{ /*{{{*/
+    assert(dst->c == src->c);
+    // crops change size every call, they would fill the cache with size pairs never seen again
+    image_resize_linear_run(dst->item, dst->stride, src->item, src->stride, dst->w, dst->h, dst->c, src->w, src->h, false);
+} /*}}}*/
+
+void image_resize_linear(uint8_t *dst_image, uint8_t *src_image, int dst_w, int dst_h, int dst_c, int src_w, int src_h)
+{ /*{{{*/
+    float scale_x = (float)src_w / dst_w;
+    float scale_y = (float)src_h / dst_h;
 
     if (fabs(scale_x - 2) <= 1e-6 && fabs(scale_y - 2) <= 1e-6)
     {
@@ -92,99 +374,612 @@ void image_resize_linear(uint8_t *dst_image, uint8_t *src_image, int dst_w, int
             src_image,
             src_w,
             dst_c);
+        return;
+    }
+
+    image_resize_linear_stride(dst_image, dst_w * dst_c, src_image, src_w * dst_c, dst_w, dst_h, dst_c, src_w, src_h);
+} /*}}}*/
+
+/*
+ * Box filter taps along one axis. Source pixel i covers [i * dst, (i + 1) * dst) and output pixel j covers
+ * [j * src, (j + 1) * src), the weight of i in j is the length of their overlap, so the weights of j sum to src.
+ */
+static void image_area_taps(int src, int dst, int *first, int *w_ofs, int32_t *w)
+{
+    int n = 0;
+    for (int j = 0; j < dst; j++)
+    {
+        int start = j * src;
+        int end = start + src;
+        first[j] = start / dst;
+        w_ofs[j] = n;
+        for (int i = first[j]; i * dst < end; i++)
+            w[n++] = DL_IMAGE_MIN((i + 1) * dst, end) - DL_IMAGE_MAX(i * dst, start);
+    }
+    w_ofs[dst] = n;
+}
+
+static inline void image_area_row_h(int32_t *dst, const uint8_t *src, int dst_w, int c, const int *first, const int *w_ofs, const int32_t *w)
+{
+    for (int j = 0; j < dst_w; j++)
+    {
+        const uint8_t *p = src + first[j] * c;
+        for (int k = 0; k < c; k++)
+            dst[k] = 0;
+        for (int t = w_ofs[j]; t < w_ofs[j + 1]; t++)
+        {
+            for (int k = 0; k < c; k++)
+                dst[k] += p[k] * w[t];
+            p += c;
+        }
+        dst += c;
+    }
+}
+
+static inline int image_pixel_bytes(image_pixel_format_t format)
+{
+    switch (format)
+    {
+    case IMAGE_PIXEL_RGB888:
+        return 3;
+    case IMAGE_PIXEL_GRAY:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+/*
+ * Read pixel x of a row as RGB, or as luma when c is 1. Called with a constant format, the switch folds away.
+ */
+static inline void image_source_pixel(const uint8_t *row, int x, image_pixel_format_t format, int c, int *p)
+{
+    int r, g, b;
+    switch (format)
+    {
+    case IMAGE_PIXEL_RGB565:
+    {
+        uint16_t in = row[2 * x] << 8 | row[2 * x + 1];
+        r = (in & RGB565_MASK_RED) >> 8;
+        g = (in & RGB565_MASK_GREEN) >> 3;
+        b = (in & RGB565_MASK_BLUE) << 3;
+        break;
+    }
+    case IMAGE_PIXEL_RGB888:
+        r = row[3 * x];
+        g = row[3 * x + 1];
+        b = row[3 * x + 2];
+        break;
+    case IMAGE_PIXEL_YUV422:
+    {
+        const uint8_t *yuyv = row + 4 * (x >> 1);
+        int y = yuyv[2 * (x & 1)];
+        if (1 == c)
+        {
+            p[0] = y;
+            return;
+        }
+        // BT.601 full range, Q8
+        int u = yuyv[1] - 128;
+        int v = yuyv[3] - 128;
+        r = DL_IMAGE_MIN(DL_IMAGE_MAX(y + ((359 * v) >> 8), 0), 255);
+        g = DL_IMAGE_MIN(DL_IMAGE_MAX(y - ((88 * u + 183 * v) >> 8), 0), 255);
+        b = DL_IMAGE_MIN(DL_IMAGE_MAX(y + ((454 * u) >> 8), 0), 255);
+        break;
+    }
+    default:
+        r = g = b = row[x];
+        break;
+    }
+
+    if (1 == c)
+    {
+        p[0] = (77 * r + 150 * g + 29 * b + 128) >> 8;
     }
     else
     {
-        for (int y = 0; y < dst_h; y++)
+        p[0] = r;
+        p[1] = g;
+        p[2] = b;
+    }
+}
+
+static void image_source_row(uint8_t *line, const uint8_t *row, int x0, int n, image_pixel_format_t format, int c)
+{
+    int p[3];
+    switch (format)
+    {
+    case IMAGE_PIXEL_RGB565:
+        for (int x = 0; x < n; x++, line += c)
         {
-            float fy[2];
-            fy[0] = (float)((y + 0.5) * scale_y - 0.5); // y
-            int src_y = (int)fy[0];                     // y1
-            fy[0] -= src_y;                             // y - y1
-            fy[1] = 1 - fy[0];                          // y2 - y
-            src_y = DL_IMAGE_MAX(0, src_y);
-            src_y = DL_IMAGE_MIN(src_y, src_h - 2);
+            image_source_pixel(row, x0 + x, IMAGE_PIXEL_RGB565, c, p);
+            for (int k = 0; k < c; k++)
+                line[k] = p[k];
+        }
+        break;
+    case IMAGE_PIXEL_RGB888:
+        for (int x = 0; x < n; x++, line += c)
+        {
+            image_source_pixel(row, x0 + x, IMAGE_PIXEL_RGB888, c, p);
+            for (int k = 0; k < c; k++)
+                line[k] = p[k];
+        }
+        break;
+    case IMAGE_PIXEL_YUV422:
+        for (int x = 0; x < n; x++, line += c)
+        {
+            image_source_pixel(row, x0 + x, IMAGE_PIXEL_YUV422, c, p);
+            for (int k = 0; k < c; k++)
+                line[k] = p[k];
+        }
+        break;
+    default:
+        for (int x = 0; x < n; x++, line += c)
+        {
+            image_source_pixel(row, x0 + x, IMAGE_PIXEL_GRAY, c, p);
+            for (int k = 0; k < c; k++)
+                line[k] = p[k];
+        }
+        break;
+    }
+}
 
-            for (int x = 0; x < dst_w; x++)
+/*
+ * Area average of src_w x src_h source pixels from (x0, y0) into dst_w x dst_h, written as 8 bits to dst8
+ * or quantized to dstq. Sources already in the output layout are read in place, the others one line at a time.
+ */
+static int image_area_run(const image_source_t *src, int x0, int y0, int src_w, int src_h, int c, int dst_w, int dst_h,
+                          uint8_t *dst8, qtp_t *dstq, int dst_stride, int shift)
+{
+    int n = dst_w * c;
+    int taps = src_w + dst_w + src_h + dst_h;
+    int in_place = ((IMAGE_PIXEL_RGB888 == src->format) && (3 == c)) || ((IMAGE_PIXEL_GRAY == src->format) && (1 == c));
+    int stride = src->stride ? src->stride : src->w * image_pixel_bytes(src->format);
+
+    // weights are exact integers, a sum is at most 255 * src_w * src_h
+    uint8_t *buf = (uint8_t *)dl_lib_calloc(1, (2 * n + taps) * sizeof(int32_t) + (2 * dst_w + 2 * dst_h + 2) * sizeof(int) + (in_place ? 0 : src_w * c), 0);
+    if (NULL == buf)
+        return -1;
+    int32_t *row = (int32_t *)buf;
+    int32_t *acc = row + n;
+    int32_t *wx = acc + n;
+    int32_t *wy = wx + src_w + dst_w;
+    int *x_first = (int *)(wy + src_h + dst_h);
+    int *x_ofs = x_first + dst_w;
+    int *y_first = x_ofs + dst_w + 1;
+    int *y_ofs = y_first + dst_h;
+    uint8_t *line = (uint8_t *)(y_ofs + dst_h + 1);
+
+    image_area_taps(src_w, dst_w, x_first, x_ofs, wx);
+    image_area_taps(src_h, dst_h, y_first, y_ofs, wy);
+
+    uint32_t area = (uint32_t)src_w * src_h;
+    int held = -1;
+    for (int j = 0; j < dst_h; j++)
+    {
+        for (int t = y_ofs[j]; t < y_ofs[j + 1]; t++)
+        {
+            // a source row on the border of two output rows is reduced once
+            int i = y_first[j] + t - y_ofs[j];
+            if (held != i)
             {
-                float fx[2];
-                fx[0] = (float)((x + 0.5) * scale_x - 0.5); // x
-                int src_x = (int)fx[0];                     // x1
-                fx[0] -= src_x;                             // x - x1
-                if (src_x < 0)
+                const uint8_t *p = src->data + (y0 + i) * stride;
+                if (in_place)
                 {
-                    fx[0] = 0;
-                    src_x = 0;
+                    p += x0 * c;
                 }
-                if (src_x > src_w - 2)
+                else
                 {
-                    fx[0] = 0;
-                    src_x = src_w - 2;
+                    image_source_row(line, p, x0, src_w, src->format, c);
+                    p = line;
                 }
-                fx[1] = 1 - fx[0]; // x2 - x
 
-                for (int c = 0; c < dst_c; c++)
-                {
-                    dst_image[y * dst_stride + x * dst_c + c] = round(src_image[src_y * src_stride + src_x * dst_c + c] * fx[1] * fy[1] + src_image[src_y * src_stride + (src_x + 1) * dst_c + c] * fx[0] * fy[1] + src_image[(src_y + 1) * src_stride + src_x * dst_c + c] * fx[1] * fy[0] + src_image[(src_y + 1) * src_stride + (src_x + 1) * dst_c + c] * fx[0] * fy[0]);
-                }
+                // constant channel numbers let the compiler unroll the taps
+                if (3 == c)
+                    image_area_row_h(row, p, dst_w, 3, x_first, x_ofs, wx);
+                else
+                    image_area_row_h(row, p, dst_w, 1, x_first, x_ofs, wx);
+                held = i;
+            }
+
+            if (t == y_ofs[j])
+            {
+                for (int k = 0; k < n; k++)
+                    acc[k] = row[k] * wy[t];
+            }
+            else
+            {
+                for (int k = 0; k < n; k++)
+                    acc[k] += row[k] * wy[t];
+            }
+        }
+
+        if (dst8)
+        {
+            uint8_t *dst = dst8 + j * dst_stride;
+            for (int k = 0; k < n; k++)
+                dst[k] = (uint8_t)(((uint32_t)acc[k] + area / 2) / area);
+        }
+        else
+        {
+            qtp_t *dst = dstq + j * dst_stride;
+            // round once at the output precision, so shift 0 matches the uint8 output
+            int bits = DL_IMAGE_MIN(shift, 8);
+            for (int k = 0; k < n; k++)
+            {
+                int v = (int)((((uint64_t)(uint32_t)acc[k] << bits) + area / 2) / area);
+                dst[k] = (qtp_t)(v << (shift - bits));
             }
         }
     }
-} /*}}}*/
 
-void image_cropper(uint8_t *rot_data, uint8_t *src_data, int rot_w, int rot_h, int rot_c, int src_w, int src_h, float rotate_angle, float ratio, float *center)
-{ /*{{{*/
-    int rot_stride = rot_w * rot_c;
-    float rot_w_start = 0.5f - (float)rot_w / 2;
-    float rot_h_start = 0.5f - (float)rot_h / 2;
+    dl_lib_free(buf);
+    return 0;
+}
 
-    //rotate_angle must be radius
-    float si = sin(rotate_angle);
-    float co = cos(rotate_angle);
+int image_resize_area(uint8_t *dst_image, const uint8_t *src_image, int dst_w, int dst_h, int dst_c, int src_w, int src_h)
+{
+    assert((1 == dst_c) || (3 == dst_c));
+    image_source_t src = {src_image, (1 == dst_c) ? IMAGE_PIXEL_GRAY : IMAGE_PIXEL_RGB888, src_w, src_h, 0, 0, 0, src_w, src_h};
+    return image_area_run(&src, 0, 0, src_w, src_h, dst_c, dst_w, dst_h, dst_image, NULL, dst_w * dst_c, 0);
+}
 
-    int src_stride = src_w * rot_c;
+int image_resize_area_rgb565(uint8_t *dst_image, const uint16_t *src_image, int dst_w, int dst_h, int src_w, int src_h)
+{
+    image_source_t src = {(const uint8_t *)src_image, IMAGE_PIXEL_RGB565, src_w, src_h, 0, 0, 0, src_w, src_h};
+    return image_area_run(&src, 0, 0, src_w, src_h, 3, dst_w, dst_h, dst_image, NULL, dst_w * 3, 0);
+}
 
-    for (int y = 0; y < rot_h; y++)
+static inline qtp_t image_quantize_q8(int v, int shift)
+{
+    return (shift >= 8) ? (qtp_t)(v << (shift - 8)) : (qtp_t)((v + (1 << (7 - shift))) >> (8 - shift));
+}
+
+/*
+ * Point sampling kernels. Called with a constant format and sample, so each pair gets its own branch-free loop.
+ * Values are carried in Q8 until the output shift, BILINEAR_ROUND keeps the float arithmetic of image_resize_linear_q.
+ */
+static inline void image_convert_resize_point(const image_target_t *dst, const image_source_t *src, const int *col, const int *wx, const float *fwx,
+                                              float scale_y, image_pixel_format_t format, image_sample_t sample)
+{
+    const int c = dst->c;
+    const int stride = src->stride ? src->stride : src->w * image_pixel_bytes(format);
+    const int dst_stride = dst->stride ? dst->stride : dst->w * c;
+    const int roi_h = src->roi_h ? src->roi_h : src->h - src->roi_y;
+
+    for (int y = 0; y < dst->h; y++)
     {
-        for (int x = 0; x < rot_w; x++)
+        int y0, y1, wy = 0;
+        float fwy = 0;
+        if (IMAGE_SAMPLE_BILINEAR_ROUND == sample)
         {
-            float xs, ys, xr, yr;
-            xs = ratio * (rot_w_start + x);
-            ys = ratio * (rot_h_start + y);
-
-            xr = xs * co + ys * si;
-            yr = -xs * si + ys * co;
+            // the row is clamped but its weight is kept, so the first and last rows extrapolate
+            fwy = (float)((y + 0.5) * scale_y - 0.5);
+            int iy = (int)fwy;
+            fwy -= iy;
+            iy = DL_IMAGE_MIN(DL_IMAGE_MAX(iy, 0), roi_h - 2);
+            y0 = src->roi_y + iy;
+            y1 = y0 + 1;
+        }
+        else if (IMAGE_SAMPLE_BILINEAR == sample)
+        {
+            float fy = (y + 0.5f) * scale_y - 0.5f;
+            int iy = (int)floorf(fy);
+            wy = (int)lrintf((fy - iy) * 256);
+            y0 = src->roi_y + iy;
+            y1 = y0 + 1;
+        }
+        else if (IMAGE_SAMPLE_MEAN == sample)
+        {
+            y0 = src->roi_y + (int)(y * scale_y);
+            y1 = y0 + 1;
+        }
+        else if (IMAGE_SAMPLE_MEAN_ROUND == sample)
+        {
+            y0 = src->roi_y + (int)rintf(y * scale_y);
+            y1 = y0 + 1;
+        }
+        else
+        {
+            y0 = y1 = src->roi_y + (int)(y * scale_y);
+        }
+        y0 = DL_IMAGE_MIN(DL_IMAGE_MAX(y0, 0), src->h - 1);
+        y1 = DL_IMAGE_MIN(DL_IMAGE_MAX(y1, 0), src->h - 1);
+        const uint8_t *row0 = src->data + y0 * stride;
+        const uint8_t *row1 = src->data + y1 * stride;
+        qtp_t *out = dst->data + y * dst_stride;
 
-            float fy[2];
-            fy[0] = center[1] + yr; // y
-            int src_y = (int)fy[0]; // y1
-            fy[0] -= src_y;         // y - y1
-            fy[1] = 1 - fy[0];      // y2 - y
-            src_y = DL_IMAGE_MAX(0, src_y);
-            src_y = DL_IMAGE_MIN(src_y, src_h - 2);
+        for (int x = 0; x < dst->w; x++, out += c)
+        {
+            int p00[3], p01[3], p10[3], p11[3];
+            image_source_pixel(row0, col[2 * x], format, c, p00);
+            if (IMAGE_SAMPLE_NEAREST == sample)
+            {
+                for (int k = 0; k < c; k++)
+                    out[k] = image_quantize_q8(p00[k] << 8, dst->shift);
+                continue;
+            }
 
-            float fx[2];
-            fx[0] = center[0] + xr; // x
-            int src_x = (int)fx[0]; // x1
-            fx[0] -= src_x;         // x - x1
-            if (src_x < 0)
+            image_source_pixel(row0, col[2 * x + 1], format, c, p01);
+            image_source_pixel(row1, col[2 * x], format, c, p10);
+            image_source_pixel(row1, col[2 * x + 1], format, c, p11);
+            if (IMAGE_SAMPLE_MEAN_ROUND == sample)
             {
-                fx[0] = 0;
-                src_x = 0;
+                // the sum is 2 bits wider, truncated like Image::resize_to_rgb888
+                for (int k = 0; k < c; k++)
+                {
+                    int sum = p00[k] + p01[k] + p10[k] + p11[k];
+                    out[k] = (dst->shift >= 2) ? (qtp_t)(sum << (dst->shift - 2)) : (qtp_t)(sum >> (2 - dst->shift));
+                }
+                continue;
             }
-            if (src_x > src_w - 2)
+            if (IMAGE_SAMPLE_BILINEAR_ROUND == sample)
             {
-                fx[0] = 0;
-                src_x = src_w - 2;
+                float fx0 = fwx[x], fx1 = 1 - fwx[x], fy1 = 1 - fwy;
+                for (int k = 0; k < c; k++)
+                {
+                    int v = (int)round(p00[k] * fx1 * fy1 + p01[k] * fx0 * fy1 + p10[k] * fx1 * fwy + p11[k] * fx0 * fwy);
+                    out[k] = (dst->shift >= 0) ? (qtp_t)(v * (1 << dst->shift)) : (qtp_t)(v >> -dst->shift);
+                }
+                continue;
             }
-            fx[1] = 1 - fx[0]; // x2 - x
+            for (int k = 0; k < c; k++)
+            {
+                int v;
+                if (IMAGE_SAMPLE_MEAN == sample)
+                {
+                    v = (p00[k] + p01[k] + p10[k] + p11[k]) << 6;
+                }
+                else
+                {
+                    int top = p00[k] * (256 - wx[x]) + p01[k] * wx[x];
+                    int bottom = p10[k] * (256 - wx[x]) + p11[k] * wx[x];
+                    v = (top * (256 - wy) + bottom * wy + 128) >> 8;
+                }
+                out[k] = image_quantize_q8(v, dst->shift);
+            }
+        }
+    }
+}
+
+static inline void image_convert_resize_format(const image_target_t *dst, const image_source_t *src, const int *col, const int *wx, const float *fwx,
+                                               float scale_y, image_pixel_format_t format, image_sample_t sample)
+{
+    switch (format)
+    {
+    case IMAGE_PIXEL_RGB565:
+        image_convert_resize_point(dst, src, col, wx, fwx, scale_y, IMAGE_PIXEL_RGB565, sample);
+        break;
+    case IMAGE_PIXEL_RGB888:
+        image_convert_resize_point(dst, src, col, wx, fwx, scale_y, IMAGE_PIXEL_RGB888, sample);
+        break;
+    case IMAGE_PIXEL_YUV422:
+        image_convert_resize_point(dst, src, col, wx, fwx, scale_y, IMAGE_PIXEL_YUV422, sample);
+        break;
+    default:
+        image_convert_resize_point(dst, src, col, wx, fwx, scale_y, IMAGE_PIXEL_GRAY, sample);
+        break;
+    }
+}
+
+int image_convert_resize_q(const image_target_t *dst, const image_source_t *src, image_sample_t sample)
+{
+    int roi_w = src->roi_w ? src->roi_w : src->w - src->roi_x;
+    int roi_h = src->roi_h ? src->roi_h : src->h - src->roi_y;
+    float scale_x = (dst->scale_x > 0) ? dst->scale_x : (float)roi_w / dst->w;
+    float scale_y = (dst->scale_y > 0) ? dst->scale_y : (float)roi_h / dst->h;
+
+    if (IMAGE_SAMPLE_AREA == sample)
+    {
+        // the area covered by the output, inside the buffer
+        int area_w = DL_IMAGE_MIN((int)lrintf(scale_x * dst->w), src->w - src->roi_x);
+        int area_h = DL_IMAGE_MIN((int)lrintf(scale_y * dst->h), src->h - src->roi_y);
+        return image_area_run(src, src->roi_x, src->roi_y, area_w, area_h, dst->c, dst->w, dst->h,
+                              NULL, dst->data, dst->stride ? dst->stride : dst->w * dst->c, dst->shift);
+    }
+
+    // source columns of each output column, and the bilinear weights in Q8 or in float
+    int *col = (int *)dl_lib_calloc(3 * dst->w + dst->w * sizeof(float) / sizeof(int), sizeof(int), 0);
+    if (NULL == col)
+        return -1;
+    int *wx = col + 2 * dst->w;
+    float *fwx = (float *)(col + 3 * dst->w);
+    for (int x = 0; x < dst->w; x++)
+    {
+        int x0, x1;
+        if (IMAGE_SAMPLE_BILINEAR_ROUND == sample)
+        {
+            // the weight is dropped where the column is clamped
+            fwx[x] = (float)((x + 0.5) * scale_x - 0.5);
+            int ix = (int)fwx[x];
+            fwx[x] -= ix;
+            if ((ix < 0) || (ix > roi_w - 2))
+            {
+                fwx[x] = 0;
+                ix = (ix < 0) ? 0 : roi_w - 2;
+            }
+            x0 = src->roi_x + ix;
+            x1 = x0 + 1;
+        }
+        else if (IMAGE_SAMPLE_BILINEAR == sample)
+        {
+            float fx = (x + 0.5f) * scale_x - 0.5f;
+            int ix = (int)floorf(fx);
+            wx[x] = (int)lrintf((fx - ix) * 256);
+            x0 = src->roi_x + ix;
+            x1 = x0 + 1;
+        }
+        else if (IMAGE_SAMPLE_MEAN == sample)
+        {
+            x0 = src->roi_x + (int)(x * scale_x);
+            x1 = x0 + 1;
+        }
+        else if (IMAGE_SAMPLE_MEAN_ROUND == sample)
+        {
+            x0 = src->roi_x + (int)rintf(x * scale_x);
+            x1 = x0 + 1;
+        }
+        else
+        {
+            x0 = x1 = src->roi_x + (int)rintf(x * scale_x);
+        }
+        col[2 * x] = DL_IMAGE_MIN(DL_IMAGE_MAX(x0, 0), src->w - 1);
+        col[2 * x + 1] = DL_IMAGE_MIN(DL_IMAGE_MAX(x1, 0), src->w - 1);
+    }
+
+    switch (sample)
+    {
+    case IMAGE_SAMPLE_NEAREST:
+        image_convert_resize_format(dst, src, col, wx, fwx, scale_y, src->format, IMAGE_SAMPLE_NEAREST);
+        break;
+    case IMAGE_SAMPLE_MEAN:
+        image_convert_resize_format(dst, src, col, wx, fwx, scale_y, src->format, IMAGE_SAMPLE_MEAN);
+        break;
+    case IMAGE_SAMPLE_MEAN_ROUND:
+        image_convert_resize_format(dst, src, col, wx, fwx, scale_y, src->format, IMAGE_SAMPLE_MEAN_ROUND);
+        break;
+    case IMAGE_SAMPLE_BILINEAR_ROUND:
+        image_convert_resize_format(dst, src, col, wx, fwx, scale_y, src->format, IMAGE_SAMPLE_BILINEAR_ROUND);
+        break;
+    default:
+        image_convert_resize_format(dst, src, col, wx, fwx, scale_y, src->format, IMAGE_SAMPLE_BILINEAR);
+        break;
+    }
+    dl_lib_free(col);
+    return 0;
+}
+
+#define IMAGE_WARP_SHIFT 16
+#define IMAGE_WARP_WEIGHT_SHIFT 8
+#define IMAGE_WARP_WEIGHT_ONE (1 << IMAGE_WARP_WEIGHT_SHIFT)
+
+static inline void image_warp_blend(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int x0, int x1, int wx, int wy, int c)
+{
+    for (int k = 0; k < c; k++)
+    {
+        int top = row0[x0 + k] * (IMAGE_WARP_WEIGHT_ONE - wx) + row0[x1 + k] * wx;
+        int bottom = row1[x0 + k] * (IMAGE_WARP_WEIGHT_ONE - wx) + row1[x1 + k] * wx;
+        dst[k] = (uint8_t)((top * (IMAGE_WARP_WEIGHT_ONE - wy) + bottom * wy + (1 << (2 * IMAGE_WARP_WEIGHT_SHIFT - 1))) >> (2 * IMAGE_WARP_WEIGHT_SHIFT));
+    }
+}
+
+/*
+ * All four neighbours are inside the source, no clamping is needed.
+ */
+static inline void image_warp_span(uint8_t *dst, const uint8_t *src, int src_stride, int c, int32_t xq, int32_t yq, int32_t dxq, int32_t dyq, int n)
+{
+    const int frac_shift = IMAGE_WARP_SHIFT - IMAGE_WARP_WEIGHT_SHIFT;
+    const int frac_mask = IMAGE_WARP_WEIGHT_ONE - 1;
+    for (int j = 0; j < n; j++)
+    {
+        const uint8_t *row0 = src + (yq >> IMAGE_WARP_SHIFT) * src_stride;
+        int x0 = (xq >> IMAGE_WARP_SHIFT) * c;
+        image_warp_blend(dst, row0, row0 + src_stride, x0, x0 + c, (xq >> frac_shift) & frac_mask, (yq >> frac_shift) & frac_mask, c);
+        dst += c;
+        xq += dxq;
+        yq += dyq;
+    }
+}
+
+static inline void image_warp_border_pixel(uint8_t *dst, const uint8_t *src, int src_stride, int src_w, int src_h, int c, int32_t xq, int32_t yq, image_border_t border)
+{
+    if (IMAGE_BORDER_CONSTANT == border)
+    {
+        memset(dst, 0, c);
+        return;
+    }
+
+    const int frac_shift = IMAGE_WARP_SHIFT - IMAGE_WARP_WEIGHT_SHIFT;
+    const int frac_mask = IMAGE_WARP_WEIGHT_ONE - 1;
+    // arithmetic shift floors the negative coordinates
+    int x = xq >> IMAGE_WARP_SHIFT;
+    int y = yq >> IMAGE_WARP_SHIFT;
+    int x0 = DL_IMAGE_MIN(DL_IMAGE_MAX(x, 0), src_w - 1) * c;
+    int x1 = DL_IMAGE_MIN(DL_IMAGE_MAX(x + 1, 0), src_w - 1) * c;
+    int y0 = DL_IMAGE_MIN(DL_IMAGE_MAX(y, 0), src_h - 1);
+    int y1 = DL_IMAGE_MIN(DL_IMAGE_MAX(y + 1, 0), src_h - 1);
+    image_warp_blend(dst, src + y0 * src_stride, src + y1 * src_stride, x0, x1, (xq >> frac_shift) & frac_mask, (yq >> frac_shift) & frac_mask, c);
+}
+
+void image_warp_affine_stride(uint8_t *dst_image, int dst_stride, const uint8_t *src_image, int src_stride, int dst_w, int dst_h, int dst_c, int src_w, int src_h, const float *m_inv, image_border_t border)
+{ /*{{{*/
+    const float one = (float)(1 << IMAGE_WARP_SHIFT);
+
+    // [0, src_w - 1) x [0, src_h - 1) in Q16, one unsigned compare per axis
+    uint32_t x_limit = (uint32_t)(src_w - 1) << IMAGE_WARP_SHIFT;
+    uint32_t y_limit = (uint32_t)(src_h - 1) << IMAGE_WARP_SHIFT;
+
+    int32_t dxq = (int32_t)lrintf(m_inv[0] * one);
+    int32_t dyq = (int32_t)lrintf(m_inv[3] * one);
+
+    for (int i = 0; i < dst_h; i++)
+    {
+        uint8_t *dst = dst_image + i * dst_stride;
+
+        // restart every row from the exact position so the stepping error never exceeds one row
+        int32_t xq = (int32_t)lrintf((m_inv[1] * i + m_inv[2]) * one);
+        int32_t yq = (int32_t)lrintf((m_inv[4] * i + m_inv[5]) * one);
+
+        // the coordinates are linear in j, so the interior pixels of a row are one contiguous span
+        int left = 0;
+        while (left < dst_w && !(((uint32_t)xq < x_limit) && ((uint32_t)yq < y_limit)))
+        {
+            image_warp_border_pixel(dst, src_image, src_stride, src_w, src_h, dst_c, xq, yq, border);
+            dst += dst_c;
+            xq += dxq;
+            yq += dyq;
+            left++;
+        }
+        if (left == dst_w)
+            continue;
+
+        int right = dst_w - 1;
+        int32_t xq_right = xq + (right - left) * dxq;
+        int32_t yq_right = yq + (right - left) * dyq;
+        while (!(((uint32_t)xq_right < x_limit) && ((uint32_t)yq_right < y_limit)))
+        {
+            image_warp_border_pixel(dst + (right - left) * dst_c, src_image, src_stride, src_w, src_h, dst_c, xq_right, yq_right, border);
+            xq_right -= dxq;
+            yq_right -= dyq;
+            right--;
+        }
+
+        // constant channel numbers let the compiler unroll the blend
+        int n = right - left + 1;
+        if (3 == dst_c)
+            image_warp_span(dst, src_image, src_stride, 3, xq, yq, dxq, dyq, n);
+        else if (1 == dst_c)
+            image_warp_span(dst, src_image, src_stride, 1, xq, yq, dxq, dyq, n);
+        else
+            image_warp_span(dst, src_image, src_stride, dst_c, xq, yq, dxq, dyq, n);
+    }
+} /*}}}*/
+
+void image_warp_affine(uint8_t *dst_image, uint8_t *src_image, int dst_w, int dst_h, int dst_c, int src_w, int src_h, const float *m_inv, image_border_t border)
+{ /*{{{*/
+    image_warp_affine_stride(dst_image, dst_w * dst_c, src_image, src_w * dst_c, dst_w, dst_h, dst_c, src_w, src_h, m_inv, border);
+} /*}}}*/
+
+void image_cropper(uint8_t *rot_data, uint8_t *src_data, int rot_w, int rot_h, int rot_c, int src_w, int src_h, float rotate_angle, float ratio, float *center)
+{ /*{{{*/
+    float rot_w_start = 0.5f - (float)rot_w / 2;
+    float rot_h_start = 0.5f - (float)rot_h / 2;
+
+    //rotate_angle must be radius
+    float si = sin(rotate_angle);
+    float co = cos(rotate_angle);
 
-            for (int c = 0; c < rot_c; c++)
-            {
-                rot_data[y * rot_stride + x * rot_c + c] = round(src_data[src_y * src_stride + src_x * rot_c + c] * fx[1] * fy[1] + src_data[src_y * src_stride + (src_x + 1) * rot_c + c] * fx[0] * fy[1] + src_data[(src_y + 1) * src_stride + src_x * rot_c + c] * fx[1] * fy[0] + src_data[(src_y + 1) * src_stride + (src_x + 1) * rot_c + c] * fx[0] * fy[0]);
-            }
-        }
-    }
+    // x_src = center_x + ratio * ((rot_w_start + x) * co + (rot_h_start + y) * si)
+    // y_src = center_y + ratio * (-(rot_w_start + x) * si + (rot_h_start + y) * co)
+    float m_inv[6];
+    m_inv[0] = ratio * co;
+    m_inv[1] = ratio * si;
+    m_inv[2] = center[0] + ratio * (rot_w_start * co + rot_h_start * si);
+    m_inv[3] = -ratio * si;
+    m_inv[4] = ratio * co;
+    m_inv[5] = center[1] + ratio * (-rot_w_start * si + rot_h_start * co);
+
+    image_warp_affine(rot_data, src_data, rot_w, rot_h, rot_c, src_w, src_h, m_inv, IMAGE_BORDER_REPLICATE);
 } /*}}}*/
 
 void image_sort_insert_by_score(image_list_t *image_sorted_list, const image_list_t *insert_list)
@@ -241,6 +1036,164 @@ void image_sort_insert_by_score(image_list_t *image_sorted_list, const image_lis
     image_sorted_list->len += insert_list->len;
 } /*}}}*/
 
+#define IMAGE_SCAN_BLOCK 32
+
+/*
+ * Whether any of n quantized scores is over the threshold. A cell passes when its best class does,
+ * which is when any of its classes does, so a whole block of cells is rejected at once.
+ */
+static inline bool image_scan_any_q(const qtp_t *score, int n, int threshold)
+{
+    int i = 0;
+#if defined(__SSE4_1__)
+    const __m128i v_threshold = _mm_set1_epi16(threshold);
+    __m128i v_hit = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8)
+        v_hit = _mm_or_si128(v_hit, _mm_cmpgt_epi16(_mm_loadu_si128((const __m128i *)(score + i)), v_threshold));
+    if (_mm_movemask_epi8(v_hit))
+        return true;
+#elif defined(__ARM_NEON)
+    const int16x8_t v_threshold = vdupq_n_s16(threshold);
+    uint16x8_t v_hit = vdupq_n_u16(0);
+    for (; i + 8 <= n; i += 8)
+        v_hit = vorrq_u16(v_hit, vcgtq_s16(vld1q_s16(score + i), v_threshold));
+    if (vget_lane_u64(vreinterpret_u64_u16(vorr_u16(vget_low_u16(v_hit), vget_high_u16(v_hit))), 0))
+        return true;
+#endif
+    // four running maxima keep the compare chains independent
+    int m0 = threshold, m1 = threshold, m2 = threshold, m3 = threshold;
+    for (; i + 4 <= n; i += 4)
+    {
+        m0 = DL_IMAGE_MAX(m0, score[i]);
+        m1 = DL_IMAGE_MAX(m1, score[i + 1]);
+        m2 = DL_IMAGE_MAX(m2, score[i + 2]);
+        m3 = DL_IMAGE_MAX(m3, score[i + 3]);
+    }
+    for (; i < n; i++)
+        m0 = DL_IMAGE_MAX(m0, score[i]);
+    return DL_IMAGE_MAX(DL_IMAGE_MAX(m0, m1), DL_IMAGE_MAX(m2, m3)) > threshold;
+}
+
+int image_scan_scores_q(image_candidate_t *candidates, int max_candidates, const qtp_t *score, int classes, int *cell, int cells, int threshold)
+{
+    int n = 0;
+    int i = *cell;
+    while ((i < cells) && ((NULL == candidates) || (n < max_candidates)))
+    {
+        // stop at a block boundary, or where the candidates run out
+        int end = DL_IMAGE_MIN(i + IMAGE_SCAN_BLOCK, cells);
+        if (candidates)
+            end = DL_IMAGE_MIN(end, i + max_candidates - n);
+        const qtp_t *s = score + i * classes;
+        if (!image_scan_any_q(s, (end - i) * classes, threshold))
+        {
+            i = end;
+            continue;
+        }
+        for (; i < end; i++, s += classes)
+        {
+            int max_score = s[0];
+            int max_score_c = 0;
+            for (int c = 1; c < classes; c++)
+            {
+                if (max_score < s[c])
+                {
+                    max_score = s[c];
+                    max_score_c = c;
+                }
+            }
+            if (max_score > threshold)
+            {
+                if (candidates)
+                {
+                    candidates[n].index = i;
+                    candidates[n].category = max_score_c;
+                    candidates[n].score = max_score;
+                }
+                n++;
+            }
+        }
+    }
+    *cell = i;
+    return n;
+}
+
+static inline bool image_scan_any_f(const fptp_t *score, int n, int step, fptp_t threshold)
+{
+    int i = 0;
+#if defined(__SSE4_1__)
+    const __m128 v_threshold = _mm_set1_ps(threshold);
+    __m128 hit = _mm_setzero_ps();
+    if (1 == step)
+    {
+        for (; i + 4 <= n; i += 4)
+            hit = _mm_or_ps(hit, _mm_cmpgt_ps(_mm_loadu_ps(score + i), v_threshold));
+    }
+    else if (2 == step)
+    {
+        // a group reads 8 floats and the last one is past the last cell, leave the last group to the tail
+        for (; i + 4 < n; i += 4)
+        {
+            __m128 v = _mm_shuffle_ps(_mm_loadu_ps(score + 2 * i), _mm_loadu_ps(score + 2 * i + 4), _MM_SHUFFLE(2, 0, 2, 0));
+            hit = _mm_or_ps(hit, _mm_cmpgt_ps(v, v_threshold));
+        }
+    }
+    if (_mm_movemask_ps(hit))
+        return true;
+#elif defined(__ARM_NEON)
+    const float32x4_t v_threshold = vdupq_n_f32(threshold);
+    uint32x4_t hit = vdupq_n_u32(0);
+    if (1 == step)
+    {
+        for (; i + 4 <= n; i += 4)
+            hit = vorrq_u32(hit, vcgtq_f32(vld1q_f32(score + i), v_threshold));
+    }
+    else if (2 == step)
+    {
+        for (; i + 4 < n; i += 4)
+            hit = vorrq_u32(hit, vcgtq_f32(vld2q_f32(score + 2 * i).val[0], v_threshold));
+    }
+    if (vget_lane_u64(vreinterpret_u64_u32(vorr_u32(vget_low_u32(hit), vget_high_u32(hit))), 0))
+        return true;
+#endif
+    bool any = false;
+    for (; i < n; i++)
+        any |= score[i * step] > threshold;
+    return any;
+}
+
+int image_scan_scores_f(image_candidate_t *candidates, int max_candidates, const fptp_t *score, int step, int *cell, int cells, fptp_t threshold)
+{
+    int n = 0;
+    int i = *cell;
+    while ((i < cells) && ((NULL == candidates) || (n < max_candidates)))
+    {
+        int end = DL_IMAGE_MIN(i + IMAGE_SCAN_BLOCK, cells);
+        if (candidates)
+            end = DL_IMAGE_MIN(end, i + max_candidates - n);
+        if (!image_scan_any_f(score + i * step, end - i, step, threshold))
+        {
+            i = end;
+            continue;
+        }
+        for (; i < end; i++)
+        {
+            if (score[i * step] > threshold)
+            {
+                if (candidates)
+                {
+                    candidates[n].index = i;
+                    candidates[n].category = 0;
+                    candidates[n].score = score[i * step];
+                }
+                n++;
+            }
+        }
+    }
+    *cell = i;
+    return n;
+}
+
 image_list_t *image_get_valid_boxes(fptp_t *score,
                                     fptp_t *offset,
                                     fptp_t *landmark,
@@ -254,40 +1207,16 @@ image_list_t *image_get_valid_boxes(fptp_t *score,
                                     fptp_t x_resize_scale,
                                     bool do_regression)
 { /*{{{*/
-    typedef struct
-    {
-        short x;
-        short y;
-        int index;
-        uc_t anchor_index;
-    } valid_index_t;
-    valid_index_t *valid_indexes = (valid_index_t *)dl_lib_calloc(width * height, sizeof(valid_index_t), 0);
-    int valid_count = 0;
-    int index = 0;
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            for (size_t c = 0; c < anchor_number; c++)
-            {
-                if (score[2 * index + 1] > score_threshold)
-                {
-                    valid_indexes[valid_count].x = x;
-                    valid_indexes[valid_count].y = y;
-                    valid_indexes[valid_count].index = index;
-                    valid_indexes[valid_count].anchor_index = c;
-                    valid_count++;
-                }
-                index++;
-            }
-        }
-    }
-
+    // the score map is (h, w, anchor, 2), the second of each pair is the face score
+    int cells = width * height * anchor_number;
+    int cell = 0;
+    int valid_count = image_scan_scores_f(NULL, 0, score + 1, 2, &cell, cells, score_threshold);
     if (0 == valid_count)
-    {
-        dl_lib_free(valid_indexes);
         return NULL;
-    }
+
+    image_candidate_t *candidates = (image_candidate_t *)dl_lib_calloc(valid_count, sizeof(image_candidate_t), 0);
+    cell = 0;
+    image_scan_scores_f(candidates, valid_count, score + 1, 2, &cell, cells, score_threshold);
 
     image_box_t *valid_box = (image_box_t *)dl_lib_calloc(valid_count, sizeof(image_box_t), 0);
     image_list_t *valid_list = (image_list_t *)dl_lib_calloc(1, sizeof(image_list_t), 0);
@@ -295,68 +1224,54 @@ image_list_t *image_get_valid_boxes(fptp_t *score,
     valid_list->origin_head = valid_box;
     valid_list->len = valid_count;
 
-    if (do_regression)
+    for (int i = 0; i < valid_count; i++)
     {
-        for (int i = 0; i < valid_count; i++)
-        {
-            // TODO: score
-            valid_box[i].score = score[2 * valid_indexes[i].index + 1];
+        int index = candidates[i].index;
+        int x = (index / anchor_number) % width;
+        int y = index / (anchor_number * width);
+        int anchor_size = anchors_size[index % anchor_number];
+        valid_box[i].score = candidates[i].score;
 
-            // TODO: box
-            int anchor_size = anchors_size[valid_indexes[i].anchor_index];
-            int anchor_left_up_x = valid_indexes[i].x * stride;
-            int anchor_left_up_y = valid_indexes[i].y * stride;
-            
+        if (do_regression)
+        {
+            int anchor_left_up_x = x * stride;
+            int anchor_left_up_y = y * stride;
 
-            valid_box[i].box.box_p[0] = (offset[valid_indexes[i].index * 4 + 0] * anchor_size + anchor_left_up_x) / x_resize_scale;
-            valid_box[i].box.box_p[1] = (offset[valid_indexes[i].index * 4 + 1] * anchor_size + anchor_left_up_y) / y_resize_scale;
-            valid_box[i].box.box_p[2] = (offset[valid_indexes[i].index * 4 + 2] * anchor_size + anchor_left_up_x + anchor_size - 1) / x_resize_scale;
-            valid_box[i].box.box_p[3] = (offset[valid_indexes[i].index * 4 + 3] * anchor_size + anchor_left_up_y + anchor_size - 1) / y_resize_scale;
+            valid_box[i].box.box_p[0] = (offset[index * 4 + 0] * anchor_size + anchor_left_up_x) / x_resize_scale;
+            valid_box[i].box.box_p[1] = (offset[index * 4 + 1] * anchor_size + anchor_left_up_y) / y_resize_scale;
+            valid_box[i].box.box_p[2] = (offset[index * 4 + 2] * anchor_size + anchor_left_up_x + anchor_size - 1) / x_resize_scale;
+            valid_box[i].box.box_p[3] = (offset[index * 4 + 3] * anchor_size + anchor_left_up_y + anchor_size - 1) / y_resize_scale;
 
-            // TODO: landmark
             if (landmark)
             {
-                valid_box[i].landmark.landmark_p[0] = (landmark[valid_indexes[i].index * 10 + 0] * anchor_size + anchor_left_up_x) / x_resize_scale;
-                valid_box[i].landmark.landmark_p[1] = (landmark[valid_indexes[i].index * 10 + 1] * anchor_size + anchor_left_up_y) / y_resize_scale;
-                valid_box[i].landmark.landmark_p[2] = (landmark[valid_indexes[i].index * 10 + 2] * anchor_size + anchor_left_up_x) / x_resize_scale;
-                valid_box[i].landmark.landmark_p[3] = (landmark[valid_indexes[i].index * 10 + 3] * anchor_size + anchor_left_up_y) / y_resize_scale;
-                valid_box[i].landmark.landmark_p[4] = (landmark[valid_indexes[i].index * 10 + 4] * anchor_size + anchor_left_up_x) / x_resize_scale;
-                valid_box[i].landmark.landmark_p[5] = (landmark[valid_indexes[i].index * 10 + 5] * anchor_size + anchor_left_up_y) / y_resize_scale;
-                valid_box[i].landmark.landmark_p[6] = (landmark[valid_indexes[i].index * 10 + 6] * anchor_size + anchor_left_up_x) / x_resize_scale;
-                valid_box[i].landmark.landmark_p[7] = (landmark[valid_indexes[i].index * 10 + 7] * anchor_size + anchor_left_up_y) / y_resize_scale;
-                valid_box[i].landmark.landmark_p[8] = (landmark[valid_indexes[i].index * 10 + 8] * anchor_size + anchor_left_up_x) / x_resize_scale;
-                valid_box[i].landmark.landmark_p[9] = (landmark[valid_indexes[i].index * 10 + 9] * anchor_size + anchor_left_up_y) / y_resize_scale;
+                for (int j = 0; j < 10; j += 2)
+                {
+                    valid_box[i].landmark.landmark_p[j] = (landmark[index * 10 + j] * anchor_size + anchor_left_up_x) / x_resize_scale;
+                    valid_box[i].landmark.landmark_p[j + 1] = (landmark[index * 10 + j + 1] * anchor_size + anchor_left_up_y) / y_resize_scale;
+                }
             }
-            valid_box[i].next = &(valid_box[i + 1]);
         }
-    }
-    else
-    {
-        for (int i = 0; i < valid_count; i++)
+        else
         {
-            valid_box[i].score = score[2 * valid_indexes[i].index + 1];
-
-            int anchor_size = anchors_size[valid_indexes[i].anchor_index];
-            valid_box[i].box.box_p[0] = valid_indexes[i].x / x_resize_scale * stride;
-            valid_box[i].box.box_p[1] = valid_indexes[i].y / y_resize_scale * stride;
+            valid_box[i].box.box_p[0] = x / x_resize_scale * stride;
+            valid_box[i].box.box_p[1] = y / y_resize_scale * stride;
             valid_box[i].box.box_p[2] = valid_box[i].box.box_p[0] + anchor_size / x_resize_scale;
             valid_box[i].box.box_p[3] = valid_box[i].box.box_p[1] + anchor_size / y_resize_scale;
 
-            valid_box[i].offset.box_p[0] = offset[valid_indexes[i].index * 4 + 0];
-            valid_box[i].offset.box_p[1] = offset[valid_indexes[i].index * 4 + 1];
-            valid_box[i].offset.box_p[2] = offset[valid_indexes[i].index * 4 + 2];
-            valid_box[i].offset.box_p[3] = offset[valid_indexes[i].index * 4 + 3];
+            valid_box[i].offset.box_p[0] = offset[index * 4 + 0];
+            valid_box[i].offset.box_p[1] = offset[index * 4 + 1];
+            valid_box[i].offset.box_p[2] = offset[index * 4 + 2];
+            valid_box[i].offset.box_p[3] = offset[index * 4 + 3];
 
             if (landmark)
                 for (size_t j = 0; j < 10; j++)
-                    valid_box[i].landmark.landmark_p[j] = landmark[valid_indexes[i].index * 10 + j];
-
-            valid_box[i].next = &(valid_box[i + 1]);
+                    valid_box[i].landmark.landmark_p[j] = landmark[index * 10 + j];
         }
+        valid_box[i].next = &(valid_box[i + 1]);
     }
     valid_box[valid_count - 1].next = NULL;
 
-    dl_lib_free(valid_indexes);
+    dl_lib_free(candidates);
 
     return valid_list;
 } /*}}}*/
@@ -422,29 +1337,169 @@ void image_nms_process(image_list_t *image_list, fptp_t nms_threshold, int same_
     image_list->len -= num_supressed;
 } /*}}}*/
 
+typedef struct
+{
+    fptp_t score;
+    int index;
+} image_nms_key_t;
+
+// higher score first, ties keep their input order
+static int image_nms_key_compare(const void *a, const void *b)
+{
+    const image_nms_key_t *x = (const image_nms_key_t *)a;
+    const image_nms_key_t *y = (const image_nms_key_t *)b;
+    if (x->score != y->score)
+        return (x->score < y->score) ? 1 : -1;
+    return x->index - y->index;
+}
+
+static void image_nms_gather(void *items, size_t size, const int *index, int n, void *scratch)
+{
+    if (NULL == items)
+        return;
+    for (int i = 0; i < n; i++)
+        memcpy((uint8_t *)scratch + i * size, (uint8_t *)items + index[i] * size, size);
+    memcpy(items, scratch, n * size);
+}
+
+int image_nms_batched(box_array_t *boxes, const image_nms_config_t *config)
+{ /*{{{*/
+    int n = boxes->len;
+    if (n <= 0)
+        return 0;
+
+    int classes = 1;
+    bool by_class = !config->class_agnostic && boxes->category;
+    if (by_class)
+        for (int i = 0; i < n; i++)
+            classes = DL_IMAGE_MAX(classes, boxes->category[i] + 1);
+
+    image_nms_key_t *key = (image_nms_key_t *)dl_lib_calloc(n, sizeof(image_nms_key_t), 0);
+    int *order = (int *)dl_lib_calloc(n + classes + 1, sizeof(int), 0);
+    fptp_t *area = (fptp_t *)dl_lib_calloc(n, sizeof(fptp_t), 0);
+    uint8_t *state = (uint8_t *)dl_lib_calloc(n, sizeof(uint8_t), 0);
+    if ((NULL == key) || (NULL == order) || (NULL == area) || (NULL == state))
+    {
+        dl_lib_free(key);
+        dl_lib_free(order);
+        dl_lib_free(area);
+        dl_lib_free(state);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        key[i].score = boxes->score[i];
+        key[i].index = i;
+        image_get_area(boxes->box + i, area + i);
+    }
+    qsort(key, n, sizeof(image_nms_key_t), image_nms_key_compare);
+
+    // one pass into per-class buckets, each still in score order
+    int *start = order + n;
+    for (int i = 0; i < n; i++)
+        start[by_class ? boxes->category[i] + 1 : 1]++;
+    for (int c = 0; c < classes; c++)
+        start[c + 1] += start[c];
+    for (int i = 0; i < n; i++)
+    {
+        int c = by_class ? boxes->category[key[i].index] : 0;
+        order[start[c]++] = key[i].index;
+    }
+    for (int c = classes; c > 0; c--)
+        start[c] = start[c - 1];
+    start[0] = 0;
+
+    // greedy NMS inside each bucket, state is 1 for kept and 2 for suppressed
+    for (int c = 0; c < classes; c++)
+    {
+        bool own = by_class && (c < config->classes);
+        fptp_t threshold = (own && config->class_iou_threshold) ? config->class_iou_threshold[c] : config->iou_threshold;
+        int max_detections = (own && config->class_max_detections) ? config->class_max_detections[c] : config->max_detections;
+        int kept = 0;
+        for (int p = start[c]; p < start[c + 1]; p++)
+        {
+            int i = order[p];
+            if (state[i])
+                continue;
+            if (max_detections && (kept == max_detections))
+                break;
+            state[i] = 1;
+            kept++;
+            box_t *kept_box = boxes->box + i;
+            for (int q = p + 1; q < start[c + 1]; q++)
+            {
+                int j = order[q];
+                if (state[j])
+                    continue;
+                box_t *other_box = boxes->box + j;
+                box_t inter_box;
+                inter_box.box_p[0] = DL_IMAGE_MAX(kept_box->box_p[0], other_box->box_p[0]);
+                inter_box.box_p[1] = DL_IMAGE_MAX(kept_box->box_p[1], other_box->box_p[1]);
+                inter_box.box_p[2] = DL_IMAGE_MIN(kept_box->box_p[2], other_box->box_p[2]);
+                inter_box.box_p[3] = DL_IMAGE_MIN(kept_box->box_p[3], other_box->box_p[3]);
+
+                fptp_t inter_w, inter_h;
+                image_get_width_and_height(&inter_box, &inter_w, &inter_h);
+                if (inter_w > 0 && inter_h > 0)
+                {
+                    fptp_t inter_area = inter_w * inter_h;
+                    fptp_t iou = inter_area / (area[i] + area[j] - inter_area);
+                    if (iou > threshold)
+                        state[j] = 2;
+                }
+            }
+        }
+    }
+
+    // the kept boxes in score order, compacted to the front of the arrays
+    int len = 0;
+    for (int i = 0; i < n; i++)
+        if (1 == state[key[i].index])
+            order[len++] = key[i].index;
+    void *scratch = dl_lib_calloc(len, boxes->landmark ? sizeof(landmark_t) : sizeof(box_t), 0);
+    if (scratch)
+    {
+        image_nms_gather(boxes->category, sizeof(uint8_t), order, len, scratch);
+        image_nms_gather(boxes->score, sizeof(fptp_t), order, len, scratch);
+        image_nms_gather(boxes->box, sizeof(box_t), order, len, scratch);
+        image_nms_gather(boxes->landmark, sizeof(landmark_t), order, len, scratch);
+        boxes->len = len;
+    }
+
+    dl_lib_free(scratch);
+    dl_lib_free(key);
+    dl_lib_free(order);
+    dl_lib_free(area);
+    dl_lib_free(state);
+    return scratch ? len : -1;
+} /*}}}*/
+
 void image_rgb565_to_888(uint8_t *m, uint16_t *bmp, int count)
 { /*{{{*/
-    uc_t dst[24];
-    for (int x = 0; x < count; x += 8)
-    {
-        rgb565_to_888(*bmp++, dst);
-        rgb565_to_888(*bmp++, dst + 3);
-        rgb565_to_888(*bmp++, dst + 6);
-        rgb565_to_888(*bmp++, dst + 9);
-        rgb565_to_888(*bmp++, dst + 12);
-        rgb565_to_888(*bmp++, dst + 15);
-        rgb565_to_888(*bmp++, dst + 18);
-        rgb565_to_888(*bmp++, dst + 21);
-        memcpy(m + x * 3, dst, 24 * sizeof(uint8_t));
+    // the camera stores the high byte first: RRRRRGGG GGGBBBBB
+    const uint8_t *p = (const uint8_t *)bmp;
+    for (int x = 0; x < count; x++)
+    {
+        uint8_t hi = p[0];
+        uint8_t lo = p[1];
+        m[0] = hi & 0xF8;
+        m[1] = ((hi & 0x07) << 5) | ((lo & 0xE0) >> 3);
+        m[2] = (lo & 0x1F) << 3;
+        p += 2;
+        m += 3;
     }
 } /*}}}*/
 
 void image_rgb888_to_565(uint16_t *bmp, uint8_t *m, int count)
 { /*{{{*/
+    // same layout as rgb888_to_565(bmp, m[2], m[1], m[0])
+    uint8_t *p = (uint8_t *)bmp;
     for (int x = 0; x < count; x++)
     {
-        rgb888_to_565(bmp, m[2], m[1], m[0]);
-        bmp++;
+        p[0] = (m[2] & 0xF8) | (m[1] >> 5);
+        p[1] = ((m[1] << 3) & 0xE0) | (m[0] >> 3);
+        p += 2;
         m += 3;
     }
 } /*}}}*/
@@ -715,6 +1770,94 @@ void image_erode(uint8_t *dst, uint8_t *src, int src_w, int src_h, int src_c)
     image_kernel_get_min(dst, src, 2, 2, src_c, stride);
 }
 
+static inline uint8_t image_morph_op(uint8_t a, uint8_t b, int dilate)
+{
+    if (dilate)
+        return a > b ? a : b;
+    return a < b ? a : b;
+}
+
+/*
+ * van Herk / Gil-Werman: the padded line is cut into blocks of k, g holds the running min (max) from the start
+ * of each block and hb the one from its end. Any window of k spans at most two blocks, so it is one op of the two.
+ */
+static void image_morph_line(uint8_t *out, const uint8_t *in, int step, int n, int k, int dilate, uint8_t *g, uint8_t *hb)
+{
+    int r0 = (k - 1) / 2;
+    int len = (n + k - 1 + k - 1) / k * k;
+    uint8_t pad = dilate ? 0 : 255;
+
+    for (int i = 0; i < r0; i++)
+        g[i] = pad;
+    for (int i = 0; i < n; i++)
+        g[r0 + i] = in[i * step];
+    for (int i = r0 + n; i < len; i++)
+        g[i] = pad;
+
+    for (int b = 0; b < len; b += k)
+    {
+        hb[b + k - 1] = g[b + k - 1];
+        for (int i = b + k - 2; i >= b; i--)
+            hb[i] = image_morph_op(g[i], hb[i + 1], dilate);
+        for (int i = b + 1; i < b + k; i++)
+            g[i] = image_morph_op(g[i - 1], g[i], dilate);
+    }
+
+    for (int x = 0; x < n; x++)
+        out[x * step] = image_morph_op(hb[x], g[x + k - 1], dilate);
+}
+
+static int image_morph_rect(uint8_t *dst, const uint8_t *src, int w, int h, int c, int kw, int kh, int dilate)
+{
+    assert((kw > 0) && (kh > 0));
+    int line = DL_IMAGE_MAX(w + 2 * kw, h + 2 * kh);
+    uint8_t *tmp = (uint8_t *)dl_lib_calloc(w * h * c + 2 * line, sizeof(uint8_t), 0);
+    if (NULL == tmp)
+        return -1;
+    uint8_t *g = tmp + w * h * c;
+    uint8_t *hb = g + line;
+    int stride = w * c;
+
+    // rows into tmp, then columns into dst, so dst can be src
+    for (int y = 0; y < h; y++)
+    {
+        for (int k = 0; k < c; k++)
+            image_morph_line(tmp + y * stride + k, src + y * stride + k, c, w, kw, dilate, g, hb);
+    }
+    for (int x = 0; x < w; x++)
+    {
+        for (int k = 0; k < c; k++)
+            image_morph_line(dst + x * c + k, tmp + x * c + k, stride, h, kh, dilate, g, hb);
+    }
+
+    dl_lib_free(tmp);
+    return 0;
+}
+
+int image_erode_rect(uint8_t *dst, const uint8_t *src, int w, int h, int c, int kw, int kh)
+{
+    return image_morph_rect(dst, src, w, h, c, kw, kh, 0);
+}
+
+int image_dilate_rect(uint8_t *dst, const uint8_t *src, int w, int h, int c, int kw, int kh)
+{
+    return image_morph_rect(dst, src, w, h, c, kw, kh, 1);
+}
+
+int image_open_rect(uint8_t *dst, const uint8_t *src, int w, int h, int c, int kw, int kh)
+{
+    if (image_morph_rect(dst, src, w, h, c, kw, kh, 0))
+        return -1;
+    return image_morph_rect(dst, dst, w, h, c, kw, kh, 1);
+}
+
+int image_close_rect(uint8_t *dst, const uint8_t *src, int w, int h, int c, int kw, int kh)
+{
+    if (image_morph_rect(dst, src, w, h, c, kw, kh, 1))
+        return -1;
+    return image_morph_rect(dst, dst, w, h, c, kw, kh, 0);
+}
+
 Matrix *matrix_alloc(int h, int w)
 {
     Matrix *r = calloc(1, sizeof(Matrix));
@@ -985,96 +2128,225 @@ uint8_t get_otsu_thresh(dl_matrix3du_t *img)
     return threshold;
 }
 
-dl_matrix3du_t *rgb2gray(dl_matrix3du_t *img)
-{
-    assert(img->c == 3);
-    dl_matrix3du_t *gray = dl_matrix3du_alloc(1, img->w, img->h, 1);
-    int count = (img->w) * (img->h);
-    uint8_t *r = img->item;
-    uint8_t *g = r + 1;
-    uint8_t *b = r + 2;
+// Gray = R*0.299 + G*0.587 + B*0.114 in Q16
+#define IMAGE_GRAY_R 19595
+#define IMAGE_GRAY_G 38469
+#define IMAGE_GRAY_B 7472
 
-    uint8_t *pgray = gray->item;
-    int x = 0;
+void image_rgb888_to_gray(uint8_t *dst, const uint8_t *src, int count)
+{
     for (int i = 0; i < count; i++)
     {
-        x = (19595 * (*r) + 38469 * (*g) + 7472 * (*b)) >> 16; //fast algorithm
-        //Gray = R*0.299 + G*0.587 + B*0.114
-        //Gray = (R*30 + G*59 + B*11 + 50) / 100
-        //Gray = (R*38 + G*75 + B*15) >> 7
-
-        *(pgray++) = (uint8_t)x;
+        dst[i] = (IMAGE_GRAY_R * src[0] + IMAGE_GRAY_G * src[1] + IMAGE_GRAY_B * src[2]) >> 16;
+        src += 3;
+    }
+}
 
-        r += 3;
-        g += 3;
-        b += 3;
+void image_rgb565_to_gray(uint8_t *dst, const uint16_t *src, int count)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    for (int i = 0; i < count; i++)
+    {
+        int r = p[0] & 0xF8;
+        int g = ((p[0] & 0x07) << 5) | ((p[1] & 0xE0) >> 3);
+        int b = (p[1] & 0x1F) << 3;
+        dst[i] = (IMAGE_GRAY_R * r + IMAGE_GRAY_G * g + IMAGE_GRAY_B * b) >> 16;
+        p += 2;
     }
-    return gray;
 }
 
-dl_matrix3du_t *rgb2lab(dl_matrix3du_t *img)
+dl_matrix3du_t *rgb2gray(dl_matrix3du_t *img)
 {
     assert(img->c == 3);
-    dl_matrix3du_t *lab = dl_matrix3du_alloc(1, img->w, img->h, img->c);
-    int count = (img->w) * (img->h);
-    uint8_t *r = img->item;
-    uint8_t *g = r + 1;
-    uint8_t *b = r + 2;
+    dl_matrix3du_t *gray = dl_matrix3du_alloc(1, img->w, img->h, 1);
+    for (int y = 0; y < img->h; y++)
+        image_rgb888_to_gray(gray->item + y * gray->stride, img->item + y * img->stride, img->w);
+    return gray;
+}
+
+static void image_rgb888_to_lab_float(uint8_t *dst, const uint8_t *src, int count)
+{
     float x, y, z;
-    uint8_t *plab = lab->item;
     for (int i = 0; i < count; i++)
     {
-        x = (0.433953 * (*r) + 0.376219 * (*g) + 0.189828 * (*b)) / 255;
-        y = (0.212671 * (*r) + 0.715160 * (*g) + 0.072169 * (*b)) / 255;
-        z = (0.017758 * (*r) + 0.109476 * (*g) + 0.872766 * (*b)) / 255;
+        x = (0.433953 * src[0] + 0.376219 * src[1] + 0.189828 * src[2]) / 255;
+        y = (0.212671 * src[0] + 0.715160 * src[1] + 0.072169 * src[2]) / 255;
+        z = (0.017758 * src[0] + 0.109476 * src[1] + 0.872766 * src[2]) / 255;
 
         x = (x > 0.008856) ? pow(x, 1.0 / 3) : (7.787037 * x + 0.137931);
         y = (y > 0.008856) ? pow(y, 1.0 / 3) : (7.787037 * y + 0.137931);
         z = (z > 0.008856) ? pow(z, 1.0 / 3) : (7.787037 * z + 0.137931);
 
-        *(plab++) = (uint8_t)(116 * y - 16);
-        *(plab++) = (uint8_t)(500 * (x - y) + 128);
-        *(plab++) = (uint8_t)(200 * (y - z) + 128);
-
-        r += 3;
-        g += 3;
-        b += 3;
+        *(dst++) = (uint8_t)DL_IMAGE_MIN(DL_IMAGE_MAX(116 * y - 16, 0), 255);
+        *(dst++) = (uint8_t)DL_IMAGE_MIN(DL_IMAGE_MAX(500 * (x - y) + 128, 0), 255);
+        *(dst++) = (uint8_t)DL_IMAGE_MIN(DL_IMAGE_MAX(200 * (y - z) + 128, 0), 255);
+        src += 3;
     }
+}
 
-    return lab;
+/*
+ * XYZ from RGB in Q16 with rows summing to 1 << 16, so X, Y and Z stay in [0, 255].
+ * f(t) of CIE Lab is tabulated for t = X / 255 in steps of 1 / 16 of a level, in Q15.
+ */
+#define IMAGE_LAB_FRAC 4
+#define IMAGE_LAB_LUT_SIZE ((255 << IMAGE_LAB_FRAC) + 1)
+
+static const int32_t image_lab_m[9] = {
+    28440, 24656, 12440,
+    13938, 46869, 4729,
+    1164, 7175, 57197,
+};
+
+static uint16_t *image_lab_lut = NULL;
+
+static const uint16_t *image_lab_lut_get(void)
+{
+    if (image_lab_lut)
+        return image_lab_lut;
+
+    uint16_t *lut = (uint16_t *)dl_lib_calloc(IMAGE_LAB_LUT_SIZE, sizeof(uint16_t), 0);
+    if (NULL == lut)
+        return NULL;
+    for (int i = 0; i < IMAGE_LAB_LUT_SIZE; i++)
+    {
+        double t = (double)i / (255 << IMAGE_LAB_FRAC);
+        double f = (t > 0.008856) ? pow(t, 1.0 / 3) : (7.787037 * t + 0.137931);
+        lut[i] = (uint16_t)lrint(f * 32768);
+    }
+    // another task may have built it meanwhile, keep theirs
+    if (!__sync_bool_compare_and_swap(&image_lab_lut, NULL, lut))
+        dl_lib_free(lut);
+    return image_lab_lut;
 }
 
-dl_matrix3du_t *rgb2lab_fast(dl_matrix3du_t *img)
+void image_rgb888_to_lab(uint8_t *dst, const uint8_t *src, int count)
 {
-    assert(img->c == 3);
-    dl_matrix3du_t *lab = dl_matrix3du_alloc(1, img->w, img->h, img->c);
-    int count = (img->w) * (img->h);
-    /*int c1 = 1<<16;
-	int c2 = 1<<24;*/
-    uint8_t *r = img->item;
-    uint8_t *g = r + 1;
-    uint8_t *b = r + 2;
-    int x, y, z;
-    //float temp = 0;
-    uint8_t *plab = lab->item;
+    const uint16_t *lut = image_lab_lut_get();
+    if (NULL == lut)
+    {
+        image_rgb888_to_lab_float(dst, src, count);
+        return;
+    }
+
+    const int32_t *m = image_lab_m;
+    const int round = 1 << (15 - IMAGE_LAB_FRAC);
     for (int i = 0; i < count; i++)
     {
-        x = (13933 * (*r) + 46871 * (*g) + 4732 * (*b)) >> 16;
-        y = (((5467631 * (*r) - 8376186 * (*g) + 2908178 * (*b))) >> 24) + 128;
-        z = (((2043680 * (*r) + 6351200 * (*g) - 8394880 * (*b))) >> 24) + 128;
+        int r = src[0], g = src[1], b = src[2];
+        int fx = lut[(m[0] * r + m[1] * g + m[2] * b + round) >> (16 - IMAGE_LAB_FRAC)];
+        int fy = lut[(m[3] * r + m[4] * g + m[5] * b + round) >> (16 - IMAGE_LAB_FRAC)];
+        int fz = lut[(m[6] * r + m[7] * g + m[8] * b + round) >> (16 - IMAGE_LAB_FRAC)];
 
-        *(plab++) = (uint8_t)x;
-        *(plab++) = (uint8_t)y;
-        *(plab++) = (uint8_t)z;
+        int l = (116 * fy - (16 << 15)) >> 15;
+        int a = (500 * (fx - fy) + (128 << 15)) >> 15;
+        int bb = (200 * (fy - fz) + (128 << 15)) >> 15;
+        dst[0] = DL_IMAGE_MIN(DL_IMAGE_MAX(l, 0), 255);
+        dst[1] = DL_IMAGE_MIN(DL_IMAGE_MAX(a, 0), 255);
+        dst[2] = DL_IMAGE_MIN(DL_IMAGE_MAX(bb, 0), 255);
+        src += 3;
+        dst += 3;
+    }
+}
 
-        r += 3;
-        g += 3;
-        b += 3;
+void image_rgb888_to_lab_fast(uint8_t *dst, const uint8_t *src, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        int r = src[0], g = src[1], b = src[2];
+        dst[0] = (uint8_t)((13933 * r + 46871 * g + 4732 * b) >> 16);
+        dst[1] = (uint8_t)(((5467631 * r - 8376186 * g + 2908178 * b) >> 24) + 128);
+        dst[2] = (uint8_t)(((2043680 * r + 6351200 * g - 8394880 * b) >> 24) + 128);
+        src += 3;
+        dst += 3;
     }
+}
+
+dl_matrix3du_t *rgb2lab(dl_matrix3du_t *img)
+{
+    assert(img->c == 3);
+    dl_matrix3du_t *lab = dl_matrix3du_alloc(1, img->w, img->h, img->c);
+    for (int y = 0; y < img->h; y++)
+        image_rgb888_to_lab(lab->item + y * lab->stride, img->item + y * img->stride, img->w);
+    return lab;
+}
 
+dl_matrix3du_t *rgb2lab_fast(dl_matrix3du_t *img)
+{
+    assert(img->c == 3);
+    dl_matrix3du_t *lab = dl_matrix3du_alloc(1, img->w, img->h, img->c);
+    for (int y = 0; y < img->h; y++)
+        image_rgb888_to_lab_fast(lab->item + y * lab->stride, img->item + y * img->stride, img->w);
     return lab;
 }
 
+int image_color_benchmark(int w, int h, int rounds)
+{
+    int count = w * h;
+    uint8_t *rgb = (uint8_t *)dl_lib_calloc(count * 3 * 3, sizeof(uint8_t), 0);
+    uint16_t *rgb565 = (uint16_t *)dl_lib_calloc(count, sizeof(uint16_t), 0);
+    if ((NULL == rgb) || (NULL == rgb565))
+    {
+        dl_lib_free(rgb);
+        dl_lib_free(rgb565);
+        return -1;
+    }
+    uint8_t *out = rgb + count * 3;
+    uint8_t *ref = out + count * 3;
+    unsigned int seed = 1;
+    for (int i = 0; i < count * 3; i++)
+        rgb[i] = rand_r(&seed);
+    for (int i = 0; i < count; i++)
+        rgb565[i] = rand_r(&seed);
+
+    int64_t t0, t_old, t_new;
+    int diff = 0;
+
+    t0 = esp_timer_get_time();
+    for (int r = 0; r < rounds; r++)
+        image_rgb888_to_lab_float(ref, rgb, count);
+    t_old = esp_timer_get_time() - t0;
+    t0 = esp_timer_get_time();
+    for (int r = 0; r < rounds; r++)
+        image_rgb888_to_lab(out, rgb, count);
+    t_new = esp_timer_get_time() - t0;
+    for (int i = 0; i < count * 3; i++)
+        diff = DL_IMAGE_MAX(diff, abs(out[i] - ref[i]));
+    // the table is within 1 of the float conversion
+    printf("rgb888 to lab: float %d us, table %d us, max diff %d%s\n", (int)(t_old / rounds), (int)(t_new / rounds), diff, (diff > 1) ? ", MISMATCH" : "");
+
+    t0 = esp_timer_get_time();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < count; i++)
+            rgb565_to_888(rgb565[i], ref + i * 3);
+    }
+    t_old = esp_timer_get_time() - t0;
+    t0 = esp_timer_get_time();
+    for (int r = 0; r < rounds; r++)
+        image_rgb565_to_888(out, rgb565, count);
+    t_new = esp_timer_get_time() - t0;
+    int mismatch = memcmp(out, ref, count * 3);
+    printf("rgb565 to rgb888: per pixel %d us, bytes %d us, %s\n", (int)(t_old / rounds), (int)(t_new / rounds), mismatch ? "MISMATCH" : "same");
+
+    t0 = esp_timer_get_time();
+    for (int r = 0; r < rounds; r++)
+    {
+        image_rgb565_to_888(out, rgb565, count);
+        image_rgb888_to_gray(ref, out, count);
+    }
+    t_old = esp_timer_get_time() - t0;
+    t0 = esp_timer_get_time();
+    for (int r = 0; r < rounds; r++)
+        image_rgb565_to_gray(out, rgb565, count);
+    t_new = esp_timer_get_time() - t0;
+    mismatch |= memcmp(out, ref, count);
+    printf("rgb565 to gray: through rgb888 %d us, direct %d us, %s\n", (int)(t_old / rounds), (int)(t_new / rounds), memcmp(out, ref, count) ? "MISMATCH" : "same");
+
+    dl_lib_free(rgb);
+    dl_lib_free(rgb565);
+    return (mismatch || (diff > 1)) ? -1 : diff;
+}
+
 dl_matrix3du_t *gen_binary_img(dl_matrix3du_t *lab, int *thresh)
 {
     dl_matrix3du_t *bin = dl_matrix3du_alloc(1, lab->w, lab->h, 1);
@@ -1379,43 +2651,12 @@ Matrix *get_similarity_matrix(float *srcx, float *srcy, float *dstx, float *dsty
 void warp_affine(dl_matrix3du_t *img, dl_matrix3du_t *crop, Matrix *M)
 {
     Matrix *M_inv = get_inv_affine_matrix(M);
-    uint8_t *dst = crop->item;
-    int stride = img->w * img->c;
-    int c = img->c;
-
-    float x_src = 0.0;
-    float y_src = 0.0;
-    int x1 = 0;
-    int x2 = 0;
-    int y1 = 0;
-    int y2 = 0;
+    if (NULL == M_inv)
+        return;
 
-    for (int i = 0; i < crop->h; i++)
-    {
-        for (int j = 0; j < crop->w; j++)
-        {
-            x_src = M_inv->array[0][0] * j + M_inv->array[0][1] * i + M_inv->array[0][2];
-            y_src = M_inv->array[1][0] * j + M_inv->array[1][1] * i + M_inv->array[1][2];
-            if ((x_src < 0) || (y_src < 0) || (x_src >= (img->w - 1)) || (y_src >= (img->h - 1)))
-            {
-                for (int k = 0; k < crop->c; k++)
-                {
-                    *dst++ = 0;
-                }
-            }
-            else
-            {
-                x1 = floor(x_src);
-                x2 = x1 + 1;
-                y1 = floor(y_src);
-                y2 = y1 + 1;
-                for (int k = 0; k < crop->c; k++)
-                {
-                    *dst++ = (uint8_t)rintf(((img->item[y1 * stride + x1 * c + k]) * (x2 - x_src) * (y2 - y_src)) + ((img->item[y1 * stride + x2 * c + k]) * (x_src - x1) * (y2 - y_src)) + ((img->item[y2 * stride + x1 * c + k]) * (x2 - x_src) * (y_src - y1)) + ((img->item[y2 * stride + x2 * c + k]) * (x_src - x1) * (y_src - y1)));
-                }
-            }
-        }
-    }
+    float m_inv[6] = {M_inv->array[0][0], M_inv->array[0][1], M_inv->array[0][2],
+                      M_inv->array[1][0], M_inv->array[1][1], M_inv->array[1][2]};
+    image_warp_affine_stride(crop->item, crop->stride, img->item, img->stride, crop->w, crop->h, crop->c, img->w, img->h, m_inv, IMAGE_BORDER_CONSTANT);
     matrix_free(M_inv);
 }
 
@@ -1745,50 +2986,41 @@ dl_matrix3dq_t *image_resize_normalize_quantize(uint8_t *image, int input_w, int
     assert(shift>=0);
     float scale = 0.0;
     int target_w, target_h = 0;
-    //int dw, dh = 0;
     if(input_w >= input_h){
         scale = (float)target_size / input_w;
         target_w = target_size;
         target_h = (int)(input_h*scale);
-        //dh = (target_size - target_h)/2;
     }else{
         scale = (float)target_size / input_h;
         target_w = (int)(input_w*scale);
         target_h = target_size;
-        //dw = (target_size - target_w)/2;
     }
+
+    dl_matrix3dq_t *out_image;
     if(process_mode == 0){ //w = h, padding right bottom
-        dl_matrix3dq_t *out_image = dl_matrix3dq_alloc(1, target_size, target_size, c, exponent);
-        int padding_num = target_size - target_w;
-        qtp_t *tmp = out_image->item;
-        if(scale == 1.0){
-            int count = 0; 
-            for(int i=0;i<input_h;i++){
-                for(int j=0;j<input_w;j++){
-                    for(int k=0;k<c; k++){
-                        *tmp++ = ((qtp_t)(image[count++]))<<shift;
-                    }
-                }
-                tmp += (padding_num * c);
-            }
-        }else{
-            image_resize_linear_padding_q(tmp, image, out_image->w, out_image->h, out_image->c, input_w, input_h, 
-                                    target_w, target_h, 0, 0, shift);
-        }
-        return out_image;
+        out_image = dl_matrix3dq_alloc(1, target_size, target_size, c, exponent);
     }else{// no padding , just resize,  w != h
-        dl_matrix3dq_t *out_image = dl_matrix3dq_alloc(1, target_w, target_h, c, exponent);
-        qtp_t *tmp = out_image->item;
-        if(scale == 1.0){
-            int count = input_w*input_h*c;
-            for(int i=0; i<count; i++){
-                *tmp++ = ((qtp_t)(image[i]))<<shift;
-            }
-        }else{
-            image_resize_linear_q(tmp, image, out_image->w, out_image->h, out_image->c, input_w, input_h, shift);
-        }
-        return out_image;
+        out_image = dl_matrix3dq_alloc(1, target_w, target_h, c, exponent);
+    }
+
+    // the same values as image_resize_linear_q: a plain copy at scale 1, the mean of four pixels at scale 2
+    image_source_t src = {image, IMAGE_PIXEL_RGB888, input_w, input_h, 0, 0, 0, input_w, input_h};
+    image_target_t dst = {out_image->item, c, out_image->w * c, target_w, target_h, 0, 0, shift};
+    float scale_x = (float)input_w / target_w;
+    float scale_y = (float)input_h / target_h;
+    image_sample_t sample = IMAGE_SAMPLE_BILINEAR_ROUND;
+    if (scale == 1.0)
+        sample = IMAGE_SAMPLE_NEAREST;
+    else if (fabs(scale_x - 2) <= 1e-6 && fabs(scale_y - 2) <= 1e-6)
+        sample = IMAGE_SAMPLE_MEAN_ROUND;
+    if (0 != image_convert_resize_q(&dst, &src, sample))
+    {
+        if(process_mode == 0)
+            image_resize_linear_padding_q(out_image->item, image, out_image->w, out_image->h, out_image->c, input_w, input_h, target_w, target_h, 0, 0, shift);
+        else
+            image_resize_linear_q(out_image->item, image, out_image->w, out_image->h, out_image->c, input_w, input_h, shift);
     }
+    return out_image;
 }
 
 
@@ -1853,72 +3085,28 @@ void image_resize_n_shift(qtp_t *dimage, uint16_t *simage, int dw, int dh, int d
     }
 }
 
-void image_resize_shift_fast(qtp_t *dimage, uint16_t *simage, int dw, int dc, int sw, int sh, int tw, int th, int shift)
+int image_resize_shift_fast(qtp_t *dimage, uint16_t *simage, int dw, int dc, int sw, int sh, int tw, int th, int shift)
 {
     assert(shift>=2);
     assert(dc == 3);
-    int shift_real = shift - 2;
-    float ratio_w = (float)sw / tw;
-    float ratio_h = (float)sh / th;
-    int16_t dst[12];
-    for (int dyi = 0; dyi < th; dyi++)
-    {
-        int _di = dyi * dw;
-
-        int _si0 = (int)(dyi * ratio_h) * sw;
-        int _si1 = _si0 + sw;
-
-        for (int dxi = 0; dxi < tw; dxi++)
-        {
-            int di = (_di + dxi) * dc;
-    
-            int si0 = (_si0 + (int)(dxi * ratio_w));
-            int si1 = (_si1 + (int)(dxi * ratio_w));
-
-            rgb565_to_888_q16(simage[si0], dst);
-            rgb565_to_888_q16(simage[si0+1], dst + 3);
-            rgb565_to_888_q16(simage[si1], dst + 6);
-            rgb565_to_888_q16(simage[si1+1], dst + 9);
-            dimage[di] = ((dst[0]+dst[3]+dst[6]+dst[9]) << shift_real);
-            dimage[di+1] = ((dst[1]+dst[4]+dst[7]+dst[10]) << shift_real);
-            dimage[di+2] = ((dst[2]+dst[5]+dst[8]+dst[11]) << shift_real);
-        }
-    }
-    return;
+    image_source_t src = {(const uint8_t *)simage, IMAGE_PIXEL_RGB565, sw, sh, 0, 0, 0, sw, sh};
+    image_target_t dst = {dimage, 3, dw * dc, tw, th, 0, 0, shift};
+    return image_convert_resize_q(&dst, &src, IMAGE_SAMPLE_MEAN);
 }
 
 
-void image_resize_nearest_shift(qtp_t *dimage, uint16_t *simage, int dw, int dc, int sw, int sh, int tw, int th, int shift)
+int image_resize_nearest_shift(qtp_t *dimage, uint16_t *simage, int dw, int dc, int sw, int sh, int tw, int th, int shift)
 {
     assert(shift>=0);
     assert(dc == 3);
-    float ratio_w = (float)sw / tw;
-    float ratio_h = (float)sh / th;
-    int16_t dst[3];
-    for (int dyi = 0; dyi < th; dyi++)
-    {
-        int _di = dyi * dw;
-
-        float _si0 = (int)(dyi * ratio_h) * sw;
-
-        for (int dxi = 0; dxi < tw; dxi++)
-        {
-            int di = (_di + dxi) * dc;
-            int si0 = rintf(_si0 + dxi * ratio_w);
-            rgb565_to_888_q16(simage[si0], dst);
-            dimage[di] = ((int16_t)(dst[0]) << shift);
-            dimage[di+1] = ((int16_t)(dst[1]) << shift);
-            dimage[di+2] = ((int16_t)(dst[2]) << shift);
-        }
-    }
-    return;
+    image_source_t src = {(const uint8_t *)simage, IMAGE_PIXEL_RGB565, sw, sh, 0, 0, 0, sw, sh};
+    image_target_t dst = {dimage, 3, dw * dc, tw, th, 0, 0, shift};
+    return image_convert_resize_q(&dst, &src, IMAGE_SAMPLE_NEAREST);
 }
 
-void image_crop_shift_fast(qtp_t *dimage, uint16_t *simage, int dw, int sw, int sh, int x1, int y1, int x2, int y2, int shift)
+int image_crop_shift_fast(qtp_t *dimage, uint16_t *simage, int dw, int sw, int sh, int x1, int y1, int x2, int y2, int shift)
 {
     assert(shift>=2);
-    int shift_real = shift - 2;
-    int16_t dst[12];
 
     int w = x2 - x1;
     int h = y2 - y1;
@@ -1933,27 +3121,7 @@ void image_crop_shift_fast(qtp_t *dimage, uint16_t *simage, int dw, int sw, int
         tw = (int)(w / scale);
         th = dw;
     }
-    for (int dyi = 0; dyi < th; dyi++)
-    {
-        int _di = dyi * dw;
-
-        int _si0 = ((int)(dyi * scale) + y1) * sw;
-        int _si1 = _si0 + sw;
-
-        for (int dxi = 0; dxi < tw; dxi++)
-        {
-            int di = (_di + dxi) * 3;
-    
-            int si0 = (_si0 + (int)(dxi * scale) + x1);
-            int si1 = (_si1 + (int)(dxi * scale) + x1);
-            rgb565_to_888_q16(simage[si0], dst);
-            rgb565_to_888_q16(simage[si0+1], dst + 3);
-            rgb565_to_888_q16(simage[si1], dst + 6);
-            rgb565_to_888_q16(simage[si1+1], dst + 9);
-            dimage[di] = ((dst[0]+dst[3]+dst[6]+dst[9]) << shift_real);
-            dimage[di+1] = ((dst[1]+dst[4]+dst[7]+dst[10]) << shift_real);
-            dimage[di+2] = ((dst[2]+dst[5]+dst[8]+dst[11]) << shift_real);
-        }
-    }
-    return;
-}
\ No newline at end of file
+    image_source_t src = {(const uint8_t *)simage, IMAGE_PIXEL_RGB565, sw, sh, 0, x1, y1, w, h};
+    image_target_t dst = {dimage, 3, dw * 3, tw, th, scale, scale, shift};
+    return image_convert_resize_q(&dst, &src, IMAGE_SAMPLE_MEAN);
+}
@@ -43,6 +43,36 @@ typedef enum
     IMAGE_RESIZE_NEAREST = 2   /*<! Resize image by taking the nearest pixel */
 } image_resize_t;
 
+/**
+ * @brief Reads the channels of one source pixel, RGB888 in place or RGB565 expanded to RGB888.
+ */
+template <class S>
+struct image_pixel_reader;
+
+template <>
+struct image_pixel_reader<uint8_t>
+{
+    const uint8_t *p;
+
+    inline image_pixel_reader(const uint8_t *src_image, int i, int channel) : p(src_image + i * channel) {}
+    inline int operator[](int c) const { return p[c]; }
+};
+
+template <>
+struct image_pixel_reader<uint16_t>
+{
+    int v[3];
+
+    inline image_pixel_reader(const uint16_t *src_image, int i, int channel)
+    {
+        uint16_t input = src_image[i];
+        v[2] = (input & 0x1F00) >> 5;                           //blue
+        v[1] = ((input & 0x7) << 5) | ((input & 0xE000) >> 11); //green
+        v[0] = input & 0xF8;                                    //red
+    }
+    inline int operator[](int c) const { return v[c]; }
+};
+
 template <class T>
 class Image
 {
@@ -97,20 +127,41 @@ public:
     static void resize_to_rgb888(T *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, uint8_t *src_image, int src_h, int src_w, int dst_w, int shift_left, image_resize_t type);
     // static void resize_to_rgb565(uint16_t *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, uint16_t *src_image, int src_h, int src_w, int dst_w, int shift_left, image_resize_t type);
     // static void resize_to_rgb565(uint16_t *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, uint8_t *src_image, int src_h, int src_w, int dst_w, int shift_left, image_resize_t type);
+
+private:
+    template <bool left>
+    static inline T shift_value(int value, int shift)
+    {
+        return left ? (T)(value << shift) : (T)(value >> shift);
+    }
+
+    /**
+     * @brief One kernel per resize type, channel number (0 for any), shift direction and source format.
+     *        Everything the pixel loops branch on is a template argument, the shift is non-negative.
+     */
+    template <image_resize_t type, int C, bool left, class S>
+    static void resize_kernel(T *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, const S *src_image, int src_h, int src_w, int dst_w, int shift);
+
+    /**
+     * @brief Select the kernel for the resize type and the shift direction.
+     */
+    template <int C, class S>
+    static void resize_dispatch(T *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, const S *src_image, int src_h, int src_w, int dst_w, int shift_left, image_resize_t type);
 };
 
 template <class T>
-void Image<T>::resize_to_rgb888(T *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, uint16_t *src_image, int src_h, int src_w, int dst_w, int shift_left, image_resize_t type)
+template <image_resize_t type, int C, bool left, class S>
+void Image<T>::resize_kernel(T *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, const S *src_image, int src_h, int src_w, int dst_w, int shift)
 {
-    assert(channel == 3);
+    const int ch = C ? C : channel;
     float scale_y = (float)src_h / (y_end - y_start);
     float scale_x = (float)src_w / (x_end - x_start);
-    int temp[13];
 
-    switch (type)
+    for (int y = y_start; y < y_end; y++)
     {
-    case IMAGE_RESIZE_BILINEAR:
-        for (size_t y = y_start; y < y_end; y++)
+        T *dst = dst_image + (y * dst_w + x_start) * ch;
+
+        if (IMAGE_RESIZE_BILINEAR == type)
         {
             float ratio_y[2];
             ratio_y[0] = (float)((y + 0.5) * scale_y - 0.5); // y
@@ -129,12 +180,10 @@ void Image<T>::resize_to_rgb888(T *dst_image, int y_start, int y_end, int x_star
             }
             ratio_y[1] = 1 - ratio_y[0]; // y2 - y
 
-            int _dst_i = y * dst_w;
-
             int _src_row_0 = src_y * src_w;
             int _src_row_1 = _src_row_0 + src_w;
 
-            for (size_t x = x_start; x < x_end; x++)
+            for (int x = x_start; x < x_end; x++, dst += ch)
             {
                 float ratio_x[2];
                 ratio_x[0] = (float)((x + 0.5) * scale_x - 0.5); // x
@@ -153,192 +202,96 @@ void Image<T>::resize_to_rgb888(T *dst_image, int y_start, int y_end, int x_star
                 }
                 ratio_x[1] = 1 - ratio_x[0]; // x2 - x
 
-                int dst_i = (_dst_i + x) * channel;
+                image_pixel_reader<S> p00(src_image, _src_row_0 + src_x, ch);
+                image_pixel_reader<S> p01(src_image, _src_row_0 + src_x + 1, ch);
+                image_pixel_reader<S> p10(src_image, _src_row_1 + src_x, ch);
+                image_pixel_reader<S> p11(src_image, _src_row_1 + src_x + 1, ch);
 
-                int src_row_0 = _src_row_0 + src_x;
-                int src_row_1 = _src_row_1 + src_x;
-
-                Image<int>::pixel_rgb565_to_rgb888(src_image[src_row_0], temp);
-                Image<int>::pixel_rgb565_to_rgb888(src_image[src_row_0 + 1], temp + 3);
-                Image<int>::pixel_rgb565_to_rgb888(src_image[src_row_1], temp + 6);
-                Image<int>::pixel_rgb565_to_rgb888(src_image[src_row_1 + 1], temp + 9);
-
-                for (int c = 0; c < channel; c++)
+                for (int c = 0; c < ch; c++)
                 {
-                    temp[12] = round(temp[c] * ratio_x[1] * ratio_y[1] + temp[channel + c] * ratio_x[0] * ratio_y[1] + temp[channel + channel + c] * ratio_x[1] * ratio_y[0] + src_image[channel + channel + channel + c] * ratio_x[0] * ratio_y[0]);
-                    dst_image[dst_i + c] = (shift_left > 0) ? (temp[12] << shift_left) : (temp[12] >> -shift_left);
+                    int temp = round(p00[c] * ratio_x[1] * ratio_y[1] + p01[c] * ratio_x[0] * ratio_y[1] + p10[c] * ratio_x[1] * ratio_y[0] + p11[c] * ratio_x[0] * ratio_y[0]);
+                    dst[c] = shift_value<left>(temp, shift);
                 }
             }
         }
-        break;
-
-    case IMAGE_RESIZE_MEAN:
-        shift_left -= 2;
-        for (int y = y_start; y < y_end; y++)
+        else
         {
-            int _dst_i = y * dst_w;
+            int _src_i = (int)rintf(y * scale_y) * src_w;
 
-            float _src_row_0 = rintf(y * scale_y) * src_w;
-            float _src_row_1 = _src_row_0 + src_w;
-
-            for (int x = x_start; x < x_end; x++)
+            for (int x = x_start; x < x_end; x++, dst += ch)
             {
-                int dst_i = (_dst_i + x) * channel;
-
-                int src_row_0 = (_src_row_0 + rintf(x * scale_x));
-                int src_row_1 = (_src_row_1 + rintf(x * scale_x));
+                int src_i = _src_i + (int)rintf(x * scale_x);
 
-                Image<int>::pixel_rgb565_to_rgb888(src_image[src_row_0], temp);
-                Image<int>::pixel_rgb565_to_rgb888(src_image[src_row_0 + 1], temp + 3);
-                Image<int>::pixel_rgb565_to_rgb888(src_image[src_row_1], temp + 6);
-                Image<int>::pixel_rgb565_to_rgb888(src_image[src_row_1 + 1], temp + 9);
-
-                dst_image[dst_i] = (shift_left > 0) ? ((temp[0] + temp[3] + temp[6] + temp[9]) << shift_left) : ((temp[0] + temp[3] + temp[6] + temp[9]) >> -shift_left);
-                dst_image[dst_i + 1] = (shift_left > 0) ? ((temp[1] + temp[4] + temp[7] + temp[10]) << shift_left) : ((temp[1] + temp[4] + temp[7] + temp[10]) >> -shift_left);
-                dst_image[dst_i + 2] = (shift_left > 0) ? ((temp[2] + temp[5] + temp[8] + temp[11]) << shift_left) : ((temp[1] + temp[4] + temp[7] + temp[10]) >> -shift_left);
-            }
-        }
-
-        break;
-
-    case IMAGE_RESIZE_NEAREST:
-        for (size_t y = y_start; y < y_end; y++)
-        {
-            int _dst_i = y * dst_w;
-            float _src_i = rintf(y * scale_y) * src_w;
-
-            for (size_t x = x_start; x < x_end; x++)
-            {
-                int dst_i = (_dst_i + x) * channel;
-                int src_i = _src_i + rintf(x * scale_x);
+                if (IMAGE_RESIZE_MEAN == type)
+                {
+                    image_pixel_reader<S> p00(src_image, src_i, ch);
+                    image_pixel_reader<S> p01(src_image, src_i + 1, ch);
+                    image_pixel_reader<S> p10(src_image, src_i + src_w, ch);
+                    image_pixel_reader<S> p11(src_image, src_i + src_w + 1, ch);
 
-                Image<int>::pixel_rgb565_to_rgb888(src_image[src_i], temp);
+                    for (int c = 0; c < ch; c++)
+                        dst[c] = shift_value<left>(p00[c] + p01[c] + p10[c] + p11[c], shift);
+                }
+                else
+                {
+                    image_pixel_reader<S> p(src_image, src_i, ch);
 
-                dst_image[dst_i] = (shift_left > 0) ? (temp[0] << shift_left) : (temp[0] >> -shift_left);
-                dst_image[dst_i + 1] = (shift_left > 0) ? (temp[1] << shift_left) : (temp[1] >> -shift_left);
-                dst_image[dst_i + 2] = (shift_left > 0) ? (temp[2] << shift_left) : (temp[2] >> -shift_left);
+                    for (int c = 0; c < ch; c++)
+                        dst[c] = shift_value<left>(p[c], shift);
+                }
             }
         }
-        break;
-
-    default:
-        break;
     }
 }
 
 template <class T>
-void Image<T>::resize_to_rgb888(T *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, uint8_t *src_image, int src_h, int src_w, int dst_w, int shift_left, image_resize_t type)
+template <int C, class S>
+void Image<T>::resize_dispatch(T *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, const S *src_image, int src_h, int src_w, int dst_w, int shift_left, image_resize_t type)
 {
-    float scale_y = (float)src_h / (y_end - y_start);
-    float scale_x = (float)src_w / (x_end - x_start);
-    int temp;
-
     switch (type)
     {
     case IMAGE_RESIZE_BILINEAR:
-        for (size_t y = y_start; y < y_end; y++)
-        {
-            float ratio_y[2];
-            ratio_y[0] = (float)((y + 0.5) * scale_y - 0.5); // y
-            int src_y = (int)ratio_y[0];                     // y1
-            ratio_y[0] -= src_y;                             // y - y1
-
-            if (src_y < 0)
-            {
-                ratio_y[0] = 0;
-                src_y = 0;
-            }
-            if (src_y > src_h - 2)
-            {
-                ratio_y[0] = 0;
-                src_y = src_h - 2;
-            }
-            ratio_y[1] = 1 - ratio_y[0]; // y2 - y
-
-            int _dst_i = y * dst_w;
-
-            int _src_row_0 = src_y * src_w;
-            int _src_row_1 = _src_row_0 + src_w;
-
-            for (size_t x = x_start; x < x_end; x++)
-            {
-                float ratio_x[2];
-                ratio_x[0] = (float)((x + 0.5) * scale_x - 0.5); // x
-                int src_x = (int)ratio_x[0];                     // x1
-                ratio_x[0] -= src_x;                             // x - x1
-
-                if (src_x < 0)
-                {
-                    ratio_x[0] = 0;
-                    src_x = 0;
-                }
-                if (src_x > src_w - 2)
-                {
-                    ratio_x[0] = 0;
-                    src_x = src_w - 2;
-                }
-                ratio_x[1] = 1 - ratio_x[0]; // x2 - x
-
-                int dst_i = (_dst_i + x) * channel;
-
-                int src_row_0 = (_src_row_0 + src_x) * channel;
-                int src_row_1 = (_src_row_1 + src_x) * channel;
-
-                for (int c = 0; c < channel; c++)
-                {
-                    temp = round(src_image[src_row_0 + c] * ratio_x[1] * ratio_y[1] + src_image[src_row_0 + channel + c] * ratio_x[0] * ratio_y[1] + src_image[src_row_1 + c] * ratio_x[1] * ratio_y[0] + src_image[src_row_1 + channel + c] * ratio_x[0] * ratio_y[0]);
-                    dst_image[dst_i + c] = (shift_left > 0) ? (temp << shift_left) : (temp >> -shift_left);
-                }
-            }
-        }
+        if (shift_left > 0)
+            resize_kernel<IMAGE_RESIZE_BILINEAR, C, true>(dst_image, y_start, y_end, x_start, x_end, channel, src_image, src_h, src_w, dst_w, shift_left);
+        else
+            resize_kernel<IMAGE_RESIZE_BILINEAR, C, false>(dst_image, y_start, y_end, x_start, x_end, channel, src_image, src_h, src_w, dst_w, -shift_left);
         break;
 
     case IMAGE_RESIZE_MEAN:
+        // the sum of four pixels is 2 bits wider
         shift_left -= 2;
-
-        for (size_t y = y_start; y < y_end; y++)
-        {
-            int _dst_i = y * dst_w;
-
-            float _src_row_0 = rintf(y * scale_y) * src_w;
-            float _src_row_1 = _src_row_0 + src_w;
-
-            for (size_t x = x_start; x < x_end; x++)
-            {
-                int dst_i = (_dst_i + x) * channel;
-
-                int src_row_0 = (_src_row_0 + rintf(x * scale_x)) * channel;
-                int src_row_1 = (_src_row_1 + rintf(x * scale_x)) * channel;
-
-                for (size_t c = 0; c < channel; c++)
-                {
-                    temp = (int)src_image[src_row_0 + c] + (int)src_image[src_row_0 + channel + c] + (int)src_image[src_row_1 + c] + (int)src_image[src_row_1 + channel + c];
-                    dst_image[dst_i + c] = (shift_left > 0) ? (temp << shift_left) : (temp >> -shift_left);
-                }
-            }
-        }
+        if (shift_left > 0)
+            resize_kernel<IMAGE_RESIZE_MEAN, C, true>(dst_image, y_start, y_end, x_start, x_end, channel, src_image, src_h, src_w, dst_w, shift_left);
+        else
+            resize_kernel<IMAGE_RESIZE_MEAN, C, false>(dst_image, y_start, y_end, x_start, x_end, channel, src_image, src_h, src_w, dst_w, -shift_left);
         break;
 
     case IMAGE_RESIZE_NEAREST:
-        for (size_t y = y_start; y < y_end; y++)
-        {
-            int _dst_i = y * dst_w;
-            float _src_i = rintf(y * scale_y) * src_w;
-
-            for (size_t x = x_start; x < x_end; x++)
-            {
-                int dst_i = (_dst_i + x) * channel;
-                int src_i = (_src_i + rintf(x * scale_x)) * channel;
-
-                for (size_t c = 0; c < channel; c++)
-                {
-                    dst_image[dst_i + c] = (shift_left > 0) ? ((T)src_image[src_i + c] << shift_left) : ((T)src_image[src_i + c] >> -shift_left);
-                }
-            }
-        }
+        if (shift_left > 0)
+            resize_kernel<IMAGE_RESIZE_NEAREST, C, true>(dst_image, y_start, y_end, x_start, x_end, channel, src_image, src_h, src_w, dst_w, shift_left);
+        else
+            resize_kernel<IMAGE_RESIZE_NEAREST, C, false>(dst_image, y_start, y_end, x_start, x_end, channel, src_image, src_h, src_w, dst_w, -shift_left);
         break;
 
     default:
         break;
     }
-}
\ No newline at end of file
+}
+
+template <class T>
+void Image<T>::resize_to_rgb888(T *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, uint16_t *src_image, int src_h, int src_w, int dst_w, int shift_left, image_resize_t type)
+{
+    assert(channel == 3);
+    resize_dispatch<3>(dst_image, y_start, y_end, x_start, x_end, channel, (const uint16_t *)src_image, src_h, src_w, dst_w, shift_left, type);
+}
+
+template <class T>
+void Image<T>::resize_to_rgb888(T *dst_image, int y_start, int y_end, int x_start, int x_end, int channel, uint8_t *src_image, int src_h, int src_w, int dst_w, int shift_left, image_resize_t type)
+{
+    if (3 == channel)
+        resize_dispatch<3>(dst_image, y_start, y_end, x_start, x_end, channel, (const uint8_t *)src_image, src_h, src_w, dst_w, shift_left, type);
+    else if (1 == channel)
+        resize_dispatch<1>(dst_image, y_start, y_end, x_start, x_end, channel, (const uint8_t *)src_image, src_h, src_w, dst_w, shift_left, type);
+    else
+        resize_dispatch<0>(dst_image, y_start, y_end, x_start, x_end, channel, (const uint8_t *)src_image, src_h, src_w, dst_w, shift_left, type);
+}
@@ -0,0 +1,90 @@
+/*
+  * ESPRESSIF MIT License
+  *
+  * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+  *
+  * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+  * it is free of charge, to any person obtaining a copy of this software and associated
+  * documentation files (the "Software"), to deal in the Software without restriction, including
+  * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+  * to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all copies or
+  * substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+  *
+  */
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "image_util.h"
+
+#ifndef IMAGE_PYRAMID_MAX_LEVELS
+#define IMAGE_PYRAMID_MAX_LEVELS 16 /*!< levels kept by one image_pyramid_t */
+#endif
+
+    typedef struct
+    {
+        dl_matrix3du_t image; /*!< The level, points into the arena, do not free */
+        fptp_t scale;         /*!< Size of the level over the size of the source */
+        int offset;           /*!< Bytes from the start of the arena */
+        int parent;           /*!< Level it was shrunk from, -1 for the first level */
+    } image_pyramid_level_t;
+
+    /*
+     * Octaves of a first level, then octaves of the first level shrunk by sqrt(0.5), in the order of pnet_forward_fast.
+     * All the levels live in one arena and stay valid until the next build.
+     */
+    typedef struct
+    {
+        int n_levels;                                         /*!< Levels in use */
+        image_pyramid_level_t level[IMAGE_PYRAMID_MAX_LEVELS]; /*!< Level descriptors */
+        uint8_t *arena;                                       /*!< Pixels of all the levels */
+        int arena_size;                                       /*!< Bytes of the arena */
+    } image_pyramid_t;
+
+    /**
+     * @brief Lay out the levels and allocate the arena. Levels smaller than min_size on a side are left out.
+     *
+     * @param p             Pyramid
+     * @param src_w         Width of the source
+     * @param src_h         Height of the source
+     * @param c             Channel of the source
+     * @param scale         Scale of the first level
+     * @param levels        Max number of levels, half of them octaves of the first level, at most IMAGE_PYRAMID_MAX_LEVELS
+     * @param min_size      Smallest side of a level
+     * @return 0            Success
+     * @return -1           Out of memory
+     * @return -2           More levels than IMAGE_PYRAMID_MAX_LEVELS
+     */
+    int image_pyramid_init(image_pyramid_t *p, int src_w, int src_h, int c, fptp_t scale, int levels, int min_size);
+
+    /**
+     * @brief Free the arena.
+     *
+     * @param p             Pyramid
+     */
+    void image_pyramid_free(image_pyramid_t *p);
+
+    /**
+     * @brief Fill all the levels. The source is read once, for the first level, every other level is shrunk from one before it.
+     *
+     * @param p             Pyramid, laid out for the size of src
+     * @param src           Source image, can be a view
+     */
+    void image_pyramid_build(image_pyramid_t *p, const dl_matrix3du_t *src);
+
+#if __cplusplus
+}
+#endif
@@ -37,6 +37,10 @@ extern "C"
 #define DL_IMAGE_MIN(A, B) ((A) < (B) ? (A) : (B))
 #define DL_IMAGE_MAX(A, B) ((A) < (B) ? (B) : (A))
 
+#ifndef IMAGE_RESIZE_PLAN_CACHE
+#define IMAGE_RESIZE_PLAN_CACHE 16 /*!< size pairs kept by image_resize_plan_get */
+#endif
+
 #define RGB565_MASK_RED 0xF800
 #define RGB565_MASK_GREEN 0x07E0
 #define RGB565_MASK_BLUE 0x001F
@@ -46,6 +50,12 @@ extern "C"
         BINARY, /*!< binary */
     } en_threshold_mode;
 
+    typedef enum
+    {
+        IMAGE_BORDER_CONSTANT = 0,  /*!< Pixels mapped outside the source are filled with 0 */
+        IMAGE_BORDER_REPLICATE = 1, /*!< Pixels mapped outside the source take the nearest edge pixel */
+    } image_border_t;
+
     typedef struct
     {
         fptp_t landmark_p[LANDMARKS_NUM]; /*!< landmark struct */
@@ -82,6 +92,71 @@ extern "C"
         int len;                  /*!< Length of the image_list */
     } image_list_t;
 
+    /*
+     * Source taps of a bilinear resize, computed once per (src, dst) size pair.
+     * Weights are in Q10 and can be negative at the top and left edges when upscaling, like image_resize_linear.
+     */
+    typedef struct
+    {
+        int src_w;      /*!< Width of the source image */
+        int src_h;      /*!< Height of the source image */
+        int dst_w;      /*!< Width of the output image */
+        int dst_h;      /*!< Height of the output image */
+        int *x_ofs;     /*!< 2 x dst_w, source columns of each output column */
+        int16_t *x_w;   /*!< 2 x dst_w, weights of the source columns */
+        int *y_ofs;     /*!< 2 x dst_h, source rows of each output row */
+        int16_t *y_w;   /*!< 2 x dst_h, weights of the source rows */
+    } image_resize_plan_t;
+
+    typedef enum
+    {
+        IMAGE_PIXEL_RGB565 = 0, /*!< 2 bytes per pixel, high byte first as from the camera */
+        IMAGE_PIXEL_RGB888 = 1, /*!< 3 bytes per pixel */
+        IMAGE_PIXEL_YUV422 = 2, /*!< YUYV, 4 bytes per 2 pixels */
+        IMAGE_PIXEL_GRAY = 3,   /*!< 1 byte per pixel */
+    } image_pixel_format_t;
+
+    typedef enum
+    {
+        IMAGE_SAMPLE_NEAREST = 0,        /*!< The nearest pixel */
+        IMAGE_SAMPLE_BILINEAR = 1,       /*!< Bilinear interpolation of four pixels */
+        IMAGE_SAMPLE_MEAN = 2,           /*!< Mean of the four pixels from the sampled one to the bottom right */
+        IMAGE_SAMPLE_AREA = 3,           /*!< Mean of the whole area covered by the output pixel */
+        IMAGE_SAMPLE_MEAN_ROUND = 4,     /*!< MEAN from the rounded position and truncated, as Image::resize_to_rgb888 with IMAGE_RESIZE_MEAN */
+        IMAGE_SAMPLE_BILINEAR_ROUND = 5, /*!< BILINEAR in float rounded to an integer before the shift, extrapolated at the top and bottom, as image_resize_linear_q */
+    } image_sample_t;
+
+    /*
+     * A region of a camera or image buffer.
+     */
+    typedef struct
+    {
+        const uint8_t *data;         /*!< First byte of the buffer */
+        image_pixel_format_t format; /*!< Pixel format */
+        int w;                       /*!< Width of the buffer */
+        int h;                       /*!< Height of the buffer */
+        int stride;                  /*!< Bytes between two rows, 0 for packed rows */
+        int roi_x;                   /*!< Left of the region */
+        int roi_y;                   /*!< Top of the region */
+        int roi_w;                   /*!< Width of the region, 0 for the whole buffer */
+        int roi_h;                   /*!< Height of the region, 0 for the whole buffer */
+    } image_source_t;
+
+    /*
+     * A quantized network input. An output pixel is the source value, in [0, 255], shifted left by shift.
+     */
+    typedef struct
+    {
+        qtp_t *data;   /*!< First output pixel */
+        int c;         /*!< 3 for RGB, 1 for luma */
+        int stride;    /*!< Elements between two rows, 0 for w * c */
+        int w;         /*!< Width written */
+        int h;         /*!< Height written */
+        float scale_x; /*!< Source pixels per output pixel, 0 for roi_w / w */
+        float scale_y; /*!< Source pixels per output pixel, 0 for roi_h / h */
+        int shift;     /*!< Left shift of the output, negative to shift right; -8 - exponent gives inputs in [0, 1) */
+    } image_target_t;
+
     /**
      * @brief Get the width and height of the box.
      * 
@@ -206,6 +281,29 @@ extern "C"
         }
     }
 
+    /**
+     * @brief A view of the w x h rectangle of m at (x, y), clipped to m. The view keeps the stride of m
+     *        and points into its pixels, nothing is copied and there is nothing to free.
+     *        Only the functions taking a stride, an image_source_t or a dl_matrix3du_t accept a view,
+     *        the ones documented as packed read w * c bytes per row.
+     *
+     * @param m      The image
+     * @param x      Left of the rectangle
+     * @param y      Top of the rectangle
+     * @param w      Width of the rectangle
+     * @param h      Height of the rectangle
+     * @return       The view
+     */
+    static inline dl_matrix3du_t image_view(const dl_matrix3du_t *m, int x, int y, int w, int h)
+    {
+        int x0 = DL_IMAGE_MIN(DL_IMAGE_MAX(x, 0), m->w);
+        int y0 = DL_IMAGE_MIN(DL_IMAGE_MAX(y, 0), m->h);
+        int x1 = DL_IMAGE_MIN(DL_IMAGE_MAX(x + w, x0), m->w);
+        int y1 = DL_IMAGE_MIN(DL_IMAGE_MAX(y + h, y0), m->h);
+        dl_matrix3du_t view = {x1 - x0, y1 - y0, m->c, 1, m->stride, m->item + y0 * m->stride + x0 * m->c};
+        return view;
+    }
+
     /**@{*/
     /**
      * @brief Convert RGB565 image to RGB888 image
@@ -256,6 +354,45 @@ extern "C"
         *in = rgb565;
     } /*}}}*/
 
+    typedef struct
+    {
+        int index;    /*!< Cell of the score map */
+        int category; /*!< Class with the best score */
+        fptp_t score; /*!< The best score, quantized scores are not scaled */
+    } image_candidate_t;
+
+    /**
+     * @brief Find the cells of a quantized score map whose best class is over the threshold.
+     *
+     * Blocks of cells with no score over the threshold are skipped without taking the class max.
+     * The scan resumes at *cell and stops when candidates is full, so a small buffer can be
+     * drained in a loop.
+     *
+     * @param candidates        Survivors in cell order, NULL to only count all of them
+     * @param max_candidates    Capacity of candidates
+     * @param score             Score map, cells x classes, classes innermost
+     * @param classes           Number of classes
+     * @param cell              First cell to scan, set to the first cell not scanned
+     * @param cells             Number of cells
+     * @param threshold         A cell survives when its best score is greater than this
+     * @return int              Number of survivors found
+     */
+    int image_scan_scores_q(image_candidate_t *candidates, int max_candidates, const qtp_t *score, int classes, int *cell, int cells, int threshold);
+
+    /**
+     * @brief Find the cells of a float score map whose score is over the threshold, see image_scan_scores_q.
+     *
+     * @param candidates        Survivors in cell order, NULL to only count all of them, category is 0
+     * @param max_candidates    Capacity of candidates
+     * @param score             Score of the first cell
+     * @param step              Distance between the scores of two cells, e.g. 2 for the face score of a 2-class map
+     * @param cell              First cell to scan, set to the first cell not scanned
+     * @param cells             Number of cells
+     * @param threshold         A cell survives when its score is greater than this
+     * @return int              Number of survivors found
+     */
+    int image_scan_scores_f(image_candidate_t *candidates, int max_candidates, const fptp_t *score, int step, int *cell, int cells, fptp_t threshold);
+
     /**
      * @brief Filter out the resulting boxes whose confidence score is lower than the threshold and convert the boxes to the actual boxes on the original image.((x, y, w, h) -> (x1, y1, x2, y2))
      * 
@@ -302,8 +439,32 @@ extern "C"
      */
     void image_nms_process(image_list_t *image_list, fptp_t nms_threshold, int same_area);
 
+    typedef struct
+    {
+        fptp_t iou_threshold;               /*!< A box overlapping a stronger kept box of its class by more is dropped */
+        int max_detections;                 /*!< Boxes kept per class, 0 for no limit */
+        const fptp_t *class_iou_threshold;  /*!< IoU threshold of each class, NULL to use iou_threshold */
+        const int *class_max_detections;    /*!< Limit of each class, NULL to use max_detections */
+        int classes;                        /*!< Length of the per-class arrays, other classes use the defaults */
+        bool class_agnostic;                /*!< true to let boxes of all classes suppress each other */
+    } image_nms_config_t;
+
     /**
-     * @brief Resize an image to half size 
+     * @brief Run NMS on an array of boxes, separately for each category.
+     *
+     * Boxes are sorted by score once and split into per-class buckets in one pass, so boxes are
+     * only compared within their class. The kept boxes are moved to the front of the arrays,
+     * highest score first, and len is updated. With one class and no limit, the boxes kept are
+     * those of image_nms_process.
+     *
+     * @param boxes              Boxes, category may be NULL for a single class, landmark may be NULL
+     * @param config             Thresholds and limits
+     * @return int               Number of boxes kept, -1 if out of memory with the boxes unchanged
+     */
+    int image_nms_batched(box_array_t *boxes, const image_nms_config_t *config);
+
+    /**
+     * @brief Resize an image to half size. Both images are packed, a view of a frame is not.
      * 
      * @param dimage      The output image
      * @param dw          Width of the output image
@@ -335,7 +496,126 @@ extern "C"
     void image_resize_linear(uint8_t *dst_image, uint8_t *src_image, int dst_w, int dst_h, int dst_c, int src_w, int src_h);
 
     /**
-     * @brief Crop， rotate and zoom the image in RGB888 format, 
+     * @brief Same as image_resize_linear, with any row stride on both sides, e.g. to resize a view
+     *
+     * @param dst_image    The output image
+     * @param dst_stride   Bytes between the rows of the output image
+     * @param src_image    Source image
+     * @param src_stride   Bytes between the rows of the source image
+     * @param dst_w        Width of the output image
+     * @param dst_h        Height of the output image
+     * @param dst_c        Channel of the output image
+     * @param src_w        Width of the source image
+     * @param src_h        Height of the source image
+     */
+    void image_resize_linear_stride(uint8_t *dst_image, int dst_stride, const uint8_t *src_image, int src_stride, int dst_w, int dst_h, int dst_c, int src_w, int src_h);
+
+    /**
+     * @brief Resize src to the size of dst via bilinear interpolation, both can be views, see image_view
+     *
+     * @param dst          The output image
+     * @param src          Source image
+     */
+    void image_resize_linear_view(dl_matrix3du_t *dst, const dl_matrix3du_t *src);
+
+    /**
+     * @brief Same as image_resize_linear_view, without caching the plan. For crops, whose size changes every call.
+     *
+     * @param dst          The output image
+     * @param src          Source image
+     */
+    void image_resize_linear_crop(dl_matrix3du_t *dst, const dl_matrix3du_t *src);
+
+    /**
+     * @brief Compute the taps of a bilinear resize. Must use image_resize_plan_free to free the plan.
+     *
+     * @param src_w        Width of the source image
+     * @param src_h        Height of the source image
+     * @param dst_w        Width of the output image
+     * @param dst_h        Height of the output image
+     * @return             The plan, NULL if out of memory
+     */
+    image_resize_plan_t *image_resize_plan_create(int src_w, int src_h, int dst_w, int dst_h);
+
+    /**
+     * @brief Free a plan from image_resize_plan_create.
+     *
+     * @param plan         The plan
+     */
+    void image_resize_plan_free(image_resize_plan_t *plan);
+
+    /**
+     * @brief Get the plan of a size pair from the cache, computing it on first use.
+     *        Cached plans live until the end of the program, IMAGE_RESIZE_PLAN_CACHE size pairs at most,
+     *        so only fixed sizes should come here, e.g. the pyramid levels of a camera frame.
+     *
+     * @param src_w        Width of the source image
+     * @param src_h        Height of the source image
+     * @param dst_w        Width of the output image
+     * @param dst_h        Height of the output image
+     * @return             The plan, NULL if the cache is full or out of memory
+     */
+    const image_resize_plan_t *image_resize_plan_get(int src_w, int src_h, int dst_w, int dst_h);
+
+    /**
+     * @brief Resize with a plan, in integer arithmetic. Each source row is interpolated horizontally once,
+     *        then pairs of rows are blended vertically.
+     *
+     * @param dst_image    The output image, plan->dst_w x plan->dst_h
+     * @param src_image    Source image, plan->src_w x plan->src_h
+     * @param c            Channel of both images
+     * @param plan         The plan
+     * @return 0           Success
+     * @return -1          Out of memory for the row buffers
+     */
+    int image_resize_linear_plan(uint8_t *dst_image, const uint8_t *src_image, int c, const image_resize_plan_t *plan);
+
+    /**
+     * @brief Shrink an image by averaging the source area of each output pixel, for any ratio.
+     *        Source pixels partly inside an output pixel count by the covered part, in exact integer weights.
+     *        Source rows are read once and in order, two rows of accumulators are kept.
+     *
+     * @param dst_image    The output image
+     * @param src_image    Source image, RGB888 or single-channel
+     * @param dst_w        Width of the output image
+     * @param dst_h        Height of the output image
+     * @param dst_c        Channel of both images
+     * @param src_w        Width of the source image
+     * @param src_h        Height of the source image
+     * @return 0           Success
+     * @return -1          Out of memory
+     */
+    int image_resize_area(uint8_t *dst_image, const uint8_t *src_image, int dst_w, int dst_h, int dst_c, int src_w, int src_h);
+
+    /**
+     * @brief Shrink a RGB565 image to a RGB888 image like image_resize_area.
+     *
+     * @param dst_image    The output image, RGB888
+     * @param src_image    Source image, RGB565
+     * @param dst_w        Width of the output image
+     * @param dst_h        Height of the output image
+     * @param src_w        Width of the source image
+     * @param src_h        Height of the source image
+     * @return 0           Success
+     * @return -1          Out of memory
+     */
+    int image_resize_area_rgb565(uint8_t *dst_image, const uint16_t *src_image, int dst_w, int dst_h, int src_w, int src_h);
+
+    /**
+     * @brief Convert, resize and quantize in one pass, from a camera buffer to a network input.
+     *        The kernel is specialized for each source format and sampling, the source is read once.
+     *
+     * @param dst          Output and its quantization
+     * @param src          Source buffer and region
+     * @param sample       How output pixels are sampled from the region
+     * @return 0           Success
+     * @return -1          Out of memory
+     */
+    int image_convert_resize_q(const image_target_t *dst, const image_source_t *src, image_sample_t sample);
+
+    /**
+     * @brief Crop， rotate and zoom the image in RGB888 format. Both images are packed,
+     *        warp_affine takes views.
      * 
      * @param corp_image       The output image
      * @param src_image        Source image
@@ -345,6 +625,41 @@ extern "C"
      */
     void image_cropper(uint8_t *corp_image, uint8_t *src_image, int dst_w, int dst_h, int dst_c, int src_w, int src_h, float rotate_angle, float ratio, float *center);
 
+    /**
+     * @brief Warp the image in RGB888 or single-channel format with an inverse affine matrix, in fixed point.
+     *
+     * Source coordinates are stepped incrementally along each row in Q16, and the bilinear weights are 8-bit integers.
+     * Pixels whose four neighbours are all inside the source take a fast path, the others go through the border path.
+     *
+     * @param dst_image        The output image
+     * @param src_image        Source image
+     * @param dst_w            Width of the output image
+     * @param dst_h            Height of the output image
+     * @param dst_c            Channel of the output and source image
+     * @param src_w            Width of the source image
+     * @param src_h            Height of the source image
+     * @param m_inv            Inverse affine matrix in row-major order, {a, b, c, d, e, f}: x_src = a * x + b * y + c, y_src = d * x + e * y + f
+     * @param border           How to treat the pixels mapped outside the source image
+     */
+    void image_warp_affine(uint8_t *dst_image, uint8_t *src_image, int dst_w, int dst_h, int dst_c, int src_w, int src_h, const float *m_inv, image_border_t border);
+
+    /**
+     * @brief Same as image_warp_affine, with any row stride on both sides. warp_affine uses the strides of its matrices.
+     *
+     * @param dst_image        The output image
+     * @param dst_stride       Bytes between the rows of the output image
+     * @param src_image        Source image
+     * @param src_stride       Bytes between the rows of the source image
+     * @param dst_w            Width of the output image
+     * @param dst_h            Height of the output image
+     * @param dst_c            Channel of the output and source image
+     * @param src_w            Width of the source image
+     * @param src_h            Height of the source image
+     * @param m_inv            Inverse affine matrix, see image_warp_affine
+     * @param border           How to treat the pixels mapped outside the source image
+     */
+    void image_warp_affine_stride(uint8_t *dst_image, int dst_stride, const uint8_t *src_image, int src_stride, int dst_w, int dst_h, int dst_c, int src_w, int src_h, const float *m_inv, image_border_t border);
+
     /**
      * @brief Convert the rgb565 image to the rgb888 image   
      * 
@@ -363,6 +678,54 @@ extern "C"
      */
     void image_rgb888_to_565(uint16_t *bmp, uint8_t *m, int count);
 
+    /**
+     * @brief Convert the rgb888 image to gray, Gray = R*0.299 + G*0.587 + B*0.114 in fixed point
+     *
+     * @param dst     The output gray image
+     * @param src     The input rgb888 image
+     * @param count   Total pixels of the image
+     */
+    void image_rgb888_to_gray(uint8_t *dst, const uint8_t *src, int count);
+
+    /**
+     * @brief Convert the rgb565 image to gray, same as image_rgb565_to_888 then image_rgb888_to_gray
+     *
+     * @param dst     The output gray image
+     * @param src     The input rgb565 image
+     * @param count   Total pixels of the image
+     */
+    void image_rgb565_to_gray(uint8_t *dst, const uint16_t *src, int count);
+
+    /**
+     * @brief Convert the rgb888 image to CIE Lab scaled to 8 bits. The cube root is read from a table
+     *        built on the first call, the result is within 1 of the float conversion.
+     *
+     * @param dst     The output Lab image
+     * @param src     The input rgb888 image
+     * @param count   Total pixels of the image
+     */
+    void image_rgb888_to_lab(uint8_t *dst, const uint8_t *src, int count);
+
+    /**
+     * @brief Convert the rgb888 image to an approximate Lab with a linear fixed-point matrix, no table
+     *
+     * @param dst     The output Lab image
+     * @param src     The input rgb888 image
+     * @param count   Total pixels of the image
+     */
+    void image_rgb888_to_lab_fast(uint8_t *dst, const uint8_t *src, int count);
+
+    /**
+     * @brief Time the conversions above against the per-pixel and float code they replace, and print the result
+     *
+     * @param w       Width of the random test image
+     * @param h       Height of the random test image
+     * @param rounds  Runs of each conversion
+     * @return >=0    Outputs match, the largest difference of the Lab table to the float conversion
+     * @return -1     Mismatch, a Lab difference over 1, or out of memory
+     */
+    int image_color_benchmark(int w, int h, int rounds);
+
     /**
      * @brief draw rectangle on the rgb565 image
      * 
@@ -414,6 +777,69 @@ extern "C"
      */
     void image_erode(uint8_t *dst, uint8_t *src, int src_w, int src_h, int src_c);
 
+    /**
+     * @brief Erode with a kw x kh rectangle, the cost per pixel does not depend on the size of the rectangle.
+     *
+     * The rectangle is centred on each pixel, the part outside the image is ignored.
+     * A 3 x 3 rectangle gives the same output as image_erode.
+     *
+     * @param dst          The output image, can be src
+     * @param src          Source image, c channels interleaved, each channel is eroded on its own
+     * @param w            Width of the image
+     * @param h            Height of the image
+     * @param c            Channel of the image
+     * @param kw           Width of the rectangle
+     * @param kh           Height of the rectangle
+     * @return 0           Success
+     * @return -1          Out of memory
+     */
+    int image_erode_rect(uint8_t *dst, const uint8_t *src, int w, int h, int c, int kw, int kh);
+
+    /**
+     * @brief Dilate with a kw x kh rectangle, see image_erode_rect.
+     *
+     * @param dst          The output image, can be src
+     * @param src          Source image
+     * @param w            Width of the image
+     * @param h            Height of the image
+     * @param c            Channel of the image
+     * @param kw           Width of the rectangle
+     * @param kh           Height of the rectangle
+     * @return 0           Success
+     * @return -1          Out of memory
+     */
+    int image_dilate_rect(uint8_t *dst, const uint8_t *src, int w, int h, int c, int kw, int kh);
+
+    /**
+     * @brief Erode then dilate, removes specks smaller than the rectangle from a mask.
+     *
+     * @param dst          The output image, can be src
+     * @param src          Source image
+     * @param w            Width of the image
+     * @param h            Height of the image
+     * @param c            Channel of the image
+     * @param kw           Width of the rectangle
+     * @param kh           Height of the rectangle
+     * @return 0           Success
+     * @return -1          Out of memory
+     */
+    int image_open_rect(uint8_t *dst, const uint8_t *src, int w, int h, int c, int kw, int kh);
+
+    /**
+     * @brief Dilate then erode, fills holes and gaps smaller than the rectangle in a mask.
+     *
+     * @param dst          The output image, can be src
+     * @param src          Source image
+     * @param w            Width of the image
+     * @param h            Height of the image
+     * @param c            Channel of the image
+     * @param kw           Width of the rectangle
+     * @param kh           Height of the rectangle
+     * @return 0           Success
+     * @return -1          Out of memory
+     */
+    int image_close_rect(uint8_t *dst, const uint8_t *src, int w, int h, int c, int kw, int kh);
+
     typedef float matrixType;
     typedef struct
     {
@@ -471,7 +897,8 @@ extern "C"
     void warp_affine(dl_matrix3du_t *img, dl_matrix3du_t *crop, Matrix *M);
 
     /**
-     * @brief Resize the image in RGB888 format via bilinear interpolation, and quantify the output image
+     * @brief Resize the image in RGB888 format via bilinear interpolation, and quantify the output image.
+     *        Both images are packed, image_convert_resize_q resizes a view or a region of a frame.
      * 
      * @param dst_image            Quantized output image
      * @param src_image            Input image 
@@ -486,6 +913,7 @@ extern "C"
 
     /**
      * @brief Preprocess the input image of object detection model. The process is like this: resize -> normalize -> quantify
+     *        The input image is packed.
      * 
      * @param image                 Input image, RGB888 format.
      * @param input_w               Width of the input image.
@@ -498,7 +926,8 @@ extern "C"
     dl_matrix3dq_t *image_resize_normalize_quantize(uint8_t *image, int input_w, int input_h, int target_size, int exponent, int process_mode);
 
     /**
-     * @brief Resize the image in RGB565 format via mean neighbour interpolation, and quantify the output image
+     * @brief Resize the image in RGB565 format via mean neighbour interpolation, and quantify the output image.
+     *        The input is a packed frame, rows of the output are dw * dc elements apart.
      * 
      * @param dimage            Quantized output image. 
      * @param simage            Input image.  
@@ -509,11 +938,14 @@ extern "C"
      * @param tw                Target width of the output image.
      * @param th                Target height of the output image.
      * @param shift             Shift parameter of quantization.
+     * @return 0                Success
+     * @return -1               Out of memory, the output is not written
      */
-    void image_resize_shift_fast(qtp_t *dimage, uint16_t *simage, int dw, int dc, int sw, int sh, int tw, int th, int shift);
+    int image_resize_shift_fast(qtp_t *dimage, uint16_t *simage, int dw, int dc, int sw, int sh, int tw, int th, int shift);
 
     /**
-     * @brief Resize the image in RGB565 format via nearest neighbour interpolation, and quantify the output image
+     * @brief Resize the image in RGB565 format via nearest neighbour interpolation, and quantify the output image.
+     *        The input is a packed frame, rows of the output are dw * dc elements apart.
      * 
      * @param dimage            Quantized output image. 
      * @param simage            Input image.  
@@ -524,11 +956,14 @@ extern "C"
      * @param tw                Target width of the output image.
      * @param th                Target height of the output image.
      * @param shift             Shift parameter of quantization.
+     * @return 0                Success
+     * @return -1               Out of memory, the output is not written
      */
-    void image_resize_nearest_shift(qtp_t *dimage, uint16_t *simage, int dw, int dc, int sw, int sh, int tw, int th, int shift);
+    int image_resize_nearest_shift(qtp_t *dimage, uint16_t *simage, int dw, int dc, int sw, int sh, int tw, int th, int shift);
 
     /**
-     * @brief Crop the image in RGB565 format and resize it to target size, then quantify the output image 
+     * @brief Crop the image in RGB565 format and resize it to target size, then quantify the output image.
+     *        The input is a packed frame of sw pixels per row, rows of the output are dw * 3 elements apart.
      * 
      * @param dimage            Quantized output image. 
      * @param simage            Input image.
@@ -540,8 +975,10 @@ extern "C"
      * @param x2                The x coordinate of the lower right corner of the cropped area
      * @param y2                The y coordinate of the lower right corner of the cropped area
      * @param shift             Shift parameter of quantization.
+     * @return 0                Success
+     * @return -1               Out of memory, the output is not written
      */
-    void image_crop_shift_fast(qtp_t *dimage, uint16_t *simage, int dw, int sw, int sh, int x1, int y1, int x2, int y2, int shift);
+    int image_crop_shift_fast(qtp_t *dimage, uint16_t *simage, int dw, int sw, int sh, int x1, int y1, int x2, int y2, int shift);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,134 @@
+/*
+  * ESPRESSIF MIT License
+  *
+  * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+  *
+  * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+  * it is free of charge, to any person obtaining a copy of this software and associated
+  * documentation files (the "Software"), to deal in the Software without restriction, including
+  * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+  * to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all copies or
+  * substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+  *
+  */
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "image_util.h"
+
+    /*
+     * Summed-area table: sum[y][x] holds the sum of the pixels above and left of (x, y), so any
+     * box sum is 4 lookups. Row 0 and column 0 are zero, the table is (w + 1) x (h + 1) x c.
+     */
+    typedef struct
+    {
+        int w;           /*!< Width of the image */
+        int h;           /*!< Height of the image */
+        int c;           /*!< Channel of the image */
+        int rows;        /*!< Rows added so far */
+        uint32_t *sum;   /*!< Sums of the pixels */
+        uint64_t *sqsum; /*!< Sums of the squared pixels, NULL when not asked for */
+    } integral_image_t;
+
+    /**
+     * @brief Allocate an empty table.
+     *
+     * @param ii            Integral image
+     * @param w             Width of the image, w x h x 255 must fit 32 bits
+     * @param h             Height of the image
+     * @param c             Channel of the image
+     * @param squared       Also sum the squares, needed by integral_image_variance
+     * @return 0            Success
+     * @return -1           Out of memory
+     */
+    int integral_image_init(integral_image_t *ii, int w, int h, int c, int squared);
+
+    /**
+     * @brief Free the table.
+     *
+     * @param ii            Integral image
+     */
+    void integral_image_free(integral_image_t *ii);
+
+    /**
+     * @brief Start again from the first row, e.g. for the next frame.
+     *
+     * @param ii            Integral image
+     */
+    void integral_image_reset(integral_image_t *ii);
+
+    /**
+     * @brief Add the next row, e.g. while a frame is decoded line by line.
+     *
+     * @param ii            Integral image
+     * @param row           w x c pixels
+     * @return int          Rows added so far, -1 if the table is full
+     */
+    int integral_image_add_row(integral_image_t *ii, const uint8_t *row);
+
+    /**
+     * @brief Build the whole table from an image.
+     *
+     * @param ii            Integral image
+     * @param image         h rows of w x c pixels
+     * @param stride        Bytes between rows, 0 for w x c
+     */
+    void integral_image_build(integral_image_t *ii, const uint8_t *image, int stride);
+
+    /**
+     * @brief Sum of one channel over a box. The box is clipped to the rows added so far.
+     *
+     * @param ii            Integral image
+     * @param x             Left of the box
+     * @param y             Top of the box
+     * @param w             Width of the box
+     * @param h             Height of the box
+     * @param ch            Channel
+     * @return uint32_t     Sum of the pixels
+     */
+    uint32_t integral_image_sum(const integral_image_t *ii, int x, int y, int w, int h, int ch);
+
+    /**
+     * @brief Mean of one channel over a box, see integral_image_sum.
+     *
+     * @return fptp_t       Mean of the pixels, 0 for an empty box
+     */
+    fptp_t integral_image_mean(const integral_image_t *ii, int x, int y, int w, int h, int ch);
+
+    /**
+     * @brief Variance of one channel over a box, the table must have the squares.
+     *
+     * @return fptp_t       Variance of the pixels, 0 for an empty box
+     */
+    fptp_t integral_image_variance(const integral_image_t *ii, int x, int y, int w, int h, int ch);
+
+    /**
+     * @brief Box-filter downscale: each output pixel is the rounded mean of the whole input pixels it covers.
+     *
+     * The cost is 4 lookups per output pixel and channel whatever the ratio. image_resize_area also weighs
+     * the partly covered pixels, use it when the ratio is small.
+     *
+     * @param ii            Integral image, all rows added
+     * @param dst           dst_w x dst_h x c output
+     * @param dst_w         Width of the output, at most w
+     * @param dst_h         Height of the output, at most h
+     */
+    void integral_image_resize(const integral_image_t *ii, uint8_t *dst, int dst_w, int dst_h);
+
+#if __cplusplus
+}
+#endif
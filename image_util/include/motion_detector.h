@@ -0,0 +1,112 @@
+/*
+  * ESPRESSIF MIT License
+  *
+  * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+  *
+  * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+  * it is free of charge, to any person obtaining a copy of this software and associated
+  * documentation files (the "Software"), to deal in the Software without restriction, including
+  * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+  * to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all copies or
+  * substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+  *
+  */
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include "image_util.h"
+
+    /*
+     * Every frame is shrunk to a w x h luma frame and compared with a running average of the past frames.
+     * The difference is summed per block of block x block pixels, blocks over the threshold are changed,
+     * and neighbouring changed blocks are merged into one box.
+     */
+    typedef struct
+    {
+        int w;                   /*!< Width of the luma frame */
+        int h;                   /*!< Height of the luma frame */
+        int block;               /*!< Side of a block, in luma pixels */
+        int bw;                  /*!< Blocks per row */
+        int bh;                  /*!< Blocks per column */
+        int alpha_shift;         /*!< The background moves 1 / 2^alpha_shift of the way to each frame */
+        int noise;               /*!< Differences up to this are noise and not summed */
+        int threshold;           /*!< A block is changed when its mean difference is above this */
+        int min_blocks;          /*!< Regions of fewer changed blocks are dropped */
+        int frames;              /*!< Frames seen, the first one starts the background */
+        qtp_t *frame;            /*!< w x h, the luma of the last frame */
+        uint16_t *background;    /*!< w x h, the background in Q8 */
+        uint32_t *sad;           /*!< bw x bh, sum of the differences of each block */
+        uint8_t *changed;        /*!< bw x bh, 1 for a changed block */
+        uint16_t *label;         /*!< bw x bh, region of each changed block */
+        uint16_t *stack;         /*!< bw x bh, blocks left to visit while labelling */
+    } motion_detector_t;
+
+    /**
+     * @brief Set up a motion detector. The background starts with the first frame.
+     *
+     * @param md            Motion detector
+     * @param w             Width of the luma frame, e.g. 80 for 320x240
+     * @param h             Height of the luma frame
+     * @param block         Side of a block, w and h are rounded down to whole blocks
+     * @param alpha_shift   The background moves 1 / 2^alpha_shift of the way to each frame, 4 is a good start
+     * @param threshold     Mean difference of a changed block, in 8-bit luma
+     * @return 0            Success
+     * @return -1           Out of memory or bad size
+     */
+    int motion_detector_init(motion_detector_t *md, int w, int h, int block, int alpha_shift, int threshold);
+
+    /**
+     * @brief Free the buffers of a motion detector.
+     *
+     * @param md            Motion detector
+     */
+    void motion_detector_free(motion_detector_t *md);
+
+    /**
+     * @brief Restart the background with the next frame, e.g. after the camera moved.
+     *
+     * @param md            Motion detector
+     */
+    void motion_detector_reset(motion_detector_t *md);
+
+    /**
+     * @brief Feed a frame, update the change map and the background.
+     *
+     * Changed blocks get into the background 4 times slower, so a moving object does not burn in,
+     * while an object that stops is taken in after a while.
+     *
+     * @param md            Motion detector
+     * @param src           Frame, any format of image_source_t. Only the region is looked at
+     * @return int          Number of changed blocks, -1 if out of memory
+     */
+    int motion_detector_update(motion_detector_t *md, const image_source_t *src);
+
+    /**
+     * @brief Merge the changed blocks of the last update into boxes.
+     *
+     * Blocks touching on a side or a corner are one region. Boxes are in the coordinates of src,
+     * the score is the share of changed blocks in the box.
+     *
+     * @param md            Motion detector
+     * @param src           The frame given to the last update
+     * @return box_array_t* Boxes of the changed regions, NULL if nothing moved. Free box, score and the array with dl_lib_free
+     */
+    box_array_t *motion_detector_boxes(motion_detector_t *md, const image_source_t *src);
+
+#if __cplusplus
+}
+#endif
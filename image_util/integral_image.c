@@ -0,0 +1,173 @@
+/*
+  * ESPRESSIF MIT License
+  *
+  * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+  *
+  * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+  * it is free of charge, to any person obtaining a copy of this software and associated
+  * documentation files (the "Software"), to deal in the Software without restriction, including
+  * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+  * to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all copies or
+  * substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+  *
+  */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include "integral_image.h"
+
+int integral_image_init(integral_image_t *ii, int w, int h, int c, int squared)
+{
+    memset(ii, 0, sizeof(integral_image_t));
+    ii->w = w;
+    ii->h = h;
+    ii->c = c;
+    int n = (w + 1) * (h + 1) * c;
+    ii->sum = (uint32_t *)dl_lib_calloc(n, sizeof(uint32_t), 0);
+    if (squared)
+        ii->sqsum = (uint64_t *)dl_lib_calloc(n, sizeof(uint64_t), 0);
+    if ((NULL == ii->sum) || (squared && (NULL == ii->sqsum)))
+    {
+        integral_image_free(ii);
+        return -1;
+    }
+    return 0;
+}
+
+void integral_image_free(integral_image_t *ii)
+{
+    dl_lib_free(ii->sum);
+    dl_lib_free(ii->sqsum);
+    ii->sum = NULL;
+    ii->sqsum = NULL;
+}
+
+void integral_image_reset(integral_image_t *ii)
+{
+    ii->rows = 0;
+}
+
+int integral_image_add_row(integral_image_t *ii, const uint8_t *row)
+{
+    if (ii->rows == ii->h)
+        return -1;
+
+    int c = ii->c;
+    int line = (ii->w + 1) * c;
+    const uint32_t *up = ii->sum + ii->rows * line;
+    uint32_t *cur = ii->sum + (ii->rows + 1) * line;
+    uint32_t acc[4] = {0};
+    uint64_t acc2[4] = {0};
+    assert(c <= 4);
+
+    // running sum of the row on top of the row above
+    for (int x = 0; x < ii->w; x++)
+    {
+        for (int k = 0; k < c; k++)
+        {
+            acc[k] += row[x * c + k];
+            cur[(x + 1) * c + k] = up[(x + 1) * c + k] + acc[k];
+        }
+    }
+    if (ii->sqsum)
+    {
+        const uint64_t *up2 = ii->sqsum + ii->rows * line;
+        uint64_t *cur2 = ii->sqsum + (ii->rows + 1) * line;
+        for (int x = 0; x < ii->w; x++)
+        {
+            for (int k = 0; k < c; k++)
+            {
+                uint32_t v = row[x * c + k];
+                acc2[k] += v * v;
+                cur2[(x + 1) * c + k] = up2[(x + 1) * c + k] + acc2[k];
+            }
+        }
+    }
+    return ++ii->rows;
+}
+
+void integral_image_build(integral_image_t *ii, const uint8_t *image, int stride)
+{
+    if (0 == stride)
+        stride = ii->w * ii->c;
+    ii->rows = 0;
+    for (int y = 0; y < ii->h; y++)
+        integral_image_add_row(ii, image + y * stride);
+}
+
+// clip a box to the table, false when nothing is left
+static inline bool integral_image_clip(const integral_image_t *ii, int *x0, int *y0, int *x1, int *y1, int x, int y, int w, int h)
+{
+    *x0 = DL_IMAGE_MAX(x, 0);
+    *y0 = DL_IMAGE_MAX(y, 0);
+    *x1 = DL_IMAGE_MIN(x + w, ii->w);
+    *y1 = DL_IMAGE_MIN(y + h, ii->rows);
+    return (*x1 > *x0) && (*y1 > *y0);
+}
+
+#define INTEGRAL_BOX(t, line, c, x0, y0, x1, y1, ch) \
+    ((t)[(y1) * (line) + (x1) * (c) + (ch)] - (t)[(y0) * (line) + (x1) * (c) + (ch)] - (t)[(y1) * (line) + (x0) * (c) + (ch)] + (t)[(y0) * (line) + (x0) * (c) + (ch)])
+
+uint32_t integral_image_sum(const integral_image_t *ii, int x, int y, int w, int h, int ch)
+{
+    int x0, y0, x1, y1;
+    if (!integral_image_clip(ii, &x0, &y0, &x1, &y1, x, y, w, h))
+        return 0;
+    return INTEGRAL_BOX(ii->sum, (ii->w + 1) * ii->c, ii->c, x0, y0, x1, y1, ch);
+}
+
+fptp_t integral_image_mean(const integral_image_t *ii, int x, int y, int w, int h, int ch)
+{
+    int x0, y0, x1, y1;
+    if (!integral_image_clip(ii, &x0, &y0, &x1, &y1, x, y, w, h))
+        return 0;
+    uint32_t s = INTEGRAL_BOX(ii->sum, (ii->w + 1) * ii->c, ii->c, x0, y0, x1, y1, ch);
+    return (fptp_t)s / ((x1 - x0) * (y1 - y0));
+}
+
+fptp_t integral_image_variance(const integral_image_t *ii, int x, int y, int w, int h, int ch)
+{
+    int x0, y0, x1, y1;
+    assert(ii->sqsum);
+    if (!integral_image_clip(ii, &x0, &y0, &x1, &y1, x, y, w, h))
+        return 0;
+    int line = (ii->w + 1) * ii->c;
+    uint64_t n = (x1 - x0) * (y1 - y0);
+    uint64_t s = INTEGRAL_BOX(ii->sum, line, ii->c, x0, y0, x1, y1, ch);
+    uint64_t s2 = INTEGRAL_BOX(ii->sqsum, line, ii->c, x0, y0, x1, y1, ch);
+
+    // exact in 64 bits while w x h x 255 fits 32 bits, and never negative
+    return (fptp_t)(n * s2 - s * s) / ((fptp_t)n * n);
+}
+
+void integral_image_resize(const integral_image_t *ii, uint8_t *dst, int dst_w, int dst_h)
+{
+    int c = ii->c;
+    int line = (ii->w + 1) * c;
+    for (int j = 0; j < dst_h; j++)
+    {
+        int y0 = j * ii->rows / dst_h;
+        int y1 = DL_IMAGE_MAX((j + 1) * ii->rows / dst_h, y0 + 1);
+        for (int i = 0; i < dst_w; i++)
+        {
+            int x0 = i * ii->w / dst_w;
+            int x1 = DL_IMAGE_MAX((i + 1) * ii->w / dst_w, x0 + 1);
+            uint32_t n = (x1 - x0) * (y1 - y0);
+            for (int k = 0; k < c; k++)
+                *dst++ = (INTEGRAL_BOX(ii->sum, line, c, x0, y0, x1, y1, k) + n / 2) / n;
+        }
+    }
+}
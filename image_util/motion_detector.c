@@ -0,0 +1,256 @@
+/*
+  * ESPRESSIF MIT License
+  *
+  * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+  *
+  * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+  * it is free of charge, to any person obtaining a copy of this software and associated
+  * documentation files (the "Software"), to deal in the Software without restriction, including
+  * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+  * to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all copies or
+  * substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+  *
+  */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "motion_detector.h"
+
+#include "esp_log.h"
+
+static const char *TAG = "motion_detector";
+
+int motion_detector_init(motion_detector_t *md, int w, int h, int block, int alpha_shift, int threshold)
+{
+    memset(md, 0, sizeof(motion_detector_t));
+    if ((block <= 0) || (w < block) || (h < block) || (alpha_shift < 0) || (alpha_shift > 12))
+        return -1;
+
+    md->block = block;
+    md->bw = w / block;
+    md->bh = h / block;
+    md->w = md->bw * block;
+    md->h = md->bh * block;
+    md->alpha_shift = alpha_shift;
+    md->noise = 4;
+    md->threshold = threshold;
+    md->min_blocks = 1;
+    if (md->bw * md->bh > UINT16_MAX)
+        return -1;
+
+    int pixels = md->w * md->h;
+    int blocks = md->bw * md->bh;
+    md->frame = (qtp_t *)dl_lib_calloc(pixels, sizeof(qtp_t), 0);
+    md->background = (uint16_t *)dl_lib_calloc(pixels, sizeof(uint16_t), 0);
+    md->sad = (uint32_t *)dl_lib_calloc(blocks, sizeof(uint32_t), 0);
+    md->changed = (uint8_t *)dl_lib_calloc(blocks, sizeof(uint8_t), 0);
+    md->label = (uint16_t *)dl_lib_calloc(blocks, sizeof(uint16_t), 0);
+    md->stack = (uint16_t *)dl_lib_calloc(blocks, sizeof(uint16_t), 0);
+    if ((NULL == md->frame) || (NULL == md->background) || (NULL == md->sad) ||
+        (NULL == md->changed) || (NULL == md->label) || (NULL == md->stack))
+    {
+        motion_detector_free(md);
+        return -1;
+    }
+    return 0;
+}
+
+void motion_detector_free(motion_detector_t *md)
+{
+    dl_lib_free(md->frame);
+    dl_lib_free(md->background);
+    dl_lib_free(md->sad);
+    dl_lib_free(md->changed);
+    dl_lib_free(md->label);
+    dl_lib_free(md->stack);
+    md->frame = NULL;
+    md->background = NULL;
+    md->sad = NULL;
+    md->changed = NULL;
+    md->label = NULL;
+    md->stack = NULL;
+}
+
+void motion_detector_reset(motion_detector_t *md)
+{
+    md->frames = 0;
+}
+
+int motion_detector_update(motion_detector_t *md, const image_source_t *src)
+{
+    int roi_w = src->roi_w ? src->roi_w : src->w - src->roi_x;
+    int roi_h = src->roi_h ? src->roi_h : src->h - src->roi_y;
+    image_target_t dst = {md->frame, 1, 0, md->w, md->h, 0, 0, 0};
+    image_sample_t sample = ((roi_w >= md->w) && (roi_h >= md->h)) ? IMAGE_SAMPLE_AREA : IMAGE_SAMPLE_BILINEAR;
+    if (image_convert_resize_q(&dst, src, sample))
+        return -1;
+
+    int pixels = md->w * md->h;
+    int blocks = md->bw * md->bh;
+    if (0 == md->frames++)
+    {
+        for (int i = 0; i < pixels; i++)
+            md->background[i] = md->frame[i] << 8;
+        memset(md->sad, 0, blocks * sizeof(uint32_t));
+        memset(md->changed, 0, blocks);
+        return 0;
+    }
+
+    // differences and the threshold in Q8
+    int noise = md->noise << 8;
+    uint32_t limit = (uint32_t)(md->threshold << 8) * md->block * md->block;
+    int changes = 0;
+    for (int by = 0; by < md->bh; by++)
+    {
+        for (int bx = 0; bx < md->bw; bx++)
+        {
+            int b = by * md->bw + bx;
+            int ofs = by * md->block * md->w + bx * md->block;
+            uint32_t sad = 0;
+            for (int y = 0; y < md->block; y++)
+            {
+                const qtp_t *f = md->frame + ofs + y * md->w;
+                const uint16_t *bg = md->background + ofs + y * md->w;
+                for (int x = 0; x < md->block; x++)
+                {
+                    int d = abs((f[x] << 8) - bg[x]) - noise;
+                    sad += (d > 0) ? d : 0;
+                }
+            }
+            md->sad[b] = sad;
+            md->changed[b] = sad > limit;
+            changes += md->changed[b];
+
+            // a changed block gets into the background 4 times slower
+            int shift = md->alpha_shift + (md->changed[b] ? 2 : 0);
+            int round = shift ? (1 << (shift - 1)) : 0;
+            for (int y = 0; y < md->block; y++)
+            {
+                const qtp_t *f = md->frame + ofs + y * md->w;
+                uint16_t *bg = md->background + ofs + y * md->w;
+                for (int x = 0; x < md->block; x++)
+                    bg[x] += ((f[x] << 8) - bg[x] + round) >> shift;
+            }
+        }
+    }
+    return changes;
+}
+
+box_array_t *motion_detector_boxes(motion_detector_t *md, const image_source_t *src)
+{
+    int blocks = md->bw * md->bh;
+    int regions = 0;
+
+    // 8-connected labelling, labels start at 1
+    memset(md->label, 0, blocks * sizeof(uint16_t));
+    for (int b = 0; b < blocks; b++)
+    {
+        if ((0 == md->changed[b]) || md->label[b])
+            continue;
+        regions++;
+        int top = 0;
+        md->stack[top++] = b;
+        md->label[b] = regions;
+        while (top)
+        {
+            int i = md->stack[--top];
+            int bx = i % md->bw;
+            int by = i / md->bw;
+            for (int ny = DL_IMAGE_MAX(by - 1, 0); ny <= DL_IMAGE_MIN(by + 1, md->bh - 1); ny++)
+            {
+                for (int nx = DL_IMAGE_MAX(bx - 1, 0); nx <= DL_IMAGE_MIN(bx + 1, md->bw - 1); nx++)
+                {
+                    int n = ny * md->bw + nx;
+                    if (md->changed[n] && (0 == md->label[n]))
+                    {
+                        md->label[n] = regions;
+                        md->stack[top++] = n;
+                    }
+                }
+            }
+        }
+    }
+    if (0 == regions)
+        return NULL;
+
+    // block bounds and size of each region
+    int *bound = (int *)dl_lib_calloc(regions * 5, sizeof(int), 0);
+    if (NULL == bound)
+    {
+        ESP_LOGW(TAG, "Out of memory for %d regions", regions);
+        return NULL;
+    }
+    for (int r = 0; r < regions; r++)
+    {
+        bound[r * 5] = md->bw;
+        bound[r * 5 + 1] = md->bh;
+    }
+    for (int b = 0; b < blocks; b++)
+    {
+        if (0 == md->label[b])
+            continue;
+        int *r = bound + (md->label[b] - 1) * 5;
+        int bx = b % md->bw;
+        int by = b / md->bw;
+        r[0] = DL_IMAGE_MIN(r[0], bx);
+        r[1] = DL_IMAGE_MIN(r[1], by);
+        r[2] = DL_IMAGE_MAX(r[2], bx);
+        r[3] = DL_IMAGE_MAX(r[3], by);
+        r[4]++;
+    }
+
+    int len = 0;
+    for (int r = 0; r < regions; r++)
+        len += bound[r * 5 + 4] >= md->min_blocks;
+
+    box_array_t *boxes = NULL;
+    if (len)
+    {
+        boxes = (box_array_t *)dl_lib_calloc(1, sizeof(box_array_t), 0);
+        box_t *box = (box_t *)dl_lib_calloc(len, sizeof(box_t), 0);
+        fptp_t *score = (fptp_t *)dl_lib_calloc(len, sizeof(fptp_t), 0);
+        if ((NULL == boxes) || (NULL == box) || (NULL == score))
+        {
+            dl_lib_free(boxes);
+            dl_lib_free(box);
+            dl_lib_free(score);
+            dl_lib_free(bound);
+            return NULL;
+        }
+
+        int roi_w = src->roi_w ? src->roi_w : src->w - src->roi_x;
+        int roi_h = src->roi_h ? src->roi_h : src->h - src->roi_y;
+        fptp_t scale_x = (fptp_t)roi_w / md->bw;
+        fptp_t scale_y = (fptp_t)roi_h / md->bh;
+        int n = 0;
+        for (int r = 0; r < regions; r++)
+        {
+            int *b = bound + r * 5;
+            if (b[4] < md->min_blocks)
+                continue;
+            box[n].box_p[0] = src->roi_x + b[0] * scale_x;
+            box[n].box_p[1] = src->roi_y + b[1] * scale_y;
+            box[n].box_p[2] = src->roi_x + (b[2] + 1) * scale_x - 1;
+            box[n].box_p[3] = src->roi_y + (b[3] + 1) * scale_y - 1;
+            score[n] = (fptp_t)b[4] / ((b[2] - b[0] + 1) * (b[3] - b[1] + 1));
+            n++;
+        }
+        boxes->box = box;
+        boxes->score = score;
+        boxes->len = len;
+    }
+
+    dl_lib_free(bound);
+    return boxes;
+}
@@ -5,6 +5,7 @@
 #include <math.h>
 #include "sdkconfig.h"
 #include "image_util.h"
+#include "motion_detector.h"
 #include "fd_forward.h"
 #include "fr_forward.h"
 #include "fr_flash.h"
@@ -12,21 +13,13 @@
 
 void md_task(void *arg)
 {
-    float ratio = 0.3;
     int ori_w = 320;
     int ori_h = 240;
-    int w = ori_w * ratio;
-    int h = ori_h * ratio;
-    int c = 3;
-    int init = 1;
     camera_fb_t * fb = NULL;
-    dl_matrix3du_t *image_ori = dl_matrix3du_alloc(1, ori_w, ori_h, c);
-    dl_matrix3du_t *image_motion = dl_matrix3du_alloc(1, w, h, c);
-    dl_matrix3du_t *image_new = dl_matrix3du_alloc(1, w, h, c);
-    dl_matrix3du_t *image_tmp = dl_matrix3du_alloc(1, w, h, c);
-
-    //dl_matrix3du_t *image1 = (dl_matrix3du_t *)get_coeff_ref_in.getter_3d("image1", NULL, 0);
-    //dl_matrix3du_t *image2 = (dl_matrix3du_t *)get_coeff_ref_in.getter_3d("image2", NULL, 0);
+    dl_matrix3du_t *image_ori = dl_matrix3du_alloc(1, ori_w, ori_h, 3);
+    motion_detector_t md;
+    motion_detector_init(&md, ori_w / 4, ori_h / 4, 8, 4, 12);
+    md.min_blocks = 2;
 
     while (1)
     {
@@ -37,43 +30,43 @@ void md_task(void *arg)
             res = ESP_FAIL;
             break;
         }
-        if(!fmt2rgb888(fb->buf, fb->len, fb->format, image_ori->item))
-        {
-            ESP_LOGW(TAG, "fmt2rgb888 failed");
-            //res = ESP_FAIL;
-            //dl_matrix3du_free(image_matrix);
-            //break;
-        }
-        image_resize_linear(image_new->item, image_ori->item, w, h, c, ori_w, ori_h);
-        int count = w * h * c;
-        if (init)
+
+        // RGB565 frames are read in place, others are decoded first
+        image_source_t src = {fb->buf, IMAGE_PIXEL_RGB565, ori_w, ori_h, 0, 0, 0, 0, 0};
+        if (PIXFORMAT_RGB565 != fb->format)
         {
-            memcpy(image_motion->item, image_new->item, count * sizeof(uint8_t));
-            init = 0;
-            continue;
+            if(!fmt2rgb888(fb->buf, fb->len, fb->format, image_ori->item))
+            {
+                ESP_LOGW(TAG, "fmt2rgb888 failed");
+                esp_camera_fb_return(fb);
+                continue;
+            }
+            src.data = image_ori->item;
+            src.format = IMAGE_PIXEL_RGB888;
         }
 
-        image_abs_diff(image_new->item, image_motion->item, image_new->item, count);
-        image_threshold(image_new->item, image_new->item, 35, 255, count, BINARY);
-        image_erode(image_tmp->item, image_new->item, w, h, c);
-
-        int motion_changes = 0;
-        int padding = 10;
-        for (int j = padding; j < h - padding - 1; j += 2)
+        int changes = motion_detector_update(&md, &src);
+        if (changes > 0)
         {
-            uint8_t *data = image_tmp->item + j * w * c;
-            for (int i = padding; i < w - padding - 1; i += 2)
+            box_array_t *boxes = motion_detector_boxes(&md, &src);
+            if (boxes)
             {
-                uint8_t *d = data + i * 3;
-                if (d[0] + d[1] + d[2] > 750)
+                // the boxes can restrict a detector to where something moved
+                for (int i = 0; i < boxes->len; i++)
                 {
-                    motion_changes++;
+                    box_t *b = &boxes->box[i];
+                    printf("motion: (%.0f, %.0f) - (%.0f, %.0f), %d blocks\n", b->box_p[0], b->box_p[1], b->box_p[2], b->box_p[3], changes);
                 }
+                dl_lib_free(boxes->score);
+                dl_lib_free(boxes->box);
+                dl_lib_free(boxes);
             }
         }
-        printf("changes: %lld\n", motion_changes);
+        esp_camera_fb_return(fb);
     }
 
+    motion_detector_free(&md);
+    dl_matrix3du_free(image_ori);
 }
 
 void app_main()
@@ -0,0 +1,574 @@
+/*
+  * ESPRESSIF MIT License
+  *
+  * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+  *
+  * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+  * it is free of charge, to any person obtaining a copy of this software and associated
+  * documentation files (the "Software"), to deal in the Software without restriction, including
+  * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+  * to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all copies or
+  * substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+  *
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "detection_pack.h"
+#include "fr_partition.h"
+#include "image_util.h"
+
+#include "esp_log.h"
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+#define DETECTION_PACK_CONV_MODE DL_XTENSA_IMPL
+#else
+#define DETECTION_PACK_CONV_MODE DL_C_IMPL
+#endif
+
+static const char *TAG = "detection_pack";
+
+static bool detection_pack_table_ok(const detection_pack_header_t *header, uint32_t offset, uint32_t count, uint32_t size)
+{
+    return (0 == offset % 4) && (offset >= header->header_size) &&
+           ((uint64_t)offset + (uint64_t)count * size <= header->total_size);
+}
+
+static bool detection_pack_slot_ok(const detection_pack_header_t *header, int slot)
+{
+    return (slot >= 0) && (slot < header->n_slots);
+}
+
+static bool detection_pack_tensor_ok(const detection_pack_header_t *header, int tensor)
+{
+    return (tensor >= 0) && (tensor < header->n_tensors);
+}
+
+static dl_padding_type detection_pack_padding(int padding)
+{
+    // the library frees the input on PADDING_SAME, slots are freed here
+    if (DETECTION_PACK_PADDING_SAME == padding)
+        return PADDING_SAME_DONT_FREE_INPUT;
+    if (DETECTION_PACK_PADDING_SAME_MXNET == padding)
+        return PADDING_SAME_MXNET;
+    return PADDING_VALID;
+}
+
+static dl_matrix3dq_t *detection_pack_depthwise(dl_matrix3dq_t *in, dl_matrix3dq_t *filter, dl_matrix3dq_t *bias, const detection_pack_layer_t *l)
+{
+    // the library has depthwise kernels for 2x2, 3x3 and 5x5 only
+    dl_padding_type padding = detection_pack_padding(l->padding);
+    dl_matrix3dq_t *out = NULL;
+    switch (filter->w)
+    {
+    case 2:
+        if (bias)
+            return dl_matrix3dqq_depthwise_conv_2x2_with_bias(in, filter, bias, l->stride_x, l->stride_y, padding, l->exponent, l->relu, NULL);
+        out = dl_matrix3dqq_depthwise_conv_2x2(in, filter, l->stride_x, l->stride_y, padding, l->exponent, NULL);
+        break;
+    case 3:
+        if (bias)
+            return dl_matrix3dqq_depthwise_conv_3x3_with_bias(in, filter, bias, l->stride_x, l->stride_y, padding, l->exponent, l->relu, NULL);
+        return dl_matrix3dqq_depthwise_conv_3x3(in, filter, l->stride_x, l->stride_y, padding, l->relu, l->exponent, NULL);
+    case 5:
+        if (bias)
+            return dl_matrix3dqq_depthwise_conv_5x5_with_bias(in, filter, bias, l->stride_x, l->stride_y, padding, l->exponent, l->relu, NULL);
+        out = dl_matrix3dqq_depthwise_conv_5x5(in, filter, l->stride_x, l->stride_y, padding, l->exponent, NULL);
+        break;
+    }
+    if (out && l->relu)
+        dl_matrix3dq_relu(out);
+    return out;
+}
+
+static int detection_pack_check(const uint8_t *data, size_t size)
+{
+    const detection_pack_header_t *header = (const detection_pack_header_t *)data;
+    if ((size < sizeof(detection_pack_header_t)) || (DETECTION_PACK_MAGIC != header->magic))
+    {
+        ESP_LOGE(TAG, "Not a detection pack");
+        return -1;
+    }
+    if ((DETECTION_PACK_VERSION != header->version) || (sizeof(detection_pack_header_t) != header->header_size))
+    {
+        ESP_LOGE(TAG, "Unsupported pack version %d", header->version);
+        return -1;
+    }
+    if ((header->total_size < header->header_size) || (header->total_size > size))
+    {
+        ESP_LOGE(TAG, "Pack truncated, %u of %u bytes", (unsigned)size, (unsigned)header->total_size);
+        return -1;
+    }
+    if (fr_crc32(0, data + header->header_size, header->total_size - header->header_size) != header->crc)
+    {
+        ESP_LOGE(TAG, "Pack CRC mismatch");
+        return -1;
+    }
+    if ((header->model_type > Anchor_Box) || (0 == header->n_stages) || (0 == header->n_layers) ||
+        (0 == header->n_slots) || (header->n_slots > DETECTION_PACK_MAX_SLOTS) ||
+        ((1 != header->input_channel) && (3 != header->input_channel)))
+    {
+        ESP_LOGE(TAG, "Bad pack header");
+        return -1;
+    }
+    if (!detection_pack_table_ok(header, header->stage_offset, header->n_stages, sizeof(detection_pack_stage_t)) ||
+        !detection_pack_table_ok(header, header->anchor_offset, header->n_anchors, 2 * sizeof(int32_t)) ||
+        !detection_pack_table_ok(header, header->layer_offset, header->n_layers, sizeof(detection_pack_layer_t)) ||
+        !detection_pack_table_ok(header, header->tensor_offset, header->n_tensors, sizeof(detection_pack_tensor_t)))
+    {
+        ESP_LOGE(TAG, "Pack table out of bounds");
+        return -1;
+    }
+
+    const detection_pack_tensor_t *tensor = (const detection_pack_tensor_t *)(data + header->tensor_offset);
+    for (int i = 0; i < header->n_tensors; i++)
+    {
+        const detection_pack_tensor_t *t = tensor + i;
+        if ((t->n <= 0) || (t->w <= 0) || (t->h <= 0) || (t->c <= 0) || (t->offset % DETECTION_PACK_ALIGN) ||
+            ((uint64_t)t->offset + (uint64_t)t->n * t->w * t->h * t->c * sizeof(qtp_t) > header->total_size))
+        {
+            ESP_LOGE(TAG, "Bad tensor %d", i);
+            return -1;
+        }
+    }
+
+    // every slot is written before it is read, slot 0 is the input
+    uint8_t written[DETECTION_PACK_MAX_SLOTS] = {1};
+    const detection_pack_layer_t *layer = (const detection_pack_layer_t *)(data + header->layer_offset);
+    for (int i = 0; i < header->n_layers; i++)
+    {
+        const detection_pack_layer_t *l = layer + i;
+        bool two_inputs = (DETECTION_PACK_ADD == l->op) || (DETECTION_PACK_CONCAT == l->op);
+        bool ok = (l->op >= 0) && (l->op < DETECTION_PACK_OP_MAX) && (two_inputs || (-1 == l->input2)) &&
+                  detection_pack_slot_ok(header, l->input) && written[l->input] &&
+                  detection_pack_slot_ok(header, l->output) && (0 != l->output) &&
+                  (l->padding >= DETECTION_PACK_PADDING_VALID) && (l->padding <= DETECTION_PACK_PADDING_SAME_MXNET);
+        switch (l->op)
+        {
+        case DETECTION_PACK_DEPTHWISE:
+            ok = ok && detection_pack_tensor_ok(header, l->filter) && (tensor[l->filter].w == tensor[l->filter].h) &&
+                 ((2 == tensor[l->filter].w) || (3 == tensor[l->filter].w) || (5 == tensor[l->filter].w));
+            // fall through
+        case DETECTION_PACK_CONV:
+            ok = ok && detection_pack_tensor_ok(header, l->filter) && ((-1 == l->bias) || detection_pack_tensor_ok(header, l->bias)) &&
+                 (l->stride_x > 0) && (l->stride_y > 0);
+            break;
+        case DETECTION_PACK_PRELU:
+            ok = ok && detection_pack_tensor_ok(header, l->filter);
+            // fall through
+        case DETECTION_PACK_RELU:
+            ok = ok && (l->output == l->input);
+            break;
+        case DETECTION_PACK_ADD:
+        case DETECTION_PACK_CONCAT:
+            ok = ok && detection_pack_slot_ok(header, l->input2) && written[l->input2];
+            break;
+        case DETECTION_PACK_UPSAMPLE:
+            ok = ok && (l->type >= UPSAMPLE_NEAREST_NEIGHBOR) && (l->type <= UPSAMPLE_BILINEAR);
+            break;
+        case DETECTION_PACK_POOL:
+            ok = ok && (l->kernel_w > 0) && (l->kernel_h > 0) && (l->stride_x > 0) && (l->stride_y > 0) &&
+                 (l->type >= DL_POOLING_MAX) && (l->type <= DL_POOLING_AVG);
+            break;
+        default:
+            break;
+        }
+        if (!ok)
+        {
+            ESP_LOGE(TAG, "Bad layer %d", i);
+            return -1;
+        }
+        written[l->output] = 1;
+    }
+
+    // stage outputs are distinct slots, all of them written
+    uint8_t output[DETECTION_PACK_MAX_SLOTS] = {0};
+    const detection_pack_stage_t *stage = (const detection_pack_stage_t *)(data + header->stage_offset);
+    for (int i = 0; i < header->n_stages; i++)
+    {
+        const detection_pack_stage_t *s = stage + i;
+        int slots[3] = {s->score, s->box_offset, s->landmark};
+        bool ok = (s->stride > 0) && (s->anchor_index >= 0) && (s->n_anchors >= 0) &&
+                  ((uint64_t)s->anchor_index + s->n_anchors <= header->n_anchors);
+        for (int j = 0; j < 3; j++)
+        {
+            if ((2 == j) && (-1 == slots[j]))
+                continue;
+            ok = ok && detection_pack_slot_ok(header, slots[j]) && (0 != slots[j]) && written[slots[j]] && !output[slots[j]];
+            if (ok)
+                output[slots[j]] = 1;
+        }
+        if (!ok)
+        {
+            ESP_LOGE(TAG, "Bad stage %d", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void detection_pack_release(dl_matrix3dq_t **slot, dl_matrix3dq_t *in, bool free_image)
+{
+    if (*slot && ((*slot != in) || free_image))
+        dl_matrix3dq_free(*slot);
+    *slot = NULL;
+}
+
+static detection_stage_result_t *detection_pack_op(dl_matrix3dq_t *in, detection_model_config_t *config)
+{
+    detection_pack_t *pack = (detection_pack_t *)((char *)config - offsetof(detection_pack_t, model.model_config));
+    int stages = config->enabled_top_k;
+    uint8_t *live = pack->needed;
+    uint8_t *run = pack->needed + pack->n_slots;
+    dl_matrix3dq_t **slot = pack->slot;
+
+    // walk back from the outputs of the enabled stages, layers of the other stages are skipped
+    memset(live, 0, pack->n_slots);
+    for (int s = 0; s < stages; s++)
+    {
+        live[pack->stage[s].score] = 1;
+        live[pack->stage[s].box_offset] = 1;
+        if (pack->stage[s].landmark >= 0)
+            live[pack->stage[s].landmark] = 1;
+    }
+    for (int i = pack->n_layers - 1; i >= 0; i--)
+    {
+        const detection_pack_layer_t *l = pack->layer + i;
+        run[i] = live[l->output];
+        if (!run[i])
+            continue;
+        live[l->output] = 0;
+        live[l->input] = 1;
+        if ((DETECTION_PACK_ADD == l->op) || (DETECTION_PACK_CONCAT == l->op))
+            live[l->input2] = 1;
+    }
+
+    detection_stage_result_t *result = NULL;
+    memset(slot, 0, pack->n_slots * sizeof(dl_matrix3dq_t *));
+    slot[0] = in;
+    if (in->c != pack->input_channel)
+    {
+        ESP_LOGE(TAG, "%s takes %d channels, got %d", pack->name, pack->input_channel, in->c);
+        goto done;
+    }
+
+    for (int i = 0; i < pack->n_layers; i++)
+    {
+        if (!run[i])
+            continue;
+        const detection_pack_layer_t *l = pack->layer + i;
+        dl_matrix3dq_t *x = slot[l->input];
+        dl_matrix3dq_t *y = NULL;
+        switch (l->op)
+        {
+        case DETECTION_PACK_CONV:
+            y = dl_matrix3dqq_conv_common(x, pack->tensor + l->filter, (l->bias < 0) ? NULL : pack->tensor + l->bias,
+                                          l->stride_x, l->stride_y, detection_pack_padding(l->padding), l->exponent, DETECTION_PACK_CONV_MODE);
+            break;
+        case DETECTION_PACK_DEPTHWISE:
+            y = detection_pack_depthwise(x, pack->tensor + l->filter, (l->bias < 0) ? NULL : pack->tensor + l->bias, l);
+            break;
+        case DETECTION_PACK_RELU:
+            dl_matrix3dq_relu(x);
+            y = x;
+            break;
+        case DETECTION_PACK_PRELU:
+            dl_matrix3dq_p_relu(x, pack->tensor + l->filter);
+            y = x;
+            break;
+        case DETECTION_PACK_ADD:
+        case DETECTION_PACK_CONCAT:
+        {
+            dl_matrix3dq_t *x2 = slot[l->input2];
+            if ((x->n != x2->n) || (x->w != x2->w) || (x->h != x2->h) ||
+                ((DETECTION_PACK_ADD == l->op) && (x->c != x2->c)))
+            {
+                ESP_LOGE(TAG, "%s layer %d joins %dx%dx%d and %dx%dx%d", pack->name, i, x->w, x->h, x->c, x2->w, x2->h, x2->c);
+                goto done;
+            }
+            if (DETECTION_PACK_ADD == l->op)
+                y = dl_matrix3dq_add(x, x2, l->exponent);
+            else
+                y = dl_matrix3dq_concat(x, x2);
+            break;
+        }
+        case DETECTION_PACK_UPSAMPLE:
+            y = dl_matrix3dqq_upsample_2x(x, (dl_upsample_type)l->type);
+            break;
+        case DETECTION_PACK_POOL:
+            y = dl_matrix3dq_pooling(x, l->kernel_w, l->kernel_h, l->stride_x, l->stride_y,
+                                     detection_pack_padding(l->padding), (dl_pooling_type)l->type);
+            break;
+        case DETECTION_PACK_GLOBAL_POOL:
+            y = dl_matrix3dq_global_pool(x);
+            break;
+        }
+        if (NULL == y)
+        {
+            ESP_LOGE(TAG, "%s failed at layer %d", pack->name, i);
+            goto done;
+        }
+        if (y != x)
+        {
+            detection_pack_release(slot + l->output, in, config->free_image);
+            slot[l->output] = y;
+        }
+        if (l->relu && (DETECTION_PACK_DEPTHWISE != l->op))
+            dl_matrix3dq_relu(y);
+
+        // drop the inputs nobody reads any more
+        if ((pack->last_use[l->input] == i) && (l->input != l->output))
+            detection_pack_release(slot + l->input, in, config->free_image);
+        if (((DETECTION_PACK_ADD == l->op) || (DETECTION_PACK_CONCAT == l->op)) &&
+            (pack->last_use[l->input2] == i) && (l->input2 != l->output))
+            detection_pack_release(slot + l->input2, in, config->free_image);
+    }
+
+    result = (detection_stage_result_t *)dl_lib_calloc(pack->model.stage_number, sizeof(detection_stage_result_t), 0);
+    if (NULL == result)
+        goto done;
+    for (int s = 0; s < stages; s++)
+    {
+        const detection_pack_stage_t *st = pack->stage + s;
+        result[s].score = slot[st->score];
+        result[s].box_offset = slot[st->box_offset];
+        slot[st->score] = NULL;
+        slot[st->box_offset] = NULL;
+        if (st->landmark >= 0)
+        {
+            result[s].landmark_offset = slot[st->landmark];
+            slot[st->landmark] = NULL;
+        }
+        // the boxes and landmarks are read at the cells and anchors of the score map
+        const dl_matrix3dq_t *score = result[s].score;
+        const dl_matrix3dq_t *box = result[s].box_offset;
+        const dl_matrix3dq_t *landmark = result[s].landmark_offset;
+        bool ok = (box->n == score->n) && (box->w == score->w) && (box->h == score->h) && (4 == box->c) &&
+                  ((NULL == landmark) || ((landmark->n == score->n) && (landmark->w == score->w) &&
+                                          (landmark->h == score->h) && (LANDMARKS_NUM == landmark->c)));
+        if (!ok)
+            ESP_LOGE(TAG, "%s stage %d maps do not match the %dx%dx%d score map", pack->name, s, score->n, score->w, score->h);
+        // anchor boxes are looked up per anchor of the score map
+        if (ok && (Anchor_Box == pack->model.model_type) && (score->n > st->n_anchors))
+        {
+            ESP_LOGE(TAG, "%s stage %d has %d anchors, the score map %d", pack->name, s, st->n_anchors, score->n);
+            ok = false;
+        }
+        if (!ok)
+        {
+            for (int j = 0; j <= s; j++)
+                free_detection_stage_result(result[j]);
+            dl_lib_free(result);
+            result = NULL;
+            goto done;
+        }
+    }
+
+done:
+    for (int i = 0; i < pack->n_slots; i++)
+        detection_pack_release(slot + i, in, config->free_image);
+    return result;
+}
+
+detection_pack_t *detection_pack_load(const void *data, size_t size, bool copy)
+{
+    if ((NULL == data) || (0 != detection_pack_check((const uint8_t *)data, size)))
+        return NULL;
+
+    const detection_pack_header_t *header = (const detection_pack_header_t *)data;
+    detection_pack_t *pack = (detection_pack_t *)dl_lib_calloc(1, sizeof(detection_pack_t), 0);
+    if (NULL == pack)
+        return NULL;
+
+    const uint8_t *base = (const uint8_t *)data;
+    if (copy)
+    {
+        pack->buffer = dl_lib_calloc(header->total_size, 1, DETECTION_PACK_ALIGN);
+        if (NULL == pack->buffer)
+            goto fail;
+        memcpy(pack->buffer, data, header->total_size);
+        base = (const uint8_t *)pack->buffer;
+        header = (const detection_pack_header_t *)base;
+    }
+    else if ((uintptr_t)data % DETECTION_PACK_ALIGN)
+    {
+        ESP_LOGE(TAG, "Pack in place must be %d-byte aligned", DETECTION_PACK_ALIGN);
+        goto fail;
+    }
+
+    memcpy(pack->name, header->name, DETECTION_PACK_NAME_LEN);
+    pack->resize_scale = header->resize_scale;
+    pack->score_threshold = header->score_threshold;
+    pack->nms_threshold = header->nms_threshold;
+    pack->input_channel = header->input_channel;
+    pack->n_slots = header->n_slots;
+    pack->n_layers = header->n_layers;
+    pack->stage = (const detection_pack_stage_t *)(base + header->stage_offset);
+    pack->layer = (const detection_pack_layer_t *)(base + header->layer_offset);
+
+    pack->model.stage_config = (detection_stage_config_t *)dl_lib_calloc(header->n_stages, sizeof(detection_stage_config_t), 0);
+    pack->tensor = (dl_matrix3dq_t *)dl_lib_calloc(header->n_tensors ? header->n_tensors : 1, sizeof(dl_matrix3dq_t), 0);
+    pack->anchor = (int **)dl_lib_calloc(header->n_anchors ? header->n_anchors : 1, sizeof(int *), 0);
+    pack->last_use = (int *)dl_lib_calloc(pack->n_slots, sizeof(int), 0);
+    pack->slot = (dl_matrix3dq_t **)dl_lib_calloc(pack->n_slots, sizeof(dl_matrix3dq_t *), 0);
+    pack->needed = (uint8_t *)dl_lib_calloc(pack->n_slots + pack->n_layers, sizeof(uint8_t), 0);
+    if ((NULL == pack->model.stage_config) || (NULL == pack->tensor) || (NULL == pack->anchor) ||
+        (NULL == pack->last_use) || (NULL == pack->slot) || (NULL == pack->needed))
+        goto fail;
+
+    const detection_pack_tensor_t *tensor = (const detection_pack_tensor_t *)(base + header->tensor_offset);
+    for (int i = 0; i < header->n_tensors; i++)
+    {
+        dl_matrix3dq_t *t = pack->tensor + i;
+        t->n = tensor[i].n;
+        t->w = tensor[i].w;
+        t->h = tensor[i].h;
+        t->c = tensor[i].c;
+        t->stride = t->w * t->c;
+        t->exponent = tensor[i].exponent;
+        t->item = (qtp_t *)(base + tensor[i].offset);
+    }
+
+    int32_t *anchor = (int32_t *)(base + header->anchor_offset);
+    for (int i = 0; i < header->n_anchors; i++)
+        pack->anchor[i] = (int *)(anchor + 2 * i);
+
+    for (int s = 0; s < header->n_stages; s++)
+    {
+        pack->model.stage_config[s].anchors_shape = pack->anchor + pack->stage[s].anchor_index;
+        pack->model.stage_config[s].stride = pack->stage[s].stride;
+        pack->model.stage_config[s].boundary = pack->stage[s].boundary;
+        pack->model.stage_config[s].project_offset = pack->stage[s].project_offset;
+    }
+
+    // stage outputs stay until the end of the run
+    for (int i = 0; i < pack->n_slots; i++)
+        pack->last_use[i] = -1;
+    for (int i = 0; i < pack->n_layers; i++)
+    {
+        pack->last_use[pack->layer[i].input] = i;
+        if ((DETECTION_PACK_ADD == pack->layer[i].op) || (DETECTION_PACK_CONCAT == pack->layer[i].op))
+            pack->last_use[pack->layer[i].input2] = i;
+    }
+    for (int s = 0; s < header->n_stages; s++)
+    {
+        pack->last_use[pack->stage[s].score] = -1;
+        pack->last_use[pack->stage[s].box_offset] = -1;
+        if (pack->stage[s].landmark >= 0)
+            pack->last_use[pack->stage[s].landmark] = -1;
+    }
+
+    // get_boxes is set by update_detection_model from the model type
+    pack->model.stage_number = header->n_stages;
+    pack->model.model_type = (detection_model_type_t)header->model_type;
+    pack->model.op = detection_pack_op;
+    pack->model.model_config.score_threshold = pack->score_threshold;
+    pack->model.model_config.nms_threshold = pack->nms_threshold;
+    pack->model.model_config.free_image = true;
+
+    ESP_LOGI(TAG, "Loaded %s: %d stages, %d layers, %d tensors", pack->name, header->n_stages, header->n_layers, header->n_tensors);
+    return pack;
+
+fail:
+    ESP_LOGE(TAG, "Out of memory loading a pack");
+    detection_pack_free(pack);
+    return NULL;
+}
+
+detection_pack_t *detection_pack_load_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (NULL == f)
+    {
+        ESP_LOGE(TAG, "Cannot open %s", path);
+        return NULL;
+    }
+
+    detection_pack_t *pack = NULL;
+    void *buffer = NULL;
+    long size = 0;
+    if ((0 == fseek(f, 0, SEEK_END)) && ((size = ftell(f)) > 0) && (0 == fseek(f, 0, SEEK_SET)))
+        buffer = dl_lib_calloc(size, 1, DETECTION_PACK_ALIGN);
+    if (buffer && (fread(buffer, 1, size, f) == (size_t)size))
+    {
+        // the read buffer becomes the pack's own copy
+        pack = detection_pack_load(buffer, size, false);
+        if (pack)
+        {
+            pack->buffer = buffer;
+            buffer = NULL;
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Cannot read %s", path);
+    }
+    dl_lib_free(buffer);
+    fclose(f);
+    return pack;
+}
+
+#ifdef ESP_PLATFORM
+detection_pack_t *detection_pack_load_partition(const char *label)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (NULL == part)
+    {
+        ESP_LOGE(TAG, "No partition %s", label);
+        return NULL;
+    }
+
+    detection_pack_header_t header;
+    if ((ESP_OK != esp_partition_read(part, 0, &header, sizeof(header))) ||
+        (DETECTION_PACK_MAGIC != header.magic) || (header.total_size > part->size) || (header.total_size < sizeof(header)))
+    {
+        ESP_LOGE(TAG, "No pack in partition %s", label);
+        return NULL;
+    }
+
+    const void *ptr = NULL;
+    spi_flash_mmap_handle_t handle = 0;
+    if (ESP_OK != esp_partition_mmap(part, 0, header.total_size, SPI_FLASH_MMAP_DATA, &ptr, &handle))
+    {
+        ESP_LOGE(TAG, "Cannot map partition %s", label);
+        return NULL;
+    }
+
+    detection_pack_t *pack = detection_pack_load(ptr, header.total_size, false);
+    if (NULL == pack)
+    {
+        spi_flash_munmap(handle);
+        return NULL;
+    }
+    pack->mmap_handle = (void *)(uintptr_t)handle;
+    return pack;
+}
+#endif
+
+void detection_pack_free(detection_pack_t *pack)
+{
+    if (NULL == pack)
+        return;
+    dl_lib_free(pack->model.stage_config);
+    dl_lib_free(pack->tensor);
+    dl_lib_free(pack->anchor);
+    dl_lib_free(pack->last_use);
+    dl_lib_free(pack->slot);
+    dl_lib_free(pack->needed);
+    dl_lib_free(pack->buffer);
+#ifdef ESP_PLATFORM
+    if (pack->mmap_handle)
+        spi_flash_munmap((spi_flash_mmap_handle_t)(uintptr_t)pack->mmap_handle);
+#endif
+    dl_lib_free(pack);
+}
@@ -0,0 +1,198 @@
+/*
+  * ESPRESSIF MIT License
+  *
+  * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+  *
+  * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+  * it is free of charge, to any person obtaining a copy of this software and associated
+  * documentation files (the "Software"), to deal in the Software without restriction, including
+  * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+  * to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all copies or
+  * substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+  *
+  */
+#pragma once
+
+#if __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "detection.h"
+
+#define DETECTION_PACK_MAGIC 0x4b504445 /*!< "EDPK" */
+#define DETECTION_PACK_VERSION 1
+#define DETECTION_PACK_NAME_LEN 16
+#define DETECTION_PACK_MAX_SLOTS 64
+#define DETECTION_PACK_ALIGN 16 /*!< Alignment of tensor data in the pack */
+
+    /*
+     * A pack is one little-endian blob: the header, then the stage, anchor, layer and tensor tables,
+     * then the tensor data. Offsets are from the start of the pack, tables are 4-byte aligned and
+     * tensor data DETECTION_PACK_ALIGN aligned, so a pack mapped from flash is used in place.
+     * The CRC covers everything after the header.
+     *
+     * The network runs over activation slots. Slot 0 holds the resized image, each layer reads
+     * one or two slots and writes one, and each stage names the slots of its outputs.
+     */
+    typedef enum
+    {
+        DETECTION_PACK_CONV = 0,        /*!< filter, bias (or -1), exponent, stride, padding */
+        DETECTION_PACK_DEPTHWISE = 1,   /*!< 2x2, 3x3 or 5x5 filter, bias (or -1), exponent, stride, padding */
+        DETECTION_PACK_RELU = 2,        /*!< in place, output == input */
+        DETECTION_PACK_PRELU = 3,       /*!< in place, filter is alpha */
+        DETECTION_PACK_ADD = 4,         /*!< input + input2, exponent */
+        DETECTION_PACK_CONCAT = 5,      /*!< input and input2 along the channel */
+        DETECTION_PACK_UPSAMPLE = 6,    /*!< 2x, type is dl_upsample_type */
+        DETECTION_PACK_POOL = 7,        /*!< kernel, stride, padding, type is dl_pooling_type */
+        DETECTION_PACK_GLOBAL_POOL = 8, /*!< average to 1x1 */
+        DETECTION_PACK_OP_MAX,
+    } detection_pack_op_t;
+
+    typedef enum
+    {
+        DETECTION_PACK_PADDING_VALID = 0,
+        DETECTION_PACK_PADDING_SAME = 1,       /*!< Same padding, from right to left */
+        DETECTION_PACK_PADDING_SAME_MXNET = 2, /*!< Same padding, from left to right */
+    } detection_pack_padding_t;
+
+    typedef struct
+    {
+        uint32_t magic;                     /*!< DETECTION_PACK_MAGIC */
+        uint16_t version;                   /*!< DETECTION_PACK_VERSION */
+        uint16_t header_size;               /*!< sizeof(detection_pack_header_t) */
+        uint32_t total_size;                /*!< Size of the whole pack */
+        uint32_t crc;                       /*!< fr_crc32 of the bytes after the header */
+        char name[DETECTION_PACK_NAME_LEN]; /*!< Model name, NUL padded */
+        uint8_t model_type;                 /*!< detection_model_type_t */
+        uint8_t n_stages;                   /*!< Number of stages */
+        uint8_t n_slots;                    /*!< Number of activation slots, at most DETECTION_PACK_MAX_SLOTS */
+        uint8_t input_channel;              /*!< Channels of the input image, 3 or 1 */
+        uint16_t n_layers;                  /*!< Number of layers */
+        uint16_t n_tensors;                 /*!< Number of weight tensors */
+        uint32_t n_anchors;                 /*!< Number of anchors of all stages */
+        float resize_scale;                 /*!< Suggested resize_scale for update_detection_model */
+        float score_threshold;              /*!< Suggested score_threshold */
+        float nms_threshold;                /*!< Suggested nms_threshold */
+        uint32_t stage_offset;              /*!< n_stages x detection_pack_stage_t */
+        uint32_t anchor_offset;             /*!< n_anchors x int32_t[2], height and width */
+        uint32_t layer_offset;              /*!< n_layers x detection_pack_layer_t */
+        uint32_t tensor_offset;             /*!< n_tensors x detection_pack_tensor_t */
+    } detection_pack_header_t;
+
+    typedef struct
+    {
+        int32_t stride;         /*!< Zoom in stride of this stage */
+        int32_t boundary;       /*!< Detection image low-limit of this stage */
+        int32_t project_offset; /*!< Project offset of this stage */
+        int32_t anchor_index;   /*!< First anchor of this stage */
+        int32_t n_anchors;      /*!< Anchors of this stage */
+        int32_t score;          /*!< Slot of the score map */
+        int32_t box_offset;     /*!< Slot of the box offset map */
+        int32_t landmark;       /*!< Slot of the landmark offset map, -1 if none, the landmarks are then zero */
+    } detection_pack_stage_t;
+
+    typedef struct
+    {
+        int32_t op;       /*!< detection_pack_op_t */
+        int32_t input;    /*!< Input slot */
+        int32_t input2;   /*!< Second input slot of ADD and CONCAT, else -1 */
+        int32_t output;   /*!< Output slot */
+        int32_t filter;   /*!< Filter or alpha tensor, else -1 */
+        int32_t bias;     /*!< Bias tensor, else -1 */
+        int32_t exponent; /*!< Exponent of the output */
+        int32_t stride_x; /*!< Stride in width */
+        int32_t stride_y; /*!< Stride in height */
+        int32_t padding;  /*!< detection_pack_padding_t */
+        int32_t kernel_w; /*!< Pooling window width */
+        int32_t kernel_h; /*!< Pooling window height */
+        int32_t type;     /*!< Pooling or upsample type */
+        int32_t relu;     /*!< 1 to apply a ReLU on the output */
+    } detection_pack_layer_t;
+
+    typedef struct
+    {
+        int32_t n;        /*!< Number of filters */
+        int32_t w;        /*!< Width */
+        int32_t h;        /*!< Height */
+        int32_t c;        /*!< Channels */
+        int32_t exponent; /*!< Exponent of the data */
+        uint32_t offset;  /*!< n x h x w x c qtp_t */
+    } detection_pack_tensor_t;
+
+    typedef struct
+    {
+        detection_model_t model;                /*!< The model, pass &pack->model to update_detection_model and detect_object */
+        char name[DETECTION_PACK_NAME_LEN + 1]; /*!< Model name */
+        fptp_t resize_scale;                    /*!< Suggested resize_scale */
+        fptp_t score_threshold;                 /*!< Suggested score_threshold */
+        fptp_t nms_threshold;                   /*!< Suggested nms_threshold */
+        int input_channel;                      /*!< Channels of the input image */
+        int n_slots;                            /*!< Number of activation slots */
+        int n_layers;                           /*!< Number of layers */
+        const detection_pack_stage_t *stage;    /*!< Stage records in the pack */
+        const detection_pack_layer_t *layer;    /*!< Layer records in the pack */
+        dl_matrix3dq_t *tensor;                 /*!< Weight tensors, items point into the pack */
+        int **anchor;                           /*!< Anchor pointers of all stages */
+        int *last_use;                          /*!< Last layer reading each slot */
+        dl_matrix3dq_t **slot;                  /*!< Activations while running */
+        uint8_t *needed;                        /*!< Live slots, then layers to run, while running */
+        void *buffer;                           /*!< Owned copy of the pack, NULL if used in place */
+        void *mmap_handle;                      /*!< Flash mapping of the pack, NULL if none */
+    } detection_pack_t;
+
+    /**
+     * @brief Build a detection model from a pack in memory.
+     *
+     * The pack is checked in full: header, CRC, table bounds, slot and tensor references.
+     * With copy false the weights are used in place, data must outlive the pack.
+     *
+     * @param data                  The pack
+     * @param size                  Bytes available at data
+     * @param copy                  true to copy the pack into a buffer owned by the result
+     * @return detection_pack_t*    The loaded pack, NULL if invalid or out of memory
+     */
+    detection_pack_t *detection_pack_load(const void *data, size_t size, bool copy);
+
+    /**
+     * @brief Build a detection model from a pack file, e.g. on SPIFFS, an SD card or a host.
+     *
+     * @param path                  Path of the pack
+     * @return detection_pack_t*    The loaded pack, NULL if unreadable or invalid
+     */
+    detection_pack_t *detection_pack_load_file(const char *path);
+
+#ifdef ESP_PLATFORM
+    /**
+     * @brief Build a detection model from a pack at the start of a data partition.
+     *
+     * The pack is memory-mapped, its weights stay in flash.
+     *
+     * @param label                 Label of the partition
+     * @return detection_pack_t*    The loaded pack, NULL if not found or invalid
+     */
+    detection_pack_t *detection_pack_load_partition(const char *label);
+#endif
+
+    /**
+     * @brief Free a pack and everything it owns or maps.
+     *
+     * @param pack                  The pack, may be NULL
+     */
+    void detection_pack_free(detection_pack_t *pack);
+
+#if __cplusplus
+}
+#endif
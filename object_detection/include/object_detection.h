@@ -54,6 +54,33 @@ extern "C"
      */
     box_array_t *detect_object(dl_matrix3du_t *image, detection_model_t *model);
 
+    /**
+     * @brief Detect objects with NMS settings of each category.
+     *
+     * detect_object is this with the nms_threshold of the model, boxes of different categories
+     * do not suppress each other.
+     *
+     * @param image             The input image
+     * @param model             A 'detection_model_t' type point of detection model
+     * @param nms               NMS thresholds and limits, NULL for the defaults of the model
+     * @return box_array_t*     The detection result with box and corresponding score and category
+     */
+    box_array_t *detect_object_nms(dl_matrix3du_t *image, detection_model_t *model, const image_nms_config_t *nms);
+
+    /**
+     * @brief Detect objects, keeping only the best candidates of each stage before NMS.
+     *
+     * A stage with a limit keeps its candidates in a heap while scanning the score map, so the boxes
+     * decoded and allocated are bounded by the limit. detect_object_nms is this without limits.
+     *
+     * @param image             The input image
+     * @param model             A 'detection_model_t' type point of detection model
+     * @param nms               NMS thresholds and limits, NULL for the defaults of the model
+     * @param stage_top_k       Candidates kept by each of the stage_number stages, 0 for all, NULL for no limit
+     * @return box_array_t*     The detection result with box and corresponding score and category
+     */
+    box_array_t *detect_object_top_k(dl_matrix3du_t *image, detection_model_t *model, const image_nms_config_t *nms, const int *stage_top_k);
+
 #if __cplusplus
 }
 #endif
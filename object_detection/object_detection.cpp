@@ -51,174 +51,227 @@ inline qtp_t __desigmoid(fptp_t value, int exponent)
     return -log(1 / value - 1) * (1 << exponent);
 }
 
-void *__ab_get_boxes(detection_stage_result_t *stage, detection_model_config_t *model_config, detection_stage_config_t *stage_config, int stage_index)
+typedef struct
+{
+    int index;    /*!< Cell of the score map, (y * w + x) * n + anchor */
+    int score;    /*!< Quantized score of the best class */
+    int category; /*!< Best class */
+} __candidate_t;
+
+/*
+ * Call survivor(index, score, category) for every cell whose best class is over the threshold.
+ * The score map layout is (h, w, anchor, cls).
+ */
+template <typename F>
+inline void __scan_scores(const dl_matrix3dq_t *score_map, int anchors, int score_threshold, F survivor)
+{
+    image_candidate_t candidates[32];
+    int cells = score_map->h * score_map->w * anchors;
+    int cell = 0;
+    while (cell < cells)
+    {
+        int n = image_scan_scores_q(candidates, 32, score_map->item, score_map->c, &cell, cells, score_threshold);
+        for (int i = 0; i < n; i++)
+            survivor(candidates[i].index, (int)candidates[i].score, candidates[i].category);
+    }
+}
+
+// min-heap on score, the root is the weakest of the k kept
+inline void __top_k_push(__candidate_t *heap, int &len, int k, int index, int score, int category)
+{
+    int i;
+    if (len < k)
+    {
+        i = len++;
+        while ((i > 0) && (heap[(i - 1) / 2].score > score))
+        {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    }
+    else if (score > heap[0].score)
+    {
+        i = 0;
+        while (true)
+        {
+            int child = 2 * i + 1;
+            if (child >= len)
+                break;
+            if ((child + 1 < len) && (heap[child + 1].score < heap[child].score))
+                child++;
+            if (heap[child].score >= score)
+                break;
+            heap[i] = heap[child];
+            i = child;
+        }
+    }
+    else
+    {
+        return;
+    }
+    heap[i].index = index;
+    heap[i].score = score;
+    heap[i].category = category;
+}
+
+/*
+ * Decode the survivors of a score map into a list sized to them. With top_k, only the top_k best
+ * are kept in a heap while scanning; without, the map is scanned once to count and once to fill.
+ * decode(box, index) fills the box of one cell, score and category are set here.
+ */
+template <typename D>
+image_list_t *__get_candidates(const dl_matrix3dq_t *score_map, int anchors, int score_threshold, int top_k, D decode)
+{
+    image_box_t *compact = NULL;
+    int len = 0;
+    if (top_k > 0)
+    {
+        __candidate_t *heap = (__candidate_t *)dl_lib_calloc(top_k, sizeof(__candidate_t), 0);
+        if (NULL == heap)
+            return NULL;
+        __scan_scores(score_map, anchors, score_threshold, [&](int index, int score, int category) {
+            __top_k_push(heap, len, top_k, index, score, category);
+        });
+        if (len)
+            compact = (image_box_t *)dl_lib_calloc(len, sizeof(image_box_t), 0);
+        for (int i = 0; compact && (i < len); i++)
+        {
+            compact[i].category = heap[i].category;
+            compact[i].score = heap[i].score;
+            decode(compact + i, heap[i].index);
+        }
+        dl_lib_free(heap);
+    }
+    else
+    {
+        int cell = 0;
+        len = image_scan_scores_q(NULL, 0, score_map->item, score_map->c, &cell, score_map->h * score_map->w * anchors, score_threshold);
+        if (len)
+            compact = (image_box_t *)dl_lib_calloc(len, sizeof(image_box_t), 0);
+        if (compact)
+        {
+            image_box_t *box = compact;
+            __scan_scores(score_map, anchors, score_threshold, [&](int index, int score, int category) {
+                box->category = category;
+                box->score = score;
+                decode(box++, index);
+            });
+        }
+    }
+    if (NULL == compact)
+        return NULL;
+
+    image_list_t *valid_list = (image_list_t *)dl_lib_calloc(1, sizeof(image_list_t), 0);
+    if (NULL == valid_list)
+    {
+        dl_lib_free(compact);
+        return NULL;
+    }
+    for (int i = 0; i < len - 1; i++)
+        compact[i].next = &(compact[i + 1]);
+    valid_list->head = compact;
+    valid_list->origin_head = compact;
+    valid_list->len = len;
+    return valid_list;
+}
+
+image_list_t *__ab_get_boxes_top_k(detection_stage_result_t *stage, detection_model_config_t *model_config, detection_stage_config_t *stage_config, int stage_index, int top_k)
 {
     int score_threshold = __desigmoid(model_config->score_threshold, stage[stage_index].score->exponent);
     int stride = stage_config[stage_index].stride;
     int project_offset = stage_config[stage_index].project_offset;
     int **anchors = stage_config[stage_index].anchors_shape;
+    int w = stage[stage_index].score->w;
+    int n = stage[stage_index].score->n;
 
     fptp_t y_resize_scale = model_config->y_resize_scale;
     fptp_t x_resize_scale = model_config->x_resize_scale;
 
-    qtp_t *score = stage[stage_index].score->item;
-    qtp_t *box_offset = stage[stage_index].box_offset->item;
+    const qtp_t *box_offset = stage[stage_index].box_offset->item;
     int box_offset_shift = -stage[stage_index].box_offset->exponent;
 
 #if CONFIG_DETECT_WITH_LANDMARK
-    qtp_t *landmark_offset = stage[stage_index].landmark_offset->item;
-    int landmark_offset_shift = -stage[stage_index].landmark_offset->exponent;
+    // a model without a landmark map leaves the landmarks zero
+    dl_matrix3dq_t *landmark_map = stage[stage_index].landmark_offset;
+    const qtp_t *landmark_offset = landmark_map ? landmark_map->item : NULL;
+    int landmark_offset_shift = landmark_map ? -landmark_map->exponent : 0;
 #endif
 
-    image_box_t *redundant = (image_box_t *)dl_lib_calloc(stage[stage_index].score->h * stage[stage_index].score->w * stage[stage_index].score->n, sizeof(image_box_t), 0);
-    image_list_t *valid_list = (image_list_t *)dl_lib_calloc(1, sizeof(image_list_t), 0);
-
     /*
         score format is (anchor_num, h, w, cls), box is (anchor_num, h, w, 4);
         while in the memory layout is (h, w, anchor, cls) and (h, w, anchor, 4)
     */
-    for (size_t y = 0; y < stage[stage_index].score->h; y++)
-    {
-        for (size_t x = 0; x < stage[stage_index].score->w; x++)
-        {
-            for (size_t a = 0; a < stage[stage_index].score->n; a++)
-            {
-                int max_score = *score++;
-                int max_score_c = 0;
-                for (size_t c = 1; c < stage[stage_index].score->c; c++)
-                {
-                    if (max_score < *score)
-                    {
-                        max_score = *score;
-                        max_score_c = c;
-                    }
-                    score++;
-                }
-                if (max_score > score_threshold)
-                {
-                    redundant[valid_list->len].category = max_score_c;
-                    redundant[valid_list->len].score = max_score;
-                    int center_y = (y * stride + project_offset) * y_resize_scale;
-                    int center_x = (x * stride + project_offset) * x_resize_scale;
-                    int anchor_h = anchors[a][0] * y_resize_scale;
-                    int anchor_w = anchors[a][1] * x_resize_scale;
-                    redundant[valid_list->len].box.box_p[0] = center_x - anchor_w / 2 + ((anchor_w * box_offset[0]) >> box_offset_shift);
-                    redundant[valid_list->len].box.box_p[1] = center_y - anchor_h / 2 + ((anchor_h * box_offset[1]) >> box_offset_shift);
-                    redundant[valid_list->len].box.box_p[2] = center_x + anchor_w / 2 + ((anchor_w * box_offset[2]) >> box_offset_shift);
-                    redundant[valid_list->len].box.box_p[3] = center_y + anchor_h / 2 + ((anchor_h * box_offset[3]) >> box_offset_shift);
-#if CONFIG_DETECT_WITH_LANDMARK
-                    redundant[valid_list->len].landmark.landmark_p[0] = center_x - anchor_w / 2 + ((anchor_w * landmark_offset[0]) >> landmark_offset_shift);
-                    redundant[valid_list->len].landmark.landmark_p[1] = center_y - anchor_h / 2 + ((anchor_h * landmark_offset[1]) >> landmark_offset_shift);
-                    redundant[valid_list->len].landmark.landmark_p[2] = center_x - anchor_w / 2 + ((anchor_w * landmark_offset[2]) >> landmark_offset_shift);
-                    redundant[valid_list->len].landmark.landmark_p[3] = center_y - anchor_h / 2 + ((anchor_h * landmark_offset[3]) >> landmark_offset_shift);
-                    redundant[valid_list->len].landmark.landmark_p[4] = center_x - anchor_w / 2 + ((anchor_w * landmark_offset[4]) >> landmark_offset_shift);
-                    redundant[valid_list->len].landmark.landmark_p[5] = center_y - anchor_h / 2 + ((anchor_h * landmark_offset[5]) >> landmark_offset_shift);
-                    redundant[valid_list->len].landmark.landmark_p[6] = center_x - anchor_w / 2 + ((anchor_w * landmark_offset[6]) >> landmark_offset_shift);
-                    redundant[valid_list->len].landmark.landmark_p[7] = center_y - anchor_h / 2 + ((anchor_h * landmark_offset[7]) >> landmark_offset_shift);
-                    redundant[valid_list->len].landmark.landmark_p[8] = center_x - anchor_w / 2 + ((anchor_w * landmark_offset[8]) >> landmark_offset_shift);
-                    redundant[valid_list->len].landmark.landmark_p[9] = center_y - anchor_h / 2 + ((anchor_h * landmark_offset[9]) >> landmark_offset_shift);
-#endif
-                    valid_list->len++;
-                }
-                box_offset += 4;
+    return __get_candidates(stage[stage_index].score, n, score_threshold, top_k, [&](image_box_t *box, int index) {
+        int a = index % n;
+        int x = (index / n) % w;
+        int y = index / (n * w);
+        int center_y = (y * stride + project_offset) * y_resize_scale;
+        int center_x = (x * stride + project_offset) * x_resize_scale;
+        int anchor_h = anchors[a][0] * y_resize_scale;
+        int anchor_w = anchors[a][1] * x_resize_scale;
+        const qtp_t *offset = box_offset + index * 4;
+        box->box.box_p[0] = center_x - anchor_w / 2 + ((anchor_w * offset[0]) >> box_offset_shift);
+        box->box.box_p[1] = center_y - anchor_h / 2 + ((anchor_h * offset[1]) >> box_offset_shift);
+        box->box.box_p[2] = center_x + anchor_w / 2 + ((anchor_w * offset[2]) >> box_offset_shift);
+        box->box.box_p[3] = center_y + anchor_h / 2 + ((anchor_h * offset[3]) >> box_offset_shift);
 #if CONFIG_DETECT_WITH_LANDMARK
-                landmark_offset += LANDMARKS_NUM;
-#endif
-            }
+        if (NULL == landmark_offset)
+            return;
+        const qtp_t *landmark = landmark_offset + index * LANDMARKS_NUM;
+        for (int i = 0; i < LANDMARKS_NUM; i += 2)
+        {
+            box->landmark.landmark_p[i] = center_x - anchor_w / 2 + ((anchor_w * landmark[i]) >> landmark_offset_shift);
+            box->landmark.landmark_p[i + 1] = center_y - anchor_h / 2 + ((anchor_h * landmark[i + 1]) >> landmark_offset_shift);
         }
-    }
-
-    if (0 == valid_list->len)
-    {
-        dl_lib_free(redundant);
-        dl_lib_free(valid_list);
-        return NULL;
-    }
-
-    image_box_t *compact = (image_box_t *)dl_lib_calloc(valid_list->len, sizeof(image_box_t), 0);
-    size_t i = 0;
-    for (; i < valid_list->len - 1; i++)
-    {
-        compact[i] = redundant[i];
-        compact[i].next = &(compact[i + 1]);
-    }
-    compact[i] = redundant[i];
-    dl_lib_free(redundant);
-
-    valid_list->head = compact;
-    valid_list->origin_head = compact;
-
-    return valid_list;
+#endif
+    });
 }
 
-void *__ap_get_boxes(detection_stage_result_t *stage, detection_model_config_t *model_config, detection_stage_config_t *stage_config, int stage_index)
+image_list_t *__ap_get_boxes_top_k(detection_stage_result_t *stage, detection_model_config_t *model_config, detection_stage_config_t *stage_config, int stage_index, int top_k)
 {
     int score_threshold = __desigmoid(model_config->score_threshold, stage[stage_index].score->exponent);
     int stride = stage_config[stage_index].stride;
     int project_offset = stage_config[stage_index].project_offset;
+    int w = stage[stage_index].score->w;
 
     fptp_t y_resize_scale = model_config->y_resize_scale;
     fptp_t x_resize_scale = model_config->x_resize_scale;
 
-    qtp_t *score = stage[stage_index].score->item;
-    qtp_t *box_offset = stage[stage_index].box_offset->item;
+    const qtp_t *box_offset = stage[stage_index].box_offset->item;
     fptp_t box_offset_shift_factor = __get_shift_factor(stage[stage_index].box_offset->exponent);
 
-    image_box_t *redundant = (image_box_t *)dl_lib_calloc(stage[stage_index].score->h * stage[stage_index].score->w, sizeof(image_box_t), 0);
-    image_list_t *valid_list = (image_list_t *)dl_lib_calloc(1, sizeof(image_list_t), 0);
-
-    for (size_t y = 0; y < stage[stage_index].score->h; y++)
-    {
-        for (size_t x = 0; x < stage[stage_index].score->w; x++)
-        {
-            int max_score = *score++;
-            int max_score_c = 0;
-            for (size_t c = 1; c < stage[stage_index].score->c; c++)
-            {
-                if (max_score < *score)
-                {
-                    max_score = *score;
-                    max_score_c = c;
-                }
-                score++;
-            }
-            if (max_score > score_threshold)
-            {
-                redundant[valid_list->len].category = max_score_c;
-                redundant[valid_list->len].score = max_score;
-                qtp_t center_y = y * stride + project_offset;
-                qtp_t center_x = x * stride + project_offset;
-                redundant[valid_list->len].box.box_p[0] = (center_x - __fast_exp(box_offset[0] * box_offset_shift_factor, 8)) * x_resize_scale;
-                redundant[valid_list->len].box.box_p[1] = (center_y - __fast_exp(box_offset[1] * box_offset_shift_factor, 8)) * y_resize_scale;
-                redundant[valid_list->len].box.box_p[2] = (center_x + __fast_exp(box_offset[2] * box_offset_shift_factor, 8)) * x_resize_scale;
-                redundant[valid_list->len].box.box_p[3] = (center_y + __fast_exp(box_offset[3] * box_offset_shift_factor, 8)) * y_resize_scale;
-                valid_list->len++;
-            }
-            box_offset += 4;
-        }
-    }
-
-    if (0 == valid_list->len)
-    {
-        dl_lib_free(redundant);
-        dl_lib_free(valid_list);
-        return NULL;
-    }
+    return __get_candidates(stage[stage_index].score, 1, score_threshold, top_k, [&](image_box_t *box, int index) {
+        qtp_t center_y = (index / w) * stride + project_offset;
+        qtp_t center_x = (index % w) * stride + project_offset;
+        const qtp_t *offset = box_offset + index * 4;
+        box->box.box_p[0] = (center_x - __fast_exp(offset[0] * box_offset_shift_factor, 8)) * x_resize_scale;
+        box->box.box_p[1] = (center_y - __fast_exp(offset[1] * box_offset_shift_factor, 8)) * y_resize_scale;
+        box->box.box_p[2] = (center_x + __fast_exp(offset[2] * box_offset_shift_factor, 8)) * x_resize_scale;
+        box->box.box_p[3] = (center_y + __fast_exp(offset[3] * box_offset_shift_factor, 8)) * y_resize_scale;
+    });
+}
 
-    image_box_t *compact = (image_box_t *)dl_lib_calloc(valid_list->len, sizeof(image_box_t), 0);
-    size_t i = 0;
-    for (; i < valid_list->len - 1; i++)
-    {
-        compact[i] = redundant[i];
-        compact[i].next = &(compact[i + 1]);
-    }
-    compact[i] = redundant[i];
-    dl_lib_free(redundant);
+void *__ab_get_boxes(detection_stage_result_t *stage, detection_model_config_t *model_config, detection_stage_config_t *stage_config, int stage_index)
+{
+    return __ab_get_boxes_top_k(stage, model_config, stage_config, stage_index, 0);
+}
 
-    valid_list->head = compact;
-    valid_list->origin_head = compact;
+void *__ap_get_boxes(detection_stage_result_t *stage, detection_model_config_t *model_config, detection_stage_config_t *stage_config, int stage_index)
+{
+    return __ap_get_boxes_top_k(stage, model_config, stage_config, stage_index, 0);
+}
 
-    return valid_list;
+/*
+ * The candidates of one stage, at most top_k of them if positive. get_boxes has no room for a limit,
+ * so only the decoders of this file apply it.
+ */
+inline image_list_t *__stage_get_boxes(detection_model_t *model, detection_stage_result_t *stage_result, int stage_index, int top_k)
+{
+    if (model->get_boxes == __ab_get_boxes)
+        return __ab_get_boxes_top_k(stage_result, &model->model_config, model->stage_config, stage_index, top_k);
+    if (model->get_boxes == __ap_get_boxes)
+        return __ap_get_boxes_top_k(stage_result, &model->model_config, model->stage_config, stage_index, top_k);
+    return (image_list_t *)model->get_boxes(stage_result, &model->model_config, model->stage_config, stage_index);
 }
 
 void update_detection_model(detection_model_t *model, fptp_t resize_scale, fptp_t score_threshold, fptp_t nms_threshold, int image_height, int image_width)
@@ -249,54 +302,76 @@ void update_detection_model(detection_model_t *model, fptp_t resize_scale, fptp_
     assert(model->model_config.enabled_top_k > 0);
 }
 
-box_array_t *detect_object(dl_matrix3du_t *image, detection_model_t *model)
+box_array_t *detect_object_top_k(dl_matrix3du_t *image, detection_model_t *model, const image_nms_config_t *nms, const int *stage_top_k)
 {
     // resize image
     dl_matrix3dq_t *resized_image = dl_matrix3dq_alloc(1, model->model_config.resized_width, model->model_config.resized_height, image->c, 0);
-    Image<qtp_t>::resize_to_rgb888(resized_image->item, 0, resized_image->h, 0, resized_image->w, resized_image->c, image->item, image->h, image->w, resized_image->w, 0, IMAGE_RESIZE_MEAN);
+    // beyond 2x the mean of four pixels aliases, average the whole area instead.
+    // Below 2x keep the rounded positions and truncated mean of resize_to_rgb888 the models were tuned on.
+    image_source_t src = {image->item, (1 == image->c) ? IMAGE_PIXEL_GRAY : IMAGE_PIXEL_RGB888, image->w, image->h, 0, 0, 0, image->w, image->h};
+    image_target_t dst = {resized_image->item, resized_image->c, 0, resized_image->w, resized_image->h, 0, 0, 0};
+    bool area = (2 * resized_image->w <= image->w) && (2 * resized_image->h <= image->h);
+    if (0 != image_convert_resize_q(&dst, &src, area ? IMAGE_SAMPLE_AREA : IMAGE_SAMPLE_MEAN_ROUND))
+        Image<qtp_t>::resize_to_rgb888(resized_image->item, 0, resized_image->h, 0, resized_image->w, resized_image->c, image->item, image->h, image->w, resized_image->w, 0, IMAGE_RESIZE_MEAN);
 
     // net operation
     detection_stage_result_t *stage_result = model->op(resized_image, &model->model_config);
+    if (NULL == stage_result)
+        return NULL;
 
     // filter by score
     image_list_t **origin_head = (image_list_t **)dl_lib_calloc(model->model_config.enabled_top_k, sizeof(image_list_t *), 0);
-    image_list_t all_box_list = {NULL, NULL, 0};
+    int len = 0;
     for (size_t i = 0; i < model->model_config.enabled_top_k; i++)
     {
-        origin_head[i] = (image_list_t *)model->get_boxes(stage_result, &model->model_config, model->stage_config, i);
-
+        origin_head[i] = __stage_get_boxes(model, stage_result, i, stage_top_k ? stage_top_k[i] : 0);
         if (origin_head[i])
-            image_sort_insert_by_score(&all_box_list, origin_head[i]);
+            len += origin_head[i]->len;
 
         free_detection_stage_result(stage_result[i]);
     }
     dl_lib_free(stage_result);
 
-    // nms
-    image_nms_process(&all_box_list, model->model_config.nms_threshold, false);
-
-    // build up result
+    // build up result, sorted and suppressed in place
     box_array_t *targets_list = NULL;
-    if (all_box_list.len)
+    if (len)
     {
         targets_list = (box_array_t *)dl_lib_calloc(1, sizeof(box_array_t), 0);
-        targets_list->len = all_box_list.len;
-        targets_list->category = (uint8_t *)dl_lib_calloc(targets_list->len, sizeof(uint8_t), 0);
-        targets_list->score = (fptp_t *)dl_lib_calloc(targets_list->len, sizeof(fptp_t), 0);
-        targets_list->box = (box_t *)dl_lib_calloc(targets_list->len, sizeof(box_t), 0);
+        targets_list->len = len;
+        targets_list->category = (uint8_t *)dl_lib_calloc(len, sizeof(uint8_t), 0);
+        targets_list->score = (fptp_t *)dl_lib_calloc(len, sizeof(fptp_t), 0);
+        targets_list->box = (box_t *)dl_lib_calloc(len, sizeof(box_t), 0);
 #if CONFIG_DETECT_WITH_LANDMARK
-        targets_list->landmark = (landmark_t *)dl_lib_calloc(targets_list->len, sizeof(landmark_t), 0);
+        targets_list->landmark = (landmark_t *)dl_lib_calloc(len, sizeof(landmark_t), 0);
 #endif
 
-        image_box_t *t = all_box_list.head;
-        for (int i = 0; i < all_box_list.len; i++, t = t->next)
+        int n = 0;
+        for (int i = 0; i < model->model_config.enabled_top_k; i++)
         {
-            targets_list->category[i] = t->category;
-            targets_list->score[i] = t->score;
-            targets_list->box[i] = t->box;
+            if (NULL == origin_head[i])
+                continue;
+            image_box_t *t = origin_head[i]->head;
+            for (int j = 0; j < origin_head[i]->len; j++, t = t->next, n++)
+            {
+                targets_list->category[n] = t->category;
+                targets_list->score[n] = t->score;
+                targets_list->box[n] = t->box;
 #if CONFIG_DETECT_WITH_LANDMARK
-            targets_list->landmark[i] = t->landmark;
+                targets_list->landmark[n] = t->landmark;
 #endif
+            }
+        }
+
+        // nms
+        image_nms_config_t config = {model->model_config.nms_threshold, 0, NULL, NULL, 0, false};
+        if (image_nms_batched(targets_list, nms ? nms : &config) < 0)
+        {
+            dl_lib_free(targets_list->category);
+            dl_lib_free(targets_list->score);
+            dl_lib_free(targets_list->box);
+            dl_lib_free(targets_list->landmark);
+            dl_lib_free(targets_list);
+            targets_list = NULL;
         }
     }
 
@@ -312,3 +387,13 @@ box_array_t *detect_object(dl_matrix3du_t *image, detection_model_t *model)
 
     return targets_list;
 }
+
+box_array_t *detect_object_nms(dl_matrix3du_t *image, detection_model_t *model, const image_nms_config_t *nms)
+{
+    return detect_object_top_k(image, model, nms, NULL);
+}
+
+box_array_t *detect_object(dl_matrix3du_t *image, detection_model_t *model)
+{
+    return detect_object_nms(image, model, NULL);
+}
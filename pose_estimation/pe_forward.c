@@ -100,40 +100,15 @@ od_image_list_t *od_image_get_valid_boxes(fptp_t *score,
                                     int padding_w,
                                     int padding_h)
 { /*{{{*/
-    typedef struct
-    {
-        int x;
-        int y;
-        int index;
-        uc_t anchor_index;
-    } valid_index_t;
-    valid_index_t *valid_indexes = (valid_index_t *)dl_lib_calloc(width * height, sizeof(valid_index_t), 0);
-    int valid_count = 0;
-    int index = 0;
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            for (size_t c = 0; c < anchor_number; c++)
-            {
-                if (score[index] > score_threshold)
-                {
-                    valid_indexes[valid_count].x = x;
-                    valid_indexes[valid_count].y = y;
-                    valid_indexes[valid_count].index = index;
-                    valid_indexes[valid_count].anchor_index = c;
-                    valid_count++;
-                }
-                index++;
-            }
-        }
-    }
-
+    int cells = height * width * anchor_number;
+    int cell = 0;
+    int valid_count = image_scan_scores_f(NULL, 0, score, 1, &cell, cells, score_threshold);
     if (0 == valid_count)
-    {
-        dl_lib_free(valid_indexes);
         return NULL;
-    }
+
+    image_candidate_t *candidates = (image_candidate_t *)dl_lib_calloc(valid_count, sizeof(image_candidate_t), 0);
+    cell = 0;
+    image_scan_scores_f(candidates, valid_count, score, 1, &cell, cells, score_threshold);
 
     od_image_box_t *valid_box = (od_image_box_t *)dl_lib_calloc(valid_count, sizeof(od_image_box_t), 0);
     od_image_list_t *valid_list = (od_image_list_t *)dl_lib_calloc(1, sizeof(od_image_list_t), 0);
@@ -143,20 +118,20 @@ od_image_list_t *od_image_get_valid_boxes(fptp_t *score,
 
     for (int i = 0; i < valid_count; i++)
     {
-        valid_box[i].score = score[valid_indexes[i].index];
+        valid_box[i].score = candidates[i].score;
 
-        valid_box[i].box.box_p[0] = ((boxes[4*valid_indexes[i].index] - 0.5*boxes[4*valid_indexes[i].index + 2])-padding_w)/resize_scale;
-        valid_box[i].box.box_p[1] = ((boxes[4*valid_indexes[i].index + 1] - 0.5*boxes[4*valid_indexes[i].index + 3])-padding_h)/resize_scale;
-        valid_box[i].box.box_p[2] = ((boxes[4*valid_indexes[i].index] + 0.5*boxes[4*valid_indexes[i].index + 2])-padding_w)/resize_scale;
-        valid_box[i].box.box_p[3] = ((boxes[4*valid_indexes[i].index + 1] + 0.5*boxes[4*valid_indexes[i].index + 3])-padding_h)/resize_scale;
+        valid_box[i].box.box_p[0] = ((boxes[4*candidates[i].index] - 0.5*boxes[4*candidates[i].index + 2])-padding_w)/resize_scale;
+        valid_box[i].box.box_p[1] = ((boxes[4*candidates[i].index + 1] - 0.5*boxes[4*candidates[i].index + 3])-padding_h)/resize_scale;
+        valid_box[i].box.box_p[2] = ((boxes[4*candidates[i].index] + 0.5*boxes[4*candidates[i].index + 2])-padding_w)/resize_scale;
+        valid_box[i].box.box_p[3] = ((boxes[4*candidates[i].index + 1] + 0.5*boxes[4*candidates[i].index + 3])-padding_h)/resize_scale;
 
-        valid_box[i].cls = (qtp_t)cls[valid_indexes[i].index];
+        valid_box[i].cls = (qtp_t)cls[candidates[i].index];
 
         valid_box[i].next = &(valid_box[i + 1]);
     }
     valid_box[valid_count - 1].next = NULL;
 
-    dl_lib_free(valid_indexes);
+    dl_lib_free(candidates);
 
     return valid_list;
 } /*}}}*/
@@ -455,7 +430,12 @@ dl_matrix3d_t *handpose_estimation_forward2(uint16_t *simage, od_box_array_t *od
             h = y2 - y1;
             scale = (float)(max(w, h))/dw;
             
-            image_crop_shift_fast(image_input->item, simage, dw, sw, sh, x1, y1, x2, y2, shift);
+            if (0 != image_crop_shift_fast(image_input->item, simage, dw, sw, sh, x1, y1, x2, y2, shift))
+            {
+                dl_matrix3dq_free(image_input);
+                dl_matrix3d_free(landmarks);
+                return NULL;
+            }
             dl_matrix3d_t *landmark = hp_nano1_ls16_q(image_input, mode);
             // ets_printf("x1:%d, y1:%d, x2:%d, y2:%d \n", x1, y1, x2, y2); 
             // printf("scale: %f\n", scale);
@@ -481,7 +461,11 @@ dl_matrix3d_t *handpose_estimation_forward2(uint16_t *simage, od_box_array_t *od
             th = dw;
         }
         // dl_matrix3dq_t *hp_input_image = od_image_preporcess(image->item, image->w, image->h, target_size, hp_exponent, 0);
-        image_resize_shift_fast(image_input->item, simage, dw, 3, sw, sh, tw, th, shift);
+        if (0 != image_resize_shift_fast(image_input->item, simage, dw, 3, sw, sh, tw, th, shift))
+        {
+            dl_matrix3dq_free(image_input);
+            return NULL;
+        }
         dl_matrix3d_t *landmarks = hp_nano1_ls16_q(image_input, mode);
         for(int j=0; j<landmark_num; j++){
                 landmarks->item[j*2] = (landmarks->item[j*2])*scale;